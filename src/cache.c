@@ -0,0 +1,611 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include "serialize.h"
+#include "table.h"
+#include "vm.h"
+
+// A script's compiled functions are cached next to it in a .ghoulc file.
+// The file starts with a header naming the cache version, the byte order
+// and compiler flags it was written with, and hashes of the source and of
+// the payload. The payload lists the use statements the script made, then
+// holds its functions, nested functions inline as constants. Anything that
+// does not match sends the script back through the compiler, which writes
+// a fresh cache.
+//
+// Bump CACHE_VERSION whenever the bytecode or this layout changes.
+#define CACHE_MAGIC "GHOULC"
+#define CACHE_MAGIC_LENGTH 6
+#define CACHE_VERSION 3
+#define CACHE_BYTE_ORDER 0x01020304u
+// Cache hashes must agree between processes, so unlike the string table
+// they use a fixed seed.
+#define CACHE_SEED 0x67686f756c63ULL
+#define NO_INDEX UINT32_MAX
+
+typedef enum {
+  CONSTANT_NIL,
+  CONSTANT_FALSE,
+  CONSTANT_TRUE,
+  CONSTANT_NUMBER,
+  CONSTANT_STRING,
+  CONSTANT_FUNCTION,
+} ConstantTag;
+
+typedef struct {
+  UseKind kind;
+  char *written;
+  int writtenLength;
+  ObjString *resolved;
+  uint64_t hash;
+  uint32_t length;
+} UseRecord;
+
+// A use read back from a cache, pointing into the cache's bytes.
+typedef struct {
+  UseKind kind;
+  const char *written;
+  uint32_t writtenLength;
+  const char *resolved;
+  uint32_t resolvedLength;
+  uint64_t hash;
+  uint32_t length;
+  ObjString *string;
+} CachedUse;
+
+static UseRecord *uses = NULL;
+static int useCount = 0;
+static int useCapacity = 0;
+static bool recording = false;
+
+static bool cacheEnabled() {
+  const char *disabled = getenv("GHOUL_NO_CACHE");
+  return disabled == NULL || *disabled == '\0';
+}
+
+static char *cachePath(const char *file) {
+  size_t length = strlen(file);
+  char *path = malloc(length + 8);
+  if (path == NULL) {
+    return NULL;
+  }
+  memcpy(path, file, length);
+  if (length > 6 && strcmp(file + length - 6, ".ghoul") == 0) {
+    strcpy(path + length, "c");
+  } else {
+    strcpy(path + length, ".ghoulc");
+  }
+  return path;
+}
+
+static uint64_t hashSource(const char *source, uint32_t *length) {
+  size_t sourceLength = strlen(source);
+  *length = (uint32_t)sourceLength;
+  return hashBytes(source, sourceLength, CACHE_SEED);
+}
+
+static void clearUses() {
+  for (int i = 0; i < useCount; i++) {
+    free(uses[i].written);
+  }
+  free(uses);
+  uses = NULL;
+  useCount = 0;
+  useCapacity = 0;
+}
+
+void beginUseRecording() {
+  clearUses();
+  recording = true;
+}
+
+void endUseRecording() {
+  clearUses();
+  recording = false;
+}
+
+// Uses are kept in plain malloc memory so recording one never gives the
+// collector a chance to run in the middle of a use statement.
+void recordUse(UseKind kind, const char *written, int writtenLength,
+               ObjString *resolved, const char *source) {
+  if (!recording) {
+    return;
+  }
+  if (useCapacity < useCount + 1) {
+    int capacity = GROW_CAPACITY(useCapacity);
+    UseRecord *grown = realloc(uses, sizeof(UseRecord) * capacity);
+    if (grown == NULL) {
+      return;
+    }
+    uses = grown;
+    useCapacity = capacity;
+  }
+
+  char *chars = malloc(writtenLength + 1);
+  if (chars == NULL) {
+    return;
+  }
+  memcpy(chars, written, writtenLength);
+  chars[writtenLength] = '\0';
+
+  UseRecord *use = &uses[useCount++];
+  use->kind = kind;
+  use->written = chars;
+  use->writtenLength = writtenLength;
+  use->resolved = resolved;
+  use->hash = 0;
+  use->length = 0;
+  if (source != NULL) {
+    use->hash = hashSource(source, &use->length);
+  }
+}
+
+// Functions name their file by the use that compiled them, or NO_INDEX for
+// the script itself, so a loaded function can point at a path the use
+// strings keep alive.
+static uint32_t fileIndex(Writer *writer, const char *chunkFile,
+                          const char *file) {
+  if (strcmp(chunkFile, file) == 0) {
+    return NO_INDEX;
+  }
+  for (int i = 0; i < useCount; i++) {
+    if (uses[i].kind == USE_FILE &&
+        strcmp(uses[i].resolved->chars, chunkFile) == 0) {
+      return (uint32_t)i;
+    }
+  }
+  writer->failed = true;
+  return NO_INDEX;
+}
+
+static void writeFunction(Writer *writer, ObjFunction *function,
+                          const char *file);
+
+static void writeValue(Writer *writer, Value value, const char *file) {
+  if (IS_NIL(value)) {
+    writeU8(writer, CONSTANT_NIL);
+  } else if (IS_BOOL(value)) {
+    writeU8(writer, AS_BOOL(value) ? CONSTANT_TRUE : CONSTANT_FALSE);
+  } else if (IS_NUMBER(value)) {
+    writeU8(writer, CONSTANT_NUMBER);
+    writeU64(writer, value);
+  } else if (IS_STRING(value)) {
+    writeU8(writer, CONSTANT_STRING);
+    writeChars(writer, AS_STRING(value)->chars, AS_STRING(value)->length);
+  } else if (IS_FUNCTION(value)) {
+    writeU8(writer, CONSTANT_FUNCTION);
+    writeFunction(writer, AS_FUNCTION(value), file);
+  } else {
+    writer->failed = true;
+  }
+}
+
+static void writeFunction(Writer *writer, ObjFunction *function,
+                          const char *file) {
+  Chunk *chunk = &function->chunk;
+  writeU32(writer, function->arity);
+  writeU32(writer, function->upvalueCount);
+  writeU8(writer, function->variadic);
+  writeU32(writer, fileIndex(writer, chunk->file, file));
+  if (function->name == NULL) {
+    writeU32(writer, NO_INDEX);
+  } else {
+    writeChars(writer, function->name->chars, function->name->length);
+  }
+
+  writeU32(writer, chunk->count);
+  writeBytes(writer, chunk->code, chunk->count);
+  writeU32(writer, chunk->lineCount);
+  for (int i = 0; i < chunk->lineCount; i++) {
+    writeU32(writer, chunk->lines[i].offset);
+    writeU32(writer, chunk->lines[i].line);
+  }
+  writeU32(writer, chunk->constants.count);
+  for (int i = 0; i < chunk->constants.count && !writer->failed; i++) {
+    writeValue(writer, chunk->constants.values[i], file);
+  }
+}
+
+static void writeHeader(Writer *writer, const char *source,
+                        Writer *payload) {
+  uint32_t sourceLength;
+  uint64_t sourceHash = hashSource(source, &sourceLength);
+  writeBytes(writer, CACHE_MAGIC, CACHE_MAGIC_LENGTH);
+  writeU32(writer, CACHE_VERSION);
+  writeU32(writer, CACHE_BYTE_ORDER);
+  writeU8(writer, vm.optimize);
+  writeU8(writer, vm.stripLines);
+  writeU64(writer, sourceHash);
+  writeU32(writer, sourceLength);
+  writeU64(writer, hashBytes(payload->bytes, payload->count, CACHE_SEED));
+  writeU32(writer, (uint32_t)payload->count);
+}
+
+// Writes the cache image for a compiled script: the header in header, the
+// uses and functions in payload. Returns false when the script cannot be
+// cached, such as when a function came from a file no use recorded.
+static bool writeImage(Writer *header, Writer *payload, const char *file,
+                       const char *source, ObjFunction *function) {
+  writeU32(payload, useCount);
+  for (int i = 0; i < useCount; i++) {
+    UseRecord *use = &uses[i];
+    writeU8(payload, use->kind);
+    writeChars(payload, use->written, use->writtenLength);
+    if (use->kind != USE_BUILTIN) {
+      writeChars(payload, use->resolved->chars, use->resolved->length);
+    }
+    if (use->kind == USE_FILE) {
+      writeU64(payload, use->hash);
+      writeU32(payload, use->length);
+    }
+  }
+  writeFunction(payload, function, file);
+  if (payload->failed) {
+    return false;
+  }
+  writeHeader(header, source, payload);
+  return !header->failed;
+}
+
+void writeCache(const char *file, const char *source, ObjFunction *function) {
+  if (!cacheEnabled() || !recording) {
+    return;
+  }
+
+  Writer header;
+  Writer payload;
+  initWriter(&header);
+  initWriter(&payload);
+  char *path = NULL;
+  if (writeImage(&header, &payload, file, source, function)) {
+    path = cachePath(file);
+  }
+  if (path != NULL) {
+    Writer *parts[] = {&header, &payload};
+    replaceFile(path, parts, 2);
+  }
+
+  free(path);
+  freeWriter(&header);
+  freeWriter(&payload);
+}
+
+bool writeBundle(Writer *writer, const char *file, const char *source) {
+  beginUseRecording();
+  ObjFunction *function = compile(source, file);
+  bool written = false;
+  if (function != NULL) {
+    push(OBJ_VAL(function));
+    Writer payload;
+    initWriter(&payload);
+    written = writeImage(writer, &payload, file, source, function);
+    writeBytes(writer, payload.bytes, payload.count);
+    freeWriter(&payload);
+    pop();
+  }
+  endUseRecording();
+  return written && !writer->failed;
+}
+
+static ObjFunction *readFunction(Reader *reader, const char *file,
+                                 CachedUse *cached, uint32_t cachedCount);
+
+static bool readValue(Reader *reader, const char *file, CachedUse *cached,
+                      uint32_t cachedCount, Value *value) {
+  switch (readU8(reader)) {
+  case CONSTANT_NIL:
+    *value = NIL_VAL;
+    break;
+  case CONSTANT_FALSE:
+    *value = FALSE_VAL;
+    break;
+  case CONSTANT_TRUE:
+    *value = TRUE_VAL;
+    break;
+  case CONSTANT_NUMBER:
+    *value = readU64(reader);
+    break;
+  case CONSTANT_STRING: {
+    uint32_t length;
+    const char *chars = readChars(reader, &length);
+    if (chars == NULL) {
+      return false;
+    }
+    *value = OBJ_VAL(copyString(chars, length, &vm.strings));
+    break;
+  }
+  case CONSTANT_FUNCTION: {
+    ObjFunction *function = readFunction(reader, file, cached, cachedCount);
+    if (function == NULL) {
+      return false;
+    }
+    *value = OBJ_VAL(function);
+    break;
+  }
+  default:
+    reader->failed = true;
+  }
+  return !reader->failed;
+}
+
+static ObjFunction *readFunction(Reader *reader, const char *file,
+                                 CachedUse *cached, uint32_t cachedCount) {
+  ObjFunction *function = newFunction(file);
+  push(OBJ_VAL(function));
+  Chunk *chunk = &function->chunk;
+
+  function->arity = (int)readU32(reader);
+  function->upvalueCount = (int)readU32(reader);
+  function->variadic = readU8(reader) != 0;
+  uint32_t index = readU32(reader);
+  if (index != NO_INDEX) {
+    if (index < cachedCount && cached[index].kind == USE_FILE) {
+      chunk->file = cached[index].string->chars;
+    } else {
+      reader->failed = true;
+    }
+  }
+  uint32_t nameLength = readU32(reader);
+  if (nameLength != NO_INDEX) {
+    const uint8_t *name = readBytes(reader, nameLength);
+    if (name != NULL) {
+      function->name = copyString((const char *)name, nameLength, &vm.strings);
+    }
+  }
+
+  uint32_t count = readU32(reader);
+  const uint8_t *code = readBytes(reader, count);
+  if (code != NULL && count > 0) {
+    chunk->code = ALLOCATE(uint8_t, count);
+    memcpy(chunk->code, code, count);
+    chunk->count = count;
+    chunk->capacity = count;
+  }
+
+  uint32_t lineCount = readU32(reader);
+  if (!reader->failed && lineCount > 0 &&
+      lineCount <= (reader->count - reader->position) / 8) {
+    chunk->lines = ALLOCATE(LineStart, lineCount);
+    chunk->lineCapacity = lineCount;
+    for (uint32_t i = 0; i < lineCount; i++) {
+      chunk->lines[i].offset = (int)readU32(reader);
+      chunk->lines[i].line = (int)readU32(reader);
+    }
+    chunk->lineCount = lineCount;
+  } else if (lineCount > 0) {
+    reader->failed = true;
+  }
+
+  uint32_t constantCount = readU32(reader);
+  for (uint32_t i = 0; i < constantCount && !reader->failed; i++) {
+    Value value;
+    if (readValue(reader, file, cached, cachedCount, &value)) {
+      addConstant(chunk, value);
+    }
+  }
+
+  pop();
+  return reader->failed ? NULL : function;
+}
+
+static bool isUsed(CachedUse *cached, uint32_t before, const char *file,
+                   const char *path, uint32_t length) {
+  if (strlen(file) == length && memcmp(file, path, length) == 0) {
+    return true;
+  }
+  uint32_t hash = hashString(path, length);
+  if (tableFindString(&vm.useStrings, path, length, hash) != NULL) {
+    return true;
+  }
+  for (uint32_t i = 0; i < before; i++) {
+    if (cached[i].kind == USE_FILE && cached[i].resolvedLength == length &&
+        memcmp(cached[i].resolved, path, length) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Replays what the compiler decided for each use against the files as they
+// are now: each path must still resolve to the same file, files compiled in
+// must be unchanged and not used yet, and files left out must be used.
+static bool checkUse(CachedUse *cached, uint32_t index, const char *file) {
+  CachedUse *use = &cached[index];
+  if (use->kind == USE_BUILTIN) {
+    return true;
+  }
+
+  char written[PATH_MAX + 1];
+  char resolved[PATH_MAX + 1];
+  if (use->writtenLength > PATH_MAX) {
+    return false;
+  }
+  memcpy(written, use->written, use->writtenLength);
+  written[use->writtenLength] = '\0';
+  if (realpath(written, resolved) == NULL ||
+      strlen(resolved) != use->resolvedLength ||
+      memcmp(resolved, use->resolved, use->resolvedLength) != 0) {
+    return false;
+  }
+
+  bool used =
+      isUsed(cached, index, file, use->resolved, use->resolvedLength);
+  if (use->kind == USE_SKIPPED) {
+    return used;
+  }
+  if (used) {
+    return false;
+  }
+
+  size_t fileLength;
+  char *source = readWholeFile(resolved, &fileLength);
+  if (source == NULL) {
+    return false;
+  }
+  uint32_t length;
+  uint64_t hash = hashSource(source, &length);
+  free(source);
+  return hash == use->hash && length == use->length;
+}
+
+static CachedUse *readUses(Reader *reader, const char *file,
+                           uint32_t *count) {
+  *count = readU32(reader);
+  if (reader->failed || *count > reader->count - reader->position) {
+    return NULL;
+  }
+  CachedUse *cached = malloc(sizeof(CachedUse) * (*count + 1));
+  if (cached == NULL) {
+    return NULL;
+  }
+  for (uint32_t i = 0; i < *count && !reader->failed; i++) {
+    CachedUse *use = &cached[i];
+    use->kind = (UseKind)readU8(reader);
+    use->written = readChars(reader, &use->writtenLength);
+    use->resolved = NULL;
+    use->resolvedLength = 0;
+    use->hash = 0;
+    use->length = 0;
+    use->string = NULL;
+    if (use->kind != USE_BUILTIN) {
+      use->resolved = readChars(reader, &use->resolvedLength);
+    }
+    if (use->kind == USE_FILE) {
+      use->hash = readU64(reader);
+      use->length = readU32(reader);
+    }
+    if (use->kind > USE_SKIPPED || !checkUse(cached, i, file)) {
+      reader->failed = true;
+    }
+  }
+  if (reader->failed) {
+    free(cached);
+    return NULL;
+  }
+  return cached;
+}
+
+static bool checkHeader(Reader *reader, const char *source) {
+  const uint8_t *magic = readBytes(reader, CACHE_MAGIC_LENGTH);
+  if (magic == NULL || memcmp(magic, CACHE_MAGIC, CACHE_MAGIC_LENGTH) != 0 ||
+      readU32(reader) != CACHE_VERSION ||
+      readU32(reader) != CACHE_BYTE_ORDER ||
+      readU8(reader) != vm.optimize || readU8(reader) != vm.stripLines) {
+    return false;
+  }
+
+  uint32_t sourceLength;
+  uint64_t sourceHash = hashSource(source, &sourceLength);
+  if (readU64(reader) != sourceHash || readU32(reader) != sourceLength) {
+    return false;
+  }
+
+  uint64_t payloadHash = readU64(reader);
+  uint32_t payloadLength = readU32(reader);
+  return !reader->failed &&
+         payloadLength == reader->count - reader->position &&
+         hashBytes(reader->bytes + reader->position, payloadLength,
+                   CACHE_SEED) == payloadHash;
+}
+
+static ObjString *markUsed(const char *path, uint32_t length) {
+  uint32_t hash = hashString(path, length);
+  char *heapChars = ALLOCATE(char, length + 1);
+  memcpy(heapChars, path, length);
+  heapChars[length] = '\0';
+  return allocateString(heapChars, length, hash, &vm.useStrings,
+                        vm.klass.string);
+}
+
+// Reads a cache image, returning NULL when it does not match the source,
+// the files it used, or the compiler flags.
+static ObjFunction *readImage(const char *file, const char *source,
+                              const void *bytes, size_t length) {
+  Reader reader;
+  initReader(&reader, bytes, length);
+  uint32_t cachedCount = 0;
+  CachedUse *cached = NULL;
+  if (checkHeader(&reader, source)) {
+    cached = readUses(&reader, file, &cachedCount);
+  }
+  if (cached == NULL) {
+    return NULL;
+  }
+
+  // The script and the files compiled into it are marked used, as the
+  // compiler would have, before its functions are read, since those
+  // functions point at the marked paths.
+  ObjString *script = markUsed(file, strlen(file));
+  for (uint32_t i = 0; i < cachedCount; i++) {
+    CachedUse *use = &cached[i];
+    if (use->kind == USE_FILE) {
+      use->string = markUsed(use->resolved, use->resolvedLength);
+    }
+  }
+
+  ObjFunction *function =
+      readFunction(&reader, script->chars, cached, cachedCount);
+  if (function == NULL || reader.position != reader.count) {
+    function = NULL;
+    tableDelete(&vm.useStrings, script);
+    for (uint32_t i = 0; i < cachedCount; i++) {
+      if (cached[i].string != NULL) {
+        tableDelete(&vm.useStrings, cached[i].string);
+      }
+    }
+  } else {
+    push(OBJ_VAL(function));
+    for (uint32_t i = 0; i < cachedCount; i++) {
+      if (cached[i].kind == USE_BUILTIN) {
+        matchUseBuiltin(copyString(cached[i].written, cached[i].writtenLength,
+                                   &vm.strings));
+      }
+    }
+    pop();
+  }
+
+  free(cached);
+  return function;
+}
+
+ObjFunction *loadCache(const char *file, const char *source) {
+  if (!cacheEnabled()) {
+    return NULL;
+  }
+  char *path = cachePath(file);
+  if (path == NULL) {
+    return NULL;
+  }
+  size_t length = 0;
+  char *bytes = readWholeFile(path, &length);
+  free(path);
+  if (bytes == NULL) {
+    return NULL;
+  }
+  ObjFunction *function = readImage(file, source, bytes, length);
+  free(bytes);
+  return function;
+}
+
+bool writeStaged(Writer *writer, ObjFunction *function, const char *file) {
+  writeFunction(writer, function, file);
+  return !writer->failed;
+}
+
+ObjFunction *readStaged(const uint8_t *bytes, size_t length,
+                        const char *file) {
+  Reader reader;
+  initReader(&reader, bytes, length);
+  ObjFunction *function = readFunction(&reader, file, NULL, 0);
+  return reader.position == reader.count ? function : NULL;
+}
+
+ObjFunction *loadBundle(const char *file, const char *source,
+                        const uint8_t *bytes, size_t length) {
+  return readImage(file, source, bytes, length);
+}
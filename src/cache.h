@@ -0,0 +1,44 @@
+#ifndef ghoul_cache_h
+#define ghoul_cache_h
+
+#include "object.h"
+#include "serialize.h"
+
+typedef enum {
+  USE_BUILTIN, // a native module such as "Math"
+  USE_FILE,    // a file compiled into the script
+  USE_SKIPPED, // a file already used earlier, so left out
+} UseKind;
+
+// Called by the compiler for every use statement while a script is compiled
+// for the cache, so a cached script can be checked against the files it
+// pulled in and can register the same natives when it is loaded.
+void recordUse(UseKind kind, const char *written, int writtenLength,
+               ObjString *resolved, const char *source);
+
+void beginUseRecording();
+void endUseRecording();
+
+// Loads the compiled script for file from its .ghoulc cache, returning NULL
+// when there is no cache or it does not match the source, the files it used,
+// or the compiler flags.
+ObjFunction *loadCache(const char *file, const char *source);
+void writeCache(const char *file, const char *source, ObjFunction *function);
+
+// Bundles are cache images built into the binary, such as the std library.
+// writeBundle compiles source with the current compiler flags and appends
+// its image to writer; loadBundle reads one back, returning NULL when it was
+// written for other flags, cache version or byte order, or another source.
+bool writeBundle(Writer *writer, const char *file, const char *source);
+ObjFunction *loadBundle(const char *file, const char *source,
+                        const uint8_t *bytes, size_t length);
+
+// A file compiled on a loader thread reaches the main thread as the image
+// of its script. Every function in it comes from that one file, so no uses
+// are written with it. Writing is safe off the main thread; reading, which
+// makes the functions in the VM's heap, is not.
+bool writeStaged(Writer *writer, ObjFunction *function, const char *file);
+ObjFunction *readStaged(const uint8_t *bytes, size_t length,
+                        const char *file);
+
+#endif
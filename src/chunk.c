@@ -9,6 +9,8 @@ void initChunk(Chunk *chunk, const char *file) {
   chunk->count = 0;
   chunk->capacity = 0;
   chunk->code = NULL;
+  chunk->lineCount = 0;
+  chunk->lineCapacity = 0;
   chunk->lines = NULL;
   chunk->file = file;
   initValueArray(&chunk->constants);
@@ -16,7 +18,7 @@ void initChunk(Chunk *chunk, const char *file) {
 
 void freeChunk(Chunk *chunk) {
   FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(int, chunk->lines, chunk->capacity);
+  FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
   freeValueArray(&chunk->constants);
   initChunk(chunk, NULL);
 }
@@ -27,18 +29,74 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line) {
     chunk->capacity = GROW_CAPACITY(oldCapacity);
     chunk->code =
         GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-    chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
   }
 
-  chunk->lines[chunk->count] = line;
   chunk->code[chunk->count] = byte;
   chunk->count++;
+
+  // Consecutive bytes almost always share a line, so only the first byte of
+  // each run is recorded.
+  if (chunk->lineCount > 0 &&
+      chunk->lines[chunk->lineCount - 1].line == line) {
+    return;
+  }
+  if (chunk->lineCapacity < chunk->lineCount + 1) {
+    int oldCapacity = chunk->lineCapacity;
+    chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+    chunk->lines = GROW_ARRAY(LineStart, chunk->lines, oldCapacity,
+                              chunk->lineCapacity);
+  }
+  LineStart *start = &chunk->lines[chunk->lineCount++];
+  start->offset = chunk->count - 1;
+  start->line = line;
+}
+
+// Drops the code from count onwards, along with the line runs that start
+// there, so runs written afterwards stay in offset order.
+void truncateChunk(Chunk *chunk, int count) {
+  chunk->count = count;
+  while (chunk->lineCount > 0 &&
+         chunk->lines[chunk->lineCount - 1].offset >= count) {
+    chunk->lineCount--;
+  }
+}
+
+// Finds the run holding the byte at offset. Only error reporting and the
+// disassembler ask, so a search here is cheaper than a line per byte.
+// Returns -1 when the chunk has no line information.
+int getLine(Chunk *chunk, int offset) {
+  if (chunk->lineCount == 0) {
+    return -1;
+  }
+
+  int low = 0;
+  int high = chunk->lineCount - 1;
+  while (low < high) {
+    int mid = low + (high - low + 1) / 2;
+    if (chunk->lines[mid].offset <= offset) {
+      low = mid;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return chunk->lines[low].line;
 }
 
-int getLine(Chunk *chunk, int line) { return chunk->lines[line]; }
+void stripLines(Chunk *chunk) {
+  FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+  chunk->lines = NULL;
+  chunk->lineCount = 0;
+  chunk->lineCapacity = 0;
+}
 const char *getFileName(Chunk *chunk) { return chunk->file; }
 
 int addConstant(Chunk *chunk, Value value) {
+  // Staged values are never collected, and the VM stack is not this
+  // thread's to push on.
+  if (staging != NULL) {
+    writeValueArray(&chunk->constants, value);
+    return chunk->constants.count - 1;
+  }
   push(value);
   writeValueArray(&chunk->constants, value);
   pop();
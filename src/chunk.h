@@ -6,6 +6,7 @@
 typedef enum {
   OP_CONSTANT,
   OP_CONSTANT_SHORT,
+  OP_CONSTANT_LONG,
   OP_NIL,
   OP_TRUE,
   OP_FALSE,
@@ -14,6 +15,7 @@ typedef enum {
   OP_GET_LOCAL_SHORT,
   OP_SET_LOCAL,
   OP_SET_LOCAL_SHORT,
+  OP_SET_LOCAL_POP,
   OP_GET_GLOBAL,
   OP_GET_GLOBAL_SHORT,
   OP_DEFINE_GLOBAL,
@@ -38,6 +40,7 @@ typedef enum {
   OP_LESS_EQUAL,
   OP_ADD,
   OP_CONCAT,
+  OP_BUILD_STRING,
   OP_SUBTRACT,
   OP_MULTIPLY,
   OP_DIVIDE,
@@ -54,6 +57,7 @@ typedef enum {
   OP_PRINT,
   OP_JUMP,
   OP_JUMP_IF_FALSE,
+  OP_JUMP_IF_TRUE,
   OP_LOOP,
   OP_CALL,
   OP_CALL_SHORT,
@@ -65,6 +69,7 @@ typedef enum {
   OP_CLOSURE_SHORT,
   OP_CLOSE_UPVALUE,
   OP_RETURN,
+  OP_RETURN_NIL,
   OP_CLASS,
   OP_CLASS_SHORT,
   OP_INHERIT,
@@ -79,11 +84,19 @@ typedef enum {
   OP_IN,
 } OpCode;
 
+// The first byte of a run of code compiled from one source line.
+typedef struct {
+  int offset;
+  int line;
+} LineStart;
+
 typedef struct {
   int count;
   int capacity;
   uint8_t *code;
-  int *lines;
+  int lineCount;
+  int lineCapacity;
+  LineStart *lines;
   const char *file;
   ValueArray constants;
 } Chunk;
@@ -91,9 +104,11 @@ typedef struct {
 void initChunk(Chunk *chunk, const char *file);
 void freeChunk(Chunk *chunk);
 void writeChunk(Chunk *chunk, uint8_t byte, int line);
+void truncateChunk(Chunk *chunk, int count);
 int addConstant(Chunk *chunk, Value value);
 void writeConstant(Chunk *chunk, Value value, int line, const char *file);
-int getLine(Chunk *chunk, int line);
+int getLine(Chunk *chunk, int offset);
+void stripLines(Chunk *chunk);
 const char *getFileName(Chunk *chunk);
 
 #endif
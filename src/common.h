@@ -13,6 +13,7 @@
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 #define UINT16_COUNT (UINT16_MAX + 1)
+#define UINT24_MAX 0xffffff
 
 #ifdef WIN32
 #define realpath(N, R) _fullpath((R), (N), PATH_MAX)
@@ -1,15 +1,22 @@
 #include <limits.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "cache.h"
+#include "loader.h"
 #include "chunk.h"
 #include "common.h"
 #include "compiler.h"
 #include "memory.h"
+#include "number.h"
+#include "optimizer.h"
 #include "native/native.h"
 #include "scanner.h"
+#include "serialize.h"
+#include "snapshot.h"
 #include "table.h"
 #include "vm.h"
 
@@ -80,23 +87,50 @@ typedef struct {
   FlowType type;
 } FlowStatement;
 
-FlowStatement flowStatements[UINT8_COUNT];
+// Breaks and continues waiting for the end of their loop, innermost loop
+// last. Each loop owns the entries from its firstStatement up.
+_Thread_local FlowStatement *flowStatements = NULL;
+_Thread_local int flowCount = 0;
+_Thread_local int flowCapacity = 0;
 
 typedef struct LoopContext {
   struct LoopContext *previous;
-  int statementCount;
+  struct Compiler *compiler;
+  int firstStatement;
 } LoopContext;
 
+// A value loaded by an OP_CONSTANT, OP_CONSTANT_SHORT, OP_CONSTANT_LONG,
+// OP_TRUE, OP_FALSE or OP_NIL instruction starting at offset.
+typedef struct {
+  int offset;
+  Value value;
+} ConstantLoad;
+
+#define CONSTANT_LOADS_MAX 8
+
 typedef struct Compiler {
   struct Compiler *enclosing;
   ObjFunction *function;
   FunctionType type;
 
-  Local locals[UINT16_COUNT];
+  // Both grow as needed, so deep nesting costs little of the C stack.
+  Local *locals;
   int localCount;
-  Upvalue upvalues[UINT16_COUNT];
+  int localCapacity;
+  Upvalue *upvalues;
+  int upvalueCapacity;
   int scopeDepth;
   const char *file;
+  // Constant table index of each identifier used so far, so a name takes
+  // one entry however often it appears.
+  Table names;
+
+  // The most recent constant loads, for folding operators applied to them.
+  // Code before foldBarrier may be the target of a jump and is never
+  // rewritten.
+  ConstantLoad loads[CONSTANT_LOADS_MAX];
+  int loadCount;
+  int foldBarrier;
 } Compiler;
 
 typedef struct ClassCompiler {
@@ -104,31 +138,101 @@ typedef struct ClassCompiler {
   bool hasSuperclass;
 } ClassCompiler;
 
-Parser parser;
-Compiler *current = NULL;
-ClassCompiler *currentClass = NULL;
-LoopContext *currentLoop = NULL;
-bool forceAssignment = false;
+// A use met while staging a file. Whether the file it names gets compiled
+// in is only known once the main thread reaches the use, so until then an
+// empty script stands in for it.
+typedef struct {
+  Token path; // points into the staged file's source
+  bool builtin;
+  char *resolved; // NULL for builtins
+  ObjFunction *placeholder;
+  int constant;        // the placeholder's constant in the script, or -1
+  size_t errorsBefore; // length of the errors reported ahead of the use
+} StagedUse;
+
+struct StagedModule {
+  Writer image;
+  StagedUse *uses;
+  int useCount;
+  int useCapacity;
+  char *errors;
+  size_t errorLength;
+  size_t errorCapacity;
+  bool hadError;
+  bool panicMode;
+  bool abandoned;
+};
+
+// Each thread compiles on its own: loader threads compile used files while
+// the main thread compiles the script.
+_Thread_local Parser parser;
+_Thread_local Compiler *current = NULL;
+_Thread_local ClassCompiler *currentClass = NULL;
+_Thread_local LoopContext *currentLoop = NULL;
+_Thread_local bool forceAssignment = false;
+// The file this thread is staging, or NULL when compiling into the VM.
+static _Thread_local StagedModule *stagedModule = NULL;
 
-static char actualpath[PATH_MAX + 1];
+static _Thread_local char actualpath[PATH_MAX + 1];
 
 static Chunk *currentChunk() { return &current->function->chunk; }
 
+// A staged file's errors are held back until the main thread reaches its
+// use, so they come out where compiling the file there would print them.
+static void reportError(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  if (stagedModule == NULL) {
+    vfprintf(stderr, format, args);
+    va_end(args);
+    return;
+  }
+
+  va_list counting;
+  va_copy(counting, args);
+  int length = vsnprintf(NULL, 0, format, counting);
+  va_end(counting);
+  StagedModule *module = stagedModule;
+  if (length < 0) {
+    module->abandoned = true;
+    va_end(args);
+    return;
+  }
+  if (module->errorLength + length + 1 > module->errorCapacity) {
+    size_t capacity = module->errorCapacity < 256 ? 256
+                                                  : module->errorCapacity * 2;
+    while (capacity < module->errorLength + length + 1) {
+      capacity *= 2;
+    }
+    char *grown = realloc(module->errors, capacity);
+    if (grown == NULL) {
+      module->abandoned = true;
+      va_end(args);
+      return;
+    }
+    module->errors = grown;
+    module->errorCapacity = capacity;
+  }
+  vsnprintf(module->errors + module->errorLength, length + 1, format, args);
+  module->errorLength += length;
+  va_end(args);
+}
+
 static void errorAt(Token *token, const char *message) {
   if (parser.panicMode)
     return;
   parser.panicMode = true;
-  fprintf(stderr, "[line %d of %s] Error", token->line, current->file);
+  reportError("[line %d of %s] Error", token->line, current->file);
 
   if (token->type == TOKEN_EOF) {
-    fprintf(stderr, " at end");
+    reportError(" at end");
   } else if (token->type == TOKEN_ERROR) {
     // Nothing.
   } else {
-    fprintf(stderr, " at '%.*s'", token->length, token->start);
+    reportError(" at '%.*s'", token->length, token->start);
   }
 
-  fprintf(stderr, ": %s\n", message);
+  reportError(": %s\n", message);
   parser.hadError = true;
 }
 
@@ -208,6 +312,11 @@ static void emitShort(uint16_t bytes) {
   emitBytes((bytes >> 8) & 0xff, bytes & 0xff);
 }
 
+static void emitLong(uint32_t bytes) {
+  emitBytes((bytes >> 16) & 0xff, (bytes >> 8) & 0xff);
+  emitByte(bytes & 0xff);
+}
+
 static void emitIndex(uint16_t bytes) {
   if (bytes > UINT8_MAX) {
     emitShort(bytes);
@@ -219,19 +328,19 @@ static void emitIndex(uint16_t bytes) {
 static void emitLoop(int loopStart) {
   emitByte(OP_LOOP);
 
-  int offset = currentChunk()->count - loopStart + 2;
-  if (offset > UINT16_MAX)
+  int offset = currentChunk()->count - loopStart + 3;
+  if (offset > UINT24_MAX)
     error("Loop body too large.");
 
-  emitByte((offset >> 8) & 0xff);
-  emitByte(offset & 0xff);
+  emitLong(offset);
 }
 
 static int emitJump(uint8_t instruction) {
   emitByte(instruction);
   emitByte(0xff);
   emitByte(0xff);
-  return currentChunk()->count - 2;
+  emitByte(0xff);
+  return currentChunk()->count - 3;
 }
 
 static void emitReturn() {
@@ -264,29 +373,210 @@ static uint16_t makeConstantShort(Value value) {
   return (uint16_t)constant;
 }
 
+static uint32_t makeConstantLong(Value value) {
+  int constant = addConstant(currentChunk(), value);
+  if (constant > UINT24_MAX) {
+    error("Too many constants in one chunk.");
+    return 0;
+  }
+  return (uint32_t)constant;
+}
+
+static void noteConstantLoad(int offset, Value value) {
+  if (current->loadCount == CONSTANT_LOADS_MAX) {
+    memmove(current->loads, current->loads + 1,
+            sizeof(ConstantLoad) * (CONSTANT_LOADS_MAX - 1));
+    current->loadCount--;
+  }
+  current->loads[current->loadCount].offset = offset;
+  current->loads[current->loadCount].value = value;
+  current->loadCount++;
+}
+
 static void emitConstant(Value value) {
+  int offset = currentChunk()->count;
   if (currentChunk()->count > UINT8_MAX) {
-    uint16_t constant = makeConstantShort(value);
-    emitByte(OP_CONSTANT_SHORT);
-    emitShort(constant);
+    uint32_t constant = makeConstantLong(value);
+    if (constant > UINT16_MAX) {
+      emitByte(OP_CONSTANT_LONG);
+      emitLong(constant);
+    } else {
+      emitByte(OP_CONSTANT_SHORT);
+      emitShort(constant);
+    }
   } else {
     emitBytes(OP_CONSTANT, makeConstant(value));
   }
+  noteConstantLoad(offset, value);
+}
+
+// Loads nil, true and false with their own instructions, anything else
+// through the constant table.
+static void emitValue(Value value) {
+  if (IS_NIL(value)) {
+    emitByte(OP_NIL);
+  } else if (IS_BOOL(value)) {
+    emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+  } else {
+    emitConstant(value);
+    return;
+  }
+  noteConstantLoad(currentChunk()->count - 1, value);
+}
+
+// Returns the current offset for use as a jump target, which folding must
+// not move code across.
+static int jumpTarget() {
+  current->foldBarrier = currentChunk()->count;
+  return current->foldBarrier;
+}
+
+static int constantLoadLength(int offset) {
+  switch (currentChunk()->code[offset]) {
+  case OP_CONSTANT:
+    return 2;
+  case OP_CONSTANT_SHORT:
+    return 3;
+  case OP_CONSTANT_LONG:
+    return 4;
+  default:
+    return 1;
+  }
+}
+
+// Returns the last count constant loads, oldest first, when they are the
+// last instructions in the chunk and nothing jumps in between them.
+static ConstantLoad *trailingConstants(int count) {
+  if (current->loadCount < count) {
+    return NULL;
+  }
+  int end = currentChunk()->count;
+  for (int i = current->loadCount - 1; i >= current->loadCount - count; i--) {
+    int offset = current->loads[i].offset;
+    if (offset + constantLoadLength(offset) != end) {
+      return NULL;
+    }
+    end = offset;
+  }
+  if (end < current->foldBarrier) {
+    return NULL;
+  }
+  return &current->loads[current->loadCount - count];
+}
+
+// Removes the last count constant loads from the chunk, and their entries
+// from the constant table when nothing was added after them.
+static void removeConstants(int count) {
+  Chunk *chunk = currentChunk();
+  int start = current->loads[current->loadCount - count].offset;
+  for (int i = current->loadCount - 1; i >= current->loadCount - count; i--) {
+    uint8_t *code = &chunk->code[current->loads[i].offset];
+    int index = -1;
+    if (code[0] == OP_CONSTANT) {
+      index = code[1];
+    } else if (code[0] == OP_CONSTANT_SHORT) {
+      index = (code[1] << 8) | code[2];
+    }
+    if (index >= 0 && index == chunk->constants.count - 1) {
+      chunk->constants.count--;
+    }
+  }
+  truncateChunk(chunk, start);
+  current->loadCount -= count;
+}
+
+// Throws away code that was compiled only so it would be checked, like a
+// branch that can never run.
+static void discardCode(int start) {
+  truncateChunk(currentChunk(), start);
+  while (current->loadCount > 0 &&
+         current->loads[current->loadCount - 1].offset >= start) {
+    current->loadCount--;
+  }
+  if (current->foldBarrier > start) {
+    current->foldBarrier = start;
+  }
+  if (currentLoop != NULL && currentLoop->compiler == current) {
+    while (flowCount > currentLoop->firstStatement &&
+           flowStatements[flowCount - 1].location >= start) {
+      flowCount--;
+    }
+  }
+}
+
+// Replaces a constant condition that was just compiled, returning whether
+// there was one and, in truthy, whether it holds.
+static bool constantCondition(bool *truthy) {
+  ConstantLoad *load = trailingConstants(1);
+  if (load == NULL) {
+    return false;
+  }
+  *truthy = !isFalsey(load->value);
+  removeConstants(1);
+  return true;
+}
+
+// Evaluates an operator on the two constants it was just given, as long as
+// doing so cannot fail at runtime, and loads the result instead.
+static bool foldBinary(uint8_t op) {
+  ConstantLoad *loads = trailingConstants(2);
+  Value result;
+  if (loads == NULL ||
+      !foldBinaryValues(op, loads[0].value, loads[1].value, &result)) {
+    return false;
+  }
+
+  if (staging == NULL)
+    push(result);
+  removeConstants(2);
+  emitValue(result);
+  if (staging == NULL)
+    pop();
+  return true;
+}
+
+static bool foldUnary(uint8_t op) {
+  ConstantLoad *load = trailingConstants(1);
+  Value result;
+  if (load == NULL || !foldUnaryValue(op, load->value, &result)) {
+    return false;
+  }
+  removeConstants(1);
+  emitValue(result);
+  return true;
+}
+
+static void emitBinary(uint8_t op) {
+  if (!foldBinary(op)) {
+    emitByte(op);
+  }
+}
+
+static void emitUnary(uint8_t op) {
+  if (!foldUnary(op)) {
+    emitByte(op);
+  }
+}
+
+static void patchLong(int offset, int value) {
+  currentChunk()->code[offset] = (value >> 16) & 0xff;
+  currentChunk()->code[offset + 1] = (value >> 8) & 0xff;
+  currentChunk()->code[offset + 2] = value & 0xff;
 }
 
 static void patchJump(int offset) {
-  int jump = currentChunk()->count - offset - 2;
+  int jump = jumpTarget() - offset - 3;
 
-  if (jump > UINT16_MAX) {
+  if (jump > UINT24_MAX) {
     error("Too much code to jump over.");
   }
 
-  currentChunk()->code[offset] = (jump >> 8) & 0xff;
-  currentChunk()->code[offset + 1] = jump & 0xff;
+  patchLong(offset, jump);
 }
 
 static void startLoop(LoopContext *loopContext) {
-  loopContext->statementCount = 0;
+  loopContext->firstStatement = flowCount;
+  loopContext->compiler = current;
   loopContext->previous = currentLoop;
   currentLoop = loopContext;
 }
@@ -294,28 +584,44 @@ static void endLoop() { currentLoop = currentLoop->previous; }
 
 static void patchFlowJumps(int loopStart) {
 
-  while (currentLoop->statementCount > 0) {
-    FlowStatement *statement = &flowStatements[--currentLoop->statementCount];
+  while (flowCount > currentLoop->firstStatement) {
+    FlowStatement *statement = &flowStatements[--flowCount];
     if (statement->type == TYPE_BREAK) {
       patchJump(statement->location);
     } else if (statement->type == TYPE_CONTINUE) {
-      int loopOffset = statement->location - loopStart + 2;
-      if (loopOffset > UINT16_MAX) {
+      int loopOffset = statement->location - loopStart + 3;
+      if (loopOffset > UINT24_MAX) {
         error("Too much code to jump over.");
       }
-      currentChunk()->code[statement->location] = (loopOffset >> 8) & 0xff;
-      currentChunk()->code[statement->location + 1] = loopOffset & 0xff;
+      patchLong(statement->location, loopOffset);
     }
   }
 }
 
+static Local *pushLocal(Compiler *compiler) {
+  if (compiler->localCapacity < compiler->localCount + 1) {
+    int oldCapacity = compiler->localCapacity;
+    compiler->localCapacity = GROW_CAPACITY(oldCapacity);
+    compiler->locals = GROW_ARRAY(Local, compiler->locals, oldCapacity,
+                                  compiler->localCapacity);
+  }
+  return &compiler->locals[compiler->localCount++];
+}
+
 static void initCompiler(Compiler *compiler, FunctionType type,
                          const char *file) {
   compiler->enclosing = current;
   compiler->function = NULL;
   compiler->type = type;
+  compiler->locals = NULL;
   compiler->localCount = 0;
+  compiler->localCapacity = 0;
+  compiler->upvalues = NULL;
+  compiler->upvalueCapacity = 0;
+  initTable(&compiler->names);
   compiler->scopeDepth = 0;
+  compiler->loadCount = 0;
+  compiler->foldBarrier = 0;
   compiler->function = newFunction(file);
   current = compiler;
   if (type != TYPE_SCRIPT) {
@@ -336,7 +642,7 @@ static void initCompiler(Compiler *compiler, FunctionType type,
                                            &vm.useStrings, vm.klass.string);
   compiler->file = realFilePath->chars;
 
-  Local *local = &current->locals[current->localCount++];
+  Local *local = pushLocal(current);
   local->depth = 0;
   local->isCaptured = false;
   if (type != TYPE_FUNCTION) {
@@ -352,6 +658,16 @@ static ObjFunction *endCompiler() {
   emitReturn();
   ObjFunction *function = current->function;
 
+  if (!parser.hadError) {
+    if (vm.optimize) {
+      optimizeFunction(function);
+    }
+    peepholeFunction(function);
+    if (vm.stripLines) {
+      stripLines(&function->chunk);
+    }
+  }
+
 #ifdef DEBUG_PRINT_CODE
   if (!parser.hadError) {
     disassembleChunk(currentChunk(), function->name != NULL
@@ -362,10 +678,22 @@ static ObjFunction *endCompiler() {
   current->scopeDepth--;
 #endif
 
+  FREE_ARRAY(Local, current->locals, current->localCapacity);
+  freeTable(&current->names);
   current = current->enclosing;
   return function;
 }
 
+// Writes the operands OP_CLOSURE reads after the function, then frees the
+// finished compiler's upvalue table.
+static void emitUpvalues(Compiler *compiler, ObjFunction *function) {
+  for (int i = 0; i < function->upvalueCount; i++) {
+    emitByte(compiler->upvalues[i].isLocal ? 1 : 0);
+    emitShort(compiler->upvalues[i].index);
+  }
+  FREE_ARRAY(Upvalue, compiler->upvalues, compiler->upvalueCapacity);
+}
+
 static void beginScope() { current->scopeDepth++; }
 
 static void endScope() {
@@ -437,12 +765,20 @@ static bool isAssignment(uint8_t *binaryOp) {
 }
 
 static uint16_t identifierConstant(Token *name) {
+  ObjString *string = copyString(name->start, name->length, &vm.strings);
+  Value index;
+  if (tableGet(&current->names, string, &index)) {
+    return (uint16_t)AS_NUMBER(index);
+  }
+
+  uint16_t constant;
   if (currentChunk()->count > UINT8_MAX) {
-    return makeConstantShort(
-        OBJ_VAL(copyString(name->start, name->length, &vm.strings)));
+    constant = makeConstantShort(OBJ_VAL(string));
+  } else {
+    constant = makeConstant(OBJ_VAL(string));
   }
-  return makeConstant(
-      OBJ_VAL(copyString(name->start, name->length, &vm.strings)));
+  tableSet(&current->names, string, NUMBER_VAL((double)constant));
+  return constant;
 }
 
 static bool identifierEqual(Token *a, Token *b) {
@@ -479,6 +815,12 @@ static int addUpvalue(Compiler *compiler, uint16_t index, bool isLocal) {
     return 0;
   }
 
+  if (compiler->upvalueCapacity < upvalueCount + 1) {
+    int oldCapacity = compiler->upvalueCapacity;
+    compiler->upvalueCapacity = GROW_CAPACITY(oldCapacity);
+    compiler->upvalues = GROW_ARRAY(Upvalue, compiler->upvalues, oldCapacity,
+                                    compiler->upvalueCapacity);
+  }
   compiler->upvalues[upvalueCount].isLocal = isLocal;
   compiler->upvalues[upvalueCount].index = index;
   return compiler->function->upvalueCount++;
@@ -584,61 +926,61 @@ static void binary(bool canAssign) {
 
   switch (operatorType) {
   case TOKEN_BANG_EQUAL:
-    emitByte(OP_BANG_EQUAL);
+    emitBinary(OP_BANG_EQUAL);
     break;
   case TOKEN_EQUAL_EQUAL:
-    emitByte(OP_EQUAL);
+    emitBinary(OP_EQUAL);
     break;
   case TOKEN_GREATER:
-    emitByte(OP_GREATER);
+    emitBinary(OP_GREATER);
     break;
   case TOKEN_GREATER_EQUAL:
-    emitByte(OP_GREATER_EQUAL);
+    emitBinary(OP_GREATER_EQUAL);
     break;
   case TOKEN_LESS:
-    emitByte(OP_LESS);
+    emitBinary(OP_LESS);
     break;
   case TOKEN_LESS_EQUAL:
-    emitByte(OP_LESS_EQUAL);
+    emitBinary(OP_LESS_EQUAL);
     break;
   case TOKEN_BANG:
     emitByte(OP_NOT);
     break;
   case TOKEN_PLUS:
-    emitByte(OP_ADD);
+    emitBinary(OP_ADD);
     break;
   case TOKEN_PLUS_PLUS:
-    emitByte(OP_CONCAT);
+    emitBinary(OP_CONCAT);
     break;
   case TOKEN_MINUS:
-    emitByte(OP_SUBTRACT);
+    emitBinary(OP_SUBTRACT);
     break;
   case TOKEN_STAR:
-    emitByte(OP_MULTIPLY);
+    emitBinary(OP_MULTIPLY);
     break;
   case TOKEN_SLASH:
-    emitByte(OP_DIVIDE);
+    emitBinary(OP_DIVIDE);
     break;
   case TOKEN_PERCENTAGE:
-    emitByte(OP_MOD);
+    emitBinary(OP_MOD);
     break;
   case TOKEN_STAR_STAR:
-    emitByte(OP_EXPONENTIATION);
+    emitBinary(OP_EXPONENTIATION);
     break;
   case TOKEN_BITWISE_AND:
-    emitByte(OP_BITWISE_AND);
+    emitBinary(OP_BITWISE_AND);
     break;
   case TOKEN_BITWISE_OR:
-    emitByte(OP_BITWISE_OR);
+    emitBinary(OP_BITWISE_OR);
     break;
   case TOKEN_BITWISE_XOR:
-    emitByte(OP_BITWISE_XOR);
+    emitBinary(OP_BITWISE_XOR);
     break;
   case TOKEN_BITWISE_LEFT_SHIFT:
-    emitByte(OP_BITWISE_LEFT_SHIFT);
+    emitBinary(OP_BITWISE_LEFT_SHIFT);
     break;
   case TOKEN_BITWISE_RIGHT_SHIFT:
-    emitByte(OP_BITWISE_RIGHT_SHIFT);
+    emitBinary(OP_BITWISE_RIGHT_SHIFT);
     break;
   default:
     return;
@@ -726,13 +1068,13 @@ static void dot(bool canAssign) {
 static void literal(bool canAssign) {
   switch (parser.previous.type) {
   case TOKEN_FALSE:
-    emitByte(OP_FALSE);
+    emitValue(FALSE_VAL);
     break;
   case TOKEN_NIL:
-    emitByte(OP_NIL);
+    emitValue(NIL_VAL);
     break;
   case TOKEN_TRUE:
-    emitByte(OP_TRUE);
+    emitValue(TRUE_VAL);
     break;
   default:
     exit(1); // unreachable
@@ -746,7 +1088,8 @@ static void grouping(bool canAssign) {
 }
 
 static void number(bool canAssign) {
-  double value = strtod(parser.previous.start, NULL);
+  double value;
+  parseNumber(parser.previous.start, parser.previous.length, &value);
   emitConstant(NUMBER_VAL(value));
 }
 
@@ -756,6 +1099,36 @@ static void string(bool canAssign) {
                                      vm.klass.string)));
 }
 
+// Emits the literal text of a string token, or nothing for an empty part of
+// an interpolated string. The token keeps `trim` delimiter bytes at its end.
+static bool stringPart(int trim) {
+  int length = parser.previous.length - 1 - trim;
+  if (length == 0) {
+    return false;
+  }
+  emitConstant(OBJ_VAL(copyEscString(parser.previous.start + 1, length,
+                                     &vm.strings, vm.klass.string)));
+  return true;
+}
+
+// "a=${a}, b=${b}" pushes each literal part and expression in order, then
+// OP_BUILD_STRING joins them into one new string.
+static void interpolation(bool canAssign) {
+  int partCount = 0;
+  do {
+    partCount += stringPart(2);
+    expression();
+    partCount++;
+  } while (match(TOKEN_INTERPOLATION));
+  consume(TOKEN_STRING, "Expect end of string after interpolation.");
+  partCount += stringPart(1);
+
+  if (partCount > UINT8_MAX) {
+    error("Cannot have more than 255 parts in an interpolated string.");
+  }
+  emitBytes(OP_BUILD_STRING, partCount);
+}
+
 static void list(bool canAssign) {
   int itemCount = 0;
   if (!check(TOKEN_RIGHT_BRACKET)) {
@@ -877,6 +1250,20 @@ static void super_(bool canAssign) {
 static void lambda(bool canAssign) { function(TYPE_FUNCTION); }
 
 static void and_(bool canAssign) {
+  ConstantLoad *left = trailingConstants(1);
+  if (left != NULL) {
+    // A falsey left side is the result; otherwise the right side is.
+    if (isFalsey(left->value)) {
+      int start = currentChunk()->count;
+      parsePrecedence(PREC_AND);
+      discardCode(start);
+    } else {
+      removeConstants(1);
+      parsePrecedence(PREC_AND);
+    }
+    return;
+  }
+
   int endJump = emitJump(OP_JUMP_IF_FALSE);
 
   emitByte(OP_POP);
@@ -886,6 +1273,19 @@ static void and_(bool canAssign) {
 }
 
 static void or_(bool canAssign) {
+  ConstantLoad *left = trailingConstants(1);
+  if (left != NULL) {
+    if (!isFalsey(left->value)) {
+      int start = currentChunk()->count;
+      parsePrecedence(PREC_OR);
+      discardCode(start);
+    } else {
+      removeConstants(1);
+      parsePrecedence(PREC_OR);
+    }
+    return;
+  }
+
   int elseJump = emitJump(OP_JUMP_IF_FALSE);
   int endJump = emitJump(OP_JUMP);
 
@@ -903,13 +1303,13 @@ static void unary(bool canAssign) {
 
   switch (operatorType) {
   case TOKEN_BANG:
-    emitByte(OP_NOT);
+    emitUnary(OP_NOT);
     break;
   case TOKEN_MINUS:
-    emitByte(OP_NEGATE);
+    emitUnary(OP_NEGATE);
     break;
   case TOKEN_BITWISE_NOT:
-    emitByte(OP_BITWISE_NOT);
+    emitUnary(OP_BITWISE_NOT);
     break;
   default:
     exit(1);
@@ -956,6 +1356,7 @@ ParseRule rules[] = {
     [TOKEN_LESS_EQUAL] = {NULL, binary, PREC_COMPARISION},
     [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
     [TOKEN_STRING] = {string, NULL, PREC_NONE},
+    [TOKEN_INTERPOLATION] = {interpolation, NULL, PREC_NONE},
     [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
     [TOKEN_AND] = {NULL, and_, PREC_AND},
     [TOKEN_ELSE] = {NULL, NULL, PREC_NONE},
@@ -1006,7 +1407,7 @@ static void addLocal(Token name) {
     return;
   }
 
-  Local *local = &current->locals[current->localCount++];
+  Local *local = pushLocal(current);
   local->name = name;
   local->depth = current->scopeDepth;
   local->isCaptured = false;
@@ -1108,10 +1509,7 @@ static void function(FunctionType type) {
   }
   emitIndex(constant);
 
-  for (int i = 0; i < function->upvalueCount; i++) {
-    emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
-    emitShort(compiler.upvalues[i].index);
-  }
+  emitUpvalues(&compiler, function);
 }
 
 static void method(bool canInit) {
@@ -1150,105 +1548,325 @@ static bool checkBuitinName(int start, int length, const char *rest,
          memcmp(name->chars + start, rest, length) == 0;
 }
 
-static bool matchUseBuiltin(ObjString *name) {
+typedef void (*RegisterNatives)();
+
+// Finds the function registering the natives of a builtin module, without
+// calling it, so a loader thread can tell builtins from files.
+static RegisterNatives findUseBuiltin(ObjString *name) {
   switch (name->chars[0]) {
   case 'M':
     if (checkBuitinName(1, 3, "ath", name)) {
-      registerMathNatives();
-      return true;
+      return registerMathNatives;
     }
     break;
   case 'R':
     if (checkBuitinName(1, 6, "equest", name)) {
-      registerRequestNatives();
-      return true;
+      return registerRequestNatives;
     } else if (checkBuitinName(1, 1, "L", name)) {
-      registerRaylibNatives();
-      return true;
+      return registerRaylibNatives;
     }
     break;
   case 'J':
     if (checkBuitinName(1, 3, "SON", name)) {
-      registerJsonNatives();
-      return true;
+      return registerJsonNatives;
+    }
+    break;
+  case 'S':
+    if (checkBuitinName(1, 5, "truct", name)) {
+      return registerStructNatives;
     }
     break;
   }
-  return false;
+  return NULL;
 }
 
-static void useStatement() {
-  consume(TOKEN_STRING, "Expect file path.");
-  Token useFile = parser.previous;
+bool matchUseBuiltin(ObjString *name) {
+  RegisterNatives registerNatives = findUseBuiltin(name);
+  if (registerNatives == NULL) {
+    return false;
+  }
+  registerNatives();
+  nameBuiltin("use", NULL, name->chars, name->length, TRUE_VAL);
+  return true;
+}
 
-  ObjString *usePath = copyString(parser.previous.start + 1,
-                                  parser.previous.length - 2, &vm.strings);
+// Calls a used file's script where the use stands. compiler is the one the
+// script was compiled with, or NULL when it has no upvalues to emit.
+static void emitUseCall(ObjFunction *function, Compiler *compiler) {
+  uint16_t constant = makeConstantShort(OBJ_VAL(function));
+  if (constant > UINT8_MAX) {
+    emitByte(OP_CLOSURE_SHORT);
+  } else {
+    emitByte(OP_CLOSURE);
+  }
+  emitIndex(constant);
 
-  if (matchUseBuiltin(usePath)) {
+  if (compiler != NULL) {
+    emitUpvalues(compiler, function);
+  }
+
+  emitByte(OP_CALL);
+  emitIndex(0);
+  emitByte(OP_POP);
+}
+
+// A file compiled on a loader thread saw none of the code around its use,
+// so it only stands in for compiling the file there when that code could
+// not have changed the result: every enclosing compiler is a script at the
+// top level, and no loop, class or error is open.
+static bool canStage() {
+  if (parser.panicMode || currentLoop != NULL || currentClass != NULL) {
+    return false;
+  }
+  for (Compiler *compiler = current; compiler != NULL;
+       compiler = compiler->enclosing) {
+    if (compiler->type != TYPE_SCRIPT || compiler->scopeDepth > 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// On a loader thread a use is only resolved, and calls a placeholder that
+// the main thread swaps for the used file's script once it knows the file
+// is compiled in. Anything canStage rules out sends the whole file back to
+// be compiled on the main thread.
+static void stageUse(Token *useFile, ObjString *usePath) {
+  StagedModule *module = stagedModule;
+  bool builtin = findUseBuiltin(usePath) != NULL;
+  if (!builtin && realpath(usePath->chars, actualpath) == NULL) {
+    errorAt(useFile, "Failed to resolve file path.");
+    return;
+  }
+
+  if (module->useCount + 1 > module->useCapacity) {
+    int capacity = GROW_CAPACITY(module->useCapacity);
+    StagedUse *grown = realloc(module->uses, sizeof(StagedUse) * capacity);
+    if (grown == NULL) {
+      module->abandoned = true;
+      return;
+    }
+    module->uses = grown;
+    module->useCapacity = capacity;
+  }
+  StagedUse *use = &module->uses[module->useCount++];
+  use->path = *useFile;
+  use->builtin = builtin;
+  use->resolved = NULL;
+  use->placeholder = NULL;
+  use->constant = -1;
+  use->errorsBefore = module->errorLength;
+  if (builtin) {
     consume(TOKEN_SEMICOLON, "Expect ';' after use statement.");
     return;
   }
+  if (!canStage()) {
+    module->abandoned = true;
+    return;
+  }
 
-  char *resolvePathRes = realpath(usePath->chars, actualpath);
-  if (resolvePathRes == NULL) {
-    errorAt(&useFile, "Failed to resolve file path.");
+  size_t pathLength = strlen(actualpath);
+  use->resolved = malloc(pathLength + 1);
+  if (use->resolved == NULL) {
+    module->abandoned = true;
     return;
   }
+  memcpy(use->resolved, actualpath, pathLength + 1);
+
+  use->placeholder = newFunction(current->file);
+  writeChunk(&use->placeholder->chunk, OP_NIL, useFile->line);
+  writeChunk(&use->placeholder->chunk, OP_RETURN, useFile->line);
+  consume(TOKEN_SEMICOLON, "Expect ';' after use statement.");
+  emitUseCall(use->placeholder, NULL);
+}
+
+// Compiles a used file in the middle of the current one, then puts back
+// the scanner and the tokens around the use's path.
+static ObjFunction *compileSource(Compiler *compiler, const char *file,
+                                  const char *source, const Token *tokens,
+                                  int tokenCount) {
+  Scanner oldScanner = scanner;
+  Token useFile = parser.previous;
+  Token afterPath = parser.current;
+  if (tokens != NULL) {
+    initScannerTokens(source, tokens, tokenCount);
+  } else {
+    initScanner(source);
+  }
+  initCompiler(compiler, TYPE_SCRIPT, file);
+  advance();
+  while (!check(TOKEN_EOF)) {
+    declaration();
+  }
+  ObjFunction *function = endCompiler();
+
+  scanner = oldScanner;
+  parser.previous = useFile;
+  parser.current = afterPath;
+  return function;
+}
+
+static ObjFunction *compileUse(Token *useFile, const char *path,
+                               Compiler *compiler, bool *skipped);
+
+static void reportStagedErrors(StagedModule *module, size_t from, size_t to) {
+  // A module without errors never allocated its buffer.
+  if (to > from) {
+    fwrite(module->errors + from, 1, to - from, stderr);
+  }
+}
+
+// Takes in a file a loader thread compiled, doing what compiling it here
+// would have: its errors are printed and its own uses resolved in source
+// order, with the scripts of the files compiled in put in place of their
+// placeholders. Returns NULL, having done nothing, when its image cannot be
+// read back.
+static ObjFunction *adoptModule(Compiler *compiler, const char *file,
+                                StagedModule *module) {
+  ObjFunction *function =
+      readStaged(module->image.bytes, module->image.count, file);
+  if (function == NULL) {
+    return NULL;
+  }
+  push(OBJ_VAL(function));
+  initCompiler(compiler, TYPE_SCRIPT, file);
+  compiler->function = function;
+  pop();
+
+  Token useFile = parser.previous;
+  Token afterPath = parser.current;
+  size_t reported = 0;
+  for (int i = 0; i < module->useCount; i++) {
+    StagedUse *use = &module->uses[i];
+    reportStagedErrors(module, reported, use->errorsBefore);
+    reported = use->errorsBefore;
+
+    parser.previous = use->path;
+    parser.panicMode = false;
+    if (use->builtin) {
+      matchUseBuiltin(copyString(use->path.start + 1, use->path.length - 2,
+                                 &vm.strings));
+      recordUse(USE_BUILTIN, use->path.start + 1, use->path.length - 2, NULL,
+                NULL);
+      continue;
+    }
+
+    Compiler used;
+    bool skipped;
+    ObjFunction *usedFunction =
+        compileUse(&use->path, use->resolved, &used, &skipped);
+    if (usedFunction != NULL) {
+      FREE_ARRAY(Upvalue, used.upvalues, used.upvalueCapacity);
+      if (use->constant != -1) {
+        function->chunk.constants.values[use->constant] =
+            OBJ_VAL(usedFunction);
+      }
+    }
+  }
+  reportStagedErrors(module, reported, module->errorLength);
+
+  if (module->hadError) {
+    parser.hadError = true;
+  }
+  parser.panicMode = module->panicMode;
+  parser.previous = useFile;
+  parser.current = afterPath;
+  FREE_ARRAY(Local, compiler->locals, compiler->localCapacity);
+  freeTable(&compiler->names);
+  current = compiler->enclosing;
+  return function;
+}
 
-  int pathLength = strlen(actualpath);
-  uint32_t hash = hashString(actualpath, pathLength);
+// Compiles in the file at path, which a use resolved to, unless an earlier
+// use compiled it in already. Returns its script, leaving its upvalues in
+// compiler, or NULL when the file was skipped or could not be read.
+static ObjFunction *compileUse(Token *useFile, const char *path,
+                               Compiler *compiler, bool *skipped) {
+  int pathLength = strlen(path);
+  uint32_t hash = hashString(path, pathLength);
   ObjString *interned =
-      tableFindString(&vm.useStrings, actualpath, pathLength, hash);
+      tableFindString(&vm.useStrings, path, pathLength, hash);
 
+  *skipped = interned != NULL;
   if (interned != NULL) {
     // already used
-    consume(TOKEN_SEMICOLON, "Expect ';' after use statement.");
-    return;
+    recordUse(USE_SKIPPED, useFile->start + 1, useFile->length - 2,
+              interned, NULL);
+    return NULL;
   }
 
   char *heapChars = ALLOCATE(char, pathLength + 1);
-  memcpy(heapChars, actualpath, pathLength);
+  memcpy(heapChars, path, pathLength);
   heapChars[pathLength] = '\0';
   ObjString *realFilePath = allocateString(heapChars, pathLength, hash,
                                            &vm.useStrings, vm.klass.string);
 
-  char *source = readFile(realFilePath->chars);
-  if (source == NULL) {
-    return;
+  char *source;
+  Token *tokens = NULL;
+  int tokenCount = 0;
+  StagedModule *staged = NULL;
+  if (!takePreloaded(realFilePath->chars, &source, &tokens, &tokenCount,
+                     &staged)) {
+    source = readFile(realFilePath->chars);
+    if (source == NULL) {
+      return NULL;
+    }
   }
+  recordUse(USE_FILE, useFile->start + 1, useFile->length - 2, realFilePath,
+            source);
 
-  Scanner oldScanner = scanner;
-  initScanner(source);
-  Compiler compiler;
-  initCompiler(&compiler, TYPE_SCRIPT, realFilePath->chars);
-  advance();
-  while (!check(TOKEN_EOF)) {
-    declaration();
+  ObjFunction *function = NULL;
+  if (staged != NULL && canStage()) {
+    function = adoptModule(compiler, realFilePath->chars, staged);
+  }
+  if (function == NULL) {
+    function = compileSource(compiler, realFilePath->chars, source, tokens,
+                             tokenCount);
   }
-  ObjFunction *function = endCompiler();
 
+  freeStagedModule(staged);
+  free(tokens);
   free(source);
-  scanner = oldScanner;
-  scanner.current--;
-  advance();
-  consume(TOKEN_SEMICOLON, "Expect ';' after use statement.");
+  return function;
+}
 
-  uint16_t constant = makeConstantShort(OBJ_VAL(function));
-  if (constant > UINT8_MAX) {
-    emitByte(OP_CLOSURE_SHORT);
-  } else {
-    emitByte(OP_CLOSURE);
+static void useStatement() {
+  consume(TOKEN_STRING, "Expect file path.");
+  Token useFile = parser.previous;
+
+  ObjString *usePath = copyString(parser.previous.start + 1,
+                                  parser.previous.length - 2, &vm.strings);
+
+  if (stagedModule != NULL) {
+    stageUse(&useFile, usePath);
+    return;
   }
-  emitIndex(constant);
 
-  for (int i = 0; i < function->upvalueCount; i++) {
-    emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
-    emitShort(compiler.upvalues[i].index);
+  if (matchUseBuiltin(usePath)) {
+    recordUse(USE_BUILTIN, useFile.start + 1, useFile.length - 2, NULL,
+              NULL);
+    consume(TOKEN_SEMICOLON, "Expect ';' after use statement.");
+    return;
   }
 
-  emitByte(OP_CALL);
-  emitIndex(0);
-  emitByte(OP_POP);
+  char *resolvePathRes = realpath(usePath->chars, actualpath);
+  if (resolvePathRes == NULL) {
+    errorAt(&useFile, "Failed to resolve file path.");
+    return;
+  }
+
+  Compiler compiler;
+  bool skipped;
+  ObjFunction *function = compileUse(&useFile, actualpath, &compiler, &skipped);
+  if (skipped) {
+    consume(TOKEN_SEMICOLON, "Expect ';' after use statement.");
+    return;
+  }
+  if (function == NULL) {
+    return;
+  }
+  consume(TOKEN_SEMICOLON, "Expect ';' after use statement.");
+  emitUseCall(function, &compiler);
 }
 
 static void classDeclaration() {
@@ -1347,7 +1965,7 @@ static void expressionStatment() {
 static void genericFor(Token identifier) {
   expression();
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
-  int loopStart = currentChunk()->count;
+  int loopStart = jumpTarget();
   emitByte(OP_IN);
   forceAssignment = true;
   namedVariable(identifier, true);
@@ -1360,7 +1978,13 @@ static void genericFor(Token identifier) {
   emitByte(OP_POP);
 
   // OP_IN stores values in stack, need to ofset for locals
-  current->localCount += 2;
+  for (int i = 0; i < 2; i++) {
+    Local *local = pushLocal(current);
+    local->name.start = "";
+    local->name.length = 0;
+    local->depth = current->scopeDepth;
+    local->isCaptured = false;
+  }
   statement();
   current->localCount -= 2;
   emitLoop(loopStart);
@@ -1397,18 +2021,25 @@ static void forStatement() {
     expressionStatment();
   }
 
-  int loopStart = currentChunk()->count;
+  int loopStart = jumpTarget();
   int exitJump = -1;
+  bool neverRuns = false;
   if (!match(TOKEN_SEMICOLON)) {
     expression();
     consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
-    exitJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
+    bool truthy;
+    if (constantCondition(&truthy)) {
+      neverRuns = !truthy;
+    } else {
+      exitJump = emitJump(OP_JUMP_IF_FALSE);
+      emitByte(OP_POP);
+    }
   }
+  int deadStart = loopStart;
   if (!match(TOKEN_RIGHT_PAREN)) {
     int bodyJump = emitJump(OP_JUMP);
-    int incrementStart = currentChunk()->count;
+    int incrementStart = jumpTarget();
     expression();
     emitByte(OP_POP);
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
@@ -1422,6 +2053,13 @@ static void forStatement() {
   startLoop(&loopContext);
 
   statement();
+  if (neverRuns) {
+    flowCount = loopContext.firstStatement;
+    endLoop();
+    discardCode(deadStart);
+    endScope();
+    return;
+  }
   emitLoop(loopStart);
 
   if (exitJump != -1) {
@@ -1461,7 +2099,7 @@ static void returnStatement() {
 }
 
 static void whileStatment() {
-  int loopStart = currentChunk()->count;
+  int loopStart = jumpTarget();
   consume(TOKEN_LEFT_PAREN, "Expect '(' after while.");
   expression();
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
@@ -1469,6 +2107,22 @@ static void whileStatment() {
   LoopContext loopContext;
   startLoop(&loopContext);
 
+  // A constant condition needs no test: the loop either never runs, and is
+  // only compiled for its errors, or runs until a break.
+  bool truthy;
+  if (constantCondition(&truthy)) {
+    statement();
+    if (truthy) {
+      emitLoop(loopStart);
+      patchFlowJumps(loopStart);
+    } else {
+      flowCount = loopContext.firstStatement;
+      discardCode(loopStart);
+    }
+    endLoop();
+    return;
+  }
+
   int exitJump = emitJump(OP_JUMP_IF_FALSE);
   emitByte(OP_POP);
   statement();
@@ -1481,19 +2135,25 @@ static void whileStatment() {
   endLoop();
 }
 
+static void addFlowStatement(FlowType type, uint8_t instruction) {
+  if (flowCapacity < flowCount + 1) {
+    int oldCapacity = flowCapacity;
+    flowCapacity = GROW_CAPACITY(oldCapacity);
+    flowStatements = GROW_ARRAY(FlowStatement, flowStatements, oldCapacity,
+                                flowCapacity);
+  }
+  FlowStatement *statement = &flowStatements[flowCount++];
+  statement->location = emitJump(instruction);
+  statement->type = type;
+}
+
 static void continueStatement() {
   if (currentLoop == NULL) {
     errorAt(&parser.previous, "Can only continue within a loop.");
     consume(TOKEN_SEMICOLON, "Expect ';' after continue.");
     return;
   }
-  if (currentLoop->statementCount > UINT8_MAX) {
-    errorAt(&parser.previous,
-            "Can't have more than 255 flow statements within a single loop.");
-  }
-  FlowStatement *statement = &flowStatements[currentLoop->statementCount++];
-  statement->location = emitJump(OP_LOOP);
-  statement->type = TYPE_CONTINUE;
+  addFlowStatement(TYPE_CONTINUE, OP_LOOP);
   consume(TOKEN_SEMICOLON, "Expect ';' after continue.");
 }
 
@@ -1503,13 +2163,7 @@ static void breakStatement() {
     consume(TOKEN_SEMICOLON, "Expect ';' after break.");
     return;
   }
-  if (currentLoop->statementCount > UINT8_MAX) {
-    errorAt(&parser.previous,
-            "Can't have more than 255 flow statements within a single loop.");
-  }
-  FlowStatement *statement = &flowStatements[currentLoop->statementCount++];
-  statement->location = emitJump(OP_JUMP);
-  statement->type = TYPE_BREAK;
+  addFlowStatement(TYPE_BREAK, OP_JUMP);
   consume(TOKEN_SEMICOLON, "Expect ';' after break.");
 }
 
@@ -1518,6 +2172,24 @@ static void ifStatement() {
   expression();
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+  // With a constant condition only the branch taken is kept.
+  bool truthy;
+  if (constantCondition(&truthy)) {
+    int start = currentChunk()->count;
+    statement();
+    if (!truthy) {
+      discardCode(start);
+    }
+    if (match(TOKEN_ELSE)) {
+      start = currentChunk()->count;
+      statement();
+      if (truthy) {
+        discardCode(start);
+      }
+    }
+    return;
+  }
+
   int thenJump = emitJump(OP_JUMP_IF_FALSE);
   emitByte(OP_POP);
   statement();
@@ -1590,8 +2262,13 @@ static void statement() {
   }
 }
 
-ObjFunction *compile(const char *source, const char *file) {
-  initScanner(source);
+ObjFunction *compileTokens(const char *source, const char *file,
+                           const Token *tokens, int tokenCount) {
+  if (tokens != NULL) {
+    initScannerTokens(source, tokens, tokenCount);
+  } else {
+    initScanner(source);
+  }
   Compiler compiler;
   initCompiler(&compiler, TYPE_SCRIPT, file);
 
@@ -1604,9 +2281,91 @@ ObjFunction *compile(const char *source, const char *file) {
   }
 
   ObjFunction *function = endCompiler();
+  FREE_ARRAY(Upvalue, compiler.upvalues, compiler.upvalueCapacity);
+  FREE_ARRAY(FlowStatement, flowStatements, flowCapacity);
+  flowStatements = NULL;
+  flowCount = 0;
+  flowCapacity = 0;
   return parser.hadError ? NULL : function;
 }
 
+ObjFunction *compile(const char *source, const char *file) {
+  return compileTokens(source, file, NULL, 0);
+}
+
+StagedModule *stageModule(const char *file, const char *source,
+                          const Token *tokens, int tokenCount) {
+  StagedModule *module = calloc(1, sizeof(StagedModule));
+  if (module == NULL) {
+    return NULL;
+  }
+  initWriter(&module->image);
+  StagingHeap heap;
+  initStagingHeap(&heap);
+  staging = &heap;
+  stagedModule = module;
+
+  initScannerTokens(source, tokens, tokenCount);
+  Compiler compiler;
+  initCompiler(&compiler, TYPE_SCRIPT, file);
+  parser.hadError = false;
+  parser.panicMode = false;
+
+  advance();
+  while (!check(TOKEN_EOF) && !module->abandoned) {
+    declaration();
+  }
+
+  ObjFunction *function = endCompiler();
+  FREE_ARRAY(Upvalue, compiler.upvalues, compiler.upvalueCapacity);
+  FREE_ARRAY(FlowStatement, flowStatements, flowCapacity);
+  flowStatements = NULL;
+  flowCount = 0;
+  flowCapacity = 0;
+  module->hadError = parser.hadError;
+  module->panicMode = parser.panicMode;
+
+  // The placeholders are found by identity, since the optimizer may have
+  // moved constants about or dropped the code using them.
+  ValueArray *constants = &function->chunk.constants;
+  for (int i = 0; i < module->useCount; i++) {
+    StagedUse *use = &module->uses[i];
+    for (int c = 0; use->placeholder != NULL && c < constants->count; c++) {
+      if (constants->values[c] == OBJ_VAL(use->placeholder)) {
+        use->constant = c;
+        break;
+      }
+    }
+    use->placeholder = NULL;
+  }
+  if (!module->abandoned &&
+      !writeStaged(&module->image, function, function->chunk.file)) {
+    module->abandoned = true;
+  }
+
+  freeStagingHeap(&heap);
+  staging = NULL;
+  stagedModule = NULL;
+  if (module->abandoned) {
+    freeStagedModule(module);
+    return NULL;
+  }
+  return module;
+}
+
+void freeStagedModule(StagedModule *module) {
+  if (module == NULL) {
+    return;
+  }
+  for (int i = 0; i < module->useCount; i++) {
+    free(module->uses[i].resolved);
+  }
+  free(module->uses);
+  free(module->errors);
+  freeWriter(&module->image);
+  free(module);
+}
+
 void markCompilerRoots() {
   Compiler *compiler = current;
   while (compiler != NULL) {
@@ -2,8 +2,24 @@
 #define ghoul_compiler_h
 
 #include "object.h"
+#include "scanner.h"
+
+// A used file compiled on a loader thread, waiting for the main thread to
+// take it in where the file is used.
+typedef struct StagedModule StagedModule;
 
 ObjFunction *compile(const char *source, const char *file);
+// Like compile, for a source already scanned into tokens ending in
+// TOKEN_EOF, which point into source and stay the caller's.
+ObjFunction *compileTokens(const char *source, const char *file,
+                           const Token *tokens, int tokenCount);
+// Compiles a used file off the main thread, into objects the VM does not
+// own. Returns NULL when the file needs to be compiled where it is used,
+// such as when one of its own uses depends on the code around it.
+StagedModule *stageModule(const char *file, const char *source,
+                          const Token *tokens, int tokenCount);
+void freeStagedModule(StagedModule *module);
+bool matchUseBuiltin(ObjString *name);
 void markCompilerRoots();
 
 #endif
@@ -33,10 +33,11 @@ static int shortInstruction(const char *name, Chunk *chunk, int offset) {
 
 static int jumpInstruction(const char *name, int sign, Chunk *chunk,
                            int offset) {
-  uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
-  jump |= chunk->code[offset + 2];
-  printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
-  return offset + 3;
+  uint32_t jump = (uint32_t)(chunk->code[offset + 1] << 16);
+  jump |= chunk->code[offset + 2] << 8;
+  jump |= chunk->code[offset + 3];
+  printf("%-16s %4d -> %d\n", name, offset, offset + 4 + sign * (int)jump);
+  return offset + 4;
 }
 
 static int constantInstruction(const char *name, Chunk *chunk, int offset) {
@@ -57,6 +58,16 @@ static int constantShortInstruction(const char *name, Chunk *chunk,
   return offset + 3;
 }
 
+static int constantLongInstruction(const char *name, Chunk *chunk,
+                                   int offset) {
+  uint32_t constant = ((uint32_t)chunk->code[offset + 1] << 16) |
+                      (chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+  printf("%-16s %4u '", name, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("'\n");
+  return offset + 4;
+}
+
 static int invokeInstruction(const char *name, Chunk *chunk, int offset) {
   uint8_t constant = chunk->code[offset + 1];
   uint8_t argCount = chunk->code[offset + 2];
@@ -93,6 +104,8 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     return constantInstruction("OP_CONSTANT", chunk, offset);
   case OP_CONSTANT_SHORT:
     return constantShortInstruction("OP_CONSTANT_SHORT", chunk, offset);
+  case OP_CONSTANT_LONG:
+    return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
   case OP_NIL:
     return simpleInstruction("OP_NIL", offset);
   case OP_TRUE:
@@ -109,6 +122,8 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     return byteInstruction("OP_SET_LOCAL", chunk, offset);
   case OP_SET_LOCAL_SHORT:
     return shortInstruction("OP_SET_LOCAL_SHORT", chunk, offset);
+  case OP_SET_LOCAL_POP:
+    return byteInstruction("OP_SET_LOCAL_POP", chunk, offset);
   case OP_GET_GLOBAL:
     return constantInstruction("OP_GET_GLOBAL", chunk, offset);
   case OP_GET_GLOBAL_SHORT:
@@ -187,6 +202,8 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     return jumpInstruction("OP_JUMP", 1, chunk, offset);
   case OP_JUMP_IF_FALSE:
     return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+  case OP_JUMP_IF_TRUE:
+    return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);
   case OP_LOOP:
     return jumpInstruction("OP_LOOP", -1, chunk, offset);
   case OP_CALL:
@@ -242,6 +259,8 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     return simpleInstruction("OP_CLOSE_UPVALUE", offset);
   case OP_RETURN:
     return simpleInstruction("OP_RETURN", offset);
+  case OP_RETURN_NIL:
+    return simpleInstruction("OP_RETURN_NIL", offset);
   case OP_CLASS:
     return constantInstruction("OP_CLASS", chunk, offset);
   case OP_CLASS_SHORT:
@@ -252,6 +271,8 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     return constantInstruction("OP_PROPERTY", chunk, offset);
   case OP_PROPERTY_SHORT:
     return constantShortInstruction("OP_PROPERTY_SHORT", chunk, offset);
+  case OP_BUILD_STRING:
+    return byteInstruction("OP_BUILD_STRING", chunk, offset);
   case OP_BUILD_LIST:
     return constantInstruction("OP_BUILD_LIST", chunk, offset);
   case OP_BUILD_LIST_SHORT:
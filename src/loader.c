@@ -0,0 +1,332 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#ifndef PATH_MAX
+#define PATH_MAX MAX_PATH
+#endif
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+#include "loader.h"
+#include "serialize.h"
+
+// Files are handed to the threads in the order they are found, and a file
+// is only looked at once however many others use it. Nothing here touches
+// the VM: sources, tokens and staged modules live outside its heap until
+// the compiler takes them.
+#define LOADER_THREADS_MAX 8
+
+typedef enum {
+  MODULE_QUEUED,
+  MODULE_LOADING,
+  MODULE_READY,
+  MODULE_TAKEN,
+} ModuleState;
+
+typedef struct {
+  char *path;
+  ModuleState state;
+  char *source; // NULL when the file could not be read
+  Token *tokens; // NULL once the file is staged
+  int tokenCount;
+  StagedModule *staged;
+} Module;
+
+static Module *modules = NULL;
+static int moduleCount = 0;
+static int moduleCapacity = 0;
+static int nextQueued = 0;
+static int scanning = 0;
+static bool stopping = false;
+
+#ifdef _WIN32
+// Without threads the whole graph is loaded up front on the main thread,
+// so nothing ever waits.
+#define LOCK()
+#define UNLOCK()
+#define WAIT()
+#define WAKE()
+#else
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static pthread_t threads[LOADER_THREADS_MAX];
+static int threadCount = 0;
+
+#define LOCK() pthread_mutex_lock(&lock)
+#define UNLOCK() pthread_mutex_unlock(&lock)
+#define WAIT() pthread_cond_wait(&changed, &lock)
+#define WAKE() pthread_cond_broadcast(&changed)
+#endif
+
+typedef struct {
+  char **paths;
+  int count;
+  int capacity;
+} PathList;
+
+static char *copyChars(const char *chars, size_t length) {
+  char *copy = malloc(length + 1);
+  if (copy != NULL) {
+    memcpy(copy, chars, length);
+    copy[length] = '\0';
+  }
+  return copy;
+}
+
+static void addPath(PathList *list, char *path) {
+  if (list->count + 1 > list->capacity) {
+    int capacity = list->capacity < 8 ? 8 : list->capacity * 2;
+    char **paths = realloc(list->paths, sizeof(char *) * capacity);
+    if (paths == NULL) {
+      free(path);
+      return;
+    }
+    list->paths = paths;
+    list->capacity = capacity;
+  }
+  list->paths[list->count++] = path;
+}
+
+// Scans all of source into an array ending in TOKEN_EOF, or returns NULL
+// when it runs out of memory.
+static Token *scanSource(const char *source, int *count) {
+  Token *tokens = NULL;
+  int capacity = 0;
+  *count = 0;
+  initScanner(source);
+  for (;;) {
+    if (*count + 1 > capacity) {
+      capacity = capacity < 64 ? 64 : capacity * 2;
+      Token *grown = realloc(tokens, sizeof(Token) * capacity);
+      if (grown == NULL) {
+        free(tokens);
+        return NULL;
+      }
+      tokens = grown;
+    }
+    Token token = scanToken();
+    tokens[(*count)++] = token;
+    if (token.type == TOKEN_EOF) {
+      return tokens;
+    }
+  }
+}
+
+// Collects the resolved paths of the files used by a scanned source. Names
+// that do not resolve, such as builtin modules, are left to the compiler.
+static void findUses(Token *tokens, int count, PathList *uses) {
+  for (int i = 0; i + 1 < count; i++) {
+    if (tokens[i].type != TOKEN_USE || tokens[i + 1].type != TOKEN_STRING) {
+      continue;
+    }
+    Token *path = &tokens[i + 1];
+    char *written = copyChars(path->start + 1, path->length - 2);
+    char resolved[PATH_MAX + 1];
+    if (written != NULL && realpath(written, resolved) != NULL) {
+      char *copy = copyChars(resolved, strlen(resolved));
+      if (copy != NULL) {
+        addPath(uses, copy);
+      }
+    }
+    free(written);
+  }
+}
+
+static int findModule(const char *path) {
+  for (int i = 0; i < moduleCount; i++) {
+    if (strcmp(modules[i].path, path) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Queues each path not seen before, taking ownership of the list's strings.
+// Called with the lock held.
+static void queueUses(PathList *uses) {
+  for (int i = 0; i < uses->count; i++) {
+    char *path = uses->paths[i];
+    if (findModule(path) != -1) {
+      free(path);
+      continue;
+    }
+    if (moduleCount + 1 > moduleCapacity) {
+      int capacity = moduleCapacity < 8 ? 8 : moduleCapacity * 2;
+      Module *grown = realloc(modules, sizeof(Module) * capacity);
+      if (grown == NULL) {
+        free(path);
+        continue;
+      }
+      modules = grown;
+      moduleCapacity = capacity;
+    }
+    Module *module = &modules[moduleCount++];
+    module->path = path;
+    module->state = MODULE_QUEUED;
+    module->source = NULL;
+    module->tokens = NULL;
+    module->tokenCount = 0;
+    module->staged = NULL;
+  }
+  free(uses->paths);
+}
+
+static void *work(void *unused) {
+  (void)unused;
+  LOCK();
+  for (;;) {
+    // A file being scanned may still queue more.
+    while (nextQueued == moduleCount && scanning > 0 && !stopping) {
+      WAIT();
+    }
+    if (nextQueued == moduleCount || stopping) {
+      break;
+    }
+    int index = nextQueued++;
+    const char *path = modules[index].path;
+    modules[index].state = MODULE_LOADING;
+    scanning++;
+    UNLOCK();
+
+    size_t length;
+    char *source = readWholeFile(path, &length);
+    Token *tokens = NULL;
+    int tokenCount = 0;
+    PathList uses = {NULL, 0, 0};
+    if (source != NULL) {
+      tokens = scanSource(source, &tokenCount);
+      if (tokens == NULL) {
+        free(source);
+        source = NULL;
+      } else {
+        findUses(tokens, tokenCount, &uses);
+      }
+    }
+
+    // The files this one uses are queued before it is compiled, so other
+    // threads can start on them.
+    LOCK();
+    queueUses(&uses);
+    scanning--;
+    WAKE();
+    UNLOCK();
+
+    StagedModule *staged = NULL;
+    if (tokens != NULL) {
+      staged = stageModule(path, source, tokens, tokenCount);
+    }
+    if (staged != NULL) {
+      free(tokens);
+      tokens = NULL;
+      tokenCount = 0;
+    }
+
+    LOCK();
+    modules[index].source = source;
+    modules[index].tokens = tokens;
+    modules[index].tokenCount = tokenCount;
+    modules[index].staged = staged;
+    modules[index].state = MODULE_READY;
+    WAKE();
+  }
+  WAKE();
+  UNLOCK();
+  return NULL;
+}
+
+Token *preloadUses(const char *source, int *tokenCount) {
+  Token *tokens = scanSource(source, tokenCount);
+  if (tokens == NULL) {
+    return NULL;
+  }
+  PathList uses = {NULL, 0, 0};
+  findUses(tokens, *tokenCount, &uses);
+  if (uses.count == 0) {
+    free(uses.paths);
+    return tokens;
+  }
+
+  LOCK();
+  stopping = false;
+  queueUses(&uses);
+  UNLOCK();
+
+#ifdef _WIN32
+  work(NULL);
+#else
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int wanted = cpus < 1 ? 1 : cpus > LOADER_THREADS_MAX ? LOADER_THREADS_MAX
+                                                         : (int)cpus;
+  while (threadCount < wanted &&
+         pthread_create(&threads[threadCount], NULL, work, NULL) == 0) {
+    threadCount++;
+  }
+  if (threadCount == 0) {
+    work(NULL);
+  }
+#endif
+  return tokens;
+}
+
+bool takePreloaded(const char *path, char **source, Token **tokens,
+                   int *tokenCount, StagedModule **staged) {
+  LOCK();
+  int index = findModule(path);
+  if (index == -1) {
+    UNLOCK();
+    return false;
+  }
+  while (modules[index].state == MODULE_QUEUED ||
+         modules[index].state == MODULE_LOADING) {
+    WAIT();
+  }
+
+  Module *module = &modules[index];
+  bool ready = module->state == MODULE_READY && module->source != NULL;
+  if (ready) {
+    *source = module->source;
+    *tokens = module->tokens;
+    *tokenCount = module->tokenCount;
+    *staged = module->staged;
+    module->source = NULL;
+    module->tokens = NULL;
+    module->staged = NULL;
+  }
+  module->state = MODULE_TAKEN;
+  UNLOCK();
+  return ready;
+}
+
+void finishPreloading() {
+#ifndef _WIN32
+  LOCK();
+  stopping = true;
+  WAKE();
+  UNLOCK();
+  for (int i = 0; i < threadCount; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  threadCount = 0;
+#endif
+
+  for (int i = 0; i < moduleCount; i++) {
+    free(modules[i].path);
+    free(modules[i].source);
+    free(modules[i].tokens);
+    freeStagedModule(modules[i].staged);
+  }
+  free(modules);
+  modules = NULL;
+  moduleCount = 0;
+  moduleCapacity = 0;
+  nextQueued = 0;
+  scanning = 0;
+  stopping = false;
+}
@@ -0,0 +1,31 @@
+#ifndef ghoul_loader_h
+#define ghoul_loader_h
+
+#include "compiler.h"
+#include "scanner.h"
+
+// Reads, scans and compiles the files a script uses on background threads
+// while the script itself is being compiled. Use paths resolve against the
+// working directory rather than the file they appear in, so the whole use
+// graph can be found before the compiler reaches it. Which files get
+// compiled in is still decided on the main thread, in source order, so
+// results do not depend on timing.
+//
+// Returns the script's own tokens, ending in TOKEN_EOF, so the compiler
+// need not scan it again, or NULL when out of memory. They belong to the
+// caller and point into source.
+Token *preloadUses(const char *source, int *tokenCount);
+
+// Hands over the file at path, waiting for it if it is still being loaded:
+// its source, and either its compiled module or, when it could not be
+// compiled on its own, its tokens. Returns false when the file was not
+// preloaded or could not be read, leaving the compiler to read it itself.
+// Everything handed over belongs to the caller, and the tokens point into
+// the source.
+bool takePreloaded(const char *path, char **source, Token **tokens,
+                   int *tokenCount, StagedModule **staged);
+
+// Waits for the background threads and frees whatever was not taken.
+void finishPreloading();
+
+#endif
@@ -7,21 +7,15 @@
 
 #ifdef _WIN32
   #include <windows.h>
-  #include <libgen.h>
   #ifndef PATH_MAX
     #define PATH_MAX MAX_PATH
   #endif
-#elif defined(__APPLE__)
-  #include <mach-o/dyld.h>
-  #include <libgen.h>
-  #include <limits.h>
-  #include <unistd.h>
 #else
-  #include <unistd.h>
-  #include <libgen.h>
   #include <limits.h>
 #endif
 
+#include "cache.h"
+#include "snapshot.h"
 #include "vm.h"
 
 static char actualpath[PATH_MAX + 1];
@@ -36,113 +30,6 @@ static void setupUTF8Support() {
 #endif
 }
 
-static char* portable_dirname(char* path) {
-  char* last_slash = NULL;
-  char* p = path;
-  
-  if (!path || !*path) {
-    return ".";
-  }
-  
-  while (*p) {
-    if (*p == '/' || *p == '\\') {
-      last_slash = p;
-    }
-    p++;
-  }
-  
-  if (!last_slash) {
-    return ".";
-  }
-  
-  if (last_slash == path) {
-    *(last_slash + 1) = '\0';
-    return path;
-  }
-  
-  *last_slash = '\0';
-  return path;
-}
-
-static char* getExecutableDir(void) {
-  static char execDir[PATH_MAX + 1];
-  static int initialized = 0;
-  
-  if (initialized) {
-    return execDir;
-  }
-
-  char path[PATH_MAX + 1] = {0};
-
-#ifdef _WIN32
-  DWORD len = GetModuleFileNameA(NULL, path, sizeof(path) - 1);
-  if (len == 0) {
-    fprintf(stderr, "Failed to get executable path on Windows (Error: %lu)\n", GetLastError());
-    return NULL;
-  }
-  if (len >= sizeof(path) - 1) {
-    fprintf(stderr, "Executable path too long on Windows\n");
-    return NULL;
-  }
-  path[len] = '\0';
-
-#elif defined(__APPLE__)
-  uint32_t size = sizeof(path) - 1;
-  if (_NSGetExecutablePath(path, &size) != 0) {
-    fprintf(stderr, "Executable path too long on macOS (required size: %u)\n", size);
-    return NULL;
-  }
-  
-  char resolved[PATH_MAX + 1];
-  if (realpath(path, resolved) != NULL) {
-    if (strlen(resolved) < sizeof(path)) {
-      strcpy(path, resolved);
-    } else {
-      fprintf(stderr, "Resolved path too long on macOS\n");
-      return NULL;
-    }
-  }
-
-#else
-  ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
-  if (len == -1) {
-    fprintf(stderr, "Failed to get executable path on Linux\n");
-    return NULL;
-  }
-  if (len == 0) {
-    fprintf(stderr, "Empty executable path on Linux\n");
-    return NULL;
-  }
-  if (len >= (ssize_t)(sizeof(path) - 1)) {
-    fprintf(stderr, "Executable path too long on Linux\n");
-    return NULL;
-  }
-  path[len] = '\0';
-#endif
-
-  char temp[PATH_MAX + 1];
-  if (strlen(path) >= sizeof(temp)) {
-    fprintf(stderr, "Path too long for processing\n");
-    return NULL;
-  }
-  strcpy(temp, path);
-
-  char* dir = portable_dirname(temp);
-  if (!dir) {
-    fprintf(stderr, "Failed to get directory name\n");
-    return NULL;
-  }
-  
-  if (strlen(dir) >= sizeof(execDir)) {
-    fprintf(stderr, "Directory path too long for buffer\n");
-    return NULL;
-  }
-  strcpy(execDir, dir);
-
-  initialized = 1;
-  return execDir;
-}
-
 static int get_nesting_level(const char *input) {
   int brace_count = 0;
   int paren_count = 0;
@@ -307,7 +194,7 @@ static void runFile(const char *path) {
     exit(74);
   }
   char *source = readFile(actualpath);
-  InterpretResult result = interpret(source, actualpath);
+  InterpretResult result = interpretFile(source, actualpath);
   free(source);
 
   if (result == INTERPRET_COMPILE_ERROR)
@@ -316,97 +203,148 @@ static void runFile(const char *path) {
     exit(70);
 }
 
-static int file_exists(const char* path) {
-  FILE* file = fopen(path, "r");
-  if (file) {
-    fclose(file);
-    return 1;
-  }
-  return 0;
-}
-
-static void loadStd() {
-  static char stdPath[PATH_MAX + 1];
-  int found = 0;
-
-  const char* search_paths[] = {
-    NULL,                                    // Will be set to executable dir
-#ifdef _WIN32
-    "C:\\Program Files\\ghoul\\std\\std.ghoul",
-    "C:\\ghoul\\std\\std.ghoul",
-#else
-    "/usr/local/share/ghoul/std/std.ghoul",  // System install location
-    "/usr/share/ghoul/std/std.ghoul",        // Alternative system location
-    "/opt/ghoul/std/std.ghoul",              // Optional software location
-#endif
-    "std/std.ghoul",                         // Current directory fallback
-    "./std/std.ghoul",                       // Explicit current directory
-    NULL
-  };
-
-  // Try executable directory first
-  char *execDir = getExecutableDir();
-  if (execDir != NULL) {
-    int result = snprintf(stdPath, sizeof(stdPath), "%s%sstd%sstd.ghoul",
-                          execDir,
-#ifdef _WIN32
-                          "\\", "\\"
+// std/std.ghoul as a string literal, generated by the Makefile.
+static const char stdSource[] =
+#include "std.inc"
+    ;
+
+// std compiled ahead of time, one bundle per combination of -O and -s,
+// indexed by optimize * 2 + strip. The Makefile writes them with a first
+// build of ghoul that has none and compiles std from source.
+#define STD_BUNDLES 4
+#ifdef GHOUL_STD_BOOTSTRAP
+static const uint8_t *const stdBundles[STD_BUNDLES] = {NULL};
+static const size_t stdBundleLengths[STD_BUNDLES] = {0};
 #else
-                          "/", "/"
+#include "std.bundle.inc"
 #endif
-    );
 
-    if (result > 0 && result < PATH_MAX && file_exists(stdPath)) {
-      found = 1;
-    }
+// The std library is built into the binary. GHOUL_STD names a std.ghoul to
+// load instead, for working on the library without rebuilding.
+static void loadStd() {
+  const char *path = getenv("GHOUL_STD");
+  if (path != NULL && *path != '\0') {
+    runFile(path);
+    return;
   }
 
-  // If not found in executable directory, try other locations
-  if (!found) {
-    for (int i = 1; search_paths[i] != NULL; i++) {
-      if (file_exists(search_paths[i])) {
-        strncpy(stdPath, search_paths[i], sizeof(stdPath) - 1);
-        stdPath[sizeof(stdPath) - 1] = '\0';
-        found = 1;
-        break;
-      }
-    }
-  }
+  int bundle = vm.optimize * 2 + vm.stripLines;
+  InterpretResult result =
+      interpretBundle(stdSource, "std.ghoul", stdBundles[bundle],
+                      stdBundleLengths[bundle]);
+  if (result == INTERPRET_COMPILE_ERROR)
+    exit(65);
+  if (result == INTERPRET_RUNTIME_ERROR)
+    exit(70);
+}
 
-  if (!found) {
-    fprintf(stderr, "Error: Could not find standard library (std.ghoul).\n");
-    fprintf(stderr, "Searched in:\n");
-    if (execDir) {
-      fprintf(stderr, "  %s%sstd%sstd.ghoul\n", execDir,
-#ifdef _WIN32
-              "\\", "\\"
-#else
-              "/", "/"
-#endif
-      );
+// Writes std.bundle.inc for the Makefile.
+static void buildStd(const char *path) {
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+  fprintf(out, "// Generated by ghoul --build-std from std/std.ghoul.\n");
+  size_t lengths[STD_BUNDLES];
+  for (int i = 0; i < STD_BUNDLES; i++) {
+    vm.optimize = i / 2;
+    vm.stripLines = i % 2;
+    Writer writer;
+    initWriter(&writer);
+    if (!writeBundle(&writer, "std.ghoul", stdSource)) {
+      fprintf(stderr, "Could not bundle std.\n");
+      exit(65);
     }
-    for (int i = 1; search_paths[i] != NULL; i++) {
-      fprintf(stderr, "  %s\n", search_paths[i]);
+    fprintf(out, "static const uint8_t stdBundle%d[] = {", i);
+    for (size_t j = 0; j < writer.count; j++) {
+      fprintf(out, "%s%u,", j % 16 == 0 ? "\n   " : " ", writer.bytes[j]);
     }
-    fprintf(stderr, "Please ensure ghoul is properly installed or run from the source directory.\n");
+    fprintf(out, "\n};\n");
+    lengths[i] = writer.count;
+    freeWriter(&writer);
+  }
+  fprintf(out, "static const uint8_t *const stdBundles[STD_BUNDLES] = {\n");
+  for (int i = 0; i < STD_BUNDLES; i++) {
+    fprintf(out, "    stdBundle%d,\n", i);
+  }
+  fprintf(out, "};\nstatic const size_t stdBundleLengths[STD_BUNDLES] = {\n");
+  for (int i = 0; i < STD_BUNDLES; i++) {
+    fprintf(out, "    %zu,\n", lengths[i]);
+  }
+  fprintf(out, "};\n");
+  if (fclose(out) != 0) {
+    fprintf(stderr, "Could not write file \"%s\".\n", path);
     exit(74);
   }
+}
 
-  runFile(stdPath);
+static void usage() {
+  fprintf(stderr, "Usage: ghoul [-O] [-s] [--snapshot file | --from-snapshot "
+                  "file] [path]\n");
+  exit(64);
 }
 
 int main(int argc, const char *argv[]) {
+  const char *path = NULL;
+  const char *snapshotOut = NULL;
+  const char *snapshotIn = NULL;
+  bool optimize = false;
+  bool strip = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-O") == 0) {
+      optimize = true;
+    } else if (strcmp(argv[i], "-s") == 0) {
+      strip = true;
+    } else if (strcmp(argv[i], "--snapshot") == 0) {
+      if (++i == argc)
+        usage();
+      snapshotOut = argv[i];
+    } else if (strcmp(argv[i], "--from-snapshot") == 0) {
+      if (++i == argc)
+        usage();
+      snapshotIn = argv[i];
+    } else if (strcmp(argv[i], "--build-std") == 0) {
+      // Used by the Makefile; see stdBundles.
+      if (++i == argc)
+        usage();
+      initVM();
+      buildStd(argv[i]);
+      freeVM();
+      return 0;
+    } else if (path == NULL) {
+      path = argv[i];
+    } else {
+      usage();
+    }
+  }
+  if (snapshotOut != NULL && snapshotIn != NULL) {
+    usage();
+  }
+
   setupUTF8Support();
   initVM();
-  loadStd();
+  vm.optimize = optimize;
+  vm.stripLines = strip;
+
+  // A snapshot already holds everything std defined, so it replaces
+  // loading std rather than adding to it.
+  if (snapshotIn != NULL) {
+    if (!loadSnapshot(snapshotIn))
+      exit(74);
+  } else {
+    loadStd();
+  }
 
-  if (argc == 1) {
+  if (snapshotOut != NULL) {
+    if (path != NULL)
+      runFile(path);
+    if (!writeSnapshot(snapshotOut))
+      exit(70);
+  } else if (path == NULL) {
     repl();
-  } else if (argc == 2) {
-    runFile(argv[1]);
   } else {
-    fprintf(stderr, "Usage: ghoul [path]\n");
-    exit(64);
+    runFile(path);
   }
 
   freeVM();
@@ -2,6 +2,7 @@
 
 #include "compiler.h"
 #include "memory.h"
+#include "utf8.h"
 #include "object.h"
 #include "vm.h"
 
@@ -12,7 +13,20 @@
 
 #define GC_HEAP_GROW_FACTOR 2
 
+_Thread_local StagingHeap *staging = NULL;
+
 void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
+  if (staging != NULL) {
+    if (newSize == 0) {
+      free(pointer);
+      return NULL;
+    }
+    void *result = realloc(pointer, newSize);
+    if (result == NULL)
+      exit(1);
+    return result;
+  }
+
   vm.bytesAllocated += newSize - oldSize;
 
   if (newSize > oldSize) {
@@ -124,6 +138,7 @@ static void blackenObject(Obj *object) {
     for (int i = 0; i < list->count; i++) {
       markValue(list->items[i]);
     }
+    markObject((Obj *)list->backing);
     markTable(&list->fields);
     markObject((Obj *)list->klass);
     break;
@@ -141,9 +156,45 @@ static void blackenObject(Obj *object) {
     markTable(&file->fields);
     break;
   }
+  case OBJ_SET: {
+    ObjSet *set = (ObjSet *)object;
+    markValueTable(&set->items);
+    markTable(&set->fields);
+    markObject((Obj *)set->klass);
+    break;
+  }
+  case OBJ_TYPED_ARRAY: {
+    ObjTypedArray *array = (ObjTypedArray *)object;
+    markTable(&array->fields);
+    markObject((Obj *)array->klass);
+    break;
+  }
+  case OBJ_DEQUE: {
+    ObjDeque *deque = (ObjDeque *)object;
+    for (int i = 0; i < deque->count; i++) {
+      markValue(*dequeSlot(deque, i));
+    }
+    markTable(&deque->fields);
+    markObject((Obj *)deque->klass);
+    break;
+  }
+  case OBJ_BYTES: {
+    ObjBytes *bytes = (ObjBytes *)object;
+    markTable(&bytes->fields);
+    markObject((Obj *)bytes->klass);
+    break;
+  }
+  case OBJ_REGEX: {
+    ObjRegex *regex = (ObjRegex *)object;
+    markObject((Obj *)regex->pattern);
+    markTable(&regex->fields);
+    markObject((Obj *)regex->klass);
+    break;
+  }
   case OBJ_STRING: {
     ObjString *string = (ObjString *)object;
     markObject((Obj *)string->klass);
+    markObject((Obj *)string->parent);
     markTable(&string->fields);
     break;
   }
@@ -193,7 +244,10 @@ static void freeObject(Obj *object) {
   }
   case OBJ_STRING: {
     ObjString *string = (ObjString *)object;
-    FREE_ARRAY(char, string->chars, string->length + 1);
+    if (string->parent == NULL) {
+      FREE_ARRAY(char, string->chars, string->length + 1);
+    }
+    utf8_free_char_offsets(string);
     freeTable(&string->fields);
     FREE(ObjString, object);
     break;
@@ -203,7 +257,9 @@ static void freeObject(Obj *object) {
     break;
   case OBJ_LIST: {
     ObjList *list = (ObjList *)object;
-    FREE_ARRAY(Value *, list->items, list->count);
+    if (list->backing == NULL) {
+      FREE_ARRAY(Value, list->items, list->capacity);
+    }
     freeTable(&list->fields);
     FREE(ObjList, object);
     break;
@@ -221,6 +277,45 @@ static void freeObject(Obj *object) {
     FREE(ObjFile, object);
     break;
   }
+  case OBJ_SET: {
+    ObjSet *set = (ObjSet *)object;
+    freeValueTable(&set->items);
+    freeTable(&set->fields);
+    FREE(ObjSet, object);
+    break;
+  }
+  case OBJ_TYPED_ARRAY: {
+    ObjTypedArray *array = (ObjTypedArray *)object;
+    reallocate(array->as.f64,
+               (array->type == ARRAY_FLOAT64 ? sizeof(double)
+                                             : sizeof(int32_t)) *
+                   array->capacity,
+               0);
+    freeTable(&array->fields);
+    FREE(ObjTypedArray, object);
+    break;
+  }
+  case OBJ_DEQUE: {
+    ObjDeque *deque = (ObjDeque *)object;
+    FREE_ARRAY(Value, deque->items, deque->capacity);
+    freeTable(&deque->fields);
+    FREE(ObjDeque, object);
+    break;
+  }
+  case OBJ_BYTES: {
+    ObjBytes *bytes = (ObjBytes *)object;
+    FREE_ARRAY(uint8_t, bytes->data, bytes->capacity);
+    freeTable(&bytes->fields);
+    FREE(ObjBytes, object);
+    break;
+  }
+  case OBJ_REGEX: {
+    ObjRegex *regex = (ObjRegex *)object;
+    freeRegexProgram(regex->program);
+    freeTable(&regex->fields);
+    FREE(ObjRegex, object);
+    break;
+  }
   }
 }
 
@@ -240,6 +335,7 @@ static void markRoots() {
 
   markTable(&vm.globals);
   markTable(&vm.useStrings);
+  markTable(&vm.builtins);
 
   // don't need to mark VM builtin classes, they are in globals
 
@@ -300,6 +396,26 @@ void freeObjects() {
   free(vm.grayStack);
 }
 
+void initStagingHeap(StagingHeap *heap) {
+  heap->objects = NULL;
+  initTable(&heap->strings);
+  initTable(&heap->useStrings);
+}
+
+// Called with the heap still current, so its memory goes back through the
+// same unaccounted path it came from.
+void freeStagingHeap(StagingHeap *heap) {
+  Obj *object = heap->objects;
+  while (object != NULL) {
+    Obj *next = object->next;
+    freeObject(object);
+    object = next;
+  }
+  freeTable(&heap->strings);
+  freeTable(&heap->useStrings);
+  heap->objects = NULL;
+}
+
 void collectGarbage() {
 #ifdef DEBUG_LOG_GC
   printf("-- gc begin\n");
@@ -2,6 +2,7 @@
 #define ghoul_memory_h
 
 #include "common.h"
+#include "table.h"
 #include "value.h"
 
 #define ALLOCATE(type, count)                                                  \
@@ -18,10 +19,24 @@
 #define FREE_ARRAY(type, pointer, oldCount)                                    \
   reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+// Objects made by a compiler running on a loader thread. They stay out of
+// the VM's heap, so the collector neither sees nor counts them, and their
+// strings are interned in tables of their own.
+typedef struct {
+  Obj *objects;
+  Table strings;
+  Table useStrings;
+} StagingHeap;
+
+// The heap this thread allocates objects in instead of the VM's, or NULL.
+extern _Thread_local StagingHeap *staging;
+
 void *reallocate(void *pointer, size_t oldSize, size_t newSize);
 void markObject(Obj *object);
 void markValue(Value value);
 void collectGarbage();
 void freeObjects();
+void initStagingHeap(StagingHeap *heap);
+void freeStagingHeap(StagingHeap *heap);
 
 #endif
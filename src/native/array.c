@@ -0,0 +1,651 @@
+#include "common_native.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Float64 kernels are written once against a tiny vector layer. Each backend
+// supplies the same handful of inline helpers and F64_LANES; without one the
+// kernels fall back to plain scalar loops.
+#if defined(__AVX__)
+#define F64_LANES 4
+typedef __m256d F64Vec;
+static inline F64Vec f64Load(const double *p) { return _mm256_loadu_pd(p); }
+static inline void f64Store(double *p, F64Vec v) { _mm256_storeu_pd(p, v); }
+static inline F64Vec f64Splat(double x) { return _mm256_set1_pd(x); }
+static inline F64Vec f64Add(F64Vec a, F64Vec b) { return _mm256_add_pd(a, b); }
+static inline F64Vec f64Sub(F64Vec a, F64Vec b) { return _mm256_sub_pd(a, b); }
+static inline F64Vec f64Mul(F64Vec a, F64Vec b) { return _mm256_mul_pd(a, b); }
+static inline F64Vec f64Div(F64Vec a, F64Vec b) { return _mm256_div_pd(a, b); }
+static inline F64Vec f64Min(F64Vec a, F64Vec b) { return _mm256_min_pd(a, b); }
+static inline F64Vec f64Max(F64Vec a, F64Vec b) { return _mm256_max_pd(a, b); }
+#elif defined(__SSE2__)
+#define F64_LANES 2
+typedef __m128d F64Vec;
+static inline F64Vec f64Load(const double *p) { return _mm_loadu_pd(p); }
+static inline void f64Store(double *p, F64Vec v) { _mm_storeu_pd(p, v); }
+static inline F64Vec f64Splat(double x) { return _mm_set1_pd(x); }
+static inline F64Vec f64Add(F64Vec a, F64Vec b) { return _mm_add_pd(a, b); }
+static inline F64Vec f64Sub(F64Vec a, F64Vec b) { return _mm_sub_pd(a, b); }
+static inline F64Vec f64Mul(F64Vec a, F64Vec b) { return _mm_mul_pd(a, b); }
+static inline F64Vec f64Div(F64Vec a, F64Vec b) { return _mm_div_pd(a, b); }
+static inline F64Vec f64Min(F64Vec a, F64Vec b) { return _mm_min_pd(a, b); }
+static inline F64Vec f64Max(F64Vec a, F64Vec b) { return _mm_max_pd(a, b); }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define F64_LANES 2
+typedef float64x2_t F64Vec;
+static inline F64Vec f64Load(const double *p) { return vld1q_f64(p); }
+static inline void f64Store(double *p, F64Vec v) { vst1q_f64(p, v); }
+static inline F64Vec f64Splat(double x) { return vdupq_n_f64(x); }
+static inline F64Vec f64Add(F64Vec a, F64Vec b) { return vaddq_f64(a, b); }
+static inline F64Vec f64Sub(F64Vec a, F64Vec b) { return vsubq_f64(a, b); }
+static inline F64Vec f64Mul(F64Vec a, F64Vec b) { return vmulq_f64(a, b); }
+static inline F64Vec f64Div(F64Vec a, F64Vec b) { return vdivq_f64(a, b); }
+// Match the x86 semantics (a < b ? a : b) so NaNs are skipped the same way.
+static inline F64Vec f64Min(F64Vec a, F64Vec b) {
+  return vbslq_f64(vcltq_f64(a, b), a, b);
+}
+static inline F64Vec f64Max(F64Vec a, F64Vec b) {
+  return vbslq_f64(vcgtq_f64(a, b), a, b);
+}
+#endif
+
+#ifdef F64_LANES
+static double f64Reduce(F64Vec v) {
+  double lanes[F64_LANES];
+  f64Store(lanes, v);
+  double total = 0;
+  for (int i = 0; i < F64_LANES; i++) {
+    total += lanes[i];
+  }
+  return total;
+}
+#endif
+
+static double sumF64(const double *x, int n) {
+  int i = 0;
+  double total = 0;
+#ifdef F64_LANES
+  F64Vec acc0 = f64Splat(0);
+  F64Vec acc1 = f64Splat(0);
+  for (; i + 2 * F64_LANES <= n; i += 2 * F64_LANES) {
+    acc0 = f64Add(acc0, f64Load(x + i));
+    acc1 = f64Add(acc1, f64Load(x + i + F64_LANES));
+  }
+  total = f64Reduce(f64Add(acc0, acc1));
+#endif
+  for (; i < n; i++) {
+    total += x[i];
+  }
+  return total;
+}
+
+static double dotF64(const double *x, const double *y, int n) {
+  int i = 0;
+  double total = 0;
+#ifdef F64_LANES
+  F64Vec acc0 = f64Splat(0);
+  F64Vec acc1 = f64Splat(0);
+  for (; i + 2 * F64_LANES <= n; i += 2 * F64_LANES) {
+    acc0 = f64Add(acc0, f64Mul(f64Load(x + i), f64Load(y + i)));
+    acc1 = f64Add(acc1, f64Mul(f64Load(x + i + F64_LANES),
+                               f64Load(y + i + F64_LANES)));
+  }
+  total = f64Reduce(f64Add(acc0, acc1));
+#endif
+  for (; i < n; i++) {
+    total += x[i] * y[i];
+  }
+  return total;
+}
+
+static double minF64(const double *x, int n) {
+  int i = 0;
+  double result = INFINITY;
+#ifdef F64_LANES
+  F64Vec acc = f64Splat(INFINITY);
+  for (; i + F64_LANES <= n; i += F64_LANES) {
+    acc = f64Min(f64Load(x + i), acc);
+  }
+  double lanes[F64_LANES];
+  f64Store(lanes, acc);
+  for (int j = 0; j < F64_LANES; j++) {
+    result = lanes[j] < result ? lanes[j] : result;
+  }
+#endif
+  for (; i < n; i++) {
+    result = x[i] < result ? x[i] : result;
+  }
+  return result;
+}
+
+static double maxF64(const double *x, int n) {
+  int i = 0;
+  double result = -INFINITY;
+#ifdef F64_LANES
+  F64Vec acc = f64Splat(-INFINITY);
+  for (; i + F64_LANES <= n; i += F64_LANES) {
+    acc = f64Max(f64Load(x + i), acc);
+  }
+  double lanes[F64_LANES];
+  f64Store(lanes, acc);
+  for (int j = 0; j < F64_LANES; j++) {
+    result = lanes[j] > result ? lanes[j] : result;
+  }
+#endif
+  for (; i < n; i++) {
+    result = x[i] > result ? x[i] : result;
+  }
+  return result;
+}
+
+static void axpyF64(double *y, double a, const double *x, int n) {
+  int i = 0;
+#ifdef F64_LANES
+  F64Vec va = f64Splat(a);
+  for (; i + F64_LANES <= n; i += F64_LANES) {
+    f64Store(y + i, f64Add(f64Load(y + i), f64Mul(va, f64Load(x + i))));
+  }
+#endif
+  for (; i < n; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+static void scaleF64(double *x, double a, int n) {
+  int i = 0;
+#ifdef F64_LANES
+  F64Vec va = f64Splat(a);
+  for (; i + F64_LANES <= n; i += F64_LANES) {
+    f64Store(x + i, f64Mul(f64Load(x + i), va));
+  }
+#endif
+  for (; i < n; i++) {
+    x[i] *= a;
+  }
+}
+
+typedef enum {
+  ELEMENT_ADD,
+  ELEMENT_SUB,
+  ELEMENT_MUL,
+  ELEMENT_DIV,
+} ElementOp;
+
+// b is either another array (bStride 1) or a broadcast scalar (bStride 0).
+static void elementwiseF64(double *out, const double *a, const double *b,
+                           int bStride, int n, ElementOp op) {
+  int i = 0;
+#ifdef F64_LANES
+  F64Vec scalar = f64Splat(b[0]);
+  for (; i + F64_LANES <= n; i += F64_LANES) {
+    F64Vec x = f64Load(a + i);
+    F64Vec y = bStride ? f64Load(b + i) : scalar;
+    F64Vec r;
+    switch (op) {
+    case ELEMENT_ADD:
+      r = f64Add(x, y);
+      break;
+    case ELEMENT_SUB:
+      r = f64Sub(x, y);
+      break;
+    case ELEMENT_MUL:
+      r = f64Mul(x, y);
+      break;
+    default:
+      r = f64Div(x, y);
+      break;
+    }
+    f64Store(out + i, r);
+  }
+#endif
+  for (; i < n; i++) {
+    double y = b[i * bStride];
+    switch (op) {
+    case ELEMENT_ADD:
+      out[i] = a[i] + y;
+      break;
+    case ELEMENT_SUB:
+      out[i] = a[i] - y;
+      break;
+    case ELEMENT_MUL:
+      out[i] = a[i] * y;
+      break;
+    default:
+      out[i] = a[i] / y;
+      break;
+    }
+  }
+}
+
+// Int32 kernels stay scalar. Add, subtract and multiply work in unsigned
+// arithmetic, so overflow wraps instead of being undefined. The switch on op
+// does not change inside the loop, so compilers can hoist it out. Division
+// still checks every divisor for zero.
+static int64_t sumI32(const int32_t *x, int n) {
+  int64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 += x[i];
+    s1 += x[i + 1];
+    s2 += x[i + 2];
+    s3 += x[i + 3];
+  }
+  for (; i < n; i++) {
+    s0 += x[i];
+  }
+  return s0 + s1 + s2 + s3;
+}
+
+static int64_t dotI32(const int32_t *x, const int32_t *y, int n) {
+  int64_t total = 0;
+  for (int i = 0; i < n; i++) {
+    total += (int64_t)x[i] * y[i];
+  }
+  return total;
+}
+
+static bool elementwiseI32(int32_t *out, const int32_t *a, const int32_t *b,
+                           int bStride, int n, ElementOp op) {
+  for (int i = 0; i < n; i++) {
+    uint32_t x = (uint32_t)a[i];
+    uint32_t y = (uint32_t)b[i * bStride];
+    switch (op) {
+    case ELEMENT_ADD:
+      out[i] = (int32_t)(x + y);
+      break;
+    case ELEMENT_SUB:
+      out[i] = (int32_t)(x - y);
+      break;
+    case ELEMENT_MUL:
+      out[i] = (int32_t)(x * y);
+      break;
+    default:
+      if (b[i * bStride] == 0) {
+        return false;
+      }
+      out[i] = (int32_t)((int64_t)a[i] / b[i * bStride]);
+      break;
+    }
+  }
+  return true;
+}
+
+static const char *arrayTypeName(ArrayType type) {
+  return type == ARRAY_FLOAT64 ? "Float64Array" : "Int32Array";
+}
+
+static bool fillFromList(ObjTypedArray *array, ObjList *list) {
+  resizeTypedArray(array, list->count);
+  for (int i = 0; i < list->count; i++) {
+    if (!IS_NUMBER(list->items[i])) {
+      runtimeError("%s can only hold numbers.", arrayTypeName(array->type));
+      vm.shouldPanic = true;
+      return false;
+    }
+    storeToTypedArray(array, i, AS_NUMBER(list->items[i]));
+  }
+  return true;
+}
+
+static Value initTypedArray(int argCount, Value *args, ArrayType type) {
+  if (argCount > 2) {
+    runtimeError("Expected 1 argument but got %d.", argCount - 1);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  ObjTypedArray *array = NULL;
+  if (IS_TYPED_ARRAY(args[0])) {
+    // Called through super.init() from a subclass: settle the element type.
+    array = AS_TYPED_ARRAY(args[0]);
+    if (array->capacity == 0) {
+      array->type = type;
+    }
+  } else if (IS_KLASS(args[0])) {
+    array = newTypedArray(AS_KLASS(args[0]), type, 0);
+  } else {
+    runtimeError("Unexpect base for %s init.", arrayTypeName(type));
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  if (argCount == 1) {
+    return OBJ_VAL(array);
+  }
+
+  push(OBJ_VAL(array));
+  if (IS_NUMBER(args[1])) {
+    double count = AS_NUMBER(args[1]);
+    if (count < 0 || count > INT_MAX) {
+      runtimeError("Array length out of range.");
+      vm.shouldPanic = true;
+      pop();
+      return NIL_VAL;
+    }
+    resizeTypedArray(array, (int)count);
+  } else if (IS_LIST(args[1])) {
+    if (!fillFromList(array, AS_LIST(args[1]))) {
+      pop();
+      return NIL_VAL;
+    }
+  } else if (IS_TYPED_ARRAY(args[1])) {
+    ObjTypedArray *from = AS_TYPED_ARRAY(args[1]);
+    resizeTypedArray(array, from->count);
+    for (int i = 0; i < from->count; i++) {
+      storeToTypedArray(array, i, indexFromTypedArray(from, i));
+    }
+  } else {
+    runtimeError("Expected argument 1 to be a length, list or array.");
+    vm.shouldPanic = true;
+    pop();
+    return NIL_VAL;
+  }
+  return pop();
+}
+
+static Value initFloat64ArrayNative(int argCount, Value *args) {
+  return initTypedArray(argCount, args, ARRAY_FLOAT64);
+}
+
+static Value initInt32ArrayNative(int argCount, Value *args) {
+  return initTypedArray(argCount, args, ARRAY_INT32);
+}
+
+static bool checkSameShape(ObjTypedArray *a, ObjTypedArray *b) {
+  if (a->type != b->type) {
+    runtimeError("Arrays must have the same element type.");
+    vm.shouldPanic = true;
+    return false;
+  }
+  if (a->count != b->count) {
+    runtimeError("Arrays must have the same length.");
+    vm.shouldPanic = true;
+    return false;
+  }
+  return true;
+}
+
+static Value lenArrayNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_TYPED_ARRAY)) {
+    return NIL_VAL;
+  }
+  return NUMBER_VAL((double)AS_TYPED_ARRAY(args[0])->count);
+}
+
+static Value pushArrayNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_VARIADIC, ARG_TYPED_ARRAY,
+                 ARG_NUMBER)) {
+    return NIL_VAL;
+  }
+  ObjTypedArray *array = AS_TYPED_ARRAY(args[0]);
+  for (int i = 1; i < argCount; i++) {
+    if (!IS_NUMBER(args[i])) {
+      runtimeError("Expected argument %d to be a number.", i + 1);
+      vm.shouldPanic = true;
+      return NIL_VAL;
+    }
+    pushToTypedArray(array, AS_NUMBER(args[i]));
+  }
+  return NIL_VAL;
+}
+
+static Value fillArrayNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_TYPED_ARRAY,
+                 ARG_NUMBER)) {
+    return NIL_VAL;
+  }
+  ObjTypedArray *array = AS_TYPED_ARRAY(args[0]);
+  double value = AS_NUMBER(args[1]);
+  for (int i = 0; i < array->count; i++) {
+    storeToTypedArray(array, i, value);
+  }
+  return NIL_VAL;
+}
+
+static Value toListArrayNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_TYPED_ARRAY)) {
+    return NIL_VAL;
+  }
+  ObjTypedArray *array = AS_TYPED_ARRAY(args[0]);
+  Value *values = ALLOCATE(Value, array->count + 1);
+  for (int i = 0; i < array->count; i++) {
+    values[i] = NUMBER_VAL(indexFromTypedArray(array, i));
+  }
+  return OBJ_VAL(takeList(vm.klass.list, values, array->count));
+}
+
+static Value copyArrayNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_TYPED_ARRAY)) {
+    return NIL_VAL;
+  }
+  ObjTypedArray *array = AS_TYPED_ARRAY(args[0]);
+  ObjTypedArray *copy = newTypedArray(array->klass, array->type, array->count);
+  size_t size = array->type == ARRAY_FLOAT64 ? sizeof(double) : sizeof(int32_t);
+  if (array->count > 0) {
+    memcpy(copy->as.f64, array->as.f64, size * array->count);
+  }
+  return OBJ_VAL(copy);
+}
+
+static Value sumArrayNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_TYPED_ARRAY)) {
+    return NIL_VAL;
+  }
+  ObjTypedArray *array = AS_TYPED_ARRAY(args[0]);
+  if (array->type == ARRAY_FLOAT64) {
+    return NUMBER_VAL(sumF64(array->as.f64, array->count));
+  }
+  return NUMBER_VAL((double)sumI32(array->as.i32, array->count));
+}
+
+static Value minArrayNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_TYPED_ARRAY)) {
+    return NIL_VAL;
+  }
+  ObjTypedArray *array = AS_TYPED_ARRAY(args[0]);
+  if (array->count == 0) {
+    return NIL_VAL;
+  }
+  if (array->type == ARRAY_FLOAT64) {
+    return NUMBER_VAL(minF64(array->as.f64, array->count));
+  }
+  int32_t result = array->as.i32[0];
+  for (int i = 1; i < array->count; i++) {
+    result = array->as.i32[i] < result ? array->as.i32[i] : result;
+  }
+  return NUMBER_VAL((double)result);
+}
+
+static Value maxArrayNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_TYPED_ARRAY)) {
+    return NIL_VAL;
+  }
+  ObjTypedArray *array = AS_TYPED_ARRAY(args[0]);
+  if (array->count == 0) {
+    return NIL_VAL;
+  }
+  if (array->type == ARRAY_FLOAT64) {
+    return NUMBER_VAL(maxF64(array->as.f64, array->count));
+  }
+  int32_t result = array->as.i32[0];
+  for (int i = 1; i < array->count; i++) {
+    result = array->as.i32[i] > result ? array->as.i32[i] : result;
+  }
+  return NUMBER_VAL((double)result);
+}
+
+static Value dotArrayNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_TYPED_ARRAY,
+                 ARG_TYPED_ARRAY)) {
+    return NIL_VAL;
+  }
+  ObjTypedArray *a = AS_TYPED_ARRAY(args[0]);
+  ObjTypedArray *b = AS_TYPED_ARRAY(args[1]);
+  if (!checkSameShape(a, b)) {
+    return NIL_VAL;
+  }
+  if (a->type == ARRAY_FLOAT64) {
+    return NUMBER_VAL(dotF64(a->as.f64, b->as.f64, a->count));
+  }
+  return NUMBER_VAL((double)dotI32(a->as.i32, b->as.i32, a->count));
+}
+
+static Value axpyArrayNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 3, args, NATIVE_NORMAL, ARG_TYPED_ARRAY, ARG_NUMBER,
+                 ARG_TYPED_ARRAY)) {
+    return NIL_VAL;
+  }
+  ObjTypedArray *y = AS_TYPED_ARRAY(args[0]);
+  double a = AS_NUMBER(args[1]);
+  ObjTypedArray *x = AS_TYPED_ARRAY(args[2]);
+  if (!checkSameShape(y, x)) {
+    return NIL_VAL;
+  }
+  if (y->type == ARRAY_FLOAT64) {
+    axpyF64(y->as.f64, a, x->as.f64, y->count);
+  } else {
+    for (int i = 0; i < y->count; i++) {
+      y->as.i32[i] = toInt32(y->as.i32[i] + a * x->as.i32[i]);
+    }
+  }
+  return NIL_VAL;
+}
+
+static Value scaleArrayNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_TYPED_ARRAY,
+                 ARG_NUMBER)) {
+    return NIL_VAL;
+  }
+  ObjTypedArray *array = AS_TYPED_ARRAY(args[0]);
+  double a = AS_NUMBER(args[1]);
+  if (array->type == ARRAY_FLOAT64) {
+    scaleF64(array->as.f64, a, array->count);
+  } else {
+    for (int i = 0; i < array->count; i++) {
+      array->as.i32[i] = toInt32(array->as.i32[i] * a);
+    }
+  }
+  return NIL_VAL;
+}
+
+static Value cumsumArrayNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_TYPED_ARRAY)) {
+    return NIL_VAL;
+  }
+  ObjTypedArray *array = AS_TYPED_ARRAY(args[0]);
+  ObjTypedArray *result =
+      newTypedArray(array->klass, array->type, array->count);
+  if (array->type == ARRAY_FLOAT64) {
+    double total = 0;
+    for (int i = 0; i < array->count; i++) {
+      total += array->as.f64[i];
+      result->as.f64[i] = total;
+    }
+  } else {
+    uint32_t total = 0;
+    for (int i = 0; i < array->count; i++) {
+      total += (uint32_t)array->as.i32[i];
+      result->as.i32[i] = (int32_t)total;
+    }
+  }
+  return OBJ_VAL(result);
+}
+
+static Value elementwise(int argCount, Value *args, ElementOp op) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_TYPED_ARRAY,
+                 ARG_ANY)) {
+    return NIL_VAL;
+  }
+  ObjTypedArray *a = AS_TYPED_ARRAY(args[0]);
+  double scalarF64 = 0;
+  int32_t scalarI32 = 0;
+  const void *b = NULL;
+  int bStride = 1;
+  if (IS_NUMBER(args[1])) {
+    scalarF64 = AS_NUMBER(args[1]);
+    scalarI32 = toInt32(scalarF64);
+    b = a->type == ARRAY_FLOAT64 ? (const void *)&scalarF64
+                                 : (const void *)&scalarI32;
+    bStride = 0;
+  } else if (IS_TYPED_ARRAY(args[1])) {
+    ObjTypedArray *other = AS_TYPED_ARRAY(args[1]);
+    if (!checkSameShape(a, other)) {
+      return NIL_VAL;
+    }
+    b = other->as.f64;
+  } else {
+    runtimeError("Expected argument 1 to be a number or array.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+
+  ObjTypedArray *result = newTypedArray(a->klass, a->type, a->count);
+  if (a->count == 0) {
+    return OBJ_VAL(result);
+  }
+  if (a->type == ARRAY_FLOAT64) {
+    elementwiseF64(result->as.f64, a->as.f64, b, bStride, a->count, op);
+  } else if (!elementwiseI32(result->as.i32, a->as.i32, b, bStride, a->count,
+                             op)) {
+    runtimeError("Division by zero in Int32Array.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  return OBJ_VAL(result);
+}
+
+static Value addArrayNative(int argCount, Value *args) {
+  return elementwise(argCount, args, ELEMENT_ADD);
+}
+
+static Value subArrayNative(int argCount, Value *args) {
+  return elementwise(argCount, args, ELEMENT_SUB);
+}
+
+static Value mulArrayNative(int argCount, Value *args) {
+  return elementwise(argCount, args, ELEMENT_MUL);
+}
+
+static Value divArrayNative(int argCount, Value *args) {
+  return elementwise(argCount, args, ELEMENT_DIV);
+}
+
+ObjKlass *createFloat64ArrayClass() {
+  return defineKlass("Float64Array", 12, OBJ_TYPED_ARRAY);
+}
+
+ObjKlass *createInt32ArrayClass() {
+  return defineKlass("Int32Array", 10, OBJ_TYPED_ARRAY);
+}
+
+static void addArrayMethods(ObjKlass *arrayKlass) {
+  defineNativeKlassMethod(arrayKlass, "len", 3, lenArrayNative);
+  defineNativeKlassMethod(arrayKlass, "push", 4, pushArrayNative);
+  defineNativeKlassMethod(arrayKlass, "fill", 4, fillArrayNative);
+  defineNativeKlassMethod(arrayKlass, "to_list", 7, toListArrayNative);
+  defineNativeKlassMethod(arrayKlass, "copy", 4, copyArrayNative);
+  defineNativeKlassMethod(arrayKlass, "sum", 3, sumArrayNative);
+  defineNativeKlassMethod(arrayKlass, "min", 3, minArrayNative);
+  defineNativeKlassMethod(arrayKlass, "max", 3, maxArrayNative);
+  defineNativeKlassMethod(arrayKlass, "dot", 3, dotArrayNative);
+  defineNativeKlassMethod(arrayKlass, "axpy", 4, axpyArrayNative);
+  defineNativeKlassMethod(arrayKlass, "scale", 5, scaleArrayNative);
+  defineNativeKlassMethod(arrayKlass, "cumsum", 6, cumsumArrayNative);
+  defineNativeKlassMethod(arrayKlass, "add", 3, addArrayNative);
+  defineNativeKlassMethod(arrayKlass, "sub", 3, subArrayNative);
+  defineNativeKlassMethod(arrayKlass, "mul", 3, mulArrayNative);
+  defineNativeKlassMethod(arrayKlass, "div", 3, divArrayNative);
+}
+
+void addFloat64ArrayMethods(ObjKlass *arrayKlass) {
+  defineNativeKlassMethod(arrayKlass, "init", 4, initFloat64ArrayNative);
+  addArrayMethods(arrayKlass);
+}
+
+void addInt32ArrayMethods(ObjKlass *arrayKlass) {
+  defineNativeKlassMethod(arrayKlass, "init", 4, initInt32ArrayNative);
+  addArrayMethods(arrayKlass);
+}
@@ -0,0 +1,250 @@
+#include "common_native.h"
+#include "native.h"
+
+bool asByteSpan(Value value, const uint8_t **data, int *length) {
+  if (IS_BYTES(value)) {
+    *data = AS_BYTES(value)->data;
+    *length = AS_BYTES(value)->length;
+    return true;
+  }
+  if (IS_STRING(value)) {
+    *data = (const uint8_t *)AS_STRING(value)->chars;
+    *length = AS_STRING(value)->length;
+    return true;
+  }
+  return false;
+}
+
+static bool checkByte(Value value, int arg) {
+  if (!IS_NUMBER(value) || AS_NUMBER(value) < 0 || AS_NUMBER(value) > 255) {
+    runtimeError("Expected argument %d to be a byte from 0 to 255.", arg);
+    vm.shouldPanic = true;
+    return false;
+  }
+  return true;
+}
+
+// Same rules as list.slice(): negative indexes count from the end and the
+// range is clamped to the buffer.
+static int clampBytesIndex(ObjBytes *bytes, double index) {
+  if (index < 0) {
+    index += bytes->length;
+  }
+  if (index < 0) {
+    return 0;
+  }
+  if (index > bytes->length) {
+    return bytes->length;
+  }
+  return (int)index;
+}
+
+static Value initBytesNative(int argCount, Value *args) {
+  if (argCount > 2) {
+    runtimeError("Expected at most 1 argument but got %d.", argCount - 1);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  ObjBytes *bytes = NULL;
+  if (IS_BYTES(args[0])) {
+    bytes = AS_BYTES(args[0]);
+  } else if (IS_KLASS(args[0])) {
+    bytes = newBytes(AS_KLASS(args[0]), 0);
+  } else {
+    runtimeError("Unexpect base for Bytes init.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  if (argCount == 1) {
+    return OBJ_VAL(bytes);
+  }
+
+  push(OBJ_VAL(bytes));
+  const uint8_t *data;
+  int length;
+  if (IS_NUMBER(args[1])) {
+    double count = AS_NUMBER(args[1]);
+    if (count < 0 || count > INT_MAX) {
+      runtimeError("Bytes length out of range.");
+      vm.shouldPanic = true;
+      pop();
+      return NIL_VAL;
+    }
+    reserveBytes(bytes, (int)count);
+    memset(bytes->data, 0, (size_t)count);
+    bytes->length = (int)count;
+  } else if (asByteSpan(args[1], &data, &length)) {
+    appendToBytes(bytes, data, length);
+  } else if (IS_LIST(args[1])) {
+    ObjList *list = AS_LIST(args[1]);
+    reserveBytes(bytes, list->count);
+    for (int i = 0; i < list->count; i++) {
+      Value item = list->items[i];
+      if (!IS_NUMBER(item) || AS_NUMBER(item) < 0 || AS_NUMBER(item) > 255) {
+        runtimeError("Bytes can only hold numbers from 0 to 255.");
+        vm.shouldPanic = true;
+        pop();
+        return NIL_VAL;
+      }
+      bytes->data[i] = (uint8_t)AS_NUMBER(item);
+    }
+    bytes->length = list->count;
+  } else {
+    runtimeError("Expected argument 1 to be a length, string, list or bytes.");
+    vm.shouldPanic = true;
+    pop();
+    return NIL_VAL;
+  }
+  return pop();
+}
+
+static Value lenBytesNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_BYTES)) {
+    return NIL_VAL;
+  }
+  return NUMBER_VAL((double)AS_BYTES(args[0])->length);
+}
+
+static Value pushBytesNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_VARIADIC, ARG_BYTES, ARG_NUMBER)) {
+    return NIL_VAL;
+  }
+  ObjBytes *bytes = AS_BYTES(args[0]);
+  for (int i = 1; i < argCount; i++) {
+    if (!checkByte(args[i], i)) {
+      return NIL_VAL;
+    }
+  }
+  reserveBytes(bytes, bytes->length + argCount - 1);
+  for (int i = 1; i < argCount; i++) {
+    bytes->data[bytes->length++] = (uint8_t)AS_NUMBER(args[i]);
+  }
+  return NIL_VAL;
+}
+
+static Value extendBytesNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_BYTES, ARG_ANY)) {
+    return NIL_VAL;
+  }
+  const uint8_t *data;
+  int length;
+  if (!asByteSpan(args[1], &data, &length)) {
+    runtimeError("Expected argument 1 to be bytes or a string.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  appendToBytes(AS_BYTES(args[0]), data, length);
+  return NIL_VAL;
+}
+
+static Value sliceBytesNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_VARIADIC, ARG_BYTES, ARG_NUMBER)) {
+    return NIL_VAL;
+  }
+  if (argCount > 3) {
+    runtimeError("Expected at most 2 arguments but got %d.", argCount - 1);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  if (argCount == 3 && !IS_NUMBER(args[2])) {
+    runtimeError("Expected argument 2 to be a number.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  ObjBytes *bytes = AS_BYTES(args[0]);
+  int start = clampBytesIndex(bytes, AS_NUMBER(args[1]));
+  int end = argCount == 3 ? clampBytesIndex(bytes, AS_NUMBER(args[2]))
+                          : bytes->length;
+  if (start > end) {
+    start = end;
+  }
+  ObjBytes *slice = newBytes(vm.klass.bytes, 0);
+  push(OBJ_VAL(slice));
+  appendToBytes(slice, bytes->data + start, end - start);
+  return pop();
+}
+
+static Value findBytesNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_VARIADIC, ARG_BYTES, ARG_ANY)) {
+    return NIL_VAL;
+  }
+  if (argCount > 3) {
+    runtimeError("Expected at most 2 arguments but got %d.", argCount - 1);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  ObjBytes *bytes = AS_BYTES(args[0]);
+  int start = 0;
+  if (argCount == 3) {
+    if (!IS_NUMBER(args[2])) {
+      runtimeError("Expected argument 2 to be a number.");
+      vm.shouldPanic = true;
+      return NIL_VAL;
+    }
+    start = clampBytesIndex(bytes, AS_NUMBER(args[2]));
+  }
+
+  uint8_t single;
+  const uint8_t *needle;
+  int needleLength;
+  if (IS_NUMBER(args[1])) {
+    if (!checkByte(args[1], 1)) {
+      return NIL_VAL;
+    }
+    single = (uint8_t)AS_NUMBER(args[1]);
+    needle = &single;
+    needleLength = 1;
+  } else if (!asByteSpan(args[1], &needle, &needleLength)) {
+    runtimeError("Expected argument 1 to be a byte, bytes or a string.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+
+  Needle compiled;
+  compileNeedle(&compiled, (const char *)needle, needleLength);
+  return NUMBER_VAL((double)findNeedle(&compiled, (const char *)bytes->data,
+                                       bytes->length, start));
+}
+
+static Value toStringBytesNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_BYTES)) {
+    return NIL_VAL;
+  }
+  ObjBytes *bytes = AS_BYTES(args[0]);
+  return OBJ_VAL(
+      copyString((const char *)bytes->data, bytes->length, &vm.strings));
+}
+
+static Value toListBytesNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_BYTES)) {
+    return NIL_VAL;
+  }
+  ObjBytes *bytes = AS_BYTES(args[0]);
+  Value *values = ALLOCATE(Value, bytes->length + 1);
+  for (int i = 0; i < bytes->length; i++) {
+    values[i] = NUMBER_VAL((double)bytes->data[i]);
+  }
+  return OBJ_VAL(takeList(vm.klass.list, values, bytes->length));
+}
+
+static Value clearBytesNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_BYTES)) {
+    return NIL_VAL;
+  }
+  AS_BYTES(args[0])->length = 0;
+  return NIL_VAL;
+}
+
+ObjKlass *createBytesClass() { return defineKlass("Bytes", 5, OBJ_BYTES); }
+
+void addBytesMethods(ObjKlass *bytesKlass) {
+  defineNativeKlassMethod(bytesKlass, "init", 4, initBytesNative);
+  defineNativeKlassMethod(bytesKlass, "len", 3, lenBytesNative);
+  defineNativeKlassMethod(bytesKlass, "push", 4, pushBytesNative);
+  defineNativeKlassMethod(bytesKlass, "extend", 6, extendBytesNative);
+  defineNativeKlassMethod(bytesKlass, "slice", 5, sliceBytesNative);
+  defineNativeKlassMethod(bytesKlass, "find", 4, findBytesNative);
+  defineNativeKlassMethod(bytesKlass, "to_string", 9, toStringBytesNative);
+  defineNativeKlassMethod(bytesKlass, "to_list", 7, toListBytesNative);
+  defineNativeKlassMethod(bytesKlass, "clear", 5, clearBytesNative);
+}
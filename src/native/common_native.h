@@ -31,6 +31,11 @@ typedef enum {
   ARG_INSTANCE,
   ARG_FILE,
   ARG_BOOL,
+  ARG_SET,
+  ARG_TYPED_ARRAY,
+  ARG_DEQUE,
+  ARG_BYTES,
+  ARG_REGEX,
 } ArgTypes;
 
 typedef enum {
@@ -0,0 +1,133 @@
+#include "common_native.h"
+#include "native.h"
+
+static Value initDequeNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_VARIADIC, ARG_ANY)) {
+    return NIL_VAL;
+  }
+  ObjDeque *deque = NULL;
+  if (IS_DEQUE(args[0])) {
+    deque = AS_DEQUE(args[0]);
+  } else if (IS_KLASS(args[0])) {
+    deque = newDeque(AS_KLASS(args[0]));
+  } else {
+    runtimeError("Unexpect base for Deque init.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  push(OBJ_VAL(deque));
+  for (int i = 1; i < argCount; i++) {
+    pushDequeBack(deque, args[i]);
+  }
+  return pop();
+}
+
+static Value pushBackDequeNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_VARIADIC, ARG_DEQUE, ARG_ANY)) {
+    return NIL_VAL;
+  }
+  ObjDeque *deque = AS_DEQUE(args[0]);
+  for (int i = 1; i < argCount; i++) {
+    pushDequeBack(deque, args[i]);
+  }
+  return NIL_VAL;
+}
+
+static Value pushFrontDequeNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_VARIADIC, ARG_DEQUE, ARG_ANY)) {
+    return NIL_VAL;
+  }
+  ObjDeque *deque = AS_DEQUE(args[0]);
+  for (int i = 1; i < argCount; i++) {
+    pushDequeFront(deque, args[i]);
+  }
+  return NIL_VAL;
+}
+
+static Value popBackDequeNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_DEQUE)) {
+    return NIL_VAL;
+  }
+  ObjDeque *deque = AS_DEQUE(args[0]);
+  if (deque->count == 0) {
+    return NIL_VAL;
+  }
+  return popDequeBack(deque);
+}
+
+static Value popFrontDequeNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_DEQUE)) {
+    return NIL_VAL;
+  }
+  ObjDeque *deque = AS_DEQUE(args[0]);
+  if (deque->count == 0) {
+    return NIL_VAL;
+  }
+  return popDequeFront(deque);
+}
+
+static Value frontDequeNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_DEQUE)) {
+    return NIL_VAL;
+  }
+  ObjDeque *deque = AS_DEQUE(args[0]);
+  if (deque->count == 0) {
+    return NIL_VAL;
+  }
+  return *dequeSlot(deque, 0);
+}
+
+static Value backDequeNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_DEQUE)) {
+    return NIL_VAL;
+  }
+  ObjDeque *deque = AS_DEQUE(args[0]);
+  if (deque->count == 0) {
+    return NIL_VAL;
+  }
+  return *dequeSlot(deque, deque->count - 1);
+}
+
+static Value lenDequeNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_DEQUE)) {
+    return NIL_VAL;
+  }
+  return NUMBER_VAL((double)AS_DEQUE(args[0])->count);
+}
+
+static Value clearDequeNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_DEQUE)) {
+    return NIL_VAL;
+  }
+  ObjDeque *deque = AS_DEQUE(args[0]);
+  deque->head = 0;
+  deque->count = 0;
+  return NIL_VAL;
+}
+
+static Value toListDequeNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_DEQUE)) {
+    return NIL_VAL;
+  }
+  ObjDeque *deque = AS_DEQUE(args[0]);
+  Value *values = ALLOCATE(Value, deque->count + 1);
+  for (int i = 0; i < deque->count; i++) {
+    values[i] = *dequeSlot(deque, i);
+  }
+  return OBJ_VAL(takeList(vm.klass.list, values, deque->count));
+}
+
+ObjKlass *createDequeClass() { return defineKlass("Deque", 5, OBJ_DEQUE); }
+
+void addDequeMethods(ObjKlass *dequeKlass) {
+  defineNativeKlassMethod(dequeKlass, "init", 4, initDequeNative);
+  defineNativeKlassMethod(dequeKlass, "push_back", 9, pushBackDequeNative);
+  defineNativeKlassMethod(dequeKlass, "push_front", 10, pushFrontDequeNative);
+  defineNativeKlassMethod(dequeKlass, "pop_back", 8, popBackDequeNative);
+  defineNativeKlassMethod(dequeKlass, "pop_front", 9, popFrontDequeNative);
+  defineNativeKlassMethod(dequeKlass, "front", 5, frontDequeNative);
+  defineNativeKlassMethod(dequeKlass, "back", 4, backDequeNative);
+  defineNativeKlassMethod(dequeKlass, "len", 3, lenDequeNative);
+  defineNativeKlassMethod(dequeKlass, "clear", 5, clearDequeNative);
+  defineNativeKlassMethod(dequeKlass, "to_list", 7, toListDequeNative);
+}
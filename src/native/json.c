@@ -1,6 +1,7 @@
 #include "../external/cJSON/cJSON.h"
 
 #include "common_native.h"
+#include "../number.h"
 
 static void buildMapFromJson(cJSON *item, ObjMap *map);
 
@@ -92,7 +93,7 @@ static cJSON *mapToJson(ObjMap *map) {
   for (int i = 0; i < map->items.capacity; i++) {
     Entry *entry = &map->items.entries[i];
     if (entry->key) {
-      const char *key = entry->key->chars;
+      const char *key = stringCString(entry->key);
       cJSON *jsonVal = valueToJson(entry->value);
       cJSON_AddItemToObject(object, key, jsonVal);
     }
@@ -113,7 +114,14 @@ static cJSON *valueToJson(Value value) {
   if (IS_STRING(value)) {
     return cJSON_CreateString(AS_CSTRING(value));
   } else if (IS_NUMBER(value)) {
-    return cJSON_CreateNumber(AS_NUMBER(value));
+    // Written as raw text so numbers match print instead of cJSON's %g.
+    double number = AS_NUMBER(value);
+    if (!isfinite(number)) {
+      return cJSON_CreateNull();
+    }
+    char buffer[NUMBER_BUFFER_SIZE];
+    formatNumber(number, buffer);
+    return cJSON_CreateRaw(buffer);
   } else if (IS_BOOL(value)) {
     return cJSON_CreateBool(AS_BOOL(value));
   } else if (IS_NIL(value)) {
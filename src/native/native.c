@@ -1,4 +1,7 @@
 #include "common_native.h"
+#include "native.h"
+#include "../number.h"
+#include "../snapshot.h"
 #include "../utf8.h"
 
 bool checkArgCount(int argCount, int expectedCount) {
@@ -109,6 +112,46 @@ bool checkArgs(int argCount, int expectedCount, Value *args,
         return false;
       }
       break;
+    case ARG_SET:
+      if (!IS_SET(args[i])) {
+        runtimeError("Expected argument %d to be a set.", i + 1);
+        vm.shouldPanic = true;
+        va_end(expectedArgs);
+        return false;
+      }
+      break;
+    case ARG_TYPED_ARRAY:
+      if (!IS_TYPED_ARRAY(args[i])) {
+        runtimeError("Expected argument %d to be a typed array.", i + 1);
+        vm.shouldPanic = true;
+        va_end(expectedArgs);
+        return false;
+      }
+      break;
+    case ARG_DEQUE:
+      if (!IS_DEQUE(args[i])) {
+        runtimeError("Expected argument %d to be a deque.", i + 1);
+        vm.shouldPanic = true;
+        va_end(expectedArgs);
+        return false;
+      }
+      break;
+    case ARG_BYTES:
+      if (!IS_BYTES(args[i])) {
+        runtimeError("Expected argument %d to be bytes.", i + 1);
+        vm.shouldPanic = true;
+        va_end(expectedArgs);
+        return false;
+      }
+      break;
+    case ARG_REGEX:
+      if (!IS_REGEX(args[i])) {
+        runtimeError("Expected argument %d to be a regex.", i + 1);
+        vm.shouldPanic = true;
+        va_end(expectedArgs);
+        return false;
+      }
+      break;
     case ARG_ANY:
     default:
       continue;
@@ -121,6 +164,7 @@ bool checkArgs(int argCount, int expectedCount, Value *args,
 void defineNative(const char *name, int len, NativeFn function) {
   push(OBJ_VAL(copyString(name, len, &vm.strings)));
   push(OBJ_VAL(newNative(function)));
+  nameBuiltin("native", NULL, name, len, peek(0));
   tableSet(&vm.globals, AS_STRING(peek(1)), peek(0));
   pop();
   pop();
@@ -130,6 +174,7 @@ ObjInstance *defineInstance(ObjKlass *klass, const char *name, int len) {
   push(OBJ_VAL(copyString(name, len, &vm.strings)));
   push(OBJ_VAL(klass));
   push(OBJ_VAL(newInstance(klass)));
+  nameBuiltin("instance", NULL, name, len, peek(0));
   tableSet(&vm.globals, AS_STRING(peek(2)), peek(0));
   ObjInstance *instance = AS_INSTANCE(peek(0));
   pop();
@@ -141,6 +186,7 @@ ObjInstance *defineInstance(ObjKlass *klass, const char *name, int len) {
 ObjKlass *defineKlass(const char *name, int len, ObjType base) {
   push(OBJ_VAL(copyString(name, len, &vm.strings)));
   push(OBJ_VAL(newKlass(AS_STRING(peek(0)), base)));
+  nameBuiltin("class", NULL, name, len, peek(0));
   tableSet(&vm.globals, AS_STRING(peek(1)), peek(0));
   ObjKlass *klass = AS_KLASS(peek(0));
   pop();
@@ -153,6 +199,7 @@ void defineNativeKlassMethod(ObjKlass *klass, const char *name, int len,
   push(OBJ_VAL(klass));
   push(OBJ_VAL(copyString(name, len, &vm.strings)));
   push(OBJ_VAL(newNative(function)));
+  nameBuiltin("method", klass->name, name, len, peek(0));
   tableSet(&klass->properties, AS_STRING(peek(1)), peek(0));
   pop();
   pop();
@@ -164,6 +211,7 @@ void defineNativeInstanceMethod(ObjInstance *instance, const char *name,
   push(OBJ_VAL(instance));
   push(OBJ_VAL(copyString(name, len, &vm.strings)));
   push(OBJ_VAL(newNative(function)));
+  nameBuiltin("field", instance->klass->name, name, len, peek(0));
   tableSet(&instance->fields, AS_STRING(peek(1)), peek(0));
   pop();
   pop();
@@ -223,18 +271,21 @@ static Value closeFileNative(int argCount, Value *args) {
 }
 
 static Value writeFileNative(int argCount, Value *args) {
-  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_FILE, ARG_STRING)) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_FILE, ARG_ANY)) {
     return NIL_VAL;
   };
-  ObjString *str = AS_STRING(args[1]);
+  const uint8_t *data;
+  int length;
+  if (!asByteSpan(args[1], &data, &length)) {
+    runtimeError("Expected argument 2 to be a string or bytes.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
   FILE *file = AS_FILE(args[0])->file;
-  for (int i = 0; i < str->length; i++) {
-    int status = fputc(str->chars[i], file);
-    if (status == EOF) {
-      runtimeError("Could not write to file!");
-      vm.shouldPanic = true;
-      return NIL_VAL;
-    }
+  if (fwrite(data, 1, length, file) != (size_t)length) {
+    runtimeError("Could not write to file!");
+    vm.shouldPanic = true;
+    return NIL_VAL;
   }
   return NIL_VAL;
 }
@@ -435,6 +486,52 @@ static Value readBytesFileNative(int argCount, Value *args) {
   return pop();
 }
 
+static Value readIntoFileNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 3, args, NATIVE_NORMAL, ARG_FILE, ARG_BYTES,
+                 ARG_NUMBER)) {
+    return NIL_VAL;
+  }
+  ObjFile *file = AS_FILE(args[0]);
+  ObjBytes *bytes = AS_BYTES(args[1]);
+  int bytesToRead = (int)AS_NUMBER(args[2]);
+  if (bytesToRead < 0) {
+    runtimeError("Number of bytes to read must be non-negative.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  reserveBytes(bytes, bytes->length + bytesToRead);
+  size_t bytesRead =
+      fread(bytes->data + bytes->length, 1, bytesToRead, file->file);
+  bytes->length += (int)bytesRead;
+  return NUMBER_VAL((double)bytesRead);
+}
+
+static Value readAllBytesFileNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_FILE)) {
+    return NIL_VAL;
+  }
+  ObjFile *file = AS_FILE(args[0]);
+  ObjBytes *bytes = newBytes(vm.klass.bytes, 0);
+  push(OBJ_VAL(bytes));
+
+  long currentPos = ftell(file->file);
+  fseek(file->file, 0, SEEK_END);
+  long size = ftell(file->file);
+  fseek(file->file, currentPos, SEEK_SET);
+  if (size > currentPos) {
+    reserveBytes(bytes, (int)(size - currentPos));
+  }
+  // Keep reading past the size estimate for pipes and growing files.
+  size_t bytesRead;
+  do {
+    reserveBytes(bytes, bytes->length + 1);
+    bytesRead = fread(bytes->data + bytes->length, 1,
+                      bytes->capacity - bytes->length, file->file);
+    bytes->length += (int)bytesRead;
+  } while (bytesRead > 0);
+  return pop();
+}
+
 static Value writeLineFileNative(int argCount, Value *args) {
   if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_FILE, ARG_STRING)) {
     return NIL_VAL;
@@ -518,6 +615,9 @@ static Value popListNative(int argCount, Value *args) {
     return NIL_VAL;
   };
   ObjList *list = AS_LIST(args[0]);
+  if (list->count == 0) {
+    return NIL_VAL;
+  }
   Value value = list->items[list->count - 1];
   deleteFromList(list, list->count - 1, list->count - 1);
   return value;
@@ -586,6 +686,185 @@ static Value joinListNative(int argCount, Value *args) {
   return OBJ_VAL(takeString(result, length));
 }
 
+// Negative indexes count back from the end, then the result is clamped to
+// [0, count] in the same way substring() treats its range.
+static int clampListIndex(ObjList *list, double index) {
+  if (index < 0) {
+    index += list->count;
+  }
+  if (index < 0) {
+    return 0;
+  }
+  if (index > list->count) {
+    return list->count;
+  }
+  return (int)index;
+}
+
+static Value sliceListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_VARIADIC, ARG_LIST, ARG_NUMBER)) {
+    return NIL_VAL;
+  }
+  if (argCount > 3) {
+    runtimeError("Expected at most 2 arguments but got %d.", argCount - 1);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  if (argCount == 3 && !IS_NUMBER(args[2])) {
+    runtimeError("Expected argument 2 to be a number.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  int start = clampListIndex(list, AS_NUMBER(args[1]));
+  int end = argCount == 3 ? clampListIndex(list, AS_NUMBER(args[2]))
+                          : list->count;
+  if (start > end) {
+    start = end;
+  }
+  return OBJ_VAL(sliceList(list, start, end));
+}
+
+static Value insertListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 3, args, NATIVE_NORMAL, ARG_LIST, ARG_NUMBER,
+                 ARG_ANY)) {
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  int index = AS_NUMBER(args[1]);
+  if (index < 0 || index > list->count) {
+    runtimeError("List index out of range.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  insertIntoList(list, index, &args[2], 1);
+  return NIL_VAL;
+}
+
+static Value extendListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_LIST, ARG_LIST)) {
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  ObjList *other = AS_LIST(args[1]);
+  insertIntoList(list, list->count, other->items, other->count);
+  return NIL_VAL;
+}
+
+static Value spliceListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 3, args, NATIVE_VARIADIC, ARG_LIST, ARG_NUMBER,
+                 ARG_NUMBER)) {
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  int start = clampListIndex(list, AS_NUMBER(args[1]));
+  int removeCount = AS_NUMBER(args[2]);
+  if (removeCount < 0) {
+    removeCount = 0;
+  }
+  if (removeCount > list->count - start) {
+    removeCount = list->count - start;
+  }
+
+  Value *removed = ALLOCATE(Value, removeCount + 1);
+  memcpy(removed, list->items + start, sizeof(Value) * removeCount);
+  ObjList *result = takeList(vm.klass.list, removed, removeCount);
+  push(OBJ_VAL(result));
+  if (removeCount > 0) {
+    deleteFromList(list, start, start + removeCount - 1);
+  }
+  insertIntoList(list, start, args + 3, argCount - 3);
+  return pop();
+}
+
+static Value mapListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_LIST, ARG_ANY)) {
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  ObjList *result = newList(vm.klass.list);
+  push(OBJ_VAL(result));
+  for (int i = 0; i < list->count; i++) {
+    Value value;
+    if (!vmCallValue(args[1], 1, &list->items[i], &value)) {
+      return NIL_VAL;
+    }
+    push(value);
+    pushToList(result, value);
+    pop();
+  }
+  return pop();
+}
+
+static Value filterListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_LIST, ARG_ANY)) {
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  ObjList *result = newList(vm.klass.list);
+  push(OBJ_VAL(result));
+  for (int i = 0; i < list->count; i++) {
+    // The callback may change the list, so the item it is asked about is
+    // the one kept, and stays rooted in case the list lets go of it.
+    Value item = list->items[i];
+    push(item);
+    Value keep;
+    if (!vmCallValue(args[1], 1, &item, &keep)) {
+      return NIL_VAL;
+    }
+    if (!isFalsey(keep)) {
+      pushToList(result, item);
+    }
+    pop();
+  }
+  return pop();
+}
+
+static Value reduceListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_VARIADIC, ARG_LIST, ARG_ANY)) {
+    return NIL_VAL;
+  }
+  if (argCount > 3) {
+    runtimeError("Expected at most 2 arguments but got %d.", argCount - 1);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  int start = 0;
+  Value acc;
+  if (argCount == 3) {
+    acc = args[2];
+  } else if (list->count > 0) {
+    acc = list->items[0];
+    start = 1;
+  } else {
+    runtimeError("Cannot reduce an empty list without an initial value.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  for (int i = start; i < list->count; i++) {
+    Value pair[2] = {acc, list->items[i]};
+    if (!vmCallValue(args[1], 2, pair, &acc)) {
+      return NIL_VAL;
+    }
+  }
+  return acc;
+}
+
+static Value eachListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_LIST, ARG_ANY)) {
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  for (int i = 0; i < list->count; i++) {
+    Value ignored;
+    if (!vmCallValue(args[1], 1, &list->items[i], &ignored)) {
+      return NIL_VAL;
+    }
+  }
+  return NIL_VAL;
+}
+
 static Value initMapNative(int argCount, Value *args) {
   if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_ANY)) {
     return NIL_VAL;
@@ -711,6 +990,149 @@ static Value deleteMapNative(int argCount, Value *args) {
   return FALSE_VAL;
 }
 
+static Value initSetNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_VARIADIC, ARG_ANY)) {
+    return NIL_VAL;
+  };
+  ObjSet *set = NULL;
+  if (IS_SET(args[0])) {
+    set = AS_SET(args[0]);
+  } else if (IS_KLASS(args[0])) {
+    set = newSet(AS_KLASS(args[0]));
+  } else {
+    runtimeError("Unexpect base for Set init.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  push(OBJ_VAL(set));
+  for (int i = 1; i < argCount; i++) {
+    valueTableAdd(&set->items, args[i]);
+  }
+  return pop();
+}
+
+static Value addSetNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_SET, ARG_ANY)) {
+    return NIL_VAL;
+  };
+  ObjSet *set = AS_SET(args[0]);
+  return BOOL_VAL(valueTableAdd(&set->items, args[1]));
+}
+
+static Value addAllSetNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_SET, ARG_ANY)) {
+    return NIL_VAL;
+  };
+  ObjSet *set = AS_SET(args[0]);
+  if (IS_SET(args[1])) {
+    valueTableAddAll(&AS_SET(args[1])->items, &set->items);
+  } else if (IS_LIST(args[1])) {
+    ObjList *list = AS_LIST(args[1]);
+    for (int i = 0; i < list->count; i++) {
+      valueTableAdd(&set->items, list->items[i]);
+    }
+  } else {
+    runtimeError("Expected argument 1 to be a set or list.");
+    vm.shouldPanic = true;
+  }
+  return NIL_VAL;
+}
+
+static Value removeSetNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_SET, ARG_ANY)) {
+    return NIL_VAL;
+  };
+  ObjSet *set = AS_SET(args[0]);
+  return BOOL_VAL(valueTableDelete(&set->items, args[1]));
+}
+
+static Value hasSetNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_SET, ARG_ANY)) {
+    return NIL_VAL;
+  };
+  ObjSet *set = AS_SET(args[0]);
+  return BOOL_VAL(valueTableHas(&set->items, args[1]));
+}
+
+static Value lenSetNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_SET)) {
+    return NIL_VAL;
+  };
+  return NUMBER_VAL((double)AS_SET(args[0])->items.count);
+}
+
+static Value clearSetNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_SET)) {
+    return NIL_VAL;
+  };
+  freeValueTable(&AS_SET(args[0])->items);
+  return NIL_VAL;
+}
+
+static Value toListSetNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_SET)) {
+    return NIL_VAL;
+  };
+  ValueTable *items = &AS_SET(args[0])->items;
+  ObjList *list = newList(vm.klass.list);
+  push(OBJ_VAL(list));
+  for (int i = valueTableNext(items, 0); i != -1;
+       i = valueTableNext(items, i + 1)) {
+    pushToList(list, items->keys[i]);
+  }
+  return pop();
+}
+
+static Value unionSetNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_SET, ARG_SET)) {
+    return NIL_VAL;
+  };
+  ObjSet *a = AS_SET(args[0]);
+  ObjSet *b = AS_SET(args[1]);
+  ObjSet *result = newSet(a->klass);
+  push(OBJ_VAL(result));
+  valueTableAddAll(&a->items, &result->items);
+  valueTableAddAll(&b->items, &result->items);
+  return pop();
+}
+
+static Value intersectionSetNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_SET, ARG_SET)) {
+    return NIL_VAL;
+  };
+  ObjSet *a = AS_SET(args[0]);
+  ObjSet *b = AS_SET(args[1]);
+  ObjSet *result = newSet(a->klass);
+  push(OBJ_VAL(result));
+  // Walk the smaller set and probe the larger one.
+  ValueTable *small = a->items.count <= b->items.count ? &a->items : &b->items;
+  ValueTable *large = small == &a->items ? &b->items : &a->items;
+  for (int i = valueTableNext(small, 0); i != -1;
+       i = valueTableNext(small, i + 1)) {
+    if (valueTableHas(large, small->keys[i])) {
+      valueTableAdd(&result->items, small->keys[i]);
+    }
+  }
+  return pop();
+}
+
+static Value differenceSetNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_SET, ARG_SET)) {
+    return NIL_VAL;
+  };
+  ObjSet *a = AS_SET(args[0]);
+  ObjSet *b = AS_SET(args[1]);
+  ObjSet *result = newSet(a->klass);
+  push(OBJ_VAL(result));
+  for (int i = valueTableNext(&a->items, 0); i != -1;
+       i = valueTableNext(&a->items, i + 1)) {
+    if (!valueTableHas(&b->items, a->items.keys[i])) {
+      valueTableAdd(&result->items, a->items.keys[i]);
+    }
+  }
+  return pop();
+}
+
 static Value initStringNative(int argCount, Value *args) {
   if (!checkArgs(argCount, 1, args, NATIVE_VARIADIC, ARG_ANY)) {
     return NIL_VAL;
@@ -720,16 +1142,14 @@ static Value initStringNative(int argCount, Value *args) {
     string = AS_STRING(args[0]);
   } else if (IS_KLASS(args[0])) {
     if (argCount == 1) {
-      string = copyEscString("", 0, &vm.strings, AS_KLASS(args[0]));
+      string = copyEscString("", 0, &vm.strings, vm.klass.string);
     } else if (argCount == 2) {
       if (IS_STRING(args[1])) {
         string = AS_STRING(args[1]);
-        string->klass = AS_KLASS(args[0]);
       } else if (IS_NUMBER(args[1])) {
-        int d_len = snprintf(NULL, 0, "%.15g", AS_NUMBER(args[1]));
-        char d_str[d_len + 1];
-        sprintf(d_str, "%.15g", AS_NUMBER(args[1]));
-        string = copyEscString(d_str, d_len, &vm.strings, AS_KLASS(args[0]));
+        char d_str[NUMBER_BUFFER_SIZE];
+        int d_len = formatNumber(AS_NUMBER(args[1]), d_str);
+        string = copyEscString(d_str, d_len, &vm.strings, vm.klass.string);
 
       } else {
         runtimeError("Expected argument to be string or number.");
@@ -747,21 +1167,57 @@ static Value initStringNative(int argCount, Value *args) {
     return NIL_VAL;
   }
 
+  // The string made is interned and shared with every equal string, so a
+  // subclass gets a copy of its own.
+  if (IS_KLASS(args[0]) && AS_KLASS(args[0]) != vm.klass.string) {
+    push(OBJ_VAL(string));
+    Value result = OBJ_VAL(
+        copyUninternedString(string->chars, string->length, AS_KLASS(args[0])));
+    pop();
+    return result;
+  }
   return OBJ_VAL(string);
 }
 
+static Value toBytesStringNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_STRING)) {
+    return NIL_VAL;
+  }
+  ObjString *string = AS_STRING(args[0]);
+  ObjBytes *bytes = newBytes(vm.klass.bytes, 0);
+  push(OBJ_VAL(bytes));
+  appendToBytes(bytes, (const uint8_t *)string->chars, string->length);
+  return pop();
+}
+
 static Value asNumberStringNative(int argCount, Value *args) {
   if (!checkArgs(argCount, 1, args, NATIVE_VARIADIC, ARG_ANY)) {
     return NIL_VAL;
   };
+  ObjString *string = AS_STRING(args[0]);
+  int start = 0;
+  while (start < string->length &&
+         isspace((unsigned char)string->chars[start])) {
+    start++;
+  }
   double num;
-  int match = sscanf(AS_CSTRING(args[0]), "%lf", &num);
-  if (match) {
+  if (parseNumber(string->chars + start, string->length - start, &num) > 0) {
     return NUMBER_VAL(num);
   }
   return NIL_VAL;
 }
 
+// Results keep the class of a String subclass. Interned strings are shared
+// by every equal string, so such a result gets a copy of its own instead of
+// changing the class of the shared one.
+static Value stringResult(ObjString *original, ObjString *result) {
+  if (original->klass == vm.klass.string) {
+    return OBJ_VAL(result);
+  }
+  return OBJ_VAL(
+      copyUninternedString(result->chars, result->length, original->klass));
+}
+
 static Value toLowerCaseStringNative(int argCount, Value *args) {
   if (!checkArgs(argCount, 1, args, NATIVE_NORMAL, ARG_STRING)) {
     return NIL_VAL;
@@ -797,9 +1253,9 @@ static Value toLowerCaseStringNative(int argCount, Value *args) {
   }
   
   push(OBJ_VAL(takeString(lowercased, original->length)));
-  ObjString *result = AS_STRING(peek(0));
-  result->klass = original->klass;
-  return pop();
+  Value result = stringResult(original, AS_STRING(peek(0)));
+  pop();
+  return result;
 }
 
 static Value toUpperCaseStringNative(int argCount, Value *args) {
@@ -837,9 +1293,9 @@ static Value toUpperCaseStringNative(int argCount, Value *args) {
   }
   
   push(OBJ_VAL(takeString(uppercased, original->length)));
-  ObjString *result = AS_STRING(peek(0));
-  result->klass = original->klass;
-  return pop();
+  Value result = stringResult(original, AS_STRING(peek(0)));
+  pop();
+  return result;
 }
 
 static Value indexOfStringNative(int argCount, Value *args) {
@@ -850,28 +1306,14 @@ static Value indexOfStringNative(int argCount, Value *args) {
   ObjString *haystack_str = AS_STRING(args[0]);
   ObjString *needle_str = AS_STRING(args[1]);
   
-  if (needle_str->length == 0) {
-    return NUMBER_VAL(0);
-  }
-  
-  if (haystack_str->length == 0 || needle_str->length > haystack_str->length) {
+  Needle needle;
+  compileNeedle(&needle, needle_str->chars, needle_str->length);
+  int index = findNeedle(&needle, haystack_str->chars, haystack_str->length, 0);
+  if (index < 0) {
     return NUMBER_VAL(-1);
   }
   
-  char *haystack = haystack_str->chars;
-  char *needle = needle_str->chars;
-  
-  char *found = strstr(haystack, needle);
-  if (found == NULL) {
-    return NUMBER_VAL(-1);
-  }
-  
-  ptrdiff_t index = found - haystack;
-  if (index < 0 || index >= haystack_str->length) {
-    return NUMBER_VAL(-1);
-  }
-  
-  return NUMBER_VAL((double)index);
+  return NUMBER_VAL((double)utf8_char_index(haystack_str, index));
 }
 
 static Value lastIndexOfStringNative(int argCount, Value *args) {
@@ -882,37 +1324,14 @@ static Value lastIndexOfStringNative(int argCount, Value *args) {
   ObjString *haystack_str = AS_STRING(args[0]);
   ObjString *needle_str = AS_STRING(args[1]);
   
-  if (needle_str->length == 0) {
-    return NUMBER_VAL((double)haystack_str->length);
-  }
-  
-  if (haystack_str->length == 0 || needle_str->length > haystack_str->length) {
+  Needle needle;
+  compileNeedle(&needle, needle_str->chars, needle_str->length);
+  int index = findLastNeedle(&needle, haystack_str->chars, haystack_str->length);
+  if (index < 0) {
     return NUMBER_VAL(-1);
   }
   
-  char *haystack = haystack_str->chars;
-  char *needle = needle_str->chars;
-  char *last_found = NULL;
-  char *current = haystack;
-  
-  while ((current = strstr(current, needle)) != NULL) {
-    last_found = current;
-    current += needle_str->length;
-    if (current > haystack + haystack_str->length) {
-      break;
-    }
-  }
-  
-  if (last_found == NULL) {
-    return NUMBER_VAL(-1);
-  }
-  
-  ptrdiff_t index = last_found - haystack;
-  if (index < 0 || index >= haystack_str->length) {
-    return NUMBER_VAL(-1);
-  }
-  
-  return NUMBER_VAL((double)index);
+  return NUMBER_VAL((double)utf8_char_index(haystack_str, index));
 }
 
 static Value startsWithStringNative(int argCount, Value *args) {
@@ -979,9 +1398,9 @@ static Value trimStringNative(int argCount, Value *args) {
   int new_length = (int)(end - start + 1);
   if (new_length <= 0) {
     push(OBJ_VAL(copyString("", 0, &vm.strings)));
-    ObjString *result = AS_STRING(peek(0));
-    result->klass = original->klass;
-    return pop();
+    Value result = stringResult(original, AS_STRING(peek(0)));
+    pop();
+    return result;
   }
   
   if (new_length == original->length) {
@@ -994,20 +1413,11 @@ static Value trimStringNative(int argCount, Value *args) {
     return NIL_VAL;
   }
   
-  char *trimmed = ALLOCATE(char, new_length + 1);
-  if (trimmed == NULL) {
-    runtimeError("Memory allocation failed in trim.");
-    vm.shouldPanic = true;
-    return NIL_VAL;
-  }
-  
-  memcpy(trimmed, start, new_length);
-  trimmed[new_length] = '\0';
-  
-  push(OBJ_VAL(takeString(trimmed, new_length)));
-  ObjString *result = AS_STRING(peek(0));
-  result->klass = original->klass;
-  return pop();
+  push(OBJ_VAL(
+      sliceString(original, (int)(start - original->chars), new_length)));
+  Value result = stringResult(original, AS_STRING(peek(0)));
+  pop();
+  return result;
 }
 
 static Value substringStringNative(int argCount, Value *args) {
@@ -1030,8 +1440,9 @@ static Value substringStringNative(int argCount, Value *args) {
   }
   
   ObjString *original = AS_STRING(args[0]);
+  int char_length = utf8_get_cached_length(original);
   double start_d = AS_NUMBER(args[1]);
-  double end_d = (argCount == 3) ? AS_NUMBER(args[2]) : (double)original->length;
+  double end_d = (argCount == 3) ? AS_NUMBER(args[2]) : (double)char_length;
   
   if (start_d < INT_MIN || start_d > INT_MAX || end_d < INT_MIN || end_d > INT_MAX) {
     runtimeError("Index out of range in substring.");
@@ -1043,16 +1454,20 @@ static Value substringStringNative(int argCount, Value *args) {
   int end = (int)end_d;
   
   if (start < 0) start = 0;
-  if (end > original->length) end = original->length;
+  if (end > char_length) end = char_length;
   if (start > end) start = end;
-  if (start > original->length) start = original->length;
+  if (start > char_length) start = char_length;
+
+  // Indexes count characters; map them to byte offsets.
+  start = utf8_char_offset(original, start);
+  end = utf8_char_offset(original, end);
   
   int new_length = end - start;
   if (new_length <= 0) {
     push(OBJ_VAL(copyString("", 0, &vm.strings)));
-    ObjString *result = AS_STRING(peek(0));
-    result->klass = original->klass;
-    return pop();
+    Value result = stringResult(original, AS_STRING(peek(0)));
+    pop();
+    return result;
   }
   
   if (new_length == original->length && start == 0) {
@@ -1065,20 +1480,10 @@ static Value substringStringNative(int argCount, Value *args) {
     return NIL_VAL;
   }
   
-  char *substring = ALLOCATE(char, new_length + 1);
-  if (substring == NULL) {
-    runtimeError("Memory allocation failed in substring.");
-    vm.shouldPanic = true;
-    return NIL_VAL;
-  }
-  
-  memcpy(substring, original->chars + start, new_length);
-  substring[new_length] = '\0';
-  
-  push(OBJ_VAL(takeString(substring, new_length)));
-  ObjString *result = AS_STRING(peek(0));
-  result->klass = original->klass;
-  return pop();
+  push(OBJ_VAL(sliceString(original, start, new_length)));
+  Value result = stringResult(original, AS_STRING(peek(0)));
+  pop();
+  return result;
 }
 
 static Value replaceStringNative(int argCount, Value *args) {
@@ -1087,32 +1492,23 @@ static Value replaceStringNative(int argCount, Value *args) {
   }
   
   ObjString *original = AS_STRING(args[0]);
-  char *search = AS_CSTRING(args[1]);
-  char *replace = AS_CSTRING(args[2]);
-  
-  int search_len = strlen(search);
-  int replace_len = strlen(replace);
+  ObjString *search = AS_STRING(args[1]);
+  ObjString *replace = AS_STRING(args[2]);
   
-  if (search_len == 0) {
+  if (search->length == 0) {
     return args[0];
   }
   
-  char *found = strstr(original->chars, search);
-  if (found == NULL) {
+  Needle needle;
+  compileNeedle(&needle, search->chars, search->length);
+  int prefix_len = findNeedle(&needle, original->chars, original->length, 0);
+  if (prefix_len < 0) {
     return args[0];
   }
   
-  int prefix_len = (int)(found - original->chars);
-  int suffix_len = original->length - prefix_len - search_len;
-  
-  if (prefix_len < 0 || suffix_len < 0 || prefix_len > original->length) {
-    runtimeError("Invalid string bounds in replace.");
-    vm.shouldPanic = true;
-    return NIL_VAL;
-  }
-  
-  long long new_length_ll = (long long)prefix_len + replace_len + suffix_len;
-  if (new_length_ll < 0 || new_length_ll > INT_MAX) {
+  int suffix_len = original->length - prefix_len - search->length;
+  long long new_length_ll = (long long)prefix_len + replace->length + suffix_len;
+  if (new_length_ll > INT_MAX) {
     runtimeError("Result string too large in replace.");
     vm.shouldPanic = true;
     return NIL_VAL;
@@ -1120,21 +1516,16 @@ static Value replaceStringNative(int argCount, Value *args) {
   
   int new_length = (int)new_length_ll;
   char *result = ALLOCATE(char, new_length + 1);
-  if (result == NULL) {
-    runtimeError("Memory allocation failed in replace.");
-    vm.shouldPanic = true;
-    return NIL_VAL;
-  }
-  
   memcpy(result, original->chars, prefix_len);
-  memcpy(result + prefix_len, replace, replace_len);
-  memcpy(result + prefix_len + replace_len, found + search_len, suffix_len);
+  memcpy(result + prefix_len, replace->chars, replace->length);
+  memcpy(result + prefix_len + replace->length,
+         original->chars + prefix_len + search->length, suffix_len);
   result[new_length] = '\0';
   
   push(OBJ_VAL(takeString(result, new_length)));
-  ObjString *result_str = AS_STRING(peek(0));
-  result_str->klass = original->klass;
-  return pop();
+  Value result_str = stringResult(original, AS_STRING(peek(0)));
+  pop();
+  return result_str;
 }
 
 static Value replaceAllStringNative(int argCount, Value *args) {
@@ -1143,34 +1534,30 @@ static Value replaceAllStringNative(int argCount, Value *args) {
   }
   
   ObjString *original = AS_STRING(args[0]);
-  char *search = AS_CSTRING(args[1]);
-  char *replace = AS_CSTRING(args[2]);
-  
-  int search_len = strlen(search);
-  int replace_len = strlen(replace);
+  ObjString *search = AS_STRING(args[1]);
+  ObjString *replace = AS_STRING(args[2]);
   
-  if (search_len == 0) {
+  if (search->length == 0) {
     return args[0];
   }
   
-  int count = 0;
-  char *temp = original->chars;
-  while ((temp = strstr(temp, search)) != NULL) {
+  // One compiled needle serves both the counting and the copying pass.
+  Needle needle;
+  compileNeedle(&needle, search->chars, search->length);
+  long long count = 0;
+  for (int pos = findNeedle(&needle, original->chars, original->length, 0);
+       pos >= 0;
+       pos = findNeedle(&needle, original->chars, original->length,
+                        pos + search->length)) {
     count++;
-    temp += search_len;
-    if (count > 10000) {
-      runtimeError("Too many replacements in replace_all.");
-      vm.shouldPanic = true;
-      return NIL_VAL;
-    }
   }
   
   if (count == 0) {
     return args[0];
   }
   
-  long long new_length_ll = (long long)original->length + (long long)count * (replace_len - search_len);
-  if (new_length_ll < 0 || new_length_ll > INT_MAX) {
+  long long new_length_ll = (long long)original->length + count * (replace->length - search->length);
+  if (new_length_ll > INT_MAX) {
     runtimeError("Result string too large in replace_all.");
     vm.shouldPanic = true;
     return NIL_VAL;
@@ -1178,47 +1565,23 @@ static Value replaceAllStringNative(int argCount, Value *args) {
   
   int new_length = (int)new_length_ll;
   char *result = ALLOCATE(char, new_length + 1);
-  
-  char *src = original->chars;
   char *dst = result;
-  char *result_end = result + new_length;
-  
-  while (*src && dst < result_end) {
-    char *found = strstr(src, search);
-    if (found == src) {
-      if (dst + replace_len > result_end) {
-        FREE_ARRAY(char, result, new_length + 1);
-        runtimeError("Buffer overflow in replace_all.");
-        vm.shouldPanic = true;
-        return NIL_VAL;
-      }
-      memcpy(dst, replace, replace_len);
-      dst += replace_len;
-      src += search_len;
-    } else {
-      if (dst >= result_end) {
-        FREE_ARRAY(char, result, new_length + 1);
-        runtimeError("Buffer overflow in replace_all.");
-        vm.shouldPanic = true;
-        return NIL_VAL;
-      }
-      *dst++ = *src++;
-    }
-  }
-  
-  if (dst > result_end) {
-    FREE_ARRAY(char, result, new_length + 1);
-    runtimeError("Buffer overflow in replace_all.");
-    vm.shouldPanic = true;
-    return NIL_VAL;
-  }
-  
-  *dst = '\0';
+  int src = 0;
+  int found;
+  while ((found = findNeedle(&needle, original->chars, original->length, src)) >= 0) {
+    memcpy(dst, original->chars + src, found - src);
+    dst += found - src;
+    memcpy(dst, replace->chars, replace->length);
+    dst += replace->length;
+    src = found + search->length;
+  }
+  memcpy(dst, original->chars + src, original->length - src);
+  result[new_length] = '\0';
   
-  push(OBJ_VAL(takeString(result, (int)(dst - result))));
-  ObjString *result_str = AS_STRING(peek(0));
-  result_str->klass = original->klass;
-  return pop();
+  push(OBJ_VAL(takeString(result, new_length)));
+  Value result_str = stringResult(original, AS_STRING(peek(0)));
+  pop();
+  return result_str;
 }
 
 static Value lenStringNative(int argCount, Value *args) {
@@ -1280,10 +1643,21 @@ static Value containsStringNative(int argCount, Value *args) {
     return NIL_VAL;
   };
 
-  char *string = AS_CSTRING(args[0]);
-  char *term = AS_CSTRING(args[1]);
+  ObjString *string = AS_STRING(args[0]);
+  ObjString *term = AS_STRING(args[1]);
+  Needle needle;
+  compileNeedle(&needle, term->chars, term->length);
+
+  return findNeedle(&needle, string->chars, string->length, 0) >= 0 ? TRUE_VAL
+                                                                    : FALSE_VAL;
+}
 
-  return (strstr(string, term) != NULL) ? TRUE_VAL : FALSE_VAL;
+static void pushSliceToList(ObjList *list, ObjString *string, int start,
+                            int length) {
+  ObjString *part = sliceString(string, start, length);
+  push(OBJ_VAL(part));
+  pushToList(list, OBJ_VAL(part));
+  pop();
 }
 
 static Value splitStringNative(int argCount, Value *args) {
@@ -1291,29 +1665,33 @@ static Value splitStringNative(int argCount, Value *args) {
     return NIL_VAL;
   };
   ObjString *string = AS_STRING(args[0]);
-  char *term = AS_CSTRING(args[1]);
+  ObjString *term = AS_STRING(args[1]);
   ObjList *list = newList(vm.klass.list);
   push(OBJ_VAL(list));
-  char *lastSplit = string->chars;
-  ObjString *str = NULL;
-
-  while (true) {
-    char *cp = strstr(lastSplit, term);
-    if (cp == NULL) {
-      str = copyString(lastSplit,
-                       (int)(&string->chars[string->length] - lastSplit),
-                       &vm.strings);
-      pushToList(list, OBJ_VAL(str));
-      return pop();
+
+  // An empty separator splits into characters.
+  if (term->length == 0) {
+    for (int pos = 0; pos < string->length;) {
+      int next = utf8_next_offset(string->chars, pos, string->length);
+      pushSliceToList(list, string, pos, next - pos);
+      pos = next;
     }
+    return pop();
+  }
 
-    str = copyString(lastSplit, (int)(cp - lastSplit), &vm.strings);
-    pushToList(list, OBJ_VAL(str));
-    lastSplit = cp + 1;
+  // Parts are views into the string, so splitting copies no text.
+  Needle needle;
+  compileNeedle(&needle, term->chars, term->length);
+  int start = 0;
+  int found;
+  while ((found = findNeedle(&needle, string->chars, string->length, start)) >= 0) {
+    pushSliceToList(list, string, start, found - start);
+    start = found + term->length;
   }
+  pushSliceToList(list, string, start, string->length - start);
+  return pop();
 }
 
-
 static Value initErrorNative(int argCount, Value *args) {
   if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_ANY, ARG_STRING)) {
     return NIL_VAL;
@@ -1349,6 +1727,9 @@ static void addFileMethods(ObjKlass *fileKlass) {
   defineNativeKlassMethod(fileKlass, "read_all", 8, readAllFileNative);
   defineNativeKlassMethod(fileKlass, "read_line", 9, readLineFileNative);
   defineNativeKlassMethod(fileKlass, "read_bytes", 10, readBytesFileNative);
+  defineNativeKlassMethod(fileKlass, "read_into", 9, readIntoFileNative);
+  defineNativeKlassMethod(fileKlass, "read_all_bytes", 14,
+                          readAllBytesFileNative);
   defineNativeKlassMethod(fileKlass, "write_line", 10, writeLineFileNative);
   defineNativeKlassMethod(fileKlass, "flush", 5, flushFileNative);
   defineNativeKlassMethod(fileKlass, "is_closed", 9, isClosedFileNative);
@@ -1369,6 +1750,15 @@ static void addListMethods(ObjKlass *listKlass) {
   defineNativeKlassMethod(listKlass, "len", 3, lenListNative);
   defineNativeKlassMethod(listKlass, "remove", 6, removeListNative);
   defineNativeKlassMethod(listKlass, "join", 4, joinListNative);
+  defineNativeKlassMethod(listKlass, "slice", 5, sliceListNative);
+  defineNativeKlassMethod(listKlass, "insert", 6, insertListNative);
+  defineNativeKlassMethod(listKlass, "extend", 6, extendListNative);
+  defineNativeKlassMethod(listKlass, "splice", 6, spliceListNative);
+  defineNativeKlassMethod(listKlass, "map", 3, mapListNative);
+  defineNativeKlassMethod(listKlass, "filter", 6, filterListNative);
+  defineNativeKlassMethod(listKlass, "reduce", 6, reduceListNative);
+  defineNativeKlassMethod(listKlass, "each", 4, eachListNative);
+  addListSortMethods(listKlass);
 }
 
 static ObjKlass *createMapClass() {
@@ -1387,6 +1777,26 @@ static void addMapMethods(ObjKlass *mapKlass) {
   defineNativeKlassMethod(mapKlass, "delete", 6, deleteMapNative);
 }
 
+static ObjKlass *createSetClass() {
+  ObjKlass *setKlass = defineKlass("Set", 3, OBJ_SET);
+  return setKlass;
+}
+
+static void addSetMethods(ObjKlass *setKlass) {
+  defineNativeKlassMethod(setKlass, "init", 4, initSetNative);
+  defineNativeKlassMethod(setKlass, "add", 3, addSetNative);
+  defineNativeKlassMethod(setKlass, "add_all", 7, addAllSetNative);
+  defineNativeKlassMethod(setKlass, "remove", 6, removeSetNative);
+  defineNativeKlassMethod(setKlass, "has", 3, hasSetNative);
+  defineNativeKlassMethod(setKlass, "len", 3, lenSetNative);
+  defineNativeKlassMethod(setKlass, "clear", 5, clearSetNative);
+  defineNativeKlassMethod(setKlass, "to_list", 7, toListSetNative);
+  defineNativeKlassMethod(setKlass, "union", 5, unionSetNative);
+  defineNativeKlassMethod(setKlass, "intersection", 12,
+                          intersectionSetNative);
+  defineNativeKlassMethod(setKlass, "difference", 10, differenceSetNative);
+}
+
 static ObjKlass *createPairClass() {
   ObjKlass *pairKlass = defineKlass("Pair", 4, OBJ_INSTANCE);
 
@@ -1417,6 +1827,7 @@ static void addStringMethods(ObjKlass *stringKlass) {
   defineNativeKlassMethod(stringKlass, "substring", 9, substringStringNative);
   defineNativeKlassMethod(stringKlass, "replace", 7, replaceStringNative);
   defineNativeKlassMethod(stringKlass, "replace_all", 11, replaceAllStringNative);
+  defineNativeKlassMethod(stringKlass, "to_bytes", 8, toBytesStringNative);
 }
 
 static ObjKlass *createErrorClass() {
@@ -1438,6 +1849,13 @@ void registerBuiltInKlasses() {
   vm.klass.error = createErrorClass();
   vm.klass.map = createMapClass();
   vm.klass.pair = createPairClass();
+  vm.klass.set = createSetClass();
+  vm.klass.float64Array = createFloat64ArrayClass();
+  vm.klass.int32Array = createInt32ArrayClass();
+  vm.klass.deque = createDequeClass();
+  vm.klass.bytes = createBytesClass();
+  vm.klass.regex = createRegexClass();
+  vm.klass.match = createMatchClass();
 }
 
 void registerBuiltInKlassMethods() {
@@ -1447,5 +1865,11 @@ void registerBuiltInKlassMethods() {
   addFileMethods(vm.klass.file);
   addErrorMethods(vm.klass.error);
   addMapMethods(vm.klass.map);
-  // Pair class has no methods
+  addSetMethods(vm.klass.set);
+  addFloat64ArrayMethods(vm.klass.float64Array);
+  addInt32ArrayMethods(vm.klass.int32Array);
+  addDequeMethods(vm.klass.deque);
+  addBytesMethods(vm.klass.bytes);
+  addRegexMethods(vm.klass.regex);
+  // Pair and Match classes have no methods
 }
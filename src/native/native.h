@@ -1,13 +1,47 @@
 #ifndef ghoul_native_h
 #define ghoul_native_h
 
+#include "../object.h"
+
 void registerNatives();
 void registerBuiltInKlasses();
 void registerBuiltInKlassMethods();
 
+ObjKlass *createFloat64ArrayClass();
+ObjKlass *createInt32ArrayClass();
+void addFloat64ArrayMethods(ObjKlass *arrayKlass);
+void addInt32ArrayMethods(ObjKlass *arrayKlass);
+void addListSortMethods(ObjKlass *listKlass);
+ObjKlass *createDequeClass();
+void addDequeMethods(ObjKlass *dequeKlass);
+ObjKlass *createBytesClass();
+void addBytesMethods(ObjKlass *bytesKlass);
+ObjKlass *createRegexClass();
+ObjKlass *createMatchClass();
+void addRegexMethods(ObjKlass *regexKlass);
+// Rebuilds the program of a regex whose pattern was restored from a snapshot.
+bool recompileRegex(ObjRegex *regex);
+bool asByteSpan(Value value, const uint8_t **data, int *length);
+
+// A needle compiled once and reused across searches, see search.c.
+typedef struct {
+  const unsigned char *chars;
+  int length;
+  size_t split;
+  size_t period;
+  size_t memory;
+  uint32_t shift[256];
+} Needle;
+
+void compileNeedle(Needle *needle, const char *chars, int length);
+int findNeedle(const Needle *needle, const char *haystack, int length,
+               int from);
+int findLastNeedle(const Needle *needle, const char *haystack, int length);
+
 void registerMathNatives();
 void registerRequestNatives();
 void registerJsonNatives();
+void registerStructNatives();
 void registerRaylibNatives();
 
 #endif
@@ -0,0 +1,1992 @@
+#include "common_native.h"
+#include "native.h"
+#include "../utf8.h"
+
+// Regular expressions for the Regex class. A pattern is parsed once into a
+// small syntax tree and compiled to two byte-level programs: the pattern and
+// its reverse. A search runs the forward program as a lazily built DFA to find
+// where the leftmost match ends, then the reverse program backwards from there
+// to find where it starts. Only patterns with capture groups go on to a Pike
+// VM run over that span. Patterns the DFA cannot express (word boundaries),
+// and searches whose DFA outgrows its state cache, use the Pike VM alone.
+// Every path is linear in the length of the text; nothing backtracks.
+//
+// Matching works on UTF-8 bytes. Non-ASCII characters compile to their byte
+// sequences and classes to alternations of byte ranges, so a match never
+// starts or ends inside a character.
+
+#define REGEX_MAX_INSTS 20000
+#define REGEX_MAX_GROUPS 32
+#define REGEX_MAX_REPEAT 1000
+#define REGEX_MAX_DEPTH 200
+#define DFA_MAX_STATES 1024
+#define DFA_BUCKETS (DFA_MAX_STATES * 2)
+#define DFA_MAX_RESETS 4
+#define DFA_UNKNOWN -1
+#define DFA_GAVE_UP -2
+
+typedef enum {
+  RX_BYTE,   // consume the byte x
+  RX_SET,    // consume one byte from sets[x]
+  RX_SPLIT,  // continue at x, or at y with lower priority
+  RX_JMP,    // continue at x
+  RX_SAVE,   // record the position in capture slot x
+  RX_ASSERT, // continue only if assertion x holds here
+  RX_MATCH,
+} RxOp;
+
+typedef enum {
+  ASSERT_TEXT_START,
+  ASSERT_TEXT_END,
+  ASSERT_WORD_BOUNDARY,
+  ASSERT_NOT_WORD_BOUNDARY,
+} RxAssert;
+
+typedef struct {
+  RxOp op;
+  int x;
+  int y;
+} RxInst;
+
+typedef struct {
+  RxInst *code;
+  int count;
+  int capacity;
+} RxProgram;
+
+typedef uint8_t ByteSet[32];
+
+// A DFA state is the priority-ordered list of program counters that are
+// waiting to consume the next byte. Transitions are filled in on first use.
+typedef struct {
+  int *pcs;
+  int count;
+  bool matching;
+  int next[256];
+} DfaState;
+
+typedef struct {
+  RxProgram *program;
+  bool longest;      // keep threads after a match instead of cutting them
+  int pendingAssert; // assertion that can only hold where the scan stops
+  DfaState *states;
+  int count;
+  int capacity;
+  int resets;
+  int buckets[DFA_BUCKETS];
+  int starts[8]; // by assertion flags, plus 4 when anchored
+} Dfa;
+
+#define DFA_AT_START 1
+#define DFA_AT_END 2
+
+typedef struct {
+  int *pcs;
+  int *sparse;
+  int *captures; // slotCount per thread
+  int count;
+} Threads;
+
+struct Regex {
+  ByteSet *sets;
+  int setCount;
+  int setCapacity;
+  RxProgram forward;
+  RxProgram reverse;
+  int unanchoredStart;
+  int anchoredStart;
+  int groupCount; // including group 0, the whole match
+  bool dfaUsable;
+  Dfa forwardDfa;
+  Dfa reverseDfa;
+
+  // Scratch space for building DFA states and running the Pike VM, sized
+  // for the larger of the two programs.
+  int scratchSize;
+  int *stack;
+  int *sparse;
+  int *dense;
+  int denseCount;
+  int *list;
+  int listCount;
+  bool cut;
+  Threads threads[2];
+  int *work;
+};
+
+typedef enum {
+  NODE_EMPTY,
+  NODE_SET, // one byte from sets[value]
+  NODE_CONCAT,
+  NODE_ALTERNATE,
+  NODE_REPEAT,
+  NODE_GROUP, // capture group number value
+  NODE_ASSERT,
+} NodeType;
+
+typedef struct {
+  NodeType type;
+  int value;
+  int min;
+  int max; // -1 when unbounded
+  bool greedy;
+  int child;
+  int last;
+  int next;
+  int prev;
+} Node;
+
+typedef struct {
+  struct Regex *regex;
+  const char *pattern;
+  int length;
+  int pos;
+  Node *nodes;
+  int count;
+  int capacity;
+  int depth;
+  const char *error;
+} Parser;
+
+static bool isWordByte(int byte) {
+  return (byte >= 'a' && byte <= 'z') || (byte >= 'A' && byte <= 'Z') ||
+         (byte >= '0' && byte <= '9') || byte == '_';
+}
+
+static void addByte(uint8_t *set, int byte) {
+  set[byte >> 3] |= (uint8_t)(1 << (byte & 7));
+}
+
+static bool hasByte(const uint8_t *set, int byte) {
+  return (set[byte >> 3] >> (byte & 7)) & 1;
+}
+
+static void addRange(uint8_t *set, int low, int high) {
+  for (int byte = low; byte <= high; byte++) {
+    addByte(set, byte);
+  }
+}
+
+#define CLASS_MAX_RANGES 256
+#define MAX_CODEPOINT 0x10FFFF
+
+// A character class as sorted, disjoint code point ranges.
+typedef struct {
+  int low;
+  int high;
+} CodeRange;
+
+typedef struct {
+  CodeRange ranges[CLASS_MAX_RANGES];
+  int count;
+} CharClass;
+
+// ---------------------------------------------------------------------------
+// Parsing
+
+static int parseError(Parser *parser, const char *message) {
+  if (parser->error == NULL) {
+    parser->error = message;
+  }
+  return -1;
+}
+
+static int newNode(Parser *parser, NodeType type) {
+  if (parser->count >= REGEX_MAX_INSTS) {
+    return parseError(parser, "Regex is too large");
+  }
+  if (parser->count + 1 > parser->capacity) {
+    int oldCapacity = parser->capacity;
+    parser->capacity = GROW_CAPACITY(oldCapacity);
+    parser->nodes =
+        GROW_ARRAY(Node, parser->nodes, oldCapacity, parser->capacity);
+  }
+  Node *node = &parser->nodes[parser->count];
+  node->type = type;
+  node->value = 0;
+  node->min = 0;
+  node->max = 0;
+  node->greedy = true;
+  node->child = -1;
+  node->last = -1;
+  node->next = -1;
+  node->prev = -1;
+  return parser->count++;
+}
+
+static void appendNode(Parser *parser, int parent, int child) {
+  Node *nodes = parser->nodes;
+  nodes[child].prev = nodes[parent].last;
+  if (nodes[parent].last == -1) {
+    nodes[parent].child = child;
+  } else {
+    nodes[nodes[parent].last].next = child;
+  }
+  nodes[parent].last = child;
+}
+
+static int addSet(struct Regex *regex, const uint8_t *set) {
+  if (regex->setCount + 1 > regex->setCapacity) {
+    int oldCapacity = regex->setCapacity;
+    regex->setCapacity = GROW_CAPACITY(oldCapacity);
+    regex->sets =
+        GROW_ARRAY(ByteSet, regex->sets, oldCapacity, regex->setCapacity);
+  }
+  memcpy(regex->sets[regex->setCount], set, sizeof(ByteSet));
+  return regex->setCount++;
+}
+
+static int setNode(Parser *parser, const uint8_t *set) {
+  int node = newNode(parser, NODE_SET);
+  if (node >= 0) {
+    parser->nodes[node].value = addSet(parser->regex, set);
+  }
+  return node;
+}
+
+static int rangeNode(Parser *parser, int low, int high) {
+  ByteSet set = {0};
+  addRange(set, low, high);
+  return setNode(parser, set);
+}
+
+static int sequenceNode(Parser *parser, const uint8_t *low,
+                        const uint8_t *high, int length) {
+  if (length == 1) {
+    return rangeNode(parser, low[0], high[0]);
+  }
+  int concat = newNode(parser, NODE_CONCAT);
+  for (int i = 0; concat >= 0 && i < length; i++) {
+    int byte = rangeNode(parser, low[i], high[i]);
+    if (byte < 0) {
+      return -1;
+    }
+    appendNode(parser, concat, byte);
+  }
+  return concat;
+}
+
+static int encodeUtf8(int codepoint, uint8_t *bytes) {
+  if (codepoint < 0x80) {
+    bytes[0] = (uint8_t)codepoint;
+    return 1;
+  }
+  if (codepoint < 0x800) {
+    bytes[0] = (uint8_t)(0xC0 | (codepoint >> 6));
+    bytes[1] = (uint8_t)(0x80 | (codepoint & 0x3F));
+    return 2;
+  }
+  if (codepoint < 0x10000) {
+    bytes[0] = (uint8_t)(0xE0 | (codepoint >> 12));
+    bytes[1] = (uint8_t)(0x80 | ((codepoint >> 6) & 0x3F));
+    bytes[2] = (uint8_t)(0x80 | (codepoint & 0x3F));
+    return 3;
+  }
+  bytes[0] = (uint8_t)(0xF0 | (codepoint >> 18));
+  bytes[1] = (uint8_t)(0x80 | ((codepoint >> 12) & 0x3F));
+  bytes[2] = (uint8_t)(0x80 | ((codepoint >> 6) & 0x3F));
+  bytes[3] = (uint8_t)(0x80 | (codepoint & 0x3F));
+  return 4;
+}
+
+static int decodeUtf8(const uint8_t *bytes, int length) {
+  switch (length) {
+  case 2:
+    return ((bytes[0] & 0x1F) << 6) | (bytes[1] & 0x3F);
+  case 3:
+    return ((bytes[0] & 0x0F) << 12) | ((bytes[1] & 0x3F) << 6) |
+           (bytes[2] & 0x3F);
+  case 4:
+    return ((bytes[0] & 0x07) << 18) | ((bytes[1] & 0x3F) << 12) |
+           ((bytes[2] & 0x3F) << 6) | (bytes[3] & 0x3F);
+  default:
+    return bytes[0];
+  }
+}
+
+// Appends alternatives matching the encodings of the non-ASCII code points
+// in [low, high]. The range is split until every piece encodes to the same
+// length and differs only in trailing bytes that span their full 0x80-0xBF
+// range, so each piece is one sequence of byte ranges.
+static bool appendUtf8Range(Parser *parser, int alternate, int low, int high) {
+  if (low <= 0xDFFF && high >= 0xD800) {
+    // Surrogates have no UTF-8 encoding.
+    return (low >= 0xD800 || appendUtf8Range(parser, alternate, low, 0xD7FF)) &&
+           (high <= 0xDFFF ||
+            appendUtf8Range(parser, alternate, 0xE000, high));
+  }
+  static const int lengthEnds[] = {0x7F, 0x7FF, 0xFFFF};
+  for (int i = 0; i < 3; i++) {
+    int end = lengthEnds[i];
+    if (low <= end && high > end) {
+      return appendUtf8Range(parser, alternate, low, end) &&
+             appendUtf8Range(parser, alternate, end + 1, high);
+    }
+  }
+
+  uint8_t lowBytes[4];
+  uint8_t highBytes[4];
+  int length = encodeUtf8(low, lowBytes);
+  encodeUtf8(high, highBytes);
+  for (int i = 1; i < length; i++) {
+    int mask = (1 << (6 * i)) - 1;
+    if ((low & ~mask) != (high & ~mask)) {
+      if ((low & mask) != 0) {
+        return appendUtf8Range(parser, alternate, low, low | mask) &&
+               appendUtf8Range(parser, alternate, (low | mask) + 1, high);
+      }
+      if ((high & mask) != mask) {
+        return appendUtf8Range(parser, alternate, low, (high & ~mask) - 1) &&
+               appendUtf8Range(parser, alternate, high & ~mask, high);
+      }
+    }
+  }
+  int sequence = sequenceNode(parser, lowBytes, highBytes, length);
+  if (sequence < 0) {
+    return false;
+  }
+  appendNode(parser, alternate, sequence);
+  return true;
+}
+
+static bool addClassRange(Parser *parser, CharClass *class, int low,
+                          int high) {
+  if (class->count >= CLASS_MAX_RANGES) {
+    parseError(parser, "Class is too large");
+    return false;
+  }
+  class->ranges[class->count].low = low;
+  class->ranges[class->count].high = high;
+  class->count++;
+  return true;
+}
+
+static int compareRanges(const void *a, const void *b) {
+  return ((const CodeRange *)a)->low - ((const CodeRange *)b)->low;
+}
+
+static void normalizeClass(CharClass *class) {
+  if (class->count == 0) {
+    return;
+  }
+  qsort(class->ranges, class->count, sizeof(CodeRange), compareRanges);
+  int merged = 0;
+  for (int i = 1; i < class->count; i++) {
+    CodeRange *last = &class->ranges[merged];
+    if (class->ranges[i].low <= last->high + 1) {
+      if (class->ranges[i].high > last->high) {
+        last->high = class->ranges[i].high;
+      }
+    } else {
+      class->ranges[++merged] = class->ranges[i];
+    }
+  }
+  class->count = merged + 1;
+}
+
+// Complements a normalized class. The result has at most one more range.
+static bool negateClass(Parser *parser, CharClass *class) {
+  CharClass negated;
+  negated.count = 0;
+  int next = 0;
+  for (int i = 0; i < class->count; i++) {
+    if (class->ranges[i].low > next &&
+        !addClassRange(parser, &negated, next, class->ranges[i].low - 1)) {
+      return false;
+    }
+    next = class->ranges[i].high + 1;
+  }
+  if (next <= MAX_CODEPOINT &&
+      !addClassRange(parser, &negated, next, MAX_CODEPOINT)) {
+    return false;
+  }
+  *class = negated;
+  return true;
+}
+
+static bool addEscapeRanges(Parser *parser, CharClass *class, char escape) {
+  CharClass members;
+  members.count = 0;
+  switch (escape | 0x20) {
+  case 'd':
+    addClassRange(parser, &members, '0', '9');
+    break;
+  case 'w':
+    addClassRange(parser, &members, '0', '9');
+    addClassRange(parser, &members, 'A', 'Z');
+    addClassRange(parser, &members, '_', '_');
+    addClassRange(parser, &members, 'a', 'z');
+    break;
+  case 's':
+    addClassRange(parser, &members, '\t', '\r');
+    addClassRange(parser, &members, ' ', ' ');
+    break;
+  }
+  if (escape >= 'A' && escape <= 'Z' && !negateClass(parser, &members)) {
+    return false;
+  }
+  for (int i = 0; i < members.count; i++) {
+    if (!addClassRange(parser, class, members.ranges[i].low,
+                       members.ranges[i].high)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Compiles a normalized class: one byte set for its ASCII members and byte
+// sequences for the rest. Classes that run to the end of Unicode, such as
+// `.` and most negated classes, also take the bytes that never appear in
+// UTF-8 so malformed text is still consumed.
+static int classNode(Parser *parser, CharClass *class) {
+  ByteSet ascii = {0};
+  bool hasAscii = false;
+  bool nonAscii = false;
+  for (int i = 0; i < class->count; i++) {
+    if (class->ranges[i].low < 0x80) {
+      int high = class->ranges[i].high < 0x80 ? class->ranges[i].high : 0x7F;
+      addRange(ascii, class->ranges[i].low, high);
+      hasAscii = true;
+    }
+    nonAscii |= class->ranges[i].high >= 0x80;
+  }
+  if (!nonAscii) {
+    return setNode(parser, ascii);
+  }
+
+  int alternate = newNode(parser, NODE_ALTERNATE);
+  if (alternate < 0) {
+    return -1;
+  }
+  if (hasAscii) {
+    int set = setNode(parser, ascii);
+    if (set < 0) {
+      return -1;
+    }
+    appendNode(parser, alternate, set);
+  }
+  for (int i = 0; i < class->count; i++) {
+    int low = class->ranges[i].low < 0x80 ? 0x80 : class->ranges[i].low;
+    if (low <= class->ranges[i].high &&
+        !appendUtf8Range(parser, alternate, low, class->ranges[i].high)) {
+      return -1;
+    }
+  }
+  if (class->ranges[class->count - 1].high == MAX_CODEPOINT) {
+    ByteSet invalid = {0};
+    addRange(invalid, 0xC0, 0xC1);
+    addRange(invalid, 0xF5, 0xFF);
+    int stray = setNode(parser, invalid);
+    if (stray < 0) {
+      return -1;
+    }
+    appendNode(parser, alternate, stray);
+  }
+  return alternate;
+}
+
+static int assertNode(Parser *parser, RxAssert kind) {
+  int node = newNode(parser, NODE_ASSERT);
+  if (node >= 0) {
+    parser->nodes[node].value = kind;
+  }
+  return node;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// One literal character from the pattern, as its UTF-8 bytes.
+typedef struct {
+  uint8_t bytes[4];
+  int length;
+  char escape; // d, w, s, D, W or S for a class escape, otherwise 0
+} Literal;
+
+// Reads a character or escape at the cursor. Returns false on error.
+static bool parseLiteral(Parser *parser, Literal *literal) {
+  literal->escape = 0;
+  unsigned char c = (unsigned char)parser->pattern[parser->pos++];
+  if (c != '\\') {
+    int length = c < 0x80 ? 1 : utf8_char_length(c);
+    if (length < 1 || parser->pos - 1 + length > parser->length) {
+      length = 1;
+    }
+    memcpy(literal->bytes, parser->pattern + parser->pos - 1, length);
+    literal->length = length;
+    parser->pos += length - 1;
+    return true;
+  }
+
+  if (parser->pos >= parser->length) {
+    parseError(parser, "Trailing backslash");
+    return false;
+  }
+  char escape = parser->pattern[parser->pos++];
+  literal->length = 1;
+  switch (escape) {
+  case 'd':
+  case 'w':
+  case 's':
+  case 'D':
+  case 'W':
+  case 'S':
+    literal->escape = escape;
+    return true;
+  case 'n':
+    literal->bytes[0] = '\n';
+    return true;
+  case 'r':
+    literal->bytes[0] = '\r';
+    return true;
+  case 't':
+    literal->bytes[0] = '\t';
+    return true;
+  case 'f':
+    literal->bytes[0] = '\f';
+    return true;
+  case 'v':
+    literal->bytes[0] = '\v';
+    return true;
+  case '0':
+    literal->bytes[0] = '\0';
+    return true;
+  case 'x': {
+    int high = parser->pos < parser->length
+                   ? hexValue(parser->pattern[parser->pos])
+                   : -1;
+    int low = parser->pos + 1 < parser->length
+                  ? hexValue(parser->pattern[parser->pos + 1])
+                  : -1;
+    if (high < 0 || low < 0) {
+      parseError(parser, "Expected two hex digits after \\x");
+      return false;
+    }
+    parser->pos += 2;
+    literal->length = encodeUtf8(high * 16 + low, literal->bytes);
+    return true;
+  }
+  default:
+    // \b and \B outside a class never get here, see parseAtom.
+    if (isalnum((unsigned char)escape)) {
+      parseError(parser, "Unknown escape");
+      return false;
+    }
+    literal->bytes[0] = (uint8_t)escape;
+    return true;
+  }
+}
+
+static int parseClass(Parser *parser) {
+  bool negated = false;
+  if (parser->pos < parser->length && parser->pattern[parser->pos] == '^') {
+    negated = true;
+    parser->pos++;
+  }
+
+  CharClass class;
+  class.count = 0;
+  bool first = true;
+  for (;;) {
+    if (parser->pos >= parser->length) {
+      return parseError(parser, "Missing ]");
+    }
+    if (parser->pattern[parser->pos] == ']' && !first) {
+      parser->pos++;
+      break;
+    }
+    first = false;
+
+    Literal low;
+    if (!parseLiteral(parser, &low)) {
+      return -1;
+    }
+    if (low.escape != 0) {
+      if (!addEscapeRanges(parser, &class, low.escape)) {
+        return -1;
+      }
+      continue;
+    }
+
+    int lowCodepoint = decodeUtf8(low.bytes, low.length);
+    int highCodepoint = lowCodepoint;
+    if (parser->pos + 1 < parser->length &&
+        parser->pattern[parser->pos] == '-' &&
+        parser->pattern[parser->pos + 1] != ']') {
+      parser->pos++;
+      Literal high;
+      if (!parseLiteral(parser, &high)) {
+        return -1;
+      }
+      highCodepoint = decodeUtf8(high.bytes, high.length);
+      if (high.escape != 0 || highCodepoint < lowCodepoint) {
+        return parseError(parser, "Bad class range");
+      }
+    }
+    if (!addClassRange(parser, &class, lowCodepoint, highCodepoint)) {
+      return -1;
+    }
+  }
+
+  normalizeClass(&class);
+  if (negated && !negateClass(parser, &class)) {
+    return -1;
+  }
+  return classNode(parser, &class);
+}
+
+static int parseAlternation(Parser *parser);
+
+static int parseGroup(Parser *parser) {
+  bool capture = true;
+  if (parser->pos < parser->length && parser->pattern[parser->pos] == '?') {
+    if (parser->pos + 1 >= parser->length ||
+        parser->pattern[parser->pos + 1] != ':') {
+      return parseError(parser, "Unsupported group syntax");
+    }
+    capture = false;
+    parser->pos += 2;
+  }
+
+  int index = 0;
+  if (capture) {
+    if (parser->regex->groupCount >= REGEX_MAX_GROUPS) {
+      return parseError(parser, "Too many groups");
+    }
+    index = parser->regex->groupCount++;
+  }
+  int inner = parseAlternation(parser);
+  if (inner < 0) {
+    return -1;
+  }
+  if (parser->pos >= parser->length || parser->pattern[parser->pos] != ')') {
+    return parseError(parser, "Missing )");
+  }
+  parser->pos++;
+  if (!capture) {
+    return inner;
+  }
+
+  int group = newNode(parser, NODE_GROUP);
+  if (group < 0) {
+    return -1;
+  }
+  parser->nodes[group].value = index;
+  appendNode(parser, group, inner);
+  return group;
+}
+
+// Parses {n}, {n,} or {n,m} at the cursor. Anything else leaves the cursor
+// alone so the brace is read as a literal.
+static bool parseBraces(Parser *parser, int *min, int *max) {
+  int pos = parser->pos + 1;
+  int low = 0;
+  int digits = 0;
+  while (pos < parser->length && isdigit((unsigned char)parser->pattern[pos])) {
+    if (low <= REGEX_MAX_REPEAT) {
+      low = low * 10 + (parser->pattern[pos] - '0');
+    }
+    pos++;
+    digits++;
+  }
+  if (digits == 0) {
+    return false;
+  }
+  int high = low;
+  if (pos < parser->length && parser->pattern[pos] == ',') {
+    pos++;
+    high = -1;
+    if (pos < parser->length && isdigit((unsigned char)parser->pattern[pos])) {
+      high = 0;
+      while (pos < parser->length &&
+             isdigit((unsigned char)parser->pattern[pos])) {
+        if (high <= REGEX_MAX_REPEAT) {
+          high = high * 10 + (parser->pattern[pos] - '0');
+        }
+        pos++;
+      }
+    }
+  }
+  if (pos >= parser->length || parser->pattern[pos] != '}') {
+    return false;
+  }
+  parser->pos = pos + 1;
+  *min = low;
+  *max = high;
+  return true;
+}
+
+static bool atQuantifier(Parser *parser) {
+  if (parser->pos >= parser->length) {
+    return false;
+  }
+  char c = parser->pattern[parser->pos];
+  if (c == '*' || c == '+' || c == '?') {
+    return true;
+  }
+  if (c == '{') {
+    int saved = parser->pos;
+    int min, max;
+    bool braces = parseBraces(parser, &min, &max);
+    parser->pos = saved;
+    return braces;
+  }
+  return false;
+}
+
+static int parseAtom(Parser *parser) {
+  char c = parser->pattern[parser->pos];
+  switch (c) {
+  case '(':
+    parser->pos++;
+    return parseGroup(parser);
+  case '[':
+    parser->pos++;
+    return parseClass(parser);
+  case '.': {
+    parser->pos++;
+    CharClass any;
+    any.count = 0;
+    addClassRange(parser, &any, '\n', '\n');
+    negateClass(parser, &any);
+    return classNode(parser, &any);
+  }
+  case '^':
+    parser->pos++;
+    return assertNode(parser, ASSERT_TEXT_START);
+  case '$':
+    parser->pos++;
+    return assertNode(parser, ASSERT_TEXT_END);
+  }
+  if (atQuantifier(parser)) {
+    return parseError(parser, "Nothing to repeat");
+  }
+
+  if (c == '\\' && parser->pos + 1 < parser->length) {
+    char escape = parser->pattern[parser->pos + 1];
+    if (escape == 'b' || escape == 'B') {
+      parser->pos += 2;
+      return assertNode(parser, escape == 'b' ? ASSERT_WORD_BOUNDARY
+                                              : ASSERT_NOT_WORD_BOUNDARY);
+    }
+  }
+  Literal literal;
+  if (!parseLiteral(parser, &literal)) {
+    return -1;
+  }
+  if (literal.escape != 0) {
+    CharClass class;
+    class.count = 0;
+    if (!addEscapeRanges(parser, &class, literal.escape)) {
+      return -1;
+    }
+    return classNode(parser, &class);
+  }
+  return sequenceNode(parser, literal.bytes, literal.bytes, literal.length);
+}
+
+static int parseRepeat(Parser *parser, int atom) {
+  if (!atQuantifier(parser)) {
+    return atom;
+  }
+
+  int min = 0;
+  int max = -1;
+  switch (parser->pattern[parser->pos]) {
+  case '*':
+    parser->pos++;
+    break;
+  case '+':
+    min = 1;
+    parser->pos++;
+    break;
+  case '?':
+    max = 1;
+    parser->pos++;
+    break;
+  default:
+    parseBraces(parser, &min, &max);
+    if (min > REGEX_MAX_REPEAT || max > REGEX_MAX_REPEAT) {
+      return parseError(parser, "Repeat count is too large");
+    }
+    if (max != -1 && max < min) {
+      return parseError(parser, "Bad repeat range");
+    }
+  }
+
+  bool greedy = true;
+  if (parser->pos < parser->length && parser->pattern[parser->pos] == '?') {
+    greedy = false;
+    parser->pos++;
+  }
+  if (atQuantifier(parser)) {
+    return parseError(parser, "Multiple repeat");
+  }
+
+  int repeat = newNode(parser, NODE_REPEAT);
+  if (repeat < 0) {
+    return -1;
+  }
+  parser->nodes[repeat].min = min;
+  parser->nodes[repeat].max = max;
+  parser->nodes[repeat].greedy = greedy;
+  appendNode(parser, repeat, atom);
+  return repeat;
+}
+
+static int parseSequence(Parser *parser) {
+  int concat = newNode(parser, NODE_CONCAT);
+  if (concat < 0) {
+    return -1;
+  }
+  while (parser->pos < parser->length &&
+         parser->pattern[parser->pos] != '|' &&
+         parser->pattern[parser->pos] != ')') {
+    int atom = parseAtom(parser);
+    if (atom < 0) {
+      return -1;
+    }
+    atom = parseRepeat(parser, atom);
+    if (atom < 0) {
+      return -1;
+    }
+    appendNode(parser, concat, atom);
+  }
+  return concat;
+}
+
+static int parseAlternation(Parser *parser) {
+  if (++parser->depth > REGEX_MAX_DEPTH) {
+    return parseError(parser, "Groups are nested too deeply");
+  }
+  int first = parseSequence(parser);
+  if (first < 0) {
+    return -1;
+  }
+  int result = first;
+  if (parser->pos < parser->length && parser->pattern[parser->pos] == '|') {
+    result = newNode(parser, NODE_ALTERNATE);
+    if (result < 0) {
+      return -1;
+    }
+    appendNode(parser, result, first);
+    while (parser->pos < parser->length &&
+           parser->pattern[parser->pos] == '|') {
+      parser->pos++;
+      int next = parseSequence(parser);
+      if (next < 0) {
+        return -1;
+      }
+      appendNode(parser, result, next);
+    }
+  }
+  parser->depth--;
+  return result;
+}
+
+// ---------------------------------------------------------------------------
+// Compiling
+
+typedef struct {
+  struct Regex *regex;
+  Node *nodes;
+  RxProgram *program;
+  bool reversed;
+  bool tooLarge;
+} Compiler;
+
+static int emit(Compiler *compiler, RxOp op, int x, int y) {
+  RxProgram *program = compiler->program;
+  if (program->count >= REGEX_MAX_INSTS) {
+    compiler->tooLarge = true;
+    return program->count;
+  }
+  if (program->count + 1 > program->capacity) {
+    int oldCapacity = program->capacity;
+    program->capacity = GROW_CAPACITY(oldCapacity);
+    program->code =
+        GROW_ARRAY(RxInst, program->code, oldCapacity, program->capacity);
+  }
+  program->code[program->count] = (RxInst){op, x, y};
+  return program->count++;
+}
+
+// Points every instruction on a chain linked through x (or y) at target.
+static void patchChain(Compiler *compiler, int head, bool viaY, int target) {
+  RxInst *code = compiler->program->code;
+  while (head != -1 && !compiler->tooLarge) {
+    int next = viaY ? code[head].y : code[head].x;
+    if (viaY) {
+      code[head].y = target;
+    } else {
+      code[head].x = target;
+    }
+    head = next;
+  }
+}
+
+// Whether the node can match without consuming any input.
+static bool matchesEmpty(Compiler *compiler, int index) {
+  Node *node = &compiler->nodes[index];
+  switch (node->type) {
+  case NODE_EMPTY:
+  case NODE_ASSERT:
+    return true;
+  case NODE_SET:
+    return false;
+  case NODE_GROUP:
+    return matchesEmpty(compiler, node->child);
+  case NODE_CONCAT:
+    for (int child = node->child; child != -1;
+         child = compiler->nodes[child].next) {
+      if (!matchesEmpty(compiler, child)) {
+        return false;
+      }
+    }
+    return true;
+  case NODE_ALTERNATE:
+    for (int child = node->child; child != -1;
+         child = compiler->nodes[child].next) {
+      if (matchesEmpty(compiler, child)) {
+        return true;
+      }
+    }
+    return false;
+  case NODE_REPEAT:
+    return node->min == 0 || matchesEmpty(compiler, node->child);
+  }
+  return false;
+}
+
+static void compileNode(Compiler *compiler, int index) {
+  if (compiler->tooLarge) {
+    return;
+  }
+  Node *node = &compiler->nodes[index];
+  switch (node->type) {
+  case NODE_EMPTY:
+    break;
+  case NODE_SET: {
+    const uint8_t *set = compiler->regex->sets[node->value];
+    int members = 0;
+    int only = 0;
+    for (int byte = 0; byte < 256; byte++) {
+      if (hasByte(set, byte)) {
+        members++;
+        only = byte;
+      }
+    }
+    if (members == 1) {
+      emit(compiler, RX_BYTE, only, 0);
+    } else {
+      emit(compiler, RX_SET, node->value, 0);
+    }
+    break;
+  }
+  case NODE_ASSERT:
+    emit(compiler, RX_ASSERT, node->value, 0);
+    break;
+  case NODE_GROUP:
+    if (!compiler->reversed) {
+      emit(compiler, RX_SAVE, node->value * 2, 0);
+    }
+    compileNode(compiler, node->child);
+    if (!compiler->reversed) {
+      emit(compiler, RX_SAVE, node->value * 2 + 1, 0);
+    }
+    break;
+  case NODE_CONCAT:
+    if (compiler->reversed) {
+      for (int child = node->last; child != -1;
+           child = compiler->nodes[child].prev) {
+        compileNode(compiler, child);
+      }
+    } else {
+      for (int child = node->child; child != -1;
+           child = compiler->nodes[child].next) {
+        compileNode(compiler, child);
+      }
+    }
+    break;
+  case NODE_ALTERNATE: {
+    int exits = -1;
+    for (int child = node->child; child != -1;
+         child = compiler->nodes[child].next) {
+      if (compiler->nodes[child].next == -1) {
+        compileNode(compiler, child);
+        break;
+      }
+      int split = emit(compiler, RX_SPLIT, 0, 0);
+      compileNode(compiler, child);
+      exits = emit(compiler, RX_JMP, exits, 0);
+      if (!compiler->tooLarge) {
+        compiler->program->code[split].x = split + 1;
+        compiler->program->code[split].y = compiler->program->count;
+      }
+    }
+    patchChain(compiler, exits, false, compiler->program->count);
+    break;
+  }
+  case NODE_REPEAT: {
+    int child = node->child;
+    int min = node->min;
+    int max = node->max;
+    bool greedy = node->greedy;
+    if (max == -1 && (min > 0 || matchesEmpty(compiler, child))) {
+      // A star whose body can match empty compiles as (?:x+)?, as Go does.
+      // Looping back to the star's own split would end an empty pass
+      // through the body, and leaving the loop would only happen at the
+      // split's lowest priority.
+      int skip = -1;
+      if (min == 0) {
+        skip = emit(compiler, RX_SPLIT, 0, 0);
+        min = 1;
+      }
+      for (int i = 0; i < min - 1; i++) {
+        compileNode(compiler, child);
+      }
+      int loop = compiler->program->count;
+      compileNode(compiler, child);
+      int next = compiler->program->count + 1;
+      emit(compiler, RX_SPLIT, greedy ? loop : next, greedy ? next : loop);
+      if (skip != -1 && !compiler->tooLarge) {
+        int exit = compiler->program->count;
+        compiler->program->code[skip].x = greedy ? skip + 1 : exit;
+        compiler->program->code[skip].y = greedy ? exit : skip + 1;
+      }
+    } else if (max == -1) {
+      int split = emit(compiler, RX_SPLIT, 0, 0);
+      compileNode(compiler, child);
+      emit(compiler, RX_JMP, split, 0);
+      if (!compiler->tooLarge) {
+        int body = split + 1;
+        int exit = compiler->program->count;
+        compiler->program->code[split].x = greedy ? body : exit;
+        compiler->program->code[split].y = greedy ? exit : body;
+      }
+    } else {
+      for (int i = 0; i < min; i++) {
+        compileNode(compiler, child);
+      }
+      // Nested optionals, (x(x(x)?)?)?, all skipping to the same exit.
+      int splits = -1;
+      for (int i = min; i < max; i++) {
+        splits = emit(compiler, RX_SPLIT, 0, splits);
+        compileNode(compiler, child);
+      }
+      int exit = compiler->program->count;
+      RxInst *code = compiler->program->code;
+      while (splits != -1 && !compiler->tooLarge) {
+        int previous = code[splits].y;
+        code[splits].x = greedy ? splits + 1 : exit;
+        code[splits].y = greedy ? exit : splits + 1;
+        splits = previous;
+      }
+    }
+    break;
+  }
+  }
+}
+
+static void freeDfa(Dfa *dfa) {
+  for (int i = 0; i < dfa->count; i++) {
+    if (dfa->states[i].count > 0) {
+      FREE_ARRAY(int, dfa->states[i].pcs, dfa->states[i].count);
+    }
+  }
+  FREE_ARRAY(DfaState, dfa->states, dfa->capacity);
+  dfa->states = NULL;
+  dfa->count = 0;
+  dfa->capacity = 0;
+  for (int i = 0; i < DFA_BUCKETS; i++) {
+    dfa->buckets[i] = -1;
+  }
+  for (int i = 0; i < 8; i++) {
+    dfa->starts[i] = DFA_UNKNOWN;
+  }
+}
+
+static void initDfa(Dfa *dfa, RxProgram *program, bool longest,
+                    int pendingAssert) {
+  dfa->program = program;
+  dfa->longest = longest;
+  dfa->pendingAssert = pendingAssert;
+  dfa->states = NULL;
+  dfa->count = 0;
+  dfa->capacity = 0;
+  dfa->resets = 0;
+  freeDfa(dfa);
+}
+
+void freeRegexProgram(struct Regex *regex) {
+  if (regex == NULL) {
+    return;
+  }
+  freeDfa(&regex->forwardDfa);
+  freeDfa(&regex->reverseDfa);
+  FREE_ARRAY(ByteSet, regex->sets, regex->setCapacity);
+  FREE_ARRAY(RxInst, regex->forward.code, regex->forward.capacity);
+  FREE_ARRAY(RxInst, regex->reverse.code, regex->reverse.capacity);
+  if (regex->stack != NULL) {
+    int size = regex->scratchSize;
+    int slots = regex->groupCount * 2;
+    FREE_ARRAY(int, regex->stack, size * 4 + 4);
+    FREE_ARRAY(int, regex->sparse, size);
+    FREE_ARRAY(int, regex->dense, size);
+    FREE_ARRAY(int, regex->list, size);
+    for (int i = 0; i < 2; i++) {
+      FREE_ARRAY(int, regex->threads[i].pcs, size);
+      FREE_ARRAY(int, regex->threads[i].sparse, size);
+      FREE_ARRAY(int, regex->threads[i].captures, size * slots);
+    }
+    FREE_ARRAY(int, regex->work, slots);
+  }
+  FREE(struct Regex, regex);
+}
+
+static int *allocateInts(int count) {
+  int *ints = ALLOCATE(int, count);
+  memset(ints, 0, sizeof(int) * count);
+  return ints;
+}
+
+// Compiles a pattern, or returns NULL with an error message and the pattern
+// offset it refers to.
+static struct Regex *compileRegex(const char *pattern, int length,
+                                  const char **error, int *errorPos) {
+  struct Regex *regex = ALLOCATE(struct Regex, 1);
+  memset(regex, 0, sizeof(struct Regex));
+  regex->groupCount = 1;
+  regex->dfaUsable = true;
+  initDfa(&regex->forwardDfa, &regex->forward, false, ASSERT_TEXT_END);
+  initDfa(&regex->reverseDfa, &regex->reverse, true, ASSERT_TEXT_START);
+
+  Parser parser = {regex, pattern, length, 0, NULL, 0, 0, 0, NULL};
+  int root = parseAlternation(&parser);
+  if (root >= 0 && parser.pos < length) {
+    root = parseError(&parser, "Unbalanced )");
+  }
+
+  Compiler compiler = {regex, parser.nodes, &regex->forward, false, false};
+  if (root >= 0) {
+    // Unanchored searches start with a lazy loop over any byte, so the DFA
+    // tries every position in one pass and drops the loop once it matches.
+    ByteSet any;
+    memset(any, 0xFF, sizeof(any));
+    emit(&compiler, RX_SPLIT, 3, 1);
+    emit(&compiler, RX_SET, addSet(regex, any), 0);
+    emit(&compiler, RX_JMP, 0, 0);
+    regex->unanchoredStart = 0;
+    regex->anchoredStart = emit(&compiler, RX_SAVE, 0, 0);
+    compileNode(&compiler, root);
+    emit(&compiler, RX_SAVE, 1, 0);
+    emit(&compiler, RX_MATCH, 0, 0);
+
+    compiler.program = &regex->reverse;
+    compiler.reversed = true;
+    compileNode(&compiler, root);
+    emit(&compiler, RX_MATCH, 0, 0);
+    if (compiler.tooLarge) {
+      root = parseError(&parser, "Regex is too large");
+    }
+  }
+  FREE_ARRAY(Node, parser.nodes, parser.capacity);
+
+  if (root < 0) {
+    *error = parser.error;
+    *errorPos = parser.pos;
+    freeRegexProgram(regex);
+    return NULL;
+  }
+
+  for (int i = 0; i < regex->forward.count; i++) {
+    RxInst *inst = &regex->forward.code[i];
+    if (inst->op == RX_ASSERT && (inst->x == ASSERT_WORD_BOUNDARY ||
+                                  inst->x == ASSERT_NOT_WORD_BOUNDARY)) {
+      regex->dfaUsable = false;
+    }
+  }
+
+  int size = regex->forward.count > regex->reverse.count
+                 ? regex->forward.count
+                 : regex->reverse.count;
+  int slots = regex->groupCount * 2;
+  regex->scratchSize = size;
+  regex->stack = allocateInts(size * 4 + 4);
+  regex->sparse = allocateInts(size);
+  regex->dense = allocateInts(size);
+  regex->list = allocateInts(size);
+  for (int i = 0; i < 2; i++) {
+    regex->threads[i].pcs = allocateInts(size);
+    regex->threads[i].sparse = allocateInts(size);
+    regex->threads[i].captures = allocateInts(size * slots);
+  }
+  regex->work = allocateInts(slots);
+  return regex;
+}
+
+// ---------------------------------------------------------------------------
+// Lazy DFA
+
+static bool consumes(struct Regex *regex, RxInst *inst, int byte) {
+  if (inst->op == RX_BYTE) {
+    return inst->x == byte;
+  }
+  return inst->op == RX_SET && hasByte(regex->sets[inst->x], byte);
+}
+
+static bool assertionHolds(int kind, int flags) {
+  return kind == ASSERT_TEXT_START ? (flags & DFA_AT_START) != 0
+                                   : (flags & DFA_AT_END) != 0;
+}
+
+static void resetBuilder(struct Regex *regex) {
+  regex->denseCount = 0;
+  regex->listCount = 0;
+  regex->cut = false;
+}
+
+static bool builderSeen(struct Regex *regex, int pc) {
+  int index = regex->sparse[pc];
+  return index < regex->denseCount && regex->dense[index] == pc;
+}
+
+// Follows the empty transitions from pc in priority order, collecting the
+// instructions that consume a byte or match. Unless the DFA wants the
+// longest match, everything after a match has lower priority and is cut.
+static void addClosure(struct Regex *regex, Dfa *dfa, int pc, int flags) {
+  RxInst *code = dfa->program->code;
+  int top = 0;
+  regex->stack[top++] = pc;
+  while (top > 0 && !regex->cut) {
+    pc = regex->stack[--top];
+    if (builderSeen(regex, pc)) {
+      continue;
+    }
+    regex->sparse[pc] = regex->denseCount;
+    regex->dense[regex->denseCount++] = pc;
+
+    RxInst *inst = &code[pc];
+    switch (inst->op) {
+    case RX_JMP:
+      regex->stack[top++] = inst->x;
+      break;
+    case RX_SPLIT:
+      regex->stack[top++] = inst->y;
+      regex->stack[top++] = inst->x;
+      break;
+    case RX_SAVE:
+      regex->stack[top++] = pc + 1;
+      break;
+    case RX_ASSERT:
+      if (assertionHolds(inst->x, flags)) {
+        regex->stack[top++] = pc + 1;
+      } else if (inst->x == dfa->pendingAssert) {
+        regex->list[regex->listCount++] = pc;
+      }
+      break;
+    case RX_MATCH:
+      regex->list[regex->listCount++] = pc;
+      regex->cut = !dfa->longest;
+      break;
+    default:
+      regex->list[regex->listCount++] = pc;
+    }
+  }
+}
+
+static uint32_t hashState(const int *pcs, int count) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < count; i++) {
+    hash ^= (uint32_t)pcs[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Finds or adds the state for the builder's list. Returns DFA_GAVE_UP once
+// the cache is full.
+static int internState(struct Regex *regex, Dfa *dfa) {
+  int *pcs = regex->list;
+  int count = regex->listCount;
+  uint32_t bucket = hashState(pcs, count) & (DFA_BUCKETS - 1);
+  while (dfa->buckets[bucket] != -1) {
+    DfaState *state = &dfa->states[dfa->buckets[bucket]];
+    if (state->count == count &&
+        memcmp(state->pcs, pcs, sizeof(int) * count) == 0) {
+      return dfa->buckets[bucket];
+    }
+    bucket = (bucket + 1) & (DFA_BUCKETS - 1);
+  }
+  if (dfa->count >= DFA_MAX_STATES) {
+    return DFA_GAVE_UP;
+  }
+
+  if (dfa->count + 1 > dfa->capacity) {
+    int oldCapacity = dfa->capacity;
+    dfa->capacity = GROW_CAPACITY(oldCapacity);
+    dfa->states =
+        GROW_ARRAY(DfaState, dfa->states, oldCapacity, dfa->capacity);
+  }
+  int *copy = NULL;
+  if (count > 0) {
+    copy = ALLOCATE(int, count);
+    memcpy(copy, pcs, sizeof(int) * count);
+  }
+  DfaState *state = &dfa->states[dfa->count];
+  state->pcs = copy;
+  state->count = count;
+  state->matching = false;
+  for (int i = 0; i < count; i++) {
+    if (dfa->program->code[pcs[i]].op == RX_MATCH) {
+      state->matching = true;
+    }
+  }
+  for (int i = 0; i < 256; i++) {
+    state->next[i] = DFA_UNKNOWN;
+  }
+  dfa->buckets[bucket] = dfa->count;
+  return dfa->count++;
+}
+
+static int startState(struct Regex *regex, Dfa *dfa, int start, int flags,
+                      bool anchored) {
+  int key = flags | (anchored ? 4 : 0);
+  if (dfa->starts[key] == DFA_UNKNOWN) {
+    resetBuilder(regex);
+    addClosure(regex, dfa, start, flags);
+    dfa->starts[key] = internState(regex, dfa);
+  }
+  return dfa->starts[key];
+}
+
+static int stepState(struct Regex *regex, Dfa *dfa, int from, int byte) {
+  resetBuilder(regex);
+  DfaState *state = &dfa->states[from];
+  for (int i = 0; i < state->count; i++) {
+    RxInst *inst = &dfa->program->code[state->pcs[i]];
+    if (consumes(regex, inst, byte)) {
+      addClosure(regex, dfa, state->pcs[i] + 1, 0);
+    }
+  }
+  int next = internState(regex, dfa);
+  if (next >= 0) {
+    dfa->states[from].next[byte] = next;
+  }
+  return next;
+}
+
+// Whether the state matches when the scan stops at a text boundary, which
+// settles the assertions left pending for that boundary.
+static bool matchesAtBoundary(struct Regex *regex, Dfa *dfa, int index,
+                              int flags) {
+  DfaState *state = &dfa->states[index];
+  for (int i = 0; i < state->count; i++) {
+    RxInst *inst = &dfa->program->code[state->pcs[i]];
+    if (inst->op == RX_MATCH) {
+      return true;
+    }
+    if (inst->op == RX_ASSERT) {
+      resetBuilder(regex);
+      addClosure(regex, dfa, state->pcs[i] + 1, flags);
+      for (int j = 0; j < regex->listCount; j++) {
+        if (dfa->program->code[regex->list[j]].op == RX_MATCH) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+static int gaveUp(Dfa *dfa) {
+  freeDfa(dfa);
+  dfa->resets++;
+  return DFA_GAVE_UP;
+}
+
+// Returns where the leftmost-first match starting at or after from ends, -1
+// if there is none, or DFA_GAVE_UP.
+static int scanForward(struct Regex *regex, const uint8_t *text, int length,
+                       int from, bool anchored) {
+  Dfa *dfa = &regex->forwardDfa;
+  int flags = (from == 0 ? DFA_AT_START : 0) | (from == length ? DFA_AT_END : 0);
+  int state = startState(regex, dfa,
+                         anchored ? regex->anchoredStart
+                                  : regex->unanchoredStart,
+                         flags, anchored);
+  if (state < 0) {
+    return gaveUp(dfa);
+  }
+  int end = dfa->states[state].matching ? from : -1;
+  int i = from;
+  for (; i < length && dfa->states[state].count > 0; i++) {
+    int next = dfa->states[state].next[text[i]];
+    if (next == DFA_UNKNOWN) {
+      next = stepState(regex, dfa, state, text[i]);
+      if (next < 0) {
+        return gaveUp(dfa);
+      }
+    }
+    state = next;
+    if (dfa->states[state].matching) {
+      end = i + 1;
+    }
+  }
+  if (i == length && i > from &&
+      matchesAtBoundary(regex, dfa, state, DFA_AT_END)) {
+    end = length;
+  }
+  return end;
+}
+
+// Runs the reverse program backwards from end, returning the smallest start
+// no lower than floor, or DFA_GAVE_UP.
+static int scanReverse(struct Regex *regex, const uint8_t *text, int length,
+                       int end, int floor) {
+  Dfa *dfa = &regex->reverseDfa;
+  int flags = (end == 0 ? DFA_AT_START : 0) | (end == length ? DFA_AT_END : 0);
+  int state = startState(regex, dfa, 0, flags, true);
+  if (state < 0) {
+    return gaveUp(dfa);
+  }
+  int start = dfa->states[state].matching ? end : -1;
+  int i = end;
+  for (; i > floor && dfa->states[state].count > 0; i--) {
+    int byte = text[i - 1];
+    int next = dfa->states[state].next[byte];
+    if (next == DFA_UNKNOWN) {
+      next = stepState(regex, dfa, state, byte);
+      if (next < 0) {
+        return gaveUp(dfa);
+      }
+    }
+    state = next;
+    if (dfa->states[state].matching) {
+      start = i - 1;
+    }
+  }
+  if (i == 0 && end > 0 &&
+      matchesAtBoundary(regex, dfa, state, DFA_AT_START)) {
+    start = 0;
+  }
+  return start;
+}
+
+// ---------------------------------------------------------------------------
+// Pike VM
+
+static bool assertAt(int kind, const uint8_t *text, int length, int pos) {
+  switch (kind) {
+  case ASSERT_TEXT_START:
+    return pos == 0;
+  case ASSERT_TEXT_END:
+    return pos == length;
+  default: {
+    bool before = pos > 0 && isWordByte(text[pos - 1]);
+    bool after = pos < length && isWordByte(text[pos]);
+    if (kind == ASSERT_WORD_BOUNDARY) {
+      return before != after;
+    }
+    // Never inside a multi-byte character.
+    return before == after && (pos == length || (text[pos] & 0xC0) != 0x80);
+  }
+  }
+}
+
+// Adds the thread at pc and everything reachable from it without consuming,
+// in priority order. Captures are updated in place and restored on the way
+// out, so work is unchanged when this returns.
+static void addThread(struct Regex *regex, Threads *threads, int pc,
+                      const uint8_t *text, int length, int pos) {
+  RxInst *code = regex->forward.code;
+  int slots = regex->groupCount * 2;
+  int *work = regex->work;
+  int *stack = regex->stack;
+  int top = 0;
+  stack[top++] = pc;
+  stack[top++] = 0;
+  while (top > 0) {
+    int value = stack[--top];
+    int target = stack[--top];
+    if (target < 0) {
+      work[-target - 1] = value;
+      continue;
+    }
+    int index = threads->sparse[target];
+    if (index < threads->count && threads->pcs[index] == target) {
+      continue;
+    }
+    threads->sparse[target] = threads->count;
+    threads->pcs[threads->count] = target;
+    int *captures = &threads->captures[threads->count * slots];
+    threads->count++;
+
+    RxInst *inst = &code[target];
+    switch (inst->op) {
+    case RX_JMP:
+      stack[top++] = inst->x;
+      stack[top++] = 0;
+      break;
+    case RX_SPLIT:
+      stack[top++] = inst->y;
+      stack[top++] = 0;
+      stack[top++] = inst->x;
+      stack[top++] = 0;
+      break;
+    case RX_SAVE:
+      stack[top++] = -inst->x - 1;
+      stack[top++] = work[inst->x];
+      work[inst->x] = pos;
+      stack[top++] = target + 1;
+      stack[top++] = 0;
+      break;
+    case RX_ASSERT:
+      if (assertAt(inst->x, text, length, pos)) {
+        stack[top++] = target + 1;
+        stack[top++] = 0;
+      }
+      break;
+    default:
+      memcpy(captures, work, sizeof(int) * slots);
+    }
+  }
+}
+
+// Leftmost-first search with captures, consuming no further than limit.
+static bool pikeSearch(struct Regex *regex, const uint8_t *text, int length,
+                       int from, bool anchored, int limit, int *captures) {
+  RxInst *code = regex->forward.code;
+  int slots = regex->groupCount * 2;
+  Threads *current = &regex->threads[0];
+  Threads *next = &regex->threads[1];
+  current->count = 0;
+  for (int i = 0; i < slots; i++) {
+    regex->work[i] = -1;
+  }
+  addThread(regex, current,
+            anchored ? regex->anchoredStart : regex->unanchoredStart, text,
+            length, from);
+
+  bool matched = false;
+  for (int pos = from; current->count > 0; pos++) {
+    next->count = 0;
+    for (int i = 0; i < current->count; i++) {
+      RxInst *inst = &code[current->pcs[i]];
+      int *threadCaptures = &current->captures[i * slots];
+      if (inst->op == RX_MATCH) {
+        memcpy(captures, threadCaptures, sizeof(int) * slots);
+        matched = true;
+        break;
+      }
+      if (pos < limit && consumes(regex, inst, text[pos])) {
+        memcpy(regex->work, threadCaptures, sizeof(int) * slots);
+        addThread(regex, next, current->pcs[i] + 1, text, length, pos + 1);
+      }
+    }
+    if (pos >= limit) {
+      break;
+    }
+    Threads *swap = current;
+    current = next;
+    next = swap;
+  }
+  return matched;
+}
+
+// Finds the leftmost-first match at or after from, filling captures with byte
+// offsets, -1 for groups that took no part.
+static bool regexSearch(struct Regex *regex, const uint8_t *text, int length,
+                        int from, bool anchored, int *captures) {
+  if (regex->dfaUsable && regex->forwardDfa.resets < DFA_MAX_RESETS &&
+      regex->reverseDfa.resets < DFA_MAX_RESETS) {
+    int end = scanForward(regex, text, length, from, anchored);
+    if (end == -1) {
+      return false;
+    }
+    if (end >= 0) {
+      int start = anchored ? from : scanReverse(regex, text, length, end, from);
+      if (start >= 0) {
+        if (regex->groupCount == 1) {
+          captures[0] = start;
+          captures[1] = end;
+          return true;
+        }
+        return pikeSearch(regex, text, length, start, true, end, captures);
+      }
+    }
+  }
+  return pikeSearch(regex, text, length, from, anchored, length, captures);
+}
+
+// ---------------------------------------------------------------------------
+// Natives
+
+static Value initRegexNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_ANY, ARG_STRING)) {
+    return NIL_VAL;
+  }
+  ObjRegex *regex = NULL;
+  if (IS_REGEX(args[0])) {
+    regex = AS_REGEX(args[0]);
+  } else if (IS_KLASS(args[0])) {
+    regex = newRegex(AS_KLASS(args[0]));
+  } else {
+    runtimeError("Unexpect base for Regex init.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  if (regex->program != NULL) {
+    runtimeError("Regex is already compiled.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+
+  push(OBJ_VAL(regex));
+  ObjString *pattern = AS_STRING(args[1]);
+  const char *error = NULL;
+  int errorPos = 0;
+  struct Regex *program =
+      compileRegex(pattern->chars, pattern->length, &error, &errorPos);
+  if (program == NULL) {
+    runtimeError("Invalid regex: %s at position %d.", error,
+                 utf8_char_index(pattern, errorPos));
+    vm.shouldPanic = true;
+    pop();
+    return NIL_VAL;
+  }
+  regex->program = program;
+  regex->pattern = pattern;
+  return pop();
+}
+
+bool recompileRegex(ObjRegex *regex) {
+  const char *error = NULL;
+  int errorPos = 0;
+  regex->program = compileRegex(regex->pattern->chars, regex->pattern->length,
+                                &error, &errorPos);
+  return regex->program != NULL;
+}
+
+static struct Regex *programOf(Value receiver) {
+  struct Regex *program = AS_REGEX(receiver)->program;
+  if (program == NULL) {
+    runtimeError("Regex is not compiled.");
+    vm.shouldPanic = true;
+  }
+  return program;
+}
+
+static bool searchString(struct Regex *program, ObjString *string, int from,
+                         bool anchored, int *captures) {
+  return regexSearch(program, (const uint8_t *)string->chars, string->length,
+                     from, anchored, captures);
+}
+
+static Value makeMatch(ObjString *string, struct Regex *program,
+                       const int *captures) {
+  ObjInstance *match = newInstance(vm.klass.match);
+  push(OBJ_VAL(match));
+  ObjList *groups = newList(vm.klass.list);
+  push(OBJ_VAL(groups));
+  defineNativeInstanceField(match, "groups", 6, OBJ_VAL(groups));
+  pop();
+  for (int group = 1; group < program->groupCount; group++) {
+    int start = captures[group * 2];
+    int end = captures[group * 2 + 1];
+    if (start < 0 || end < 0) {
+      pushToList(groups, NIL_VAL);
+      continue;
+    }
+    push(OBJ_VAL(sliceString(string, start, end - start)));
+    pushToList(groups, peek(0));
+    pop();
+  }
+  push(OBJ_VAL(sliceString(string, captures[0], captures[1] - captures[0])));
+  defineNativeInstanceField(match, "value", 5, peek(0));
+  pop();
+  defineNativeInstanceField(
+      match, "start", 5, NUMBER_VAL(utf8_char_index(string, captures[0])));
+  defineNativeInstanceField(match, "end", 3,
+                            NUMBER_VAL(utf8_char_index(string, captures[1])));
+  return pop();
+}
+
+// Where to continue after a match: past its end, or one character further
+// for an empty match so the scan always makes progress.
+static int nextSearchStart(ObjString *string, const int *captures) {
+  if (captures[1] > captures[0]) {
+    return captures[1];
+  }
+  if (captures[1] >= string->length) {
+    return string->length + 1;
+  }
+  return utf8_next_offset(string->chars, captures[1], string->length);
+}
+
+static Value testRegexNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_REGEX, ARG_STRING)) {
+    return NIL_VAL;
+  }
+  struct Regex *program = programOf(args[0]);
+  if (program == NULL) {
+    return NIL_VAL;
+  }
+  int captures[REGEX_MAX_GROUPS * 2];
+  return BOOL_VAL(
+      searchString(program, AS_STRING(args[1]), 0, false, captures));
+}
+
+static Value matchRegexNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_REGEX, ARG_STRING)) {
+    return NIL_VAL;
+  }
+  struct Regex *program = programOf(args[0]);
+  if (program == NULL) {
+    return NIL_VAL;
+  }
+  ObjString *string = AS_STRING(args[1]);
+  int captures[REGEX_MAX_GROUPS * 2];
+  if (!searchString(program, string, 0, true, captures)) {
+    return NIL_VAL;
+  }
+  return makeMatch(string, program, captures);
+}
+
+static Value searchRegexNative(int argCount, Value *args) {
+  if (argCount < 2 || argCount > 3) {
+    runtimeError("Expected 1 or 2 arguments but got %d.", argCount - 1);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  if (!checkArgs(argCount, argCount, args, NATIVE_NORMAL, ARG_REGEX,
+                 ARG_STRING, ARG_NUMBER)) {
+    return NIL_VAL;
+  }
+  struct Regex *program = programOf(args[0]);
+  if (program == NULL) {
+    return NIL_VAL;
+  }
+  ObjString *string = AS_STRING(args[1]);
+  int from = 0;
+  if (argCount == 3) {
+    double start = AS_NUMBER(args[2]);
+    int length = utf8_get_cached_length(string);
+    if (start < 0) {
+      start += length;
+    }
+    if (start < 0) {
+      start = 0;
+    }
+    if (start > length) {
+      return NIL_VAL;
+    }
+    from = utf8_char_offset(string, (int)start);
+  }
+  int captures[REGEX_MAX_GROUPS * 2];
+  if (!searchString(program, string, from, false, captures)) {
+    return NIL_VAL;
+  }
+  return makeMatch(string, program, captures);
+}
+
+static Value findAllRegexNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_REGEX, ARG_STRING)) {
+    return NIL_VAL;
+  }
+  struct Regex *program = programOf(args[0]);
+  if (program == NULL) {
+    return NIL_VAL;
+  }
+  ObjString *string = AS_STRING(args[1]);
+  ObjList *list = newList(vm.klass.list);
+  push(OBJ_VAL(list));
+  int captures[REGEX_MAX_GROUPS * 2];
+  int from = 0;
+  while (from <= string->length &&
+         searchString(program, string, from, false, captures)) {
+    push(OBJ_VAL(
+        sliceString(string, captures[0], captures[1] - captures[0])));
+    pushToList(list, peek(0));
+    pop();
+    from = nextSearchStart(string, captures);
+  }
+  return pop();
+}
+
+static Value splitRegexNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_REGEX, ARG_STRING)) {
+    return NIL_VAL;
+  }
+  struct Regex *program = programOf(args[0]);
+  if (program == NULL) {
+    return NIL_VAL;
+  }
+  ObjString *string = AS_STRING(args[1]);
+  ObjList *list = newList(vm.klass.list);
+  push(OBJ_VAL(list));
+  int captures[REGEX_MAX_GROUPS * 2];
+  int from = 0;
+  int pieceStart = 0;
+  while (from <= string->length &&
+         searchString(program, string, from, false, captures)) {
+    // Empty matches never split.
+    if (captures[1] > captures[0]) {
+      push(OBJ_VAL(sliceString(string, pieceStart, captures[0] - pieceStart)));
+      pushToList(list, peek(0));
+      pop();
+      pieceStart = captures[1];
+    }
+    from = nextSearchStart(string, captures);
+  }
+  push(OBJ_VAL(
+      sliceString(string, pieceStart, string->length - pieceStart)));
+  pushToList(list, peek(0));
+  pop();
+  return pop();
+}
+
+typedef struct {
+  char *chars;
+  int length;
+  int capacity;
+} Builder;
+
+static void appendChars(Builder *builder, const char *chars, int length) {
+  if (builder->length + length + 1 > builder->capacity) {
+    int oldCapacity = builder->capacity;
+    int capacity = GROW_CAPACITY(oldCapacity);
+    while (capacity < builder->length + length + 1) {
+      capacity *= 2;
+    }
+    builder->chars = GROW_ARRAY(char, builder->chars, oldCapacity, capacity);
+    builder->capacity = capacity;
+  }
+  memcpy(builder->chars + builder->length, chars, length);
+  builder->length += length;
+}
+
+// Expands $0-$9 and $$ in a replacement template.
+static bool appendTemplate(Builder *builder, ObjString *template,
+                           ObjString *string, struct Regex *program,
+                           const int *captures) {
+  const char *chars = template->chars;
+  int literal = 0;
+  for (int i = 0; i < template->length; i++) {
+    if (chars[i] != '$' || i + 1 >= template->length) {
+      continue;
+    }
+    char next = chars[i + 1];
+    if (next != '$' && !isdigit((unsigned char)next)) {
+      continue;
+    }
+    appendChars(builder, chars + literal, i - literal);
+    if (next == '$') {
+      appendChars(builder, "$", 1);
+    } else {
+      int group = next - '0';
+      if (group >= program->groupCount) {
+        runtimeError("Replacement refers to missing group $%d.", group);
+        vm.shouldPanic = true;
+        return false;
+      }
+      int start = captures[group * 2];
+      int end = captures[group * 2 + 1];
+      if (start >= 0 && end >= 0) {
+        appendChars(builder, string->chars + start, end - start);
+      }
+    }
+    i++;
+    literal = i + 1;
+  }
+  appendChars(builder, chars + literal, template->length - literal);
+  return true;
+}
+
+static Value replaceRegexNative(int argCount, Value *args) {
+  if (argCount < 3 || argCount > 4) {
+    runtimeError("Expected 2 or 3 arguments but got %d.", argCount - 1);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  if (!checkArgs(argCount, argCount, args, NATIVE_NORMAL, ARG_REGEX,
+                 ARG_STRING, ARG_ANY, ARG_NUMBER)) {
+    return NIL_VAL;
+  }
+  struct Regex *program = programOf(args[0]);
+  if (program == NULL) {
+    return NIL_VAL;
+  }
+  ObjString *string = AS_STRING(args[1]);
+  double limit = argCount == 4 ? AS_NUMBER(args[3]) : -1;
+
+  Builder builder = {NULL, 0, 0};
+  int captures[REGEX_MAX_GROUPS * 2];
+  int from = 0;
+  int copied = 0;
+  int replaced = 0;
+  bool ok = true;
+  while (ok && (limit < 0 || replaced < limit) && from <= string->length &&
+         searchString(program, string, from, false, captures)) {
+    appendChars(&builder, string->chars + copied, captures[0] - copied);
+    if (IS_STRING(args[2])) {
+      ok = appendTemplate(&builder, AS_STRING(args[2]), string, program,
+                          captures);
+    } else {
+      Value match = makeMatch(string, program, captures);
+      Value result;
+      ok = vmCallValue(args[2], 1, &match, &result);
+      if (ok && !IS_STRING(result)) {
+        runtimeError("Replacement function must return a string.");
+        vm.shouldPanic = true;
+        ok = false;
+      }
+      if (ok) {
+        push(result);
+        appendChars(&builder, AS_STRING(result)->chars,
+                    AS_STRING(result)->length);
+        pop();
+      }
+    }
+    copied = captures[1];
+    replaced++;
+    from = nextSearchStart(string, captures);
+  }
+  if (!ok) {
+    FREE_ARRAY(char, builder.chars, builder.capacity);
+    return NIL_VAL;
+  }
+  if (replaced == 0) {
+    FREE_ARRAY(char, builder.chars, builder.capacity);
+    return args[1];
+  }
+  appendChars(&builder, string->chars + copied, string->length - copied);
+  builder.chars =
+      GROW_ARRAY(char, builder.chars, builder.capacity, builder.length + 1);
+  builder.chars[builder.length] = '\0';
+  return OBJ_VAL(takeString(builder.chars, builder.length));
+}
+
+ObjKlass *createRegexClass() { return defineKlass("Regex", 5, OBJ_REGEX); }
+
+ObjKlass *createMatchClass() { return defineKlass("Match", 5, OBJ_INSTANCE); }
+
+void addRegexMethods(ObjKlass *regexKlass) {
+  defineNativeKlassMethod(regexKlass, "init", 4, initRegexNative);
+  defineNativeKlassMethod(regexKlass, "test", 4, testRegexNative);
+  defineNativeKlassMethod(regexKlass, "match", 5, matchRegexNative);
+  defineNativeKlassMethod(regexKlass, "search", 6, searchRegexNative);
+  defineNativeKlassMethod(regexKlass, "find_all", 8, findAllRegexNative);
+  defineNativeKlassMethod(regexKlass, "replace", 7, replaceRegexNative);
+  defineNativeKlassMethod(regexKlass, "split", 5, splitRegexNative);
+}
@@ -1,4 +1,5 @@
 #include "common_native.h"
+#include "native.h"
 
 struct NetworkData {
   char *response;
@@ -22,12 +23,18 @@ static size_t writeDataCallback(char *data, size_t size, size_t nmemb, void *cli
   return realsize;
 }
 
-static Value getRequestNative(int argCount, Value *args) {
-  if (!checkArgs(argCount, 3, args, NATIVE_NORMAL, ARG_ANY, ARG_STRING, ARG_LIST)) {
-    vm.shouldPanic = true;
-    return NIL_VAL;
-  };
+// Streams the response body straight into a rooted Bytes object.
+static size_t writeBytesCallback(char *data, size_t size, size_t nmemb,
+                                 void *clientp) {
+  size_t realsize = size * nmemb;
+  appendToBytes((ObjBytes *)clientp, (const uint8_t *)data, (int)realsize);
+  return realsize;
+}
 
+// Performs a GET, or a POST when body is not nil, and returns a pair of the
+// status code and the response as a string, or as Bytes when asBytes is set.
+static Value sendRequest(Value url, Value body, ObjList *headerList,
+                         bool asBytes) {
   CURL *curl = curl_easy_init();
   if (!curl) {
     vm.shouldPanic = true;
@@ -35,110 +42,112 @@ static Value getRequestNative(int argCount, Value *args) {
   }
 
   struct curl_slist *headers = NULL;
-
-  ObjList *list = AS_LIST(args[2]);
-  for (int i = 0; i < list->count; i++) {
-    Value item = list->items[i];
+  for (int i = 0; i < headerList->count; i++) {
+    Value item = headerList->items[i];
     if (!IS_STRING(item)) {
       vm.shouldPanic = true;
       runtimeError("Post header list must be strings only");
+      curl_slist_free_all(headers);
+      curl_easy_cleanup(curl);
       return NIL_VAL;
-    }    
+    }
     headers = curl_slist_append(headers, AS_CSTRING(item));
   }
 
+  if (!IS_NIL(body)) {
+    const uint8_t *data;
+    int length;
+    if (!asByteSpan(body, &data, &length)) {
+      runtimeError("Post body must be a string or bytes.");
+      vm.shouldPanic = true;
+      curl_slist_free_all(headers);
+      curl_easy_cleanup(curl);
+      return NIL_VAL;
+    }
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)length);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (const char *)data);
+  }
   if (headers != NULL) {
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
   }
 
   struct NetworkData chunk = {0};
+  ObjBytes *bytes = NULL;
   curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeDataCallback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-
-  curl_easy_setopt(curl, CURLOPT_URL, AS_CSTRING(args[1]));
+  if (asBytes) {
+    bytes = newBytes(vm.klass.bytes, 0);
+    push(OBJ_VAL(bytes));
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeBytesCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)bytes);
+  } else {
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeDataCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+  }
 
+  curl_easy_setopt(curl, CURLOPT_URL, AS_CSTRING(url));
 
   CURLcode res = curl_easy_perform(curl);
+  curl_slist_free_all(headers);
 
   if (res != CURLE_OK) {
     runtimeError("Error making get request.");
     vm.shouldPanic = true;
+    free(chunk.response);
+    curl_easy_cleanup(curl);
     return NIL_VAL;
   }
 
   long response_code;
   curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+  curl_easy_cleanup(curl);
 
   ObjInstance *pair = newInstance(vm.klass.pair);
   push(OBJ_VAL(pair));
   defineNativeInstanceField(pair, "status", 6, NUMBER_VAL((double)response_code));
-  defineNativeInstanceField(pair, "response", 8, OBJ_VAL(copyString(chunk.response, chunk.size, &vm.strings)));
+  if (asBytes) {
+    defineNativeInstanceField(pair, "response", 8, OBJ_VAL(bytes));
+  } else {
+    defineNativeInstanceField(pair, "response", 8, OBJ_VAL(copyString(chunk.response, chunk.size, &vm.strings)));
+    free(chunk.response);
+  }
+  pop();
+  if (asBytes) {
+    pop();
+  }
+  return OBJ_VAL(pair);
+}
 
-  free(chunk.response);
-  curl_easy_cleanup(curl);
-  curl_slist_free_all(headers);
-  return pop();
+static Value getRequestNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 3, args, NATIVE_NORMAL, ARG_ANY, ARG_STRING, ARG_LIST)) {
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  };
+  return sendRequest(args[1], NIL_VAL, AS_LIST(args[2]), false);
 }
 
 static Value postRequestNative(int argCount, Value *args) {
-  if (!checkArgs(argCount, 4, args, NATIVE_NORMAL, ARG_ANY, ARG_STRING, ARG_STRING, ARG_LIST)) {
+  if (!checkArgs(argCount, 4, args, NATIVE_NORMAL, ARG_ANY, ARG_STRING, ARG_ANY, ARG_LIST)) {
     vm.shouldPanic = true;
     return NIL_VAL;
   };
+  return sendRequest(args[1], args[2], AS_LIST(args[3]), false);
+}
 
-  CURL *curl = curl_easy_init();
-  if (!curl) {
+static Value getBytesRequestNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 3, args, NATIVE_NORMAL, ARG_ANY, ARG_STRING, ARG_LIST)) {
     vm.shouldPanic = true;
     return NIL_VAL;
-  }
-
-  struct curl_slist *headers = NULL;
-
-  ObjList *list = AS_LIST(args[3]);
-  for (int i = 0; i < list->count; i++) {
-    Value item = list->items[i];
-    if (!IS_STRING(item)) {
-      vm.shouldPanic = true;
-      runtimeError("Post header list must be strings only");
-      return NIL_VAL;
-    }    
-    headers = curl_slist_append(headers, AS_CSTRING(item));
-  }
-
-  struct NetworkData chunk = {0};
-  curl_easy_setopt(curl, CURLOPT_POST, 1L);
-  if (headers != NULL) {
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-  }
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, AS_CSTRING(args[2]));
-  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeDataCallback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-
-  curl_easy_setopt(curl, CURLOPT_URL, AS_CSTRING(args[1]));
-
-
-  CURLcode res = curl_easy_perform(curl);
+  };
+  return sendRequest(args[1], NIL_VAL, AS_LIST(args[2]), true);
+}
 
-  if (res != CURLE_OK) {
-    runtimeError("Error making get request.");
+static Value postBytesRequestNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 4, args, NATIVE_NORMAL, ARG_ANY, ARG_STRING, ARG_ANY, ARG_LIST)) {
     vm.shouldPanic = true;
     return NIL_VAL;
-  }
-
-  long response_code;
-  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-
-  ObjInstance *pair = newInstance(vm.klass.pair);
-  push(OBJ_VAL(pair));
-  defineNativeInstanceField(pair, "status", 6, NUMBER_VAL((double)response_code));
-  defineNativeInstanceField(pair, "response", 8, OBJ_VAL(copyString(chunk.response, chunk.size, &vm.strings)));
-
-  free(chunk.response);
-  curl_easy_cleanup(curl);
-  curl_slist_free_all(headers);
-  return pop();
+  };
+  return sendRequest(args[1], args[2], AS_LIST(args[3]), true);
 }
 
 void registerRequestNatives() {
@@ -152,4 +161,6 @@ void registerRequestNatives() {
       defineInstance(defineKlass("Request", 7, OBJ_INSTANCE), "Request", 7);
   defineNativeInstanceMethod(requestInstance, "get", 3, getRequestNative);
   defineNativeInstanceMethod(requestInstance, "post", 4, postRequestNative);
+  defineNativeInstanceMethod(requestInstance, "get_bytes", 9, getBytesRequestNative);
+  defineNativeInstanceMethod(requestInstance, "post_bytes", 10, postBytesRequestNative);
 }
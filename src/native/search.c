@@ -0,0 +1,182 @@
+#include "common_native.h"
+#include "native.h"
+
+// Substring search shared by the string and bytes natives. Needles shorter
+// than SEARCH_TWO_WAY_MIN are found with memchr on their first byte. Longer
+// ones use Crochemore-Perrin Two-Way, which is linear in the worst case,
+// combined with a bad-character shift on the window's last byte that skips
+// most of the text on typical input. Everything is length based, so NUL
+// bytes are ordinary characters.
+
+#define SEARCH_TWO_WAY_MIN 3
+
+// Computes the maximal suffix of the needle under one of the two byte
+// orderings, returning its start minus one and its period.
+static void maximalSuffix(const unsigned char *n, size_t l, bool reversed,
+                          size_t *split, size_t *period) {
+  size_t ip = (size_t)-1;
+  size_t jp = 0;
+  size_t k = 1;
+  size_t p = 1;
+  while (jp + k < l) {
+    unsigned char a = n[ip + k];
+    unsigned char b = n[jp + k];
+    if (a == b) {
+      if (k == p) {
+        jp += p;
+        k = 1;
+      } else {
+        k++;
+      }
+    } else if (reversed ? a < b : a > b) {
+      jp += k;
+      k = 1;
+      p = jp - ip;
+    } else {
+      ip = jp++;
+      k = p = 1;
+    }
+  }
+  *split = ip;
+  *period = p;
+}
+
+void compileNeedle(Needle *needle, const char *chars, int length) {
+  needle->chars = (const unsigned char *)chars;
+  needle->length = length;
+  if (length < SEARCH_TWO_WAY_MIN) {
+    return;
+  }
+
+  const unsigned char *n = needle->chars;
+  size_t l = (size_t)length;
+  memset(needle->shift, 0, sizeof(needle->shift));
+  for (size_t i = 0; i < l; i++) {
+    needle->shift[n[i]] = (uint32_t)(i + 1);
+  }
+
+  size_t split, period, reverseSplit, reversePeriod;
+  maximalSuffix(n, l, false, &split, &period);
+  maximalSuffix(n, l, true, &reverseSplit, &reversePeriod);
+  if (reverseSplit + 1 > split + 1) {
+    split = reverseSplit;
+    period = reversePeriod;
+  }
+
+  if (memcmp(n, n + period, split + 1) != 0) {
+    // Not periodic: any mismatch allows a shift past the larger half.
+    needle->memory = 0;
+    period = (split > l - split - 1 ? split : l - split - 1) + 1;
+  } else {
+    needle->memory = l - period;
+  }
+  needle->split = split;
+  needle->period = period;
+}
+
+static int findShort(const Needle *needle, const char *haystack, int length,
+                     int from) {
+  const char *cursor = haystack + from;
+  const char *last = haystack + length - needle->length;
+  while (cursor <= last) {
+    cursor = memchr(cursor, needle->chars[0], last - cursor + 1);
+    if (cursor == NULL) {
+      return -1;
+    }
+    if (needle->length == 1 || (unsigned char)cursor[1] == needle->chars[1]) {
+      return (int)(cursor - haystack);
+    }
+    cursor++;
+  }
+  return -1;
+}
+
+int findNeedle(const Needle *needle, const char *haystack, int length,
+               int from) {
+  if (from < 0) {
+    from = 0;
+  }
+  if (needle->length == 0) {
+    return from <= length ? from : -1;
+  }
+  if (from > length || length - from < needle->length) {
+    return -1;
+  }
+  if (needle->length < SEARCH_TWO_WAY_MIN) {
+    return findShort(needle, haystack, length, from);
+  }
+
+  const unsigned char *n = needle->chars;
+  const unsigned char *h = (const unsigned char *)haystack + from;
+  const unsigned char *end = (const unsigned char *)haystack + length;
+  size_t l = (size_t)needle->length;
+  size_t ms = needle->split;
+  size_t mem = 0;
+  size_t k;
+
+  while ((size_t)(end - h) >= l) {
+    // Bad character shift on the window's last byte.
+    uint32_t shift = needle->shift[h[l - 1]];
+    if (shift == 0) {
+      h += l;
+      mem = 0;
+      continue;
+    }
+    k = l - shift;
+    if (k) {
+      if (k < mem) {
+        k = mem;
+      }
+      h += k;
+      mem = 0;
+      continue;
+    }
+
+    // Right half, then left half down to what the last shift proved.
+    for (k = ms + 1 > mem ? ms + 1 : mem; k < l && n[k] == h[k]; k++)
+      ;
+    if (k < l) {
+      h += k - ms;
+      mem = 0;
+      continue;
+    }
+    for (k = ms + 1; k > mem && n[k - 1] == h[k - 1]; k--)
+      ;
+    if (k <= mem) {
+      return (int)((const char *)h - haystack);
+    }
+    h += needle->period;
+    mem = needle->memory;
+  }
+  return -1;
+}
+
+int findLastNeedle(const Needle *needle, const char *haystack, int length) {
+  int l = needle->length;
+  if (l == 0) {
+    return length;
+  }
+  if (length < l) {
+    return -1;
+  }
+
+  // Horspool run backwards: align the window's first byte with its nearest
+  // other occurrence in the needle.
+  int shift[256];
+  for (int c = 0; c < 256; c++) {
+    shift[c] = l;
+  }
+  for (int i = l - 1; i > 0; i--) {
+    shift[needle->chars[i]] = i;
+  }
+
+  for (int pos = length - l; pos >= 0;) {
+    unsigned char first = (unsigned char)haystack[pos];
+    if (first == needle->chars[0] &&
+        memcmp(haystack + pos + 1, needle->chars + 1, l - 1) == 0) {
+      return pos;
+    }
+    pos -= shift[first];
+  }
+  return -1;
+}
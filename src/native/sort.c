@@ -0,0 +1,505 @@
+#include "common_native.h"
+#include "native.h"
+
+// Lists shorter than this are insertion sorted; longer lists are cut into
+// runs of this size and merged bottom-up.
+#define SORT_RUN 32
+
+typedef enum {
+  ORDER_NUMBERS,
+  ORDER_STRINGS,
+} Ordering;
+
+static inline int compareStrings(ObjString *a, ObjString *b) {
+  int length = a->length < b->length ? a->length : b->length;
+  int result = memcmp(a->chars, b->chars, length);
+  if (result != 0) {
+    return result;
+  }
+  return a->length - b->length;
+}
+
+// NaN sorts after every other number so the order stays total.
+static inline bool numberLess(double a, double b) {
+  return a < b || (isnan(b) && !isnan(a));
+}
+
+#define NUMBER_LESS(a, b) numberLess(AS_NUMBER(a), AS_NUMBER(b))
+#define STRING_LESS(a, b) (compareStrings(AS_STRING(a), AS_STRING(b)) < 0)
+
+// Stable hybrid merge sort: already sorted or strictly descending input is
+// handled in one pass, short runs are insertion sorted, and neighbouring
+// runs that are already in order skip the merge. The merges need count
+// entries of scratch space; pass NULL to have one allocated.
+#define DEFINE_STABLE_SORT(name, type, LESS)                                   \
+  static void name##Merge(type *items, type *scratch, int lo, int mid,         \
+                          int hi) {                                            \
+    memcpy(scratch + lo, items + lo, sizeof(type) * (mid - lo));               \
+    int left = lo, right = mid, out = lo;                                      \
+    while (left < mid && right < hi) {                                         \
+      if (LESS(items[right], scratch[left])) {                                 \
+        items[out++] = items[right++];                                         \
+      } else {                                                                 \
+        items[out++] = scratch[left++];                                        \
+      }                                                                        \
+    }                                                                          \
+    while (left < mid) {                                                       \
+      items[out++] = scratch[left++];                                          \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void name(type *items, type *scratch, int count) {                    \
+    if (count < 2) {                                                           \
+      return;                                                                  \
+    }                                                                          \
+    int ascending = 1;                                                         \
+    while (ascending < count &&                                                \
+           !LESS(items[ascending], items[ascending - 1])) {                    \
+      ascending++;                                                             \
+    }                                                                          \
+    if (ascending == count) {                                                  \
+      return;                                                                  \
+    }                                                                          \
+    if (ascending == 1) {                                                      \
+      int descending = 1;                                                      \
+      while (descending < count &&                                             \
+             LESS(items[descending], items[descending - 1])) {                 \
+        descending++;                                                          \
+      }                                                                        \
+      if (descending == count) {                                               \
+        for (int i = 0, j = count - 1; i < j; i++, j--) {                      \
+          type tmp = items[i];                                                 \
+          items[i] = items[j];                                                 \
+          items[j] = tmp;                                                      \
+        }                                                                      \
+        return;                                                                \
+      }                                                                        \
+    }                                                                          \
+    for (int lo = 0; lo < count; lo += SORT_RUN) {                             \
+      int hi = lo + SORT_RUN < count ? lo + SORT_RUN : count;                  \
+      for (int i = lo + 1; i < hi; i++) {                                      \
+        type item = items[i];                                                  \
+        int j = i;                                                             \
+        while (j > lo && LESS(item, items[j - 1])) {                           \
+          items[j] = items[j - 1];                                             \
+          j--;                                                                 \
+        }                                                                      \
+        items[j] = item;                                                       \
+      }                                                                        \
+    }                                                                          \
+    if (count <= SORT_RUN) {                                                   \
+      return;                                                                  \
+    }                                                                          \
+    bool ownsScratch = scratch == NULL;                                        \
+    if (ownsScratch) {                                                         \
+      scratch = ALLOCATE(type, count);                                         \
+    }                                                                          \
+    for (int width = SORT_RUN; width < count; width *= 2) {                    \
+      for (int lo = 0; lo < count - width; lo += 2 * width) {                  \
+        int mid = lo + width;                                                  \
+        int hi = mid + width < count ? mid + width : count;                    \
+        if (LESS(items[mid], items[mid - 1])) {                                \
+          name##Merge(items, scratch, lo, mid, hi);                            \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    if (ownsScratch) {                                                         \
+      FREE_ARRAY(type, scratch, count);                                        \
+    }                                                                          \
+  }
+
+// The comparator or key list for the sort in progress. A comparator can run
+// arbitrary code, including another sort, so it is saved and restored.
+static Value sortComparator;
+static Value *sortKeys;
+
+static bool comparatorLess(Value a, Value b) {
+  if (vm.shouldPanic) {
+    return false;
+  }
+  Value pair[2] = {a, b};
+  Value result;
+  if (!vmCallValue(sortComparator, 2, pair, &result)) {
+    return false;
+  }
+  if (!IS_NUMBER(result)) {
+    runtimeError("Sort comparator must return a number.");
+    vm.shouldPanic = true;
+    return false;
+  }
+  return AS_NUMBER(result) < 0;
+}
+
+#define COMPARATOR_LESS(a, b) comparatorLess(a, b)
+#define KEY_NUMBER_LESS(a, b) NUMBER_LESS(sortKeys[a], sortKeys[b])
+#define KEY_STRING_LESS(a, b) STRING_LESS(sortKeys[a], sortKeys[b])
+
+DEFINE_STABLE_SORT(sortNumbers, Value, NUMBER_LESS)
+DEFINE_STABLE_SORT(sortStrings, Value, STRING_LESS)
+DEFINE_STABLE_SORT(sortWithComparator, Value, COMPARATOR_LESS)
+DEFINE_STABLE_SORT(sortByNumberKeys, int, KEY_NUMBER_LESS)
+DEFINE_STABLE_SORT(sortByStringKeys, int, KEY_STRING_LESS)
+
+static bool listOrdering(ObjList *list, Ordering *ordering) {
+  *ordering = ORDER_NUMBERS;
+  if (list->count == 0) {
+    return true;
+  }
+  if (IS_NUMBER(list->items[0])) {
+    for (int i = 1; i < list->count; i++) {
+      if (!IS_NUMBER(list->items[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (IS_STRING(list->items[0])) {
+    *ordering = ORDER_STRINGS;
+    for (int i = 1; i < list->count; i++) {
+      if (!IS_STRING(list->items[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+static bool checkOrdering(ObjList *list, Ordering *ordering) {
+  if (!listOrdering(list, ordering)) {
+    runtimeError("Can only order a list of numbers or a list of strings.");
+    vm.shouldPanic = true;
+    return false;
+  }
+  return true;
+}
+
+static bool checkComparable(Ordering ordering, Value value) {
+  if ((ordering == ORDER_NUMBERS && IS_NUMBER(value)) ||
+      (ordering == ORDER_STRINGS && IS_STRING(value))) {
+    return true;
+  }
+  runtimeError("Value is not comparable with the items in the list.");
+  vm.shouldPanic = true;
+  return false;
+}
+
+static inline bool orderedLess(Ordering ordering, Value a, Value b) {
+  return ordering == ORDER_NUMBERS ? NUMBER_LESS(a, b) : STRING_LESS(a, b);
+}
+
+static bool checkUnmodified(ObjList *list, int count) {
+  if (list->count != count) {
+    runtimeError("List was modified while being ordered.");
+    vm.shouldPanic = true;
+    return false;
+  }
+  return true;
+}
+
+static ObjList *copyList(ObjList *list) {
+  Value *items = ALLOCATE(Value, list->count + 1);
+  memcpy(items, list->items, sizeof(Value) * list->count);
+  return takeList(vm.klass.list, items, list->count);
+}
+
+// The comparator sorts a rooted copy, so a callback that mutates the list or
+// fails part way through never leaves it half sorted. While an item is being
+// inserted or merged it may be missing from the copy, so the scratch space
+// is a second rooted copy that keeps every item reachable until the end.
+static Value sortListWithComparator(ObjList *list, Value comparator) {
+  int count = list->count;
+  if (count < 2) {
+    return NIL_VAL;
+  }
+  ObjList *copy = copyList(list);
+  push(OBJ_VAL(copy));
+  ObjList *scratch = copyList(list);
+  push(OBJ_VAL(scratch));
+
+  Value savedComparator = sortComparator;
+  sortComparator = comparator;
+  sortWithComparator(copy->items, scratch->items, count);
+  sortComparator = savedComparator;
+  if (vm.shouldPanic || !checkUnmodified(list, count)) {
+    return NIL_VAL;
+  }
+  ensureListOwned(list);
+  memcpy(list->items, copy->items, sizeof(Value) * count);
+  pop();
+  pop();
+  return NIL_VAL;
+}
+
+static Value sortListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 1, args, NATIVE_VARIADIC, ARG_LIST)) {
+    return NIL_VAL;
+  }
+  if (argCount > 2) {
+    runtimeError("Expected at most 1 argument but got %d.", argCount - 1);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  if (argCount == 2) {
+    return sortListWithComparator(list, args[1]);
+  }
+  Ordering ordering;
+  if (!checkOrdering(list, &ordering)) {
+    return NIL_VAL;
+  }
+  ensureListOwned(list);
+  if (ordering == ORDER_NUMBERS) {
+    sortNumbers(list->items, NULL, list->count);
+  } else {
+    sortStrings(list->items, NULL, list->count);
+  }
+  return NIL_VAL;
+}
+
+// Computes each key once, then sorts indices by key and permutes the list.
+static Value sortByListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_LIST, ARG_ANY)) {
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  int count = list->count;
+  if (count < 2) {
+    return NIL_VAL;
+  }
+  ObjList *keys = newList(vm.klass.list);
+  push(OBJ_VAL(keys));
+  for (int i = 0; i < count; i++) {
+    Value key;
+    if (!vmCallValue(args[1], 1, &list->items[i], &key)) {
+      return NIL_VAL;
+    }
+    push(key);
+    pushToList(keys, key);
+    pop();
+    if (!checkUnmodified(list, count)) {
+      return NIL_VAL;
+    }
+  }
+  Ordering ordering;
+  if (!listOrdering(keys, &ordering)) {
+    runtimeError("Sort keys must all be numbers or all be strings.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+
+  int *order = ALLOCATE(int, count);
+  for (int i = 0; i < count; i++) {
+    order[i] = i;
+  }
+  sortKeys = keys->items;
+  if (ordering == ORDER_NUMBERS) {
+    sortByNumberKeys(order, NULL, count);
+  } else {
+    sortByStringKeys(order, NULL, count);
+  }
+  sortKeys = NULL;
+
+  ensureListOwned(list);
+  Value *sorted = ALLOCATE(Value, count);
+  for (int i = 0; i < count; i++) {
+    sorted[i] = list->items[order[i]];
+  }
+  memcpy(list->items, sorted, sizeof(Value) * count);
+  FREE_ARRAY(Value, sorted, count);
+  FREE_ARRAY(int, order, count);
+  pop();
+  return NIL_VAL;
+}
+
+static Value binarySearchListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_LIST, ARG_ANY)) {
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  Value target = args[1];
+  Ordering ordering;
+  if (!checkOrdering(list, &ordering)) {
+    return NIL_VAL;
+  }
+  if (list->count == 0) {
+    return NUMBER_VAL(-1);
+  }
+  if (!checkComparable(ordering, target)) {
+    return NIL_VAL;
+  }
+
+  // Lower bound, so the first of several equal items is found.
+  int lo = 0;
+  int hi = list->count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (orderedLess(ordering, list->items[mid], target)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < list->count && !orderedLess(ordering, target, list->items[lo])) {
+    return NUMBER_VAL(lo);
+  }
+  return NUMBER_VAL(-1);
+}
+
+// Stable: items the predicate accepts keep their order, and so does the rest.
+static Value partitionListByPredicate(ObjList *list, Value predicate) {
+  int count = list->count;
+  bool *accepted = ALLOCATE(bool, count);
+  for (int i = 0; i < count; i++) {
+    Value result;
+    if (!vmCallValue(predicate, 1, &list->items[i], &result) ||
+        !checkUnmodified(list, count)) {
+      FREE_ARRAY(bool, accepted, count);
+      return NIL_VAL;
+    }
+    accepted[i] = !isFalsey(result);
+  }
+  ensureListOwned(list);
+
+  Value *rest = ALLOCATE(Value, count);
+  int front = 0;
+  int restCount = 0;
+  for (int i = 0; i < count; i++) {
+    Value item = list->items[i];
+    if (accepted[i]) {
+      list->items[front++] = item;
+    } else {
+      rest[restCount++] = item;
+    }
+  }
+  memcpy(list->items + front, rest, sizeof(Value) * restCount);
+  FREE_ARRAY(Value, rest, count);
+  FREE_ARRAY(bool, accepted, count);
+  return NUMBER_VAL(front);
+}
+
+static Value partitionListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_LIST, ARG_ANY)) {
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  Value pivot = args[1];
+  if (!IS_NUMBER(pivot) && !IS_STRING(pivot)) {
+    return partitionListByPredicate(list, pivot);
+  }
+  Ordering ordering;
+  if (!checkOrdering(list, &ordering)) {
+    return NIL_VAL;
+  }
+  if (list->count == 0) {
+    return NUMBER_VAL(0);
+  }
+  if (!checkComparable(ordering, pivot)) {
+    return NIL_VAL;
+  }
+
+  // Stable: items below the pivot keep their order, and so does the rest.
+  ensureListOwned(list);
+  Value *rest = ALLOCATE(Value, list->count);
+  int below = 0;
+  int restCount = 0;
+  for (int i = 0; i < list->count; i++) {
+    Value item = list->items[i];
+    if (orderedLess(ordering, item, pivot)) {
+      list->items[below++] = item;
+    } else {
+      rest[restCount++] = item;
+    }
+  }
+  memcpy(list->items + below, rest, sizeof(Value) * restCount);
+  FREE_ARRAY(Value, rest, list->count);
+  return NUMBER_VAL(below);
+}
+
+static inline void swapValues(Value *items, int a, int b) {
+  Value tmp = items[a];
+  items[a] = items[b];
+  items[b] = tmp;
+}
+
+static Value nthElementListNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_LIST, ARG_NUMBER)) {
+    return NIL_VAL;
+  }
+  ObjList *list = AS_LIST(args[0]);
+  int n = AS_NUMBER(args[1]);
+  if (!isValidListIndex(list, n)) {
+    runtimeError("List index out of range.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  Ordering ordering;
+  if (!checkOrdering(list, &ordering)) {
+    return NIL_VAL;
+  }
+
+  // Quickselect with a median-of-three pivot. If the partitions keep coming
+  // out lopsided, sort the remaining window instead so the worst case stays
+  // O(n log n).
+  ensureListOwned(list);
+  Value *items = list->items;
+  int lo = 0;
+  int hi = list->count - 1;
+  int budget = 2;
+  for (int c = list->count; c > 1; c >>= 1) {
+    budget += 2;
+  }
+  while (hi - lo > SORT_RUN) {
+    if (budget-- == 0) {
+      break;
+    }
+    int mid = lo + (hi - lo) / 2;
+    if (orderedLess(ordering, items[mid], items[lo])) {
+      swapValues(items, mid, lo);
+    }
+    if (orderedLess(ordering, items[hi], items[lo])) {
+      swapValues(items, hi, lo);
+    }
+    if (orderedLess(ordering, items[hi], items[mid])) {
+      swapValues(items, hi, mid);
+    }
+    Value pivot = items[mid];
+    int i = lo;
+    int j = hi;
+    while (i <= j) {
+      while (orderedLess(ordering, items[i], pivot)) {
+        i++;
+      }
+      while (orderedLess(ordering, pivot, items[j])) {
+        j--;
+      }
+      if (i <= j) {
+        swapValues(items, i, j);
+        i++;
+        j--;
+      }
+    }
+    if (n <= j) {
+      hi = j;
+    } else if (n >= i) {
+      lo = i;
+    } else {
+      return items[n];
+    }
+  }
+  if (ordering == ORDER_NUMBERS) {
+    sortNumbers(items + lo, NULL, hi - lo + 1);
+  } else {
+    sortStrings(items + lo, NULL, hi - lo + 1);
+  }
+  return items[n];
+}
+
+void addListSortMethods(ObjKlass *listKlass) {
+  defineNativeKlassMethod(listKlass, "sort", 4, sortListNative);
+  defineNativeKlassMethod(listKlass, "sort_by", 7, sortByListNative);
+  defineNativeKlassMethod(listKlass, "binary_search", 13,
+                          binarySearchListNative);
+  defineNativeKlassMethod(listKlass, "partition", 9, partitionListNative);
+  defineNativeKlassMethod(listKlass, "nth_element", 11, nthElementListNative);
+}
@@ -121,6 +121,34 @@ static Value isMapNative(int argCount, Value *args) {
   return IS_MAP(args[1]) ? TRUE_VAL : FALSE_VAL;
 }
 
+static Value isSetNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_ANY, ARG_ANY)) {
+    return NIL_VAL;
+  };
+  return IS_SET(args[1]) ? TRUE_VAL : FALSE_VAL;
+}
+
+static Value isDequeNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_ANY, ARG_ANY)) {
+    return NIL_VAL;
+  };
+  return IS_DEQUE(args[1]) ? TRUE_VAL : FALSE_VAL;
+}
+
+static Value isBytesNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_ANY, ARG_ANY)) {
+    return NIL_VAL;
+  };
+  return IS_BYTES(args[1]) ? TRUE_VAL : FALSE_VAL;
+}
+
+static Value isRegexNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_ANY, ARG_ANY)) {
+    return NIL_VAL;
+  };
+  return IS_REGEX(args[1]) ? TRUE_VAL : FALSE_VAL;
+}
+
 static Value isBoolNative(int argCount, Value *args) {
   if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_ANY, ARG_ANY)) {
     return NIL_VAL;
@@ -177,6 +205,10 @@ void registerNatives() {
   defineNative("isclass", 7, isKlassNative);
   defineNative("islist", 6, isListNative);
   defineNative("ismap", 5, isMapNative);
+  defineNative("isset", 5, isSetNative);
+  defineNative("isdeque", 7, isDequeNative);
+  defineNative("isbytes", 7, isBytesNative);
+  defineNative("isregex", 7, isRegexNative);
   defineNative("isbool", 6, isBoolNative);
   defineNative("isnil", 5, isNilNative);
   defineNative("isfn", 4, isFuncNative);
@@ -0,0 +1,518 @@
+#include "common_native.h"
+#include "native.h"
+
+// Binary record packing in the spirit of Python's struct module. A format is
+// an optional byte order prefix followed by codes with optional repeat
+// counts, e.g. "<I2hd8s". Records are always packed without padding.
+
+#define STRUCT_MAX_FIELDS 128
+
+typedef struct {
+  char code;
+  int count; // repeat count, or the byte length for 's'
+} StructField;
+
+typedef struct {
+  bool bigEndian;
+  int fieldCount;
+  int size;       // bytes per record
+  int valueCount; // values read or written per record
+  StructField fields[STRUCT_MAX_FIELDS];
+} StructFormat;
+
+static bool hostIsBigEndian() {
+  const uint16_t probe = 1;
+  return *(const uint8_t *)&probe == 0;
+}
+
+static int codeSize(char code) {
+  switch (code) {
+  case 'x':
+  case 'b':
+  case 'B':
+  case '?':
+  case 's':
+    return 1;
+  case 'h':
+  case 'H':
+    return 2;
+  case 'i':
+  case 'I':
+  case 'l':
+  case 'L':
+  case 'f':
+    return 4;
+  case 'q':
+  case 'Q':
+  case 'd':
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+static bool parseFormat(ObjString *format, StructFormat *out) {
+  const char *c = format->chars;
+  const char *end = format->chars + format->length;
+  out->bigEndian = hostIsBigEndian();
+  out->fieldCount = 0;
+  out->size = 0;
+  out->valueCount = 0;
+
+  if (c < end) {
+    switch (*c) {
+    case '<':
+      out->bigEndian = false;
+      c++;
+      break;
+    case '>':
+    case '!':
+      out->bigEndian = true;
+      c++;
+      break;
+    case '=':
+    case '@':
+      c++;
+      break;
+    }
+  }
+
+  while (c < end) {
+    if (isspace((unsigned char)*c)) {
+      c++;
+      continue;
+    }
+    int count = 1;
+    if (isdigit((unsigned char)*c)) {
+      count = 0;
+      while (c < end && isdigit((unsigned char)*c)) {
+        count = count * 10 + (*c - '0');
+        if (count > INT_MAX / 16) {
+          runtimeError("Struct repeat count is too large.");
+          vm.shouldPanic = true;
+          return false;
+        }
+        c++;
+      }
+      if (c == end) {
+        runtimeError("Struct repeat count must be followed by a code.");
+        vm.shouldPanic = true;
+        return false;
+      }
+    }
+    int size = codeSize(*c);
+    if (size == 0) {
+      runtimeError("Unknown struct format code '%c'.", *c);
+      vm.shouldPanic = true;
+      return false;
+    }
+    if (out->fieldCount == STRUCT_MAX_FIELDS) {
+      runtimeError("Struct format is too long.");
+      vm.shouldPanic = true;
+      return false;
+    }
+    if (size * count > INT_MAX - out->size) {
+      runtimeError("Struct format is too large.");
+      vm.shouldPanic = true;
+      return false;
+    }
+    out->fields[out->fieldCount++] = (StructField){*c, count};
+    out->size += size * count;
+    if (*c == 's') {
+      out->valueCount++;
+    } else if (*c != 'x') {
+      out->valueCount += count;
+    }
+    c++;
+  }
+  return true;
+}
+
+static uint64_t loadUnsigned(const uint8_t *p, int size, bool bigEndian) {
+  uint64_t result = 0;
+  if (bigEndian) {
+    for (int i = 0; i < size; i++) {
+      result = (result << 8) | p[i];
+    }
+  } else {
+    for (int i = size - 1; i >= 0; i--) {
+      result = (result << 8) | p[i];
+    }
+  }
+  return result;
+}
+
+static void storeUnsigned(uint8_t *p, uint64_t value, int size,
+                          bool bigEndian) {
+  for (int i = 0; i < size; i++) {
+    uint8_t byte = (uint8_t)(value >> (8 * i));
+    p[bigEndian ? size - 1 - i : i] = byte;
+  }
+}
+
+// Decodes one numeric field. 's' and 'x' are handled by the callers.
+static double decodeNumber(char code, const uint8_t *p, bool bigEndian) {
+  uint64_t bits = loadUnsigned(p, codeSize(code), bigEndian);
+  switch (code) {
+  case 'b':
+    return (double)(int8_t)bits;
+  case 'h':
+    return (double)(int16_t)bits;
+  case 'i':
+  case 'l':
+    return (double)(int32_t)bits;
+  case 'q':
+    return (double)(int64_t)bits;
+  case 'f': {
+    uint32_t narrow = (uint32_t)bits;
+    float value;
+    memcpy(&value, &narrow, sizeof(value));
+    return value;
+  }
+  case 'd': {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+  default:
+    return (double)bits;
+  }
+}
+
+static bool encodeNumber(char code, Value value, uint8_t *p, bool bigEndian) {
+  if (code == '?') {
+    *p = isFalsey(value) ? 0 : 1;
+    return true;
+  }
+  if (!IS_NUMBER(value)) {
+    runtimeError("Struct value for '%c' must be a number.", code);
+    vm.shouldPanic = true;
+    return false;
+  }
+  double number = AS_NUMBER(value);
+  int size = codeSize(code);
+  if (code == 'f') {
+    float narrow = (float)number;
+    uint32_t bits;
+    memcpy(&bits, &narrow, sizeof(bits));
+    storeUnsigned(p, bits, size, bigEndian);
+    return true;
+  }
+  if (code == 'd') {
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    storeUnsigned(p, bits, size, bigEndian);
+    return true;
+  }
+
+  bool isSigned = code == 'b' || code == 'h' || code == 'i' || code == 'l' ||
+                  code == 'q';
+  double limit = ldexp(1.0, size * 8);
+  double min = isSigned ? -limit / 2 : 0;
+  double max = isSigned ? limit / 2 : limit;
+  if (number != trunc(number) || number < min || number >= max) {
+    runtimeError("Struct value for '%c' must be an integer in range.", code);
+    vm.shouldPanic = true;
+    return false;
+  }
+  uint64_t bits = isSigned ? (uint64_t)(int64_t)number : (uint64_t)number;
+  storeUnsigned(p, bits, size, bigEndian);
+  return true;
+}
+
+static bool readBuffer(Value buffer, const uint8_t **data, int *length) {
+  if (!asByteSpan(buffer, data, length)) {
+    runtimeError("Expected buffer to be bytes or a string.");
+    vm.shouldPanic = true;
+    return false;
+  }
+  return true;
+}
+
+static bool checkOffset(Value offset, int *out) {
+  if (!IS_NUMBER(offset) || AS_NUMBER(offset) < 0) {
+    runtimeError("Struct offset must be a non-negative number.");
+    vm.shouldPanic = true;
+    return false;
+  }
+  *out = (int)AS_NUMBER(offset);
+  return true;
+}
+
+static bool checkFits(int length, int offset, int size) {
+  if (offset > length || length - offset < size) {
+    runtimeError("Buffer too small for struct format.");
+    vm.shouldPanic = true;
+    return false;
+  }
+  return true;
+}
+
+// Appends one record's values to list.
+static void unpackRecord(StructFormat *format, const uint8_t *p,
+                         ObjList *list) {
+  for (int f = 0; f < format->fieldCount; f++) {
+    StructField field = format->fields[f];
+    if (field.code == 'x') {
+      p += field.count;
+      continue;
+    }
+    if (field.code == 's') {
+      Value string = OBJ_VAL(
+          copyString((const char *)p, field.count, &vm.strings));
+      push(string);
+      pushToList(list, string);
+      pop();
+      p += field.count;
+      continue;
+    }
+    int size = codeSize(field.code);
+    for (int i = 0; i < field.count; i++) {
+      double number = decodeNumber(field.code, p, format->bigEndian);
+      pushToList(list, field.code == '?' ? BOOL_VAL(number != 0)
+                                         : NUMBER_VAL(number));
+      p += size;
+    }
+  }
+}
+
+static Value packStructNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_VARIADIC, ARG_ANY, ARG_STRING)) {
+    return NIL_VAL;
+  }
+  StructFormat format;
+  if (!parseFormat(AS_STRING(args[1]), &format)) {
+    return NIL_VAL;
+  }
+  int given = argCount - 2;
+  if (given != format.valueCount) {
+    runtimeError("Struct format expects %d values but got %d.",
+                 format.valueCount, given);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+
+  ObjBytes *bytes = newBytes(vm.klass.bytes, format.size);
+  push(OBJ_VAL(bytes));
+  uint8_t *p = bytes->data;
+  Value *value = args + 2;
+  for (int f = 0; f < format.fieldCount; f++) {
+    StructField field = format.fields[f];
+    if (field.code == 'x') {
+      p += field.count;
+      continue;
+    }
+    if (field.code == 's') {
+      const uint8_t *data;
+      int length;
+      if (!asByteSpan(*value, &data, &length)) {
+        runtimeError("Struct value for 's' must be a string or bytes.");
+        vm.shouldPanic = true;
+        return NIL_VAL;
+      }
+      memcpy(p, data, length < field.count ? length : field.count);
+      p += field.count;
+      value++;
+      continue;
+    }
+    int size = codeSize(field.code);
+    for (int i = 0; i < field.count; i++) {
+      if (!encodeNumber(field.code, *value++, p, format.bigEndian)) {
+        return NIL_VAL;
+      }
+      p += size;
+    }
+  }
+  return pop();
+}
+
+static Value unpackStructNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 3, args, NATIVE_VARIADIC, ARG_ANY, ARG_STRING,
+                 ARG_ANY)) {
+    return NIL_VAL;
+  }
+  if (argCount > 4) {
+    runtimeError("Expected at most 3 arguments but got %d.", argCount - 1);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  StructFormat format;
+  const uint8_t *data;
+  int length;
+  int offset = 0;
+  if (!parseFormat(AS_STRING(args[1]), &format) ||
+      !readBuffer(args[2], &data, &length) ||
+      (argCount == 4 && !checkOffset(args[3], &offset)) ||
+      !checkFits(length, offset, format.size)) {
+    return NIL_VAL;
+  }
+  ObjList *record = newList(vm.klass.list);
+  push(OBJ_VAL(record));
+  unpackRecord(&format, data + offset, record);
+  return pop();
+}
+
+static bool checkTargets(StructFormat *format, ObjList *targets) {
+  if (targets->count != format->valueCount) {
+    runtimeError("Expected %d targets but got %d.", format->valueCount,
+                 targets->count);
+    vm.shouldPanic = true;
+    return false;
+  }
+  int t = 0;
+  for (int f = 0; f < format->fieldCount; f++) {
+    StructField field = format->fields[f];
+    if (field.code == 'x') {
+      continue;
+    }
+    int values = field.code == 's' ? 1 : field.count;
+    for (int i = 0; i < values; i++, t++) {
+      Value target = targets->items[t];
+      if (IS_LIST(target)) {
+        continue;
+      }
+      if (!IS_TYPED_ARRAY(target) || field.code == 's') {
+        runtimeError("Target %d must be a list%s.", t + 1,
+                     field.code == 's' ? "" : " or typed array");
+        vm.shouldPanic = true;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Decodes column by column into the caller's lists or typed arrays, so a
+// numeric column going into a typed array never boxes a value.
+static void unpackColumns(StructFormat *format, const uint8_t *data,
+                          int count, ObjList *targets) {
+  int t = 0;
+  int fieldOffset = 0;
+  for (int f = 0; f < format->fieldCount; f++) {
+    StructField field = format->fields[f];
+    if (field.code == 'x') {
+      fieldOffset += field.count;
+      continue;
+    }
+    int size = field.code == 's' ? field.count : codeSize(field.code);
+    int values = field.code == 's' ? 1 : field.count;
+    for (int i = 0; i < values; i++, t++) {
+      const uint8_t *p = data + fieldOffset + i * size;
+      Value target = targets->items[t];
+      if (IS_TYPED_ARRAY(target)) {
+        ObjTypedArray *array = AS_TYPED_ARRAY(target);
+        int base = array->count;
+        resizeTypedArray(array, base + count);
+        for (int r = 0; r < count; r++, p += format->size) {
+          storeToTypedArray(array, base + r,
+                            decodeNumber(field.code, p, format->bigEndian));
+        }
+        continue;
+      }
+      ObjList *list = AS_LIST(target);
+      for (int r = 0; r < count; r++, p += format->size) {
+        Value value;
+        if (field.code == 's') {
+          value = OBJ_VAL(
+              copyString((const char *)p, field.count, &vm.strings));
+        } else if (field.code == '?') {
+          value = BOOL_VAL(*p != 0);
+        } else {
+          value = NUMBER_VAL(decodeNumber(field.code, p, format->bigEndian));
+        }
+        push(value);
+        pushToList(list, value);
+        pop();
+      }
+    }
+    fieldOffset += size * values;
+  }
+}
+
+static Value unpackManyStructNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 4, args, NATIVE_VARIADIC, ARG_ANY, ARG_STRING,
+                 ARG_ANY, ARG_NUMBER)) {
+    return NIL_VAL;
+  }
+  if (argCount > 6) {
+    runtimeError("Expected at most 5 arguments but got %d.", argCount - 1);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  StructFormat format;
+  const uint8_t *data;
+  int length;
+  int offset = 0;
+  if (!parseFormat(AS_STRING(args[1]), &format) ||
+      !readBuffer(args[2], &data, &length) ||
+      (argCount >= 5 && !checkOffset(args[4], &offset))) {
+    return NIL_VAL;
+  }
+  if (format.size == 0) {
+    runtimeError("Struct format has no fields.");
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+  int count = (int)AS_NUMBER(args[3]);
+  if (count < 0) {
+    count = offset > length ? 0 : (length - offset) / format.size;
+  }
+  if (!checkFits(length, offset, 0) ||
+      (length - offset) / format.size < count) {
+    runtimeError("Buffer too small for %d records.", count);
+    vm.shouldPanic = true;
+    return NIL_VAL;
+  }
+
+  if (argCount == 6) {
+    if (!IS_LIST(args[5])) {
+      runtimeError("Expected argument 5 to be a list of targets.");
+      vm.shouldPanic = true;
+      return NIL_VAL;
+    }
+    ObjList *targets = AS_LIST(args[5]);
+    if (!checkTargets(&format, targets)) {
+      return NIL_VAL;
+    }
+    unpackColumns(&format, data + offset, count, targets);
+    return NUMBER_VAL(count);
+  }
+
+  ObjList *records = newList(vm.klass.list);
+  push(OBJ_VAL(records));
+  for (int r = 0; r < count; r++) {
+    ObjList *record = newList(vm.klass.list);
+    push(OBJ_VAL(record));
+    unpackRecord(&format, data + offset + r * format.size, record);
+    pushToList(records, OBJ_VAL(record));
+    pop();
+  }
+  return pop();
+}
+
+static Value calcsizeStructNative(int argCount, Value *args) {
+  if (!checkArgs(argCount, 2, args, NATIVE_NORMAL, ARG_ANY, ARG_STRING)) {
+    return NIL_VAL;
+  }
+  StructFormat format;
+  if (!parseFormat(AS_STRING(args[1]), &format)) {
+    return NIL_VAL;
+  }
+  return NUMBER_VAL(format.size);
+}
+
+void registerStructNatives() {
+  static bool isRegistered = false;
+  if (isRegistered)
+    return;
+  isRegistered = true;
+
+  ObjInstance *structInstance =
+      defineInstance(defineKlass("Struct", 6, OBJ_INSTANCE), "Struct", 6);
+  defineNativeInstanceMethod(structInstance, "pack", 4, packStructNative);
+  defineNativeInstanceMethod(structInstance, "unpack", 6, unpackStructNative);
+  defineNativeInstanceMethod(structInstance, "unpack_many", 11,
+                             unpackManyStructNative);
+  defineNativeInstanceMethod(structInstance, "calcsize", 8,
+                             calcsizeStructNative);
+}
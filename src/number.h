@@ -0,0 +1,22 @@
+#ifndef ghoul_number_h
+#define ghoul_number_h
+
+// Locale independent conversions between doubles and text, shared by
+// print, String(), asnum, JSON and the compiler.
+//
+// formatNumber writes the shortest digits that read back as the same
+// double, laid out like printf's %g with 15 digits of precision would lay
+// them out: integers up to 15 digits plainly, exponents beyond that as
+// "1.5e+20". It returns the length and NUL terminates the buffer.
+//
+// parseNumber reads an optionally signed decimal number, with an optional
+// fraction and exponent, or inf, infinity or nan, from the start of chars.
+// The result is correctly rounded. It returns the number of bytes read,
+// or 0 when chars does not start with a number.
+
+#define NUMBER_BUFFER_SIZE 32
+
+int formatNumber(double number, char *buffer);
+int parseNumber(const char *chars, int length, double *number);
+
+#endif
@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -16,8 +17,13 @@ static Obj *allocateObject(size_t size, ObjType type) {
   object->type = type;
   object->isMarked = false;
 
-  object->next = vm.objects;
-  vm.objects = object;
+  if (staging != NULL) {
+    object->next = staging->objects;
+    staging->objects = object;
+  } else {
+    object->next = vm.objects;
+    vm.objects = object;
+  }
 
 #ifdef DEBUG_LOG_GC
   printf("%p allocate %zu for %d\n", (void *)object, size, type);
@@ -91,6 +97,7 @@ ObjList *newList(ObjKlass *klass) {
   list->klass = klass;
   list->count = 0;
   list->capacity = 0;
+  list->backing = NULL;
   initTable(&list->fields);
   return list;
 }
@@ -101,6 +108,7 @@ ObjList *takeList(ObjKlass *klass, Value *values, int length) {
   list->klass = klass;
   list->count = length;
   list->capacity = length + 1;
+  list->backing = NULL;
   initTable(&list->fields);
   return list;
 }
@@ -121,7 +129,246 @@ ObjFile *newFile(ObjKlass *klass) {
   return file;
 }
 
+ObjSet *newSet(ObjKlass *klass) {
+  ObjSet *set = ALLOCATE_OBJ(ObjSet, OBJ_SET);
+  set->klass = klass;
+  initValueTable(&set->items);
+  initTable(&set->fields);
+  return set;
+}
+
+static size_t typedArrayElementSize(ArrayType type) {
+  return type == ARRAY_FLOAT64 ? sizeof(double) : sizeof(int32_t);
+}
+
+ObjTypedArray *newTypedArray(ObjKlass *klass, ArrayType type, int count) {
+  ObjTypedArray *array = ALLOCATE_OBJ(ObjTypedArray, OBJ_TYPED_ARRAY);
+  array->klass = klass;
+  array->type = type;
+  array->count = 0;
+  array->capacity = 0;
+  array->as.f64 = NULL;
+  initTable(&array->fields);
+  if (count > 0) {
+    push(OBJ_VAL(array));
+    resizeTypedArray(array, count);
+    pop();
+  }
+  return array;
+}
+
+void resizeTypedArray(ObjTypedArray *array, int count) {
+  size_t size = typedArrayElementSize(array->type);
+  if (count > array->capacity) {
+    int capacity = array->capacity;
+    while (capacity < count) {
+      capacity = GROW_CAPACITY(capacity);
+    }
+    array->as.f64 = reallocate(array->as.f64, size * array->capacity,
+                               size * capacity);
+    array->capacity = capacity;
+  }
+  if (count > array->count) {
+    memset((char *)array->as.f64 + size * array->count, 0,
+           size * (count - array->count));
+  }
+  array->count = count;
+}
+
+void pushToTypedArray(ObjTypedArray *array, double value) {
+  resizeTypedArray(array, array->count + 1);
+  storeToTypedArray(array, array->count - 1, value);
+}
+
+int32_t toInt32(double value) {
+  // Wrap like a two's complement store instead of hitting undefined
+  // behaviour for values outside the int32 range.
+  if (value >= INT32_MIN && value <= INT32_MAX) {
+    return (int32_t)value;
+  }
+  if (!isfinite(value)) {
+    return 0;
+  }
+  return (int32_t)(uint32_t)(int64_t)fmod(trunc(value), 4294967296.0);
+}
+
+bool isValidTypedArrayIndex(ObjTypedArray *array, int index) {
+  return index >= 0 && index < array->count;
+}
+
+ObjDeque *newDeque(ObjKlass *klass) {
+  ObjDeque *deque = ALLOCATE_OBJ(ObjDeque, OBJ_DEQUE);
+  deque->klass = klass;
+  deque->head = 0;
+  deque->count = 0;
+  deque->capacity = 0;
+  deque->items = NULL;
+  initTable(&deque->fields);
+  return deque;
+}
+
+static void growDeque(ObjDeque *deque) {
+  int capacity = GROW_CAPACITY(deque->capacity);
+  Value *items = ALLOCATE(Value, capacity);
+  // Unwrap into the new buffer so the front starts at index 0 again.
+  int first = deque->capacity - deque->head;
+  if (first > deque->count) {
+    first = deque->count;
+  }
+  if (deque->count > 0) {
+    memcpy(items, deque->items + deque->head, sizeof(Value) * first);
+    memcpy(items + first, deque->items,
+           sizeof(Value) * (deque->count - first));
+  }
+  FREE_ARRAY(Value, deque->items, deque->capacity);
+  deque->items = items;
+  deque->capacity = capacity;
+  deque->head = 0;
+}
+
+void pushDequeBack(ObjDeque *deque, Value value) {
+  if (deque->count == deque->capacity) {
+    growDeque(deque);
+  }
+  *dequeSlot(deque, deque->count) = value;
+  deque->count++;
+}
+
+void pushDequeFront(ObjDeque *deque, Value value) {
+  if (deque->count == deque->capacity) {
+    growDeque(deque);
+  }
+  deque->head = (deque->head - 1) & (deque->capacity - 1);
+  deque->items[deque->head] = value;
+  deque->count++;
+}
+
+Value popDequeBack(ObjDeque *deque) {
+  deque->count--;
+  return *dequeSlot(deque, deque->count);
+}
+
+Value popDequeFront(ObjDeque *deque) {
+  Value value = deque->items[deque->head];
+  deque->head = (deque->head + 1) & (deque->capacity - 1);
+  deque->count--;
+  return value;
+}
+
+bool isValidDequeIndex(ObjDeque *deque, int index) {
+  return index >= 0 && index < deque->count;
+}
+
+ObjBytes *newBytes(ObjKlass *klass, int length) {
+  ObjBytes *bytes = ALLOCATE_OBJ(ObjBytes, OBJ_BYTES);
+  bytes->klass = klass;
+  bytes->length = 0;
+  bytes->capacity = 0;
+  bytes->data = NULL;
+  initTable(&bytes->fields);
+  if (length > 0) {
+    push(OBJ_VAL(bytes));
+    reserveBytes(bytes, length);
+    memset(bytes->data, 0, length);
+    bytes->length = length;
+    pop();
+  }
+  return bytes;
+}
+
+ObjRegex *newRegex(ObjKlass *klass) {
+  ObjRegex *regex = ALLOCATE_OBJ(ObjRegex, OBJ_REGEX);
+  regex->klass = klass;
+  regex->pattern = NULL;
+  regex->program = NULL;
+  initTable(&regex->fields);
+  return regex;
+}
+
+void reserveBytes(ObjBytes *bytes, int capacity) {
+  if (bytes->capacity >= capacity) {
+    return;
+  }
+  int newCapacity = GROW_CAPACITY(bytes->capacity);
+  while (newCapacity < capacity) {
+    newCapacity = GROW_CAPACITY(newCapacity);
+  }
+  bytes->data =
+      GROW_ARRAY(uint8_t, bytes->data, bytes->capacity, newCapacity);
+  bytes->capacity = newCapacity;
+}
+
+void appendToBytes(ObjBytes *bytes, const uint8_t *data, int length) {
+  if (length == 0) {
+    return;
+  }
+  // data may point into this buffer (bytes.extend(bytes)).
+  ptrdiff_t aliased = -1;
+  if (data >= bytes->data && data < bytes->data + bytes->length) {
+    aliased = data - bytes->data;
+  }
+  reserveBytes(bytes, bytes->length + length);
+  if (aliased >= 0) {
+    data = bytes->data + aliased;
+  }
+  memmove(bytes->data + bytes->length, data, length);
+  bytes->length += length;
+}
+
+bool isValidBytesIndex(ObjBytes *bytes, int index) {
+  return index >= 0 && index < bytes->length;
+}
+
+static void reserveList(ObjList *list, int count) {
+  if (list->capacity >= count) {
+    return;
+  }
+  int oldCapacity = list->capacity;
+  int capacity = oldCapacity;
+  while (capacity < count) {
+    capacity = GROW_CAPACITY(capacity);
+  }
+  list->items = GROW_ARRAY(Value, list->items, oldCapacity, capacity);
+  list->capacity = capacity;
+}
+
+// Slices share their source's buffer instead of copying it. On the first
+// slice the buffer moves into a hidden storage list, and both the source and
+// the slice become views into it. Storage is never written to: a view copies
+// its own range out the first time it is modified.
+ObjList *sliceList(ObjList *list, int start, int end) {
+  if (start == end) {
+    return newList(vm.klass.list);
+  }
+  if (list->backing == NULL) {
+    ObjList *storage = newList(list->klass);
+    storage->items = list->items;
+    storage->count = list->count;
+    storage->capacity = list->capacity;
+    list->backing = storage;
+    list->capacity = 0;
+  }
+  ObjList *slice = newList(vm.klass.list);
+  slice->backing = list->backing;
+  slice->items = list->items + start;
+  slice->count = end - start;
+  return slice;
+}
+
+void ensureListOwned(ObjList *list) {
+  if (list->backing == NULL) {
+    return;
+  }
+  int capacity = GROW_CAPACITY(list->count);
+  Value *items = ALLOCATE(Value, capacity);
+  memcpy(items, list->items, sizeof(Value) * list->count);
+  list->items = items;
+  list->capacity = capacity;
+  list->backing = NULL;
+}
+
 void pushToList(ObjList *list, Value value) {
+  ensureListOwned(list);
   if (list->capacity < list->count + 1) {
     int oldCapacity = list->capacity;
     list->capacity = GROW_CAPACITY(oldCapacity);
@@ -133,6 +380,7 @@ void pushToList(ObjList *list, Value value) {
 }
 
 void storeToList(ObjList *list, int index, Value value) {
+  ensureListOwned(list);
   list->items[index] = value;
 }
 
@@ -140,16 +388,51 @@ Value indexFromList(ObjList *list, int index) { return list->items[index]; }
 
 void deleteFromList(ObjList *list, int start, int end) {
   int range = end - start + 1;
-
-  for (int i = start; i < list->count - range; i++) {
-    list->items[i] = list->items[i + range];
+  if (list->backing != NULL) {
+    // Trimming either end of a view only moves the window.
+    if (end == list->count - 1) {
+      list->count -= range;
+      return;
+    }
+    if (start == 0) {
+      list->items += range;
+      list->count -= range;
+      return;
+    }
+    ensureListOwned(list);
   }
+  memmove(list->items + start, list->items + end + 1,
+          sizeof(Value) * (list->count - end - 1));
+  list->count -= range;
+}
 
-  for (int i = list->count - range; i < list->count; i++) {
-    list->items[i] = NIL_VAL;
+void insertIntoList(ObjList *list, int index, Value *values, int count) {
+  if (count == 0) {
+    return;
   }
-
-  list->count -= range;
+  // values may point into this list's own buffer (list.extend(list)), which
+  // is about to be copied or grown, so track it as an offset.
+  ptrdiff_t aliased = -1;
+  if (values >= list->items && values < list->items + list->count) {
+    aliased = values - list->items;
+  }
+  ensureListOwned(list);
+  reserveList(list, list->count + count);
+  if (aliased >= 0) {
+    values = list->items + aliased;
+  }
+  memmove(list->items + index + count, list->items + index,
+          sizeof(Value) * (list->count - index));
+  if (aliased >= 0 && aliased + count > index) {
+    // Part of the source shifted along with the tail.
+    for (int i = 0; i < count; i++) {
+      int from = (int)aliased + i;
+      list->items[index + i] = list->items[from >= index ? from + count : from];
+    }
+  } else {
+    memcpy(list->items + index, values, sizeof(Value) * count);
+  }
+  list->count += count;
 }
 
 bool isValidListRange(ObjList *list, int start, int end) {
@@ -166,8 +449,17 @@ bool isValidListIndex(ObjList *list, int index) {
   return true;
 }
 
-ObjString *allocateString(char *chars, int length, uint32_t hash,
-                          Table *stringTable, ObjKlass *klass) {
+// A staged compile interns in its heap's tables in place of the VM's.
+static Table *internTable(Table *stringTable) {
+  if (staging == NULL) {
+    return stringTable;
+  }
+  return stringTable == &vm.useStrings ? &staging->useStrings
+                                       : &staging->strings;
+}
+
+static ObjString *newString(char *chars, int length, uint32_t hash,
+                            ObjKlass *klass) {
   ObjString *string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
   string->length = length;
   string->hash = hash;
@@ -177,28 +469,180 @@ ObjString *allocateString(char *chars, int length, uint32_t hash,
   
   string->char_length = -1;
   string->is_ascii = false;
+  string->char_offsets = NULL;
+  string->parent = NULL;
+  return string;
+}
 
+ObjString *allocateString(char *chars, int length, uint32_t hash,
+                          Table *stringTable, ObjKlass *klass) {
+  stringTable = internTable(stringTable);
+  ObjString *string = newString(chars, length, hash, klass);
+
+  if (staging != NULL) {
+    tableSet(stringTable, string, NIL_VAL);
+    return string;
+  }
   push(OBJ_VAL(string));
   tableSet(stringTable, string, NIL_VAL);
   pop();
   return string;
 }
 
-uint32_t hashString(const char *key, int length) {
-  uint32_t hash = 2166136261u;
-  for (int i = 0; i < length; i++) {
-    hash ^= (uint8_t)key[i];
-    hash *= 16777619;
+// String hashing is wyhash: eight bytes at a time through 64x64->128 bit
+// multiplies, keyed by a per-process seed so table collisions cannot be
+// computed ahead of time from outside the process.
+static const uint64_t hashSecret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL,
+    0x4d5a2da51de1aa47ULL};
+
+static void hashMultiply(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+  unsigned __int128 product = (unsigned __int128)*a * *b;
+  *a = (uint64_t)product;
+  *b = (uint64_t)(product >> 64);
+#else
+  uint64_t aHigh = *a >> 32, aLow = (uint32_t)*a;
+  uint64_t bHigh = *b >> 32, bLow = (uint32_t)*b;
+  uint64_t highHigh = aHigh * bHigh, highLow = aHigh * bLow;
+  uint64_t lowHigh = aLow * bHigh, lowLow = aLow * bLow;
+  uint64_t middle = (lowLow >> 32) + (uint32_t)highLow + (uint32_t)lowHigh;
+  *a = (middle << 32) | (uint32_t)lowLow;
+  *b = highHigh + (highLow >> 32) + (lowHigh >> 32) + (middle >> 32);
+#endif
+}
+
+static uint64_t hashMix(uint64_t a, uint64_t b) {
+  hashMultiply(&a, &b);
+  return a ^ b;
+}
+
+static uint64_t read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint64_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+void seedStringHash(uint64_t seed) {
+  vm.hashSeed = seed ^ hashMix(seed ^ hashSecret[0], hashSecret[1]);
+}
+
+uint64_t hashBytes(const void *key, size_t length, uint64_t seed) {
+  const uint8_t *p = (const uint8_t *)key;
+  size_t remaining = length;
+  uint64_t a, b;
+
+  if (remaining <= 16) {
+    if (remaining >= 4) {
+      size_t middle = (remaining >> 3) << 2;
+      a = (read32(p) << 32) | read32(p + middle);
+      b = (read32(p + remaining - 4) << 32) |
+          read32(p + remaining - 4 - middle);
+    } else if (remaining > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[remaining >> 1] << 8) |
+          p[remaining - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    if (remaining > 48) {
+      uint64_t lane1 = seed, lane2 = seed;
+      do {
+        seed = hashMix(read64(p) ^ hashSecret[1], read64(p + 8) ^ seed);
+        lane1 =
+            hashMix(read64(p + 16) ^ hashSecret[2], read64(p + 24) ^ lane1);
+        lane2 =
+            hashMix(read64(p + 32) ^ hashSecret[3], read64(p + 40) ^ lane2);
+        p += 48;
+        remaining -= 48;
+      } while (remaining > 48);
+      seed ^= lane1 ^ lane2;
+    }
+    while (remaining > 16) {
+      seed = hashMix(read64(p) ^ hashSecret[1], read64(p + 8) ^ seed);
+      p += 16;
+      remaining -= 16;
+    }
+    a = read64(p + remaining - 16);
+    b = read64(p + remaining - 8);
   }
-  return hash;
+
+  a ^= hashSecret[1];
+  b ^= seed;
+  hashMultiply(&a, &b);
+  return hashMix(a ^ hashSecret[0] ^ (uint64_t)length, b ^ hashSecret[1]);
+}
+
+uint32_t hashString(const char *key, int length) {
+  return (uint32_t)hashBytes(key, (size_t)length, vm.hashSeed);
 }
 
 ObjString *takeString(char *chars, int length) {
   uint32_t hash = hashString(chars, length);
+  ObjString *interned =
+      tableFindString(internTable(&vm.strings), chars, length, hash);
+
+  if (interned != NULL) {
+    FREE_ARRAY(char, chars, length + 1);
+    return interned;
+  }
   return allocateString(chars, length, hash, &vm.strings, vm.klass.string);
 }
 
+// Slices shorter than this are copied: a private buffer costs less than
+// keeping a possibly much larger parent alive.
+#define STRING_VIEW_MIN 16
+
+ObjString *sliceString(ObjString *string, int start, int length) {
+  if (start == 0 && length == string->length) {
+    return string;
+  }
+
+  const char *chars = string->chars + start;
+  uint32_t hash = hashString(chars, length);
+  ObjString *interned =
+      tableFindString(internTable(&vm.strings), chars, length, hash);
+
+  if (interned != NULL)
+    return interned;
+
+  if (length < STRING_VIEW_MIN) {
+    char *heapChars = ALLOCATE(char, length + 1);
+    memcpy(heapChars, chars, length);
+    heapChars[length] = '\0';
+    return allocateString(heapChars, length, hash, &vm.strings,
+                          vm.klass.string);
+  }
+
+  // Views always borrow from a string that owns its buffer, so chains of
+  // slices never keep intermediate views alive.
+  ObjString *owner = string->parent != NULL ? string->parent : string;
+  ObjString *view = allocateString((char *)chars, length, hash, &vm.strings,
+                                   vm.klass.string);
+  view->parent = owner;
+  return view;
+}
+
+char *stringCString(ObjString *string) {
+  if (string->parent != NULL) {
+    char *chars = ALLOCATE(char, string->length + 1);
+    memcpy(chars, string->chars, string->length);
+    chars[string->length] = '\0';
+    string->chars = chars;
+    string->parent = NULL;
+  }
+  return string->chars;
+}
+
 ObjString *copyString(const char *chars, int length, Table *stringTable) {
+  stringTable = internTable(stringTable);
   uint32_t hash = hashString(chars, length);
   ObjString *interned = tableFindString(stringTable, chars, length, hash);
 
@@ -211,6 +655,14 @@ ObjString *copyString(const char *chars, int length, Table *stringTable) {
   return allocateString(heapChars, length, hash, stringTable, vm.klass.string);
 }
 
+ObjString *copyUninternedString(const char *chars, int length,
+                                ObjKlass *klass) {
+  char *heapChars = ALLOCATE(char, length + 1);
+  memcpy(heapChars, chars, length);
+  heapChars[length] = '\0';
+  return newString(heapChars, length, hashString(heapChars, length), klass);
+}
+
 ObjString *copyEscString(const char *chars, int length, Table *stringTable,
                          ObjKlass *klass) {
   char escString[length];
@@ -237,6 +689,7 @@ ObjString *copyEscString(const char *chars, int length, Table *stringTable,
     }
     escString[escLen++] = c;
   }
+  stringTable = internTable(stringTable);
   uint32_t hash = hashString(escString, escLen);
   ObjString *interned = tableFindString(stringTable, escString, escLen, hash);
 
@@ -297,12 +750,93 @@ static void printMap(ObjMap *map) {
       printf(", ");
     }
 
-    printf("\"%s\":", entry.key->chars);
+    printf("\"%.*s\":", entry.key->length, entry.key->chars);
     printValue(entry.value);
   }
   printf("}");
 }
 
+static void printSet(ObjSet *set) {
+  printf("{");
+  bool first = true;
+  for (int i = valueTableNext(&set->items, 0); i != -1;
+       i = valueTableNext(&set->items, i + 1)) {
+    if (first) {
+      first = false;
+    } else {
+      printf(", ");
+    }
+
+    Value value = set->items.keys[i];
+    if (IS_STRING(value)) {
+      printf("'");
+      printValue(value);
+      printf("'");
+    } else {
+      printValue(value);
+    }
+  }
+  printf("}");
+}
+
+static void printTypedArray(ObjTypedArray *array) {
+  printf("[");
+  for (int i = 0; i < array->count; i++) {
+    printValue(NUMBER_VAL(indexFromTypedArray(array, i)));
+    if (i < array->count - 1) {
+      printf(", ");
+    }
+  }
+  printf("]");
+}
+
+static void printDeque(ObjDeque *deque) {
+  printf("[");
+  for (int i = 0; i < deque->count; i++) {
+    Value value = *dequeSlot(deque, i);
+    if (IS_STRING(value)) {
+      printf("'");
+      printValue(value);
+      printf("'");
+    } else {
+      printValue(value);
+    }
+    if (i < deque->count - 1) {
+      printf(", ");
+    }
+  }
+  printf("]");
+}
+
+static void printBytes(ObjBytes *bytes) {
+  printf("b'");
+  for (int i = 0; i < bytes->length; i++) {
+    uint8_t byte = bytes->data[i];
+    switch (byte) {
+    case '\n':
+      printf("\\n");
+      break;
+    case '\r':
+      printf("\\r");
+      break;
+    case '\t':
+      printf("\\t");
+      break;
+    case '\\':
+    case '\'':
+      printf("\\%c", byte);
+      break;
+    default:
+      if (byte >= 0x20 && byte < 0x7f) {
+        putchar(byte);
+      } else {
+        printf("\\x%02x", byte);
+      }
+    }
+  }
+  printf("'");
+}
+
 void printObject(Value value) {
   switch (OBJ_TYPE(value)) {
   case OBJ_BOUND_METHOD:
@@ -333,7 +867,7 @@ void printObject(Value value) {
     printMap(AS_MAP(value));
     break;
   case OBJ_STRING:
-    printf("%s", AS_CSTRING(value));
+    printf("%.*s", AS_STRING(value)->length, AS_STRING(value)->chars);
     break;
   case OBJ_UPVALUE:
     printf("<upvalue>");
@@ -341,5 +875,25 @@ void printObject(Value value) {
   case OBJ_FILE:
     printf("<instance '%s'>", AS_FILE(value)->klass->name->chars);
     break;
+  case OBJ_SET:
+    printSet(AS_SET(value));
+    break;
+  case OBJ_TYPED_ARRAY:
+    printTypedArray(AS_TYPED_ARRAY(value));
+    break;
+  case OBJ_DEQUE:
+    printDeque(AS_DEQUE(value));
+    break;
+  case OBJ_BYTES:
+    printBytes(AS_BYTES(value));
+    break;
+  case OBJ_REGEX:
+    if (AS_REGEX(value)->pattern == NULL) {
+      printf("<instance '%s'>", AS_REGEX(value)->klass->name->chars);
+    } else {
+      printf("<regex '%.*s'>", AS_REGEX(value)->pattern->length,
+             AS_REGEX(value)->pattern->chars);
+    }
+    break;
   }
 }
@@ -19,6 +19,11 @@
 #define IS_MAP(value) isObjType(value, OBJ_MAP)
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
 #define IS_FILE(value) isObjType(value, OBJ_FILE)
+#define IS_SET(value) isObjType(value, OBJ_SET)
+#define IS_TYPED_ARRAY(value) isObjType(value, OBJ_TYPED_ARRAY)
+#define IS_DEQUE(value) isObjType(value, OBJ_DEQUE)
+#define IS_BYTES(value) isObjType(value, OBJ_BYTES)
+#define IS_REGEX(value) isObjType(value, OBJ_REGEX)
 
 #define AS_BOUND_NATIVE(value) ((ObjBoundNative *)AS_OBJ(value))
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod *)AS_OBJ(value))
@@ -30,8 +35,13 @@
 #define AS_LIST(value) ((ObjList *)AS_OBJ(value))
 #define AS_MAP(value) ((ObjMap *)AS_OBJ(value))
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
-#define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
+#define AS_CSTRING(value) (stringCString(AS_STRING(value)))
 #define AS_FILE(value) ((ObjFile *)AS_OBJ(value))
+#define AS_SET(value) ((ObjSet *)AS_OBJ(value))
+#define AS_TYPED_ARRAY(value) ((ObjTypedArray *)AS_OBJ(value))
+#define AS_DEQUE(value) ((ObjDeque *)AS_OBJ(value))
+#define AS_BYTES(value) ((ObjBytes *)AS_OBJ(value))
+#define AS_REGEX(value) ((ObjRegex *)AS_OBJ(value))
 
 typedef enum {
   OBJ_BOUND_METHOD,
@@ -46,6 +56,11 @@ typedef enum {
   OBJ_STRING,
   OBJ_UPVALUE,
   OBJ_FILE,
+  OBJ_SET,
+  OBJ_TYPED_ARRAY,
+  OBJ_DEQUE,
+  OBJ_BYTES,
+  OBJ_REGEX,
 } ObjType;
 
 struct Obj {
@@ -86,6 +101,10 @@ struct ObjString {
   char *chars;
   int char_length;
   bool is_ascii;
+  int *char_offsets;
+  // Set when this is a view into another string's buffer; chars is then not
+  // NUL-terminated. Use stringCString() where C needs a terminated string.
+  struct ObjString *parent;
 };
 
 typedef struct ObjUpvalue {
@@ -120,12 +139,14 @@ typedef struct {
   ObjNative *native;
 } ObjBoundNative;
 
-typedef struct {
+typedef struct ObjList {
   Obj obj;
   ObjKlass *klass;
   int count;
   int capacity;
   Value *items;
+  // Set while items is a window into another list's buffer (see sliceList).
+  struct ObjList *backing;
   Table fields;
 } ObjList;
 
@@ -143,6 +164,66 @@ typedef struct {
   Table fields;
 } ObjFile;
 
+typedef struct {
+  Obj obj;
+  ObjKlass *klass;
+  ValueTable items;
+  Table fields;
+} ObjSet;
+
+typedef enum {
+  ARRAY_FLOAT64,
+  ARRAY_INT32,
+} ArrayType;
+
+typedef struct {
+  Obj obj;
+  ObjKlass *klass;
+  ArrayType type;
+  int count;
+  int capacity;
+  union {
+    double *f64;
+    int32_t *i32;
+  } as;
+  Table fields;
+} ObjTypedArray;
+
+// Ring buffer: items live at (head + i) & (capacity - 1), and capacity is
+// always zero or a power of two.
+typedef struct {
+  Obj obj;
+  ObjKlass *klass;
+  int head;
+  int count;
+  int capacity;
+  Value *items;
+  Table fields;
+} ObjDeque;
+
+// Mutable raw byte buffer. Unlike ObjString it is never hashed, interned or
+// NUL-terminated, so it can hold arbitrary binary data.
+typedef struct {
+  Obj obj;
+  ObjKlass *klass;
+  int length;
+  int capacity;
+  uint8_t *data;
+  Table fields;
+} ObjBytes;
+
+// Compiled regular expression. The program is owned by the object and built
+// once by the Regex initializer; see native/regex.c.
+struct Regex;
+
+typedef struct {
+  Obj obj;
+  ObjKlass *klass;
+  ObjString *pattern;
+  struct Regex *program;
+  Table fields;
+} ObjRegex;
+
 ObjBoundMethod *newBoundMethod(Value receiver, ObjClosure *method);
 ObjBoundNative *newBoundNative(Value receiver, ObjNative *native);
 ObjKlass *newKlass(ObjString *name, ObjType base);
@@ -154,10 +235,22 @@ ObjList *newList(ObjKlass *klass);
 ObjMap *newMap(ObjKlass *klass);
 ObjString *takeString(char *chars, int length);
 ObjString *copyString(const char *chars, int length, Table *stringTable);
+// A string left out of the intern table, so it is never shared with equal
+// strings, such as one carrying a String subclass.
+ObjString *copyUninternedString(const char *chars, int length,
+                                ObjKlass *klass);
+ObjString *sliceString(ObjString *string, int start, int length);
+char *stringCString(ObjString *string);
 ObjString *copyEscString(const char *chars, int length, Table *stringTable,
                          ObjKlass *klass);
 ObjUpvalue *newUpvalue(Value *slot);
 ObjFile *newFile(ObjKlass *klass);
+ObjSet *newSet(ObjKlass *klass);
+ObjTypedArray *newTypedArray(ObjKlass *klass, ArrayType type, int count);
+ObjDeque *newDeque(ObjKlass *klass);
+ObjBytes *newBytes(ObjKlass *klass, int length);
+ObjRegex *newRegex(ObjKlass *klass);
+void freeRegexProgram(struct Regex *program);
 void printObject(Value value);
 
 ObjList *takeList(ObjKlass *klass, Value *values, int length);
@@ -165,8 +258,25 @@ void pushToList(ObjList *list, Value value);
 void storeToList(ObjList *list, int index, Value value);
 Value indexFromList(ObjList *list, int index);
 void deleteFromList(ObjList *list, int start, int end);
+void insertIntoList(ObjList *list, int index, Value *values, int count);
+ObjList *sliceList(ObjList *list, int start, int end);
+void ensureListOwned(ObjList *list);
 bool isValidListRange(ObjList *list, int start, int end);
 bool isValidListIndex(ObjList *list, int index);
+void resizeTypedArray(ObjTypedArray *array, int count);
+void pushToTypedArray(ObjTypedArray *array, double value);
+int32_t toInt32(double value);
+bool isValidTypedArrayIndex(ObjTypedArray *array, int index);
+void pushDequeBack(ObjDeque *deque, Value value);
+void pushDequeFront(ObjDeque *deque, Value value);
+Value popDequeBack(ObjDeque *deque);
+Value popDequeFront(ObjDeque *deque);
+bool isValidDequeIndex(ObjDeque *deque, int index);
+void reserveBytes(ObjBytes *bytes, int capacity);
+void appendToBytes(ObjBytes *bytes, const uint8_t *data, int length);
+bool isValidBytesIndex(ObjBytes *bytes, int index);
+void seedStringHash(uint64_t seed);
+uint64_t hashBytes(const void *key, size_t length, uint64_t seed);
 uint32_t hashString(const char *key, int length);
 ObjString *allocateString(char *chars, int length, uint32_t hash,
                           Table *stringTable, ObjKlass *klass);
@@ -175,4 +285,22 @@ static inline bool isObjType(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+static inline double indexFromTypedArray(ObjTypedArray *array, int index) {
+  return array->type == ARRAY_FLOAT64 ? array->as.f64[index]
+                                      : (double)array->as.i32[index];
+}
+
+static inline Value *dequeSlot(ObjDeque *deque, int index) {
+  return &deque->items[(deque->head + index) & (deque->capacity - 1)];
+}
+
+static inline void storeToTypedArray(ObjTypedArray *array, int index,
+                                     double value) {
+  if (array->type == ARRAY_FLOAT64) {
+    array->as.f64[index] = value;
+  } else {
+    array->as.i32[index] = toInt32(value);
+  }
+}
+
 #endif
@@ -0,0 +1,1566 @@
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "memory.h"
+#include "optimizer.h"
+#include "vm.h"
+
+// The optimizer works on a function's finished bytecode rather than on a
+// syntax tree: the single pass compiler never builds one, and the bytecode
+// already says everything the passes need. The chunk is decoded into an
+// array of instructions whose jumps point at instruction indexes, split into
+// basic blocks, and checked to have one stack depth at every instruction.
+// Locals are just stack slots, so knowing the depth is what lets the passes
+// follow values in and out of them.
+//
+// The passes are, in order:
+//   constant propagation  constants held in slots are tracked across blocks,
+//                         and reading one becomes a constant load
+//   value numbering       within a block, reading a slot that holds a copy
+//                         of an earlier slot reads that slot instead, pure
+//                         operators on constants are folded, and a pure
+//                         expression whose value is already in a slot is
+//                         replaced by reading the slot
+//   dead stores           assignments to a slot that is never read again,
+//                         or that already holds the value, are removed
+// and the surviving instructions are encoded back into the chunk with their
+// jumps and lines fixed up. Slots captured by a closure can change behind
+// the function's back and are left alone. A function the decoder does not
+// fully understand, such as one using a generic for loop, is left as it is.
+//
+// The peephole pass runs on every function, with or without -O, and only
+// looks at neighbouring instructions, so it costs next to nothing. It drops
+// code no jump can reach, fuses a store and its pop, a nil and its return,
+// and a not and the conditional jump testing it, removes pushes that are
+// popped straight away, and threads jumps through the jumps they land on.
+
+#define SAME_NUMBER_DEPTH 16
+#define PEEPHOLE_ROUNDS 4
+#define THREAD_HOPS_MAX 8
+
+typedef struct {
+  uint8_t op;
+  int operand; // constant, slot, count, or jump target instruction
+  int argCount;
+  int length;
+  int offset;
+  int line;
+  int depth;
+  bool removed;
+} Instruction;
+
+typedef struct {
+  int start;
+  int end;
+  int depth;
+  int successors[2];
+  int successorCount;
+} Block;
+
+typedef enum {
+  SLOT_VARYING,
+  SLOT_CONSTANT,
+} SlotState;
+
+typedef struct {
+  SlotState state;
+  Value value;
+} SlotConstant;
+
+typedef enum {
+  NUMBER_OPAQUE,
+  NUMBER_CONSTANT,
+  NUMBER_EXPRESSION,
+} NumberKind;
+
+// A value number names a value that two stack slots can be proven to share.
+// Opaque numbers are only equal to themselves, constants to the same
+// constant, and expressions to the same operator on equal operands.
+typedef struct {
+  NumberKind kind;
+  Value value;
+  uint8_t op;
+  int left;
+  int right;
+} ValueNumber;
+
+// What is known about one stack slot while numbering a block. When pure,
+// the instructions from start to end compute it and nothing else, so they
+// can be removed.
+typedef struct {
+  int number;
+  int start;
+  int end;
+  bool pure;
+} StackEntry;
+
+typedef struct {
+  ObjFunction *function;
+  Chunk *chunk;
+  Instruction *code;
+  int count;
+  int *blockOf;
+  Block *blocks;
+  int blockCount;
+  int maxDepth;
+  bool *captured;
+  SlotConstant *slotConstants;
+  bool *seen;
+  ValueNumber *numbers;
+  int numberCount;
+  int numberCapacity;
+  StackEntry *stack;
+  bool changed;
+} Optimizer;
+
+static bool isFoldableInt(double number) {
+  return number > INT_MIN - 1.0 && number < INT_MAX + 1.0;
+}
+
+bool foldBinaryValues(uint8_t op, Value a, Value b, Value *result) {
+  if (op == OP_EQUAL || op == OP_BANG_EQUAL) {
+    *result = BOOL_VAL(valuesEqual(a, b) == (op == OP_EQUAL));
+    return true;
+  }
+  if (op == OP_CONCAT) {
+    if (!IS_STRING(a) || !IS_STRING(b)) {
+      return false;
+    }
+    ObjString *left = AS_STRING(a);
+    ObjString *right = AS_STRING(b);
+    int length = left->length + right->length;
+    char *chars = ALLOCATE(char, length + 1);
+    memcpy(chars, left->chars, left->length);
+    memcpy(chars + left->length, right->chars, right->length);
+    chars[length] = '\0';
+    *result = OBJ_VAL(takeString(chars, length));
+    return true;
+  }
+  if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+    return false;
+  }
+
+  double x = AS_NUMBER(a);
+  double y = AS_NUMBER(b);
+  switch (op) {
+  case OP_GREATER:
+    *result = BOOL_VAL(x > y);
+    return true;
+  case OP_GREATER_EQUAL:
+    *result = BOOL_VAL(x >= y);
+    return true;
+  case OP_LESS:
+    *result = BOOL_VAL(x < y);
+    return true;
+  case OP_LESS_EQUAL:
+    *result = BOOL_VAL(x <= y);
+    return true;
+  case OP_ADD:
+    *result = NUMBER_VAL(x + y);
+    return true;
+  case OP_SUBTRACT:
+    *result = NUMBER_VAL(x - y);
+    return true;
+  case OP_MULTIPLY:
+    *result = NUMBER_VAL(x * y);
+    return true;
+  case OP_DIVIDE:
+    *result = NUMBER_VAL(x / y);
+    return true;
+  case OP_MOD:
+    *result = NUMBER_VAL(fmod(x, y));
+    return true;
+  case OP_EXPONENTIATION:
+    *result = NUMBER_VAL(pow(x, y));
+    return true;
+  case OP_BITWISE_AND:
+  case OP_BITWISE_OR:
+  case OP_BITWISE_XOR:
+  case OP_BITWISE_LEFT_SHIFT:
+  case OP_BITWISE_RIGHT_SHIFT: {
+    // Only where the VM's int arithmetic is well defined.
+    if (!isFoldableInt(x) || !isFoldableInt(y)) {
+      return false;
+    }
+    int i = (int)x;
+    int j = (int)y;
+    if (op == OP_BITWISE_AND) {
+      *result = NUMBER_VAL((double)(i & j));
+    } else if (op == OP_BITWISE_OR) {
+      *result = NUMBER_VAL((double)(i | j));
+    } else if (op == OP_BITWISE_XOR) {
+      *result = NUMBER_VAL((double)(i ^ j));
+    } else if (j < 0 || j > 31) {
+      return false;
+    } else if (op == OP_BITWISE_RIGHT_SHIFT) {
+      *result = NUMBER_VAL((double)(i >> j));
+    } else if (i < 0 || ((int64_t)i << j) > INT_MAX) {
+      return false;
+    } else {
+      *result = NUMBER_VAL((double)(i << j));
+    }
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+bool foldUnaryValue(uint8_t op, Value operand, Value *result) {
+  if (op == OP_NOT) {
+    *result = BOOL_VAL(isFalsey(operand));
+    return true;
+  }
+  if (!IS_NUMBER(operand)) {
+    return false;
+  }
+  if (op == OP_NEGATE) {
+    *result = NUMBER_VAL(-AS_NUMBER(operand));
+    return true;
+  }
+  if (op == OP_BITWISE_NOT && isFoldableInt(AS_NUMBER(operand))) {
+    *result = NUMBER_VAL((double)~(int)AS_NUMBER(operand));
+    return true;
+  }
+  return false;
+}
+
+// Operators whose result depends only on their operands and is not a new
+// mutable object, so computing them again can be skipped.
+static bool isPureBinary(uint8_t op) {
+  switch (op) {
+  case OP_EQUAL:
+  case OP_BANG_EQUAL:
+  case OP_GREATER:
+  case OP_GREATER_EQUAL:
+  case OP_LESS:
+  case OP_LESS_EQUAL:
+  case OP_ADD:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_MOD:
+  case OP_EXPONENTIATION:
+  case OP_BITWISE_AND:
+  case OP_BITWISE_OR:
+  case OP_BITWISE_XOR:
+  case OP_BITWISE_LEFT_SHIFT:
+  case OP_BITWISE_RIGHT_SHIFT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool isPureUnary(uint8_t op) {
+  return op == OP_NOT || op == OP_NEGATE || op == OP_BITWISE_NOT;
+}
+
+static bool isGetLocal(uint8_t op) {
+  return op == OP_GET_LOCAL || op == OP_GET_LOCAL_SHORT;
+}
+
+static bool isSetLocal(uint8_t op) {
+  return op == OP_SET_LOCAL || op == OP_SET_LOCAL_SHORT;
+}
+
+static bool isJump(uint8_t op) {
+  return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE ||
+         op == OP_LOOP;
+}
+
+static bool isConditionalJump(uint8_t op) {
+  return op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE;
+}
+
+// Instructions that never continue to the one after them.
+static bool isTerminator(uint8_t op) {
+  return op == OP_JUMP || op == OP_LOOP || op == OP_RETURN ||
+         op == OP_RETURN_NIL;
+}
+
+static int readShort(uint8_t *code) { return (code[0] << 8) | code[1]; }
+
+static int readLong(uint8_t *code) {
+  return (code[0] << 16) | (code[1] << 8) | code[2];
+}
+
+// Fills in one instruction from the bytes at offset, returning false for
+// instructions the passes cannot reason about.
+static bool decodeInstruction(Chunk *chunk, int offset,
+                              Instruction *instruction) {
+  uint8_t *code = &chunk->code[offset];
+  instruction->op = code[0];
+  instruction->operand = 0;
+  instruction->argCount = 0;
+  instruction->length = 1;
+  instruction->offset = offset;
+  instruction->line = getLine(chunk, offset);
+  instruction->depth = -1;
+  instruction->removed = false;
+
+  switch (code[0]) {
+  case OP_NIL:
+  case OP_TRUE:
+  case OP_FALSE:
+  case OP_POP:
+  case OP_EQUAL:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_BANG_EQUAL:
+  case OP_GREATER_EQUAL:
+  case OP_LESS_EQUAL:
+  case OP_ADD:
+  case OP_CONCAT:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_MOD:
+  case OP_EXPONENTIATION:
+  case OP_NOT:
+  case OP_NEGATE:
+  case OP_BITWISE_NOT:
+  case OP_BITWISE_AND:
+  case OP_BITWISE_OR:
+  case OP_BITWISE_XOR:
+  case OP_BITWISE_LEFT_SHIFT:
+  case OP_BITWISE_RIGHT_SHIFT:
+  case OP_PRINT:
+  case OP_CLOSE_UPVALUE:
+  case OP_RETURN:
+  case OP_RETURN_NIL:
+  case OP_INHERIT:
+  case OP_INDEX_SUBSCR:
+  case OP_STORE_SUBSCR:
+  case OP_IN:
+    break;
+  case OP_CONSTANT:
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_SET_LOCAL_POP:
+  case OP_GET_GLOBAL:
+  case OP_DEFINE_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_GET_UPVALUE:
+  case OP_SET_UPVALUE:
+  case OP_GET_PROPERTY:
+  case OP_SET_PROPERTY:
+  case OP_GET_SUPER:
+  case OP_BUILD_STRING:
+  case OP_CALL:
+  case OP_CLASS:
+  case OP_PROPERTY:
+  case OP_BUILD_LIST:
+  case OP_BUILD_MAP:
+    instruction->operand = code[1];
+    instruction->length = 2;
+    break;
+  case OP_CONSTANT_SHORT:
+  case OP_GET_LOCAL_SHORT:
+  case OP_SET_LOCAL_SHORT:
+  case OP_GET_GLOBAL_SHORT:
+  case OP_DEFINE_GLOBAL_SHORT:
+  case OP_SET_GLOBAL_SHORT:
+  case OP_GET_UPVALUE_SHORT:
+  case OP_SET_UPVALUE_SHORT:
+  case OP_GET_PROPERTY_SHORT:
+  case OP_SET_PROPERTY_SHORT:
+  case OP_GET_SUPER_SHORT:
+  case OP_CALL_SHORT:
+  case OP_CLASS_SHORT:
+  case OP_PROPERTY_SHORT:
+  case OP_BUILD_LIST_SHORT:
+  case OP_BUILD_MAP_SHORT:
+    instruction->operand = readShort(&code[1]);
+    instruction->length = 3;
+    break;
+  case OP_CONSTANT_LONG:
+    instruction->operand = readLong(&code[1]);
+    instruction->length = 4;
+    break;
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_JUMP_IF_TRUE:
+    instruction->operand = offset + 4 + readLong(&code[1]);
+    instruction->length = 4;
+    break;
+  case OP_LOOP:
+    instruction->operand = offset + 4 - readLong(&code[1]);
+    instruction->length = 4;
+    break;
+  case OP_INVOKE:
+  case OP_SUPER_INVOKE:
+    instruction->operand = code[1];
+    instruction->argCount = code[2];
+    instruction->length = 3;
+    break;
+  case OP_INVOKE_SHORT:
+  case OP_SUPER_INVOKE_SHORT:
+    instruction->operand = readShort(&code[1]);
+    instruction->argCount = readShort(&code[3]);
+    instruction->length = 5;
+    break;
+  case OP_CLOSURE:
+  case OP_CLOSURE_SHORT: {
+    bool isShort = code[0] == OP_CLOSURE_SHORT;
+    if (offset + (isShort ? 3 : 2) > chunk->count) {
+      return false;
+    }
+    instruction->operand = isShort ? readShort(&code[1]) : code[1];
+    if (instruction->operand >= chunk->constants.count ||
+        !IS_FUNCTION(chunk->constants.values[instruction->operand])) {
+      return false;
+    }
+    ObjFunction *function =
+        AS_FUNCTION(chunk->constants.values[instruction->operand]);
+    instruction->length = (isShort ? 3 : 2) + function->upvalueCount * 3;
+    break;
+  }
+  default:
+    return false;
+  }
+  return offset + instruction->length <= chunk->count;
+}
+
+// Returns false for instructions the passes cannot follow. OP_IN leaves a
+// different number of values on the first pass of a loop than on the others,
+// and the instructions the peephole pass fuses never reach the passes, which
+// run first.
+static bool stackEffect(Instruction *instruction, int *pops, int *pushes) {
+  *pops = 0;
+  *pushes = 1;
+  switch (instruction->op) {
+  case OP_IN:
+  case OP_SET_LOCAL_POP:
+  case OP_RETURN_NIL:
+    return false;
+  case OP_POP:
+  case OP_DEFINE_GLOBAL:
+  case OP_DEFINE_GLOBAL_SHORT:
+  case OP_PRINT:
+  case OP_CLOSE_UPVALUE:
+  case OP_RETURN:
+    *pops = 1;
+    *pushes = 0;
+    break;
+  case OP_SET_LOCAL:
+  case OP_SET_LOCAL_SHORT:
+  case OP_SET_GLOBAL:
+  case OP_SET_GLOBAL_SHORT:
+  case OP_SET_UPVALUE:
+  case OP_SET_UPVALUE_SHORT:
+  case OP_GET_PROPERTY:
+  case OP_GET_PROPERTY_SHORT:
+  case OP_NOT:
+  case OP_NEGATE:
+  case OP_BITWISE_NOT:
+  case OP_JUMP_IF_FALSE:
+  case OP_JUMP_IF_TRUE:
+    *pops = 1;
+    break;
+  case OP_SET_PROPERTY:
+  case OP_SET_PROPERTY_SHORT:
+  case OP_GET_SUPER:
+  case OP_GET_SUPER_SHORT:
+  case OP_EQUAL:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_BANG_EQUAL:
+  case OP_GREATER_EQUAL:
+  case OP_LESS_EQUAL:
+  case OP_ADD:
+  case OP_CONCAT:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_MOD:
+  case OP_EXPONENTIATION:
+  case OP_BITWISE_AND:
+  case OP_BITWISE_OR:
+  case OP_BITWISE_XOR:
+  case OP_BITWISE_LEFT_SHIFT:
+  case OP_BITWISE_RIGHT_SHIFT:
+  case OP_INHERIT:
+  case OP_PROPERTY:
+  case OP_PROPERTY_SHORT:
+  case OP_INDEX_SUBSCR:
+    *pops = 2;
+    break;
+  case OP_STORE_SUBSCR:
+    *pops = 3;
+    break;
+  case OP_JUMP:
+  case OP_LOOP:
+    *pushes = 0;
+    break;
+  case OP_CALL:
+  case OP_CALL_SHORT:
+    *pops = instruction->operand + 1;
+    break;
+  case OP_INVOKE:
+  case OP_INVOKE_SHORT:
+    *pops = instruction->argCount + 1;
+    break;
+  case OP_SUPER_INVOKE:
+  case OP_SUPER_INVOKE_SHORT:
+    *pops = instruction->argCount + 2;
+    break;
+  case OP_BUILD_STRING:
+  case OP_BUILD_LIST:
+  case OP_BUILD_LIST_SHORT:
+  case OP_BUILD_MAP:
+  case OP_BUILD_MAP_SHORT:
+    *pops = instruction->operand;
+    break;
+  default:
+    break;
+  }
+  return true;
+}
+
+static bool decode(Optimizer *optimizer) {
+  Chunk *chunk = optimizer->chunk;
+  optimizer->code = ALLOCATE(Instruction, chunk->count);
+  int *instructionAt = ALLOCATE(int, chunk->count);
+  for (int offset = 0; offset < chunk->count; offset++) {
+    instructionAt[offset] = -1;
+  }
+
+  bool ok = true;
+  for (int offset = 0; offset < chunk->count;) {
+    Instruction *instruction = &optimizer->code[optimizer->count];
+    if (!decodeInstruction(chunk, offset, instruction)) {
+      ok = false;
+      break;
+    }
+    instructionAt[offset] = optimizer->count++;
+    offset += instruction->length;
+  }
+
+  for (int i = 0; ok && i < optimizer->count; i++) {
+    Instruction *instruction = &optimizer->code[i];
+    if (isJump(instruction->op)) {
+      int target = instruction->operand;
+      if (target < 0 || target >= chunk->count || instructionAt[target] < 0) {
+        ok = false;
+      } else {
+        instruction->operand = instructionAt[target];
+      }
+    }
+  }
+
+  FREE_ARRAY(int, instructionAt, chunk->count);
+  return ok && optimizer->count > 0;
+}
+
+static void findBlocks(Optimizer *optimizer) {
+  int count = optimizer->count;
+  Instruction *code = optimizer->code;
+  bool *leader = ALLOCATE(bool, count + 1);
+  memset(leader, 0, sizeof(bool) * (count + 1));
+  leader[0] = true;
+  for (int i = 0; i < count; i++) {
+    if (isJump(code[i].op)) {
+      leader[code[i].operand] = true;
+    }
+    if (isJump(code[i].op) || isTerminator(code[i].op)) {
+      leader[i + 1] = true;
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (leader[i]) {
+      optimizer->blockCount++;
+    }
+  }
+  optimizer->blocks = ALLOCATE(Block, optimizer->blockCount);
+  optimizer->blockOf = ALLOCATE(int, count);
+  int block = -1;
+  for (int i = 0; i < count; i++) {
+    if (leader[i]) {
+      block++;
+      optimizer->blocks[block].start = i;
+    }
+    optimizer->blocks[block].end = i + 1;
+    optimizer->blockOf[i] = block;
+  }
+  FREE_ARRAY(bool, leader, count + 1);
+
+  for (int b = 0; b < optimizer->blockCount; b++) {
+    Block *current = &optimizer->blocks[b];
+    Instruction *last = &code[current->end - 1];
+    current->successorCount = 0;
+    if (isJump(last->op)) {
+      current->successors[current->successorCount++] =
+          optimizer->blockOf[last->operand];
+    }
+    if (!isTerminator(last->op) && current->end < count) {
+      current->successors[current->successorCount++] = b + 1;
+    }
+  }
+}
+
+// Walks the reachable blocks recording the stack depth before every live
+// instruction. Fails when two paths reach a block with different depths or a
+// local is read outside the stack, which the passes would not survive.
+static bool computeDepths(Optimizer *optimizer) {
+  for (int b = 0; b < optimizer->blockCount; b++) {
+    optimizer->blocks[b].depth = -1;
+  }
+  for (int i = 0; i < optimizer->count; i++) {
+    optimizer->code[i].depth = -1;
+  }
+
+  int *worklist = ALLOCATE(int, optimizer->blockCount);
+  int pending = 0;
+  optimizer->blocks[0].depth = optimizer->function->arity + 1;
+  worklist[pending++] = 0;
+  int maxDepth = optimizer->blocks[0].depth;
+  bool ok = true;
+
+  while (ok && pending > 0) {
+    Block *block = &optimizer->blocks[worklist[--pending]];
+    int depth = block->depth;
+    for (int i = block->start; ok && i < block->end; i++) {
+      Instruction *instruction = &optimizer->code[i];
+      if (instruction->removed) {
+        continue;
+      }
+      instruction->depth = depth;
+      int pops, pushes;
+      if (!stackEffect(instruction, &pops, &pushes) || pops > depth ||
+          ((isGetLocal(instruction->op) || isSetLocal(instruction->op)) &&
+           instruction->operand >= depth)) {
+        ok = false;
+      }
+      depth += pushes - pops;
+      if (depth > maxDepth) {
+        maxDepth = depth;
+      }
+    }
+
+    for (int s = 0; ok && s < block->successorCount; s++) {
+      Block *next = &optimizer->blocks[block->successors[s]];
+      if (next->depth == -1) {
+        next->depth = depth;
+        worklist[pending++] = block->successors[s];
+      } else if (next->depth != depth) {
+        ok = false;
+      }
+    }
+  }
+  FREE_ARRAY(int, worklist, optimizer->blockCount);
+
+  // Rewriting only ever shortens what a block keeps on the stack, so the
+  // arrays sized by the first walk stay large enough.
+  if (optimizer->maxDepth == 0) {
+    optimizer->maxDepth = maxDepth + 1;
+  } else if (maxDepth + 1 > optimizer->maxDepth) {
+    ok = false;
+  }
+  return ok;
+}
+
+static bool findCaptured(Optimizer *optimizer) {
+  optimizer->captured = ALLOCATE(bool, optimizer->maxDepth);
+  memset(optimizer->captured, 0, sizeof(bool) * optimizer->maxDepth);
+
+  for (int i = 0; i < optimizer->count; i++) {
+    Instruction *instruction = &optimizer->code[i];
+    if ((instruction->op != OP_CLOSURE &&
+         instruction->op != OP_CLOSURE_SHORT) ||
+        instruction->depth < 0) {
+      continue;
+    }
+    ObjFunction *function = AS_FUNCTION(
+        optimizer->chunk->constants.values[instruction->operand]);
+    uint8_t *upvalue = &optimizer->chunk->code[instruction->offset +
+                                               (instruction->op == OP_CLOSURE
+                                                    ? 2
+                                                    : 3)];
+    for (int u = 0; u < function->upvalueCount; u++, upvalue += 3) {
+      int index = readShort(&upvalue[1]);
+      if (!upvalue[0]) {
+        continue;
+      }
+      // A local function captures its own slot, which is being pushed.
+      if (index > instruction->depth) {
+        return false;
+      }
+      optimizer->captured[index] = true;
+    }
+  }
+  return true;
+}
+
+static bool constantOf(Optimizer *optimizer, Instruction *instruction,
+                       Value *value) {
+  switch (instruction->op) {
+  case OP_CONSTANT:
+  case OP_CONSTANT_SHORT:
+  case OP_CONSTANT_LONG:
+    *value = optimizer->chunk->constants.values[instruction->operand];
+    return true;
+  case OP_NIL:
+    *value = NIL_VAL;
+    return true;
+  case OP_TRUE:
+    *value = BOOL_VAL(true);
+    return true;
+  case OP_FALSE:
+    *value = BOOL_VAL(false);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Turns an instruction into a load of value, reusing the constant table
+// entry when there is one.
+static bool loadConstant(Optimizer *optimizer, Instruction *instruction,
+                         Value value) {
+  if (IS_NIL(value)) {
+    instruction->op = OP_NIL;
+    instruction->length = 1;
+  } else if (IS_BOOL(value)) {
+    instruction->op = AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+    instruction->length = 1;
+  } else {
+    ValueArray *constants = &optimizer->chunk->constants;
+    int index = -1;
+    for (int i = 0; i < constants->count; i++) {
+      if (constants->values[i] == value) {
+        index = i;
+        break;
+      }
+    }
+    if (index == -1) {
+      if (constants->count > UINT24_MAX) {
+        return false;
+      }
+      index = addConstant(optimizer->chunk, value);
+    }
+    if (index > UINT16_MAX) {
+      instruction->op = OP_CONSTANT_LONG;
+      instruction->length = 4;
+    } else {
+      instruction->op = index > UINT8_MAX ? OP_CONSTANT_SHORT : OP_CONSTANT;
+      instruction->length = index > UINT8_MAX ? 3 : 2;
+    }
+    instruction->operand = index;
+  }
+  optimizer->changed = true;
+  return true;
+}
+
+static void loadLocal(Optimizer *optimizer, Instruction *instruction,
+                      int slot) {
+  instruction->op = slot > UINT8_MAX ? OP_GET_LOCAL_SHORT : OP_GET_LOCAL;
+  instruction->length = slot > UINT8_MAX ? 3 : 2;
+  instruction->operand = slot;
+  optimizer->changed = true;
+}
+
+static void removeRange(Optimizer *optimizer, int start, int end) {
+  for (int i = start; i < end; i++) {
+    optimizer->code[i].removed = true;
+  }
+  optimizer->changed = true;
+}
+
+static bool onlyRemovedBetween(Optimizer *optimizer, int start, int end) {
+  for (int i = start + 1; i < end; i++) {
+    if (!optimizer->code[i].removed) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static SlotConstant *blockConstants(Optimizer *optimizer, int block) {
+  return &optimizer->slotConstants[block * optimizer->maxDepth];
+}
+
+static void propagateConstants(Optimizer *optimizer, Block *block,
+                               SlotConstant *slots) {
+  for (int i = block->start; i < block->end; i++) {
+    Instruction *instruction = &optimizer->code[i];
+    if (instruction->removed) {
+      continue;
+    }
+    int depth = instruction->depth;
+    int slot = instruction->operand;
+    Value value;
+    if (constantOf(optimizer, instruction, &value)) {
+      slots[depth].state = SLOT_CONSTANT;
+      slots[depth].value = value;
+    } else if (isGetLocal(instruction->op)) {
+      slots[depth] = slots[slot];
+      if (optimizer->captured[slot]) {
+        slots[depth].state = SLOT_VARYING;
+      }
+    } else if (isSetLocal(instruction->op)) {
+      slots[slot] = slots[depth - 1];
+      if (optimizer->captured[slot]) {
+        slots[slot].state = SLOT_VARYING;
+      }
+    } else {
+      int pops, pushes;
+      stackEffect(instruction, &pops, &pushes);
+      SlotConstant result = {SLOT_VARYING, NIL_VAL};
+      // Concatenation would allocate, so it waits for value numbering.
+      if (isPureBinary(instruction->op) &&
+          slots[depth - 2].state == SLOT_CONSTANT &&
+          slots[depth - 1].state == SLOT_CONSTANT &&
+          foldBinaryValues(instruction->op, slots[depth - 2].value,
+                           slots[depth - 1].value, &value)) {
+        result.state = SLOT_CONSTANT;
+        result.value = value;
+      } else if (isPureUnary(instruction->op) &&
+                 slots[depth - 1].state == SLOT_CONSTANT &&
+                 foldUnaryValue(instruction->op, slots[depth - 1].value,
+                                &value)) {
+        result.state = SLOT_CONSTANT;
+        result.value = value;
+      }
+      for (int p = depth - pops; p < depth - pops + pushes; p++) {
+        slots[p] = result;
+      }
+    }
+  }
+}
+
+// Merges the slots a block leaves behind into a successor's entry state,
+// returning whether the entry state changed.
+static bool mergeConstants(Optimizer *optimizer, int block,
+                           SlotConstant *slots) {
+  SlotConstant *entry = blockConstants(optimizer, block);
+  int depth = optimizer->blocks[block].depth;
+  if (!optimizer->seen[block]) {
+    memcpy(entry, slots, sizeof(SlotConstant) * depth);
+    optimizer->seen[block] = true;
+    return true;
+  }
+  bool changed = false;
+  for (int p = 0; p < depth; p++) {
+    if (entry[p].state == SLOT_CONSTANT &&
+        (slots[p].state != SLOT_CONSTANT || slots[p].value != entry[p].value)) {
+      entry[p].state = SLOT_VARYING;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+static void analyzeConstants(Optimizer *optimizer) {
+  int maxDepth = optimizer->maxDepth;
+  optimizer->slotConstants =
+      ALLOCATE(SlotConstant, optimizer->blockCount * maxDepth);
+  optimizer->seen = ALLOCATE(bool, optimizer->blockCount);
+  memset(optimizer->seen, 0, sizeof(bool) * optimizer->blockCount);
+  SlotConstant *slots = ALLOCATE(SlotConstant, maxDepth);
+
+  SlotConstant *entry = blockConstants(optimizer, 0);
+  for (int p = 0; p < optimizer->blocks[0].depth; p++) {
+    entry[p].state = SLOT_VARYING;
+    entry[p].value = NIL_VAL;
+  }
+  optimizer->seen[0] = true;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b = 0; b < optimizer->blockCount; b++) {
+      Block *block = &optimizer->blocks[b];
+      if (!optimizer->seen[b]) {
+        continue;
+      }
+      memcpy(slots, blockConstants(optimizer, b),
+             sizeof(SlotConstant) * block->depth);
+      propagateConstants(optimizer, block, slots);
+      for (int s = 0; s < block->successorCount; s++) {
+        if (mergeConstants(optimizer, block->successors[s], slots)) {
+          changed = true;
+        }
+      }
+    }
+  }
+  FREE_ARRAY(SlotConstant, slots, maxDepth);
+}
+
+static int newNumber(Optimizer *optimizer, NumberKind kind) {
+  if (optimizer->numberCount == optimizer->numberCapacity) {
+    int oldCapacity = optimizer->numberCapacity;
+    optimizer->numberCapacity = GROW_CAPACITY(oldCapacity);
+    optimizer->numbers = GROW_ARRAY(ValueNumber, optimizer->numbers,
+                                    oldCapacity, optimizer->numberCapacity);
+  }
+  ValueNumber *number = &optimizer->numbers[optimizer->numberCount];
+  number->kind = kind;
+  number->value = NIL_VAL;
+  number->op = 0;
+  number->left = -1;
+  number->right = -1;
+  return optimizer->numberCount++;
+}
+
+static int constantNumber(Optimizer *optimizer, Value value) {
+  int number = newNumber(optimizer, NUMBER_CONSTANT);
+  optimizer->numbers[number].value = value;
+  return number;
+}
+
+static bool sameNumber(Optimizer *optimizer, int a, int b, int depth) {
+  if (a == b) {
+    return true;
+  }
+  if (a < 0 || b < 0) {
+    return false;
+  }
+  ValueNumber *x = &optimizer->numbers[a];
+  ValueNumber *y = &optimizer->numbers[b];
+  if (x->kind != y->kind || x->kind == NUMBER_OPAQUE) {
+    return false;
+  }
+  if (x->kind == NUMBER_CONSTANT) {
+    return x->value == y->value;
+  }
+  return depth < SAME_NUMBER_DEPTH && x->op == y->op &&
+         sameNumber(optimizer, x->left, y->left, depth + 1) &&
+         sameNumber(optimizer, x->right, y->right, depth + 1);
+}
+
+static void setEntry(StackEntry *entry, int number, int start, int end,
+                     bool pure) {
+  entry->number = number;
+  entry->start = start;
+  entry->end = end;
+  entry->pure = pure;
+}
+
+static void numberLoad(Optimizer *optimizer, int i) {
+  Instruction *instruction = &optimizer->code[i];
+  StackEntry *stack = optimizer->stack;
+  int slot = instruction->operand;
+  if (optimizer->captured[slot]) {
+    setEntry(&stack[instruction->depth], newNumber(optimizer, NUMBER_OPAQUE),
+             i, i, true);
+    return;
+  }
+
+  int number = stack[slot].number;
+  if (optimizer->numbers[number].kind == NUMBER_CONSTANT) {
+    loadConstant(optimizer, instruction, optimizer->numbers[number].value);
+  } else {
+    for (int j = 0; j < slot; j++) {
+      if (!optimizer->captured[j] &&
+          sameNumber(optimizer, stack[j].number, number, 0)) {
+        loadLocal(optimizer, instruction, j);
+        break;
+      }
+    }
+  }
+  setEntry(&stack[instruction->depth], number, i, i, true);
+}
+
+static void numberStore(Optimizer *optimizer, int i) {
+  Instruction *instruction = &optimizer->code[i];
+  StackEntry *stack = optimizer->stack;
+  StackEntry *top = &stack[instruction->depth - 1];
+  int slot = instruction->operand;
+  if (optimizer->captured[slot]) {
+    stack[slot].number = newNumber(optimizer, NUMBER_OPAQUE);
+  } else if (sameNumber(optimizer, stack[slot].number, top->number, 0)) {
+    instruction->removed = true;
+    optimizer->changed = true;
+    return;
+  } else {
+    stack[slot].number = top->number;
+  }
+  stack[slot].pure = false;
+  top->pure = false;
+}
+
+// Looks below the operands for a slot already holding number, replacing the
+// instructions that compute it with a read of that slot.
+static void reuseSlot(Optimizer *optimizer, int i, StackEntry *result) {
+  for (int j = 0; j < result - optimizer->stack; j++) {
+    if (!optimizer->captured[j] &&
+        sameNumber(optimizer, optimizer->stack[j].number, result->number, 0)) {
+      removeRange(optimizer, result->start, i);
+      loadLocal(optimizer, &optimizer->code[i], j);
+      setEntry(result, optimizer->stack[j].number, i, i, true);
+      return;
+    }
+  }
+}
+
+static void numberBinary(Optimizer *optimizer, int i) {
+  Instruction *instruction = &optimizer->code[i];
+  StackEntry *left = &optimizer->stack[instruction->depth - 2];
+  StackEntry *right = &optimizer->stack[instruction->depth - 1];
+  bool pure = left->pure && right->pure &&
+              onlyRemovedBetween(optimizer, left->end, right->start) &&
+              onlyRemovedBetween(optimizer, right->end, i);
+
+  ValueNumber *a = &optimizer->numbers[left->number];
+  ValueNumber *b = &optimizer->numbers[right->number];
+  Value result;
+  if (pure && a->kind == NUMBER_CONSTANT && b->kind == NUMBER_CONSTANT &&
+      foldBinaryValues(instruction->op, a->value, b->value, &result)) {
+    if (staging == NULL)
+      push(result);
+    bool loaded = loadConstant(optimizer, instruction, result);
+    if (staging == NULL)
+      pop();
+    if (loaded) {
+      removeRange(optimizer, left->start, i);
+      setEntry(left, constantNumber(optimizer, result), i, i, true);
+      return;
+    }
+  }
+
+  if (!isPureBinary(instruction->op)) {
+    setEntry(left, newNumber(optimizer, NUMBER_OPAQUE), i, i, false);
+    return;
+  }
+  int number = newNumber(optimizer, NUMBER_EXPRESSION);
+  optimizer->numbers[number].op = instruction->op;
+  optimizer->numbers[number].left = left->number;
+  optimizer->numbers[number].right = right->number;
+  setEntry(left, number, pure ? left->start : i, i, pure);
+  if (pure) {
+    reuseSlot(optimizer, i, left);
+  }
+}
+
+static void numberUnary(Optimizer *optimizer, int i) {
+  Instruction *instruction = &optimizer->code[i];
+  StackEntry *operand = &optimizer->stack[instruction->depth - 1];
+  bool pure =
+      operand->pure && onlyRemovedBetween(optimizer, operand->end, i);
+
+  ValueNumber *a = &optimizer->numbers[operand->number];
+  Value result;
+  if (pure && a->kind == NUMBER_CONSTANT &&
+      foldUnaryValue(instruction->op, a->value, &result) &&
+      loadConstant(optimizer, instruction, result)) {
+    removeRange(optimizer, operand->start, i);
+    setEntry(operand, constantNumber(optimizer, result), i, i, true);
+    return;
+  }
+
+  int number = newNumber(optimizer, NUMBER_EXPRESSION);
+  optimizer->numbers[number].op = instruction->op;
+  optimizer->numbers[number].left = operand->number;
+  setEntry(operand, number, pure ? operand->start : i, i, pure);
+  if (pure) {
+    reuseSlot(optimizer, i, operand);
+  }
+}
+
+static void numberBlock(Optimizer *optimizer, int b) {
+  Block *block = &optimizer->blocks[b];
+  if (block->depth < 0) {
+    return;
+  }
+
+  StackEntry *stack = optimizer->stack;
+  SlotConstant *entry = blockConstants(optimizer, b);
+  optimizer->numberCount = 0;
+  for (int p = 0; p < block->depth; p++) {
+    int number = entry[p].state == SLOT_CONSTANT
+                     ? constantNumber(optimizer, entry[p].value)
+                     : newNumber(optimizer, NUMBER_OPAQUE);
+    setEntry(&stack[p], number, -1, -1, false);
+  }
+
+  for (int i = block->start; i < block->end; i++) {
+    Instruction *instruction = &optimizer->code[i];
+    if (instruction->removed) {
+      continue;
+    }
+    int depth = instruction->depth;
+    Value value;
+    if (constantOf(optimizer, instruction, &value)) {
+      setEntry(&stack[depth], constantNumber(optimizer, value), i, i, true);
+      continue;
+    }
+    switch (instruction->op) {
+    case OP_GET_LOCAL:
+    case OP_GET_LOCAL_SHORT:
+      numberLoad(optimizer, i);
+      break;
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_SHORT:
+      numberStore(optimizer, i);
+      break;
+    case OP_POP:
+      break;
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_SHORT:
+    case OP_SET_UPVALUE:
+    case OP_SET_UPVALUE_SHORT:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:
+      stack[depth - 1].pure = false;
+      break;
+    default:
+      if (isPureBinary(instruction->op) || instruction->op == OP_CONCAT) {
+        numberBinary(optimizer, i);
+      } else if (isPureUnary(instruction->op)) {
+        numberUnary(optimizer, i);
+      } else {
+        int pops, pushes;
+        stackEffect(instruction, &pops, &pushes);
+        for (int p = depth - pops; p < depth - pops + pushes; p++) {
+          setEntry(&stack[p], newNumber(optimizer, NUMBER_OPAQUE), i, i,
+                   false);
+        }
+      }
+      break;
+    }
+  }
+}
+
+// Updates the set of slots that will be read, going backwards over one
+// instruction. Values dropped by OP_POP are not reads.
+static void transferLiveness(Optimizer *optimizer, Instruction *instruction,
+                             bool *live) {
+  int depth = instruction->depth;
+  switch (instruction->op) {
+  case OP_POP:
+    live[depth - 1] = false;
+    return;
+  case OP_RETURN:
+    memset(live, 0, sizeof(bool) * optimizer->maxDepth);
+    live[depth - 1] = true;
+    return;
+  case OP_GET_LOCAL:
+  case OP_GET_LOCAL_SHORT:
+    live[depth] = false;
+    live[instruction->operand] = true;
+    return;
+  case OP_SET_LOCAL:
+  case OP_SET_LOCAL_SHORT:
+    live[instruction->operand] = false;
+    live[depth - 1] = true;
+    return;
+  default: {
+    int pops, pushes;
+    stackEffect(instruction, &pops, &pushes);
+    for (int p = depth - pops; p < depth - pops + pushes; p++) {
+      live[p] = false;
+    }
+    for (int p = depth - pops; p < depth; p++) {
+      live[p] = true;
+    }
+    return;
+  }
+  }
+}
+
+static void liveOut(Optimizer *optimizer, Block *block, bool *liveIn,
+                    bool *live) {
+  int maxDepth = optimizer->maxDepth;
+  memset(live, 0, sizeof(bool) * maxDepth);
+  for (int s = 0; s < block->successorCount; s++) {
+    bool *next = &liveIn[block->successors[s] * maxDepth];
+    for (int p = 0; p < maxDepth; p++) {
+      live[p] = live[p] || next[p];
+    }
+  }
+}
+
+static void eliminateDeadStores(Optimizer *optimizer) {
+  int maxDepth = optimizer->maxDepth;
+  bool *liveIn = ALLOCATE(bool, optimizer->blockCount * maxDepth);
+  memset(liveIn, 0, sizeof(bool) * optimizer->blockCount * maxDepth);
+  bool *live = ALLOCATE(bool, maxDepth);
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b = optimizer->blockCount - 1; b >= 0; b--) {
+      Block *block = &optimizer->blocks[b];
+      if (block->depth < 0) {
+        continue;
+      }
+      liveOut(optimizer, block, liveIn, live);
+      for (int i = block->end - 1; i >= block->start; i--) {
+        if (!optimizer->code[i].removed) {
+          transferLiveness(optimizer, &optimizer->code[i], live);
+        }
+      }
+      if (memcmp(&liveIn[b * maxDepth], live, sizeof(bool) * maxDepth) != 0) {
+        memcpy(&liveIn[b * maxDepth], live, sizeof(bool) * maxDepth);
+        changed = true;
+      }
+    }
+  }
+
+  for (int b = 0; b < optimizer->blockCount; b++) {
+    Block *block = &optimizer->blocks[b];
+    if (block->depth < 0) {
+      continue;
+    }
+    liveOut(optimizer, block, liveIn, live);
+    for (int i = block->end - 1; i >= block->start; i--) {
+      Instruction *instruction = &optimizer->code[i];
+      if (instruction->removed) {
+        continue;
+      }
+      int slot = instruction->operand;
+      if (isSetLocal(instruction->op) && !optimizer->captured[slot] &&
+          slot != instruction->depth - 1 && !live[slot]) {
+        instruction->removed = true;
+        optimizer->changed = true;
+        continue;
+      }
+      transferLiveness(optimizer, instruction, live);
+    }
+  }
+
+  FREE_ARRAY(bool, live, maxDepth);
+  FREE_ARRAY(bool, liveIn, optimizer->blockCount * maxDepth);
+}
+
+// Writes the live instructions back into the chunk. Removed instructions
+// hand their offset to the next live one, so jumps to them still land where
+// the removed code used to start. Returns false, leaving the chunk alone, if
+// a jump no longer fits its operand.
+static bool encode(Optimizer *optimizer) {
+  Chunk *chunk = optimizer->chunk;
+  Instruction *code = optimizer->code;
+  int count = optimizer->count;
+  int *offsets = ALLOCATE(int, count + 1);
+  int offset = 0;
+  for (int i = 0; i < count; i++) {
+    offsets[i] = offset;
+    if (!code[i].removed) {
+      offset += code[i].length;
+    }
+  }
+  offsets[count] = offset;
+
+  bool ok = true;
+  for (int i = 0; i < count; i++) {
+    if (!code[i].removed && isJump(code[i].op)) {
+      int from = offsets[i] + 4;
+      int to = offsets[code[i].operand];
+      // Threading can send an unconditional jump either way.
+      if (!isConditionalJump(code[i].op)) {
+        code[i].op = to >= from ? OP_JUMP : OP_LOOP;
+      }
+      int jump = code[i].op == OP_LOOP ? from - to : to - from;
+      if (jump < 0 || jump > UINT24_MAX) {
+        ok = false;
+      }
+    }
+  }
+  if (!ok) {
+    FREE_ARRAY(int, offsets, count + 1);
+    return false;
+  }
+
+  Chunk rewritten;
+  initChunk(&rewritten, chunk->file);
+  for (int i = 0; i < count; i++) {
+    Instruction *instruction = &code[i];
+    if (instruction->removed) {
+      continue;
+    }
+    int line = instruction->line;
+    int operand = instruction->operand;
+    writeChunk(&rewritten, instruction->op, line);
+    if (isJump(instruction->op)) {
+      int from = offsets[i] + 4;
+      operand = instruction->op == OP_LOOP ? from - offsets[operand]
+                                           : offsets[operand] - from;
+      writeChunk(&rewritten, (operand >> 16) & 0xff, line);
+      writeChunk(&rewritten, (operand >> 8) & 0xff, line);
+      writeChunk(&rewritten, operand & 0xff, line);
+    } else if (instruction->op == OP_INVOKE ||
+               instruction->op == OP_SUPER_INVOKE) {
+      writeChunk(&rewritten, operand, line);
+      writeChunk(&rewritten, instruction->argCount, line);
+    } else if (instruction->op == OP_INVOKE_SHORT ||
+               instruction->op == OP_SUPER_INVOKE_SHORT) {
+      writeChunk(&rewritten, (operand >> 8) & 0xff, line);
+      writeChunk(&rewritten, operand & 0xff, line);
+      writeChunk(&rewritten, (instruction->argCount >> 8) & 0xff, line);
+      writeChunk(&rewritten, instruction->argCount & 0xff, line);
+    } else if (instruction->op == OP_CLOSURE ||
+               instruction->op == OP_CLOSURE_SHORT) {
+      int width = instruction->op == OP_CLOSURE ? 1 : 2;
+      if (width == 2) {
+        writeChunk(&rewritten, (operand >> 8) & 0xff, line);
+      }
+      writeChunk(&rewritten, operand & 0xff, line);
+      for (int b = 1 + width; b < instruction->length; b++) {
+        writeChunk(&rewritten, chunk->code[instruction->offset + b], line);
+      }
+    } else if (instruction->length == 2) {
+      writeChunk(&rewritten, operand, line);
+    } else if (instruction->length == 3) {
+      writeChunk(&rewritten, (operand >> 8) & 0xff, line);
+      writeChunk(&rewritten, operand & 0xff, line);
+    } else if (instruction->length == 4) {
+      writeChunk(&rewritten, (operand >> 16) & 0xff, line);
+      writeChunk(&rewritten, (operand >> 8) & 0xff, line);
+      writeChunk(&rewritten, operand & 0xff, line);
+    }
+  }
+  FREE_ARRAY(int, offsets, count + 1);
+
+  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+  FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+  chunk->code = rewritten.code;
+  chunk->lines = rewritten.lines;
+  chunk->lineCount = rewritten.lineCount;
+  chunk->lineCapacity = rewritten.lineCapacity;
+  chunk->count = rewritten.count;
+  chunk->capacity = rewritten.capacity;
+  return true;
+}
+
+static void freeOptimizer(Optimizer *optimizer, int codeCapacity) {
+  int maxDepth = optimizer->maxDepth;
+  int blockCount = optimizer->blockCount;
+  FREE_ARRAY(Instruction, optimizer->code, codeCapacity);
+  if (optimizer->blocks != NULL) {
+    FREE_ARRAY(int, optimizer->blockOf, optimizer->count);
+    FREE_ARRAY(Block, optimizer->blocks, blockCount);
+  }
+  if (optimizer->captured != NULL) {
+    FREE_ARRAY(bool, optimizer->captured, maxDepth);
+  }
+  if (optimizer->slotConstants != NULL) {
+    FREE_ARRAY(SlotConstant, optimizer->slotConstants, blockCount * maxDepth);
+    FREE_ARRAY(bool, optimizer->seen, blockCount);
+  }
+  if (optimizer->stack != NULL) {
+    FREE_ARRAY(StackEntry, optimizer->stack, maxDepth);
+  }
+  FREE_ARRAY(ValueNumber, optimizer->numbers, optimizer->numberCapacity);
+}
+
+void optimizeFunction(ObjFunction *function) {
+  Optimizer optimizer;
+  memset(&optimizer, 0, sizeof(Optimizer));
+  optimizer.function = function;
+  optimizer.chunk = &function->chunk;
+  int codeCapacity = function->chunk.count;
+  if (codeCapacity == 0) {
+    return;
+  }
+
+  if (decode(&optimizer)) {
+    findBlocks(&optimizer);
+    if (computeDepths(&optimizer) && findCaptured(&optimizer)) {
+      analyzeConstants(&optimizer);
+      optimizer.stack = ALLOCATE(StackEntry, optimizer.maxDepth);
+      for (int b = 0; b < optimizer.blockCount; b++) {
+        numberBlock(&optimizer, b);
+      }
+      // Depths move inside the blocks that were rewritten.
+      if (computeDepths(&optimizer)) {
+        eliminateDeadStores(&optimizer);
+        if (optimizer.changed) {
+          encode(&optimizer);
+        }
+      }
+    }
+  }
+  freeOptimizer(&optimizer, codeCapacity);
+}
+
+static int nextLive(Optimizer *optimizer, int i) {
+  do {
+    i++;
+  } while (i < optimizer->count && optimizer->code[i].removed);
+  return i;
+}
+
+// Where a jump to instruction i lands once removed instructions are gone.
+static int landing(Optimizer *optimizer, int i) {
+  while (i < optimizer->count && optimizer->code[i].removed) {
+    i++;
+  }
+  return i;
+}
+
+static void countTargets(Optimizer *optimizer, int *targeted) {
+  memset(targeted, 0, sizeof(int) * optimizer->count);
+  for (int i = 0; i < optimizer->count; i++) {
+    Instruction *instruction = &optimizer->code[i];
+    if (!instruction->removed && isJump(instruction->op)) {
+      targeted[instruction->operand]++;
+    }
+  }
+}
+
+// Whether any jump lands on b, the live instruction following a.
+static bool isLanding(int *targeted, int a, int b) {
+  for (int i = a + 1; i <= b; i++) {
+    if (targeted[i] > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool isPurePush(uint8_t op) {
+  switch (op) {
+  case OP_CONSTANT:
+  case OP_CONSTANT_SHORT:
+  case OP_CONSTANT_LONG:
+  case OP_NIL:
+  case OP_TRUE:
+  case OP_FALSE:
+  case OP_GET_LOCAL:
+  case OP_GET_LOCAL_SHORT:
+  case OP_GET_UPVALUE:
+  case OP_GET_UPVALUE_SHORT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static void removeUnreachable(Optimizer *optimizer, int *targeted) {
+  for (int i = 0; i < optimizer->count; i++) {
+    if (optimizer->code[i].removed || !isTerminator(optimizer->code[i].op)) {
+      continue;
+    }
+    for (int j = i + 1; j < optimizer->count && targeted[j] == 0; j++) {
+      if (!optimizer->code[j].removed) {
+        optimizer->code[j].removed = true;
+        optimizer->changed = true;
+      }
+    }
+  }
+}
+
+// Whether the value a conditional jump tests is popped straight away on both
+// paths, so nothing sees which way round it was.
+static bool popsBothWays(Optimizer *optimizer, int jump) {
+  int next = nextLive(optimizer, jump);
+  int target = landing(optimizer, optimizer->code[jump].operand);
+  return next < optimizer->count && optimizer->code[next].op == OP_POP &&
+         target < optimizer->count && optimizer->code[target].op == OP_POP;
+}
+
+static void fusePairs(Optimizer *optimizer, int *targeted) {
+  for (int a = 0; a < optimizer->count; a++) {
+    Instruction *first = &optimizer->code[a];
+    if (first->removed) {
+      continue;
+    }
+    int b = nextLive(optimizer, a);
+    if (b >= optimizer->count || isLanding(targeted, a, b)) {
+      continue;
+    }
+
+    Instruction *second = &optimizer->code[b];
+    if (second->op == OP_POP && isPurePush(first->op)) {
+      first->removed = true;
+      second->removed = true;
+    } else if (second->op == OP_POP && first->op == OP_SET_LOCAL) {
+      first->op = OP_SET_LOCAL_POP;
+      second->removed = true;
+    } else if (second->op == OP_RETURN && first->op == OP_NIL) {
+      first->op = OP_RETURN_NIL;
+      second->removed = true;
+    } else if (second->op == OP_JUMP_IF_FALSE && first->op == OP_NOT &&
+               popsBothWays(optimizer, b)) {
+      first->removed = true;
+      second->op = OP_JUMP_IF_TRUE;
+    } else {
+      continue;
+    }
+    optimizer->changed = true;
+  }
+}
+
+// Follows a jump through the jumps it lands on. A conditional jump can pass
+// through another of the same kind, since the value it tested is still on
+// the stack and sends that one the same way, but can only go forwards.
+static int threadTarget(Optimizer *optimizer, int jump) {
+  uint8_t op = optimizer->code[jump].op;
+  int target = landing(optimizer, optimizer->code[jump].operand);
+  for (int hops = 0; hops < THREAD_HOPS_MAX && target < optimizer->count;
+       hops++) {
+    Instruction *next = &optimizer->code[target];
+    if (target == jump ||
+        (next->op != OP_JUMP && next->op != OP_LOOP &&
+         (!isConditionalJump(op) || next->op != op))) {
+      break;
+    }
+    int further = landing(optimizer, next->operand);
+    if (isConditionalJump(op) && further <= jump) {
+      break;
+    }
+    target = further;
+  }
+  return target;
+}
+
+static void simplifyJumps(Optimizer *optimizer) {
+  for (int i = 0; i < optimizer->count; i++) {
+    Instruction *jump = &optimizer->code[i];
+    if (jump->removed || !isJump(jump->op)) {
+      continue;
+    }
+    int target = threadTarget(optimizer, i);
+    if (target != landing(optimizer, jump->operand)) {
+      optimizer->changed = true;
+    }
+    jump->operand = target;
+
+    if (target == nextLive(optimizer, i)) {
+      jump->removed = true;
+      optimizer->changed = true;
+    } else if (!isConditionalJump(jump->op) && target < optimizer->count &&
+               optimizer->code[target].op == OP_RETURN_NIL) {
+      jump->op = OP_RETURN_NIL;
+      jump->length = 1;
+      optimizer->changed = true;
+    }
+  }
+}
+
+void peepholeFunction(ObjFunction *function) {
+  Optimizer optimizer;
+  memset(&optimizer, 0, sizeof(Optimizer));
+  optimizer.function = function;
+  optimizer.chunk = &function->chunk;
+  int codeCapacity = function->chunk.count;
+  if (codeCapacity == 0) {
+    return;
+  }
+
+  if (decode(&optimizer)) {
+    int *targeted = ALLOCATE(int, optimizer.count);
+    bool rewritten = false;
+    for (int round = 0; round < PEEPHOLE_ROUNDS; round++) {
+      optimizer.changed = false;
+      countTargets(&optimizer, targeted);
+      removeUnreachable(&optimizer, targeted);
+      fusePairs(&optimizer, targeted);
+      simplifyJumps(&optimizer);
+      if (!optimizer.changed) {
+        break;
+      }
+      rewritten = true;
+    }
+    if (rewritten) {
+      encode(&optimizer);
+    }
+    FREE_ARRAY(int, targeted, optimizer.count);
+  }
+  freeOptimizer(&optimizer, codeCapacity);
+}
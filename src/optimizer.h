@@ -0,0 +1,22 @@
+#ifndef ghoul_optimizer_h
+#define ghoul_optimizer_h
+
+#include "object.h"
+
+// Evaluates an operator on constant operands the way the VM would, returning
+// false when the VM would raise an error or the result depends on more than
+// the operands. Concatenating strings allocates the result, which the caller
+// must keep reachable.
+bool foldBinaryValues(uint8_t op, Value a, Value b, Value *result);
+bool foldUnaryValue(uint8_t op, Value operand, Value *result);
+
+// Rewrites a function's finished bytecode in place. Run by the compiler on
+// each function it ends when ghoul is started with -O.
+void optimizeFunction(ObjFunction *function);
+
+// Cleans up patterns the compiler leaves behind, such as jumps to jumps and
+// a pop after a store. Cheap enough to run on every function, including in
+// the REPL.
+void peepholeFunction(ObjFunction *function);
+
+#endif
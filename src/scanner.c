@@ -5,12 +5,22 @@
 #include "scanner.h"
 #include "utf8.h"
 
-Scanner scanner;
+_Thread_local Scanner scanner;
 
 void initScanner(const char *source) {
   scanner.start = source;
   scanner.current = source;
   scanner.line = 1;
+  scanner.interpolationDepth = 0;
+  scanner.tokens = NULL;
+  scanner.tokenCount = 0;
+  scanner.nextToken = 0;
+}
+
+void initScannerTokens(const char *source, const Token *tokens, int count) {
+  initScanner(source);
+  scanner.tokens = tokens;
+  scanner.tokenCount = count;
 }
 
 static bool isAlpha(char c) {
@@ -157,12 +167,23 @@ static Token number() {
   return makeToken(TOKEN_NUMBER);
 }
 
+// Scans the rest of a string literal, or of the part of one that follows an
+// interpolated expression. A part ending in "${" is a TOKEN_INTERPOLATION;
+// the expression's tokens follow, and the "}" closing it resumes the string.
 static Token string() {
   while (peek() != '"' && !isAtEnd()) {
     if (peek() == '\n') {
       scanner.line++;
     } else if (peek() == '\\') {
       advance();
+    } else if (peek() == '$' && peekNext() == '{') {
+      if (scanner.interpolationDepth == MAX_INTERPOLATION_DEPTH) {
+        return errorToken("Interpolation nested too deeply.");
+      }
+      advance();
+      advance();
+      scanner.braceDepth[scanner.interpolationDepth++] = 0;
+      return makeToken(TOKEN_INTERPOLATION);
     }
     advance();
   }
@@ -184,6 +205,13 @@ static bool match(char expected) {
 }
 
 Token scanToken() {
+  if (scanner.tokens != NULL) {
+    if (scanner.nextToken < scanner.tokenCount - 1) {
+      return scanner.tokens[scanner.nextToken++];
+    }
+    return scanner.tokens[scanner.tokenCount - 1];
+  }
+
   skipWhitespace();
   scanner.start = scanner.current;
 
@@ -202,8 +230,18 @@ Token scanToken() {
   case ')':
     return makeToken(TOKEN_RIGHT_PAREN);
   case '{':
+    if (scanner.interpolationDepth > 0) {
+      scanner.braceDepth[scanner.interpolationDepth - 1]++;
+    }
     return makeToken(TOKEN_LEFT_BRACE);
   case '}':
+    if (scanner.interpolationDepth > 0) {
+      if (scanner.braceDepth[scanner.interpolationDepth - 1] == 0) {
+        scanner.interpolationDepth--;
+        return string();
+      }
+      scanner.braceDepth[scanner.interpolationDepth - 1]--;
+    }
     return makeToken(TOKEN_RIGHT_BRACE);
   case '[':
     return makeToken(TOKEN_LEFT_BRACKET);
@@ -45,6 +45,7 @@ typedef enum {
   TOKEN_BITWISE_RIGHT_SHIFT_EQUAL,
   TOKEN_IDENTIFIER,
   TOKEN_STRING,
+  TOKEN_INTERPOLATION,
   TOKEN_NUMBER,
   TOKEN_AND,
   TOKEN_ELSE,
@@ -75,15 +76,28 @@ typedef struct {
   int line;
 } Token;
 
+#define MAX_INTERPOLATION_DEPTH 8
+
 typedef struct {
   const char *start;
   const char *current;
   int line;
+  // Open braces inside each "${" being scanned, innermost last.
+  int braceDepth[MAX_INTERPOLATION_DEPTH];
+  int interpolationDepth;
+  // Tokens scanned ahead of time, handed out in place of scanning when set.
+  // The last one is always TOKEN_EOF.
+  const Token *tokens;
+  int tokenCount;
+  int nextToken;
 } Scanner;
 
-extern Scanner scanner;
+// Each thread scans with its own state, so files can be scanned in the
+// background while the main thread compiles.
+extern _Thread_local Scanner scanner;
 
 void initScanner(const char *source);
+void initScannerTokens(const char *source, const Token *tokens, int count);
 Token scanToken();
 
 #endif
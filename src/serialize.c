@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "serialize.h"
+
+void initWriter(Writer *writer) {
+  writer->bytes = NULL;
+  writer->count = 0;
+  writer->capacity = 0;
+  writer->failed = false;
+}
+
+void freeWriter(Writer *writer) {
+  free(writer->bytes);
+  initWriter(writer);
+}
+
+void writeBytes(Writer *writer, const void *data, size_t length) {
+  if (writer->failed) {
+    return;
+  }
+  if (writer->count + length > writer->capacity) {
+    size_t capacity = writer->capacity < 256 ? 256 : writer->capacity;
+    while (capacity < writer->count + length) {
+      capacity *= 2;
+    }
+    uint8_t *grown = realloc(writer->bytes, capacity);
+    if (grown == NULL) {
+      writer->failed = true;
+      return;
+    }
+    writer->bytes = grown;
+    writer->capacity = capacity;
+  }
+  memcpy(writer->bytes + writer->count, data, length);
+  writer->count += length;
+}
+
+void writeU8(Writer *writer, uint8_t value) {
+  writeBytes(writer, &value, sizeof(value));
+}
+
+void writeU32(Writer *writer, uint32_t value) {
+  writeBytes(writer, &value, sizeof(value));
+}
+
+void writeU64(Writer *writer, uint64_t value) {
+  writeBytes(writer, &value, sizeof(value));
+}
+
+void writeChars(Writer *writer, const char *chars, uint32_t length) {
+  writeU32(writer, length);
+  writeBytes(writer, chars, length);
+}
+
+void initReader(Reader *reader, const void *bytes, size_t count) {
+  reader->bytes = bytes;
+  reader->count = count;
+  reader->position = 0;
+  reader->failed = false;
+}
+
+const uint8_t *readBytes(Reader *reader, size_t length) {
+  if (reader->failed || length > reader->count - reader->position) {
+    reader->failed = true;
+    return NULL;
+  }
+  const uint8_t *bytes = reader->bytes + reader->position;
+  reader->position += length;
+  return bytes;
+}
+
+uint8_t readU8(Reader *reader) {
+  const uint8_t *bytes = readBytes(reader, sizeof(uint8_t));
+  return bytes == NULL ? 0 : bytes[0];
+}
+
+uint32_t readU32(Reader *reader) {
+  uint32_t value = 0;
+  const uint8_t *bytes = readBytes(reader, sizeof(value));
+  if (bytes != NULL) {
+    memcpy(&value, bytes, sizeof(value));
+  }
+  return value;
+}
+
+uint64_t readU64(Reader *reader) {
+  uint64_t value = 0;
+  const uint8_t *bytes = readBytes(reader, sizeof(value));
+  if (bytes != NULL) {
+    memcpy(&value, bytes, sizeof(value));
+  }
+  return value;
+}
+
+const char *readChars(Reader *reader, uint32_t *length) {
+  *length = readU32(reader);
+  return (const char *)readBytes(reader, *length);
+}
+
+char *readWholeFile(const char *path, size_t *length) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+
+  fseek(file, 0L, SEEK_END);
+  long fileSize = ftell(file);
+  rewind(file);
+  char *buffer = fileSize < 0 ? NULL : malloc(fileSize + 1);
+  if (buffer == NULL) {
+    fclose(file);
+    return NULL;
+  }
+  size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
+  fclose(file);
+  if (bytesRead < (size_t)fileSize) {
+    free(buffer);
+    return NULL;
+  }
+  buffer[bytesRead] = '\0';
+  *length = bytesRead;
+  return buffer;
+}
+
+bool replaceFile(const char *path, Writer **parts, int partCount) {
+  for (int i = 0; i < partCount; i++) {
+    if (parts[i]->failed) {
+      return false;
+    }
+  }
+
+  char *temporary = malloc(strlen(path) + 32);
+  if (temporary == NULL) {
+    return false;
+  }
+  sprintf(temporary, "%s.%ld.tmp", path, (long)getpid());
+  FILE *out = fopen(temporary, "wb");
+  if (out == NULL) {
+    free(temporary);
+    return false;
+  }
+
+  bool written = true;
+  for (int i = 0; i < partCount && written; i++) {
+    written = fwrite(parts[i]->bytes, 1, parts[i]->count, out) ==
+              parts[i]->count;
+  }
+  written = fclose(out) == 0 && written;
+#ifdef _WIN32
+  if (written) {
+    remove(path);
+  }
+#endif
+  if (!written || rename(temporary, path) != 0) {
+    remove(temporary);
+    written = false;
+  }
+  free(temporary);
+  return written;
+}
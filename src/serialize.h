@@ -0,0 +1,46 @@
+#ifndef ghoul_serialize_h
+#define ghoul_serialize_h
+
+#include "common.h"
+
+// Byte buffers for the files ghoul writes about itself, such as bytecode
+// caches. Values are stored in the byte order of the machine writing them.
+// Both sides latch failed on the first error and ignore everything after,
+// so callers only need to check it once at the end.
+typedef struct {
+  uint8_t *bytes;
+  size_t count;
+  size_t capacity;
+  bool failed;
+} Writer;
+
+typedef struct {
+  const uint8_t *bytes;
+  size_t count;
+  size_t position;
+  bool failed;
+} Reader;
+
+void initWriter(Writer *writer);
+void freeWriter(Writer *writer);
+void writeBytes(Writer *writer, const void *data, size_t length);
+void writeU8(Writer *writer, uint8_t value);
+void writeU32(Writer *writer, uint32_t value);
+void writeU64(Writer *writer, uint64_t value);
+void writeChars(Writer *writer, const char *chars, uint32_t length);
+
+void initReader(Reader *reader, const void *bytes, size_t count);
+const uint8_t *readBytes(Reader *reader, size_t length);
+uint8_t readU8(Reader *reader);
+uint32_t readU32(Reader *reader);
+uint64_t readU64(Reader *reader);
+const char *readChars(Reader *reader, uint32_t *length);
+
+// Reads a whole file, returning NULL without reporting anything when it
+// cannot. The buffer is NUL-terminated and must be freed by the caller.
+char *readWholeFile(const char *path, size_t *length);
+// Writes the parts out to a temporary file and renames it over path, so a
+// reader never sees half a file.
+bool replaceFile(const char *path, Writer **parts, int partCount);
+
+#endif
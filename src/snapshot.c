@@ -0,0 +1,1084 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "memory.h"
+#include "native/native.h"
+#include "serialize.h"
+#include "snapshot.h"
+#include "table.h"
+#include "vm.h"
+
+// A snapshot is the heap after a script has run, saved so a later process
+// can start from it instead of running the script again. It holds the
+// globals and every object reachable from them, each numbered once so
+// shared and cyclic references come back as they were.
+//
+// Objects made by registering natives are not saved. They are written as
+// the name they were registered under and looked up again in the loading
+// process, which registers the same natives first, replaying any builtin
+// modules such as Math that the saved script used. That keeps the C
+// functions behind natives out of the file.
+//
+// Objects are created in two passes. The first makes every object, in an
+// order where whatever a constructor needs already exists: strings, then
+// functions and upvalues, then classes, closures, the objects of a class,
+// and bound methods. The second fills in everything that can point back
+// at other objects.
+//
+// Bump SNAPSHOT_VERSION whenever the bytecode or this layout changes.
+#define SNAPSHOT_MAGIC "GHOULS"
+#define SNAPSHOT_MAGIC_LENGTH 6
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define NO_OBJECT UINT32_MAX
+#define BUILTIN_TYPE 0xff
+#define RANK_COUNT 8
+
+typedef enum {
+  VALUE_PLAIN,
+  VALUE_OBJECT,
+} ValueTag;
+
+typedef struct {
+  Obj **objects;
+  ObjString **symbols; // registered name, or NULL for a saved object
+  uint32_t count;
+  uint32_t capacity;
+  // Open addressed map from object to its number.
+  Obj **keys;
+  uint32_t *numbers;
+  uint32_t keyCapacity;
+  bool failed;
+} Heap;
+
+void nameBuiltin(const char *kind, ObjString *owner, const char *name,
+                 int length, Value value) {
+  char symbol[256];
+  int symbolLength;
+  if (owner != NULL) {
+    symbolLength = snprintf(symbol, sizeof(symbol), "%s:%.*s.%.*s", kind,
+                            owner->length, owner->chars, length, name);
+  } else {
+    symbolLength =
+        snprintf(symbol, sizeof(symbol), "%s:%.*s", kind, length, name);
+  }
+  if (symbolLength >= (int)sizeof(symbol)) {
+    symbolLength = sizeof(symbol) - 1;
+  }
+
+  push(value);
+  push(OBJ_VAL(copyString(symbol, symbolLength, &vm.strings)));
+  tableSet(&vm.builtins, AS_STRING(peek(0)), peek(1));
+  pop();
+  pop();
+}
+
+static void snapshotError(Heap *heap, const char *message) {
+  if (!heap->failed) {
+    fprintf(stderr, "Cannot snapshot %s.\n", message);
+  }
+  heap->failed = true;
+}
+
+static uint32_t hashObject(Obj *object) {
+  uintptr_t address = (uintptr_t)object;
+  return (uint32_t)((address >> 4) ^ (address >> 20));
+}
+
+static bool growHeap(Heap *heap) {
+  uint32_t keyCapacity = heap->keyCapacity < 64 ? 64 : heap->keyCapacity * 2;
+  Obj **keys = calloc(keyCapacity, sizeof(Obj *));
+  uint32_t *numbers = malloc(sizeof(uint32_t) * keyCapacity);
+  uint32_t capacity = keyCapacity / 2;
+  Obj **objects = realloc(heap->objects, sizeof(Obj *) * capacity);
+  if (objects != NULL) {
+    heap->objects = objects;
+  }
+  ObjString **symbols = realloc(heap->symbols, sizeof(ObjString *) * capacity);
+  if (symbols != NULL) {
+    heap->symbols = symbols;
+  }
+  if (keys == NULL || numbers == NULL || objects == NULL || symbols == NULL) {
+    free(keys);
+    free(numbers);
+    return false;
+  }
+
+  for (uint32_t i = 0; i < heap->count; i++) {
+    uint32_t index = hashObject(heap->objects[i]) & (keyCapacity - 1);
+    while (keys[index] != NULL) {
+      index = (index + 1) & (keyCapacity - 1);
+    }
+    keys[index] = heap->objects[i];
+    numbers[index] = i;
+  }
+  free(heap->keys);
+  free(heap->numbers);
+  heap->keys = keys;
+  heap->numbers = numbers;
+  heap->keyCapacity = keyCapacity;
+  heap->capacity = capacity;
+  return true;
+}
+
+// Returns the number of object, numbering it if it is new.
+static uint32_t numberOf(Heap *heap, Obj *object, ObjString *symbol) {
+  if (object == NULL) {
+    return NO_OBJECT;
+  }
+  if (heap->keyCapacity > 0) {
+    uint32_t index = hashObject(object) & (heap->keyCapacity - 1);
+    while (heap->keys[index] != NULL) {
+      if (heap->keys[index] == object) {
+        return heap->numbers[index];
+      }
+      index = (index + 1) & (heap->keyCapacity - 1);
+    }
+  }
+
+  if (heap->count + 1 > heap->capacity && !growHeap(heap)) {
+    snapshotError(heap, "a heap this large");
+    return NO_OBJECT;
+  }
+  uint32_t index = hashObject(object) & (heap->keyCapacity - 1);
+  while (heap->keys[index] != NULL) {
+    index = (index + 1) & (heap->keyCapacity - 1);
+  }
+  uint32_t number = heap->count++;
+  heap->keys[index] = object;
+  heap->numbers[index] = number;
+  heap->objects[number] = object;
+  heap->symbols[number] = symbol;
+  return number;
+}
+
+static void freeHeap(Heap *heap) {
+  free(heap->objects);
+  free(heap->symbols);
+  free(heap->keys);
+  free(heap->numbers);
+}
+
+static void findValue(Heap *heap, Value value) {
+  if (IS_OBJ(value)) {
+    numberOf(heap, AS_OBJ(value), NULL);
+  }
+}
+
+static void findTable(Heap *heap, Table *table) {
+  for (int i = 0; i < table->capacity; i++) {
+    Entry *entry = &table->entries[i];
+    if (entry->key != NULL) {
+      numberOf(heap, (Obj *)entry->key, NULL);
+      findValue(heap, entry->value);
+    }
+  }
+}
+
+// Numbers the objects a saved object points at.
+static void findReferences(Heap *heap, Obj *object) {
+  switch (object->type) {
+  case OBJ_BOUND_METHOD: {
+    ObjBoundMethod *bound = (ObjBoundMethod *)object;
+    findValue(heap, bound->receiver);
+    numberOf(heap, (Obj *)bound->method, NULL);
+    break;
+  }
+  case OBJ_BOUND_NATIVE: {
+    ObjBoundNative *bound = (ObjBoundNative *)object;
+    findValue(heap, bound->receiver);
+    numberOf(heap, (Obj *)bound->native, NULL);
+    break;
+  }
+  case OBJ_KLASS: {
+    ObjKlass *klass = (ObjKlass *)object;
+    numberOf(heap, (Obj *)klass->name, NULL);
+    findTable(heap, &klass->properties);
+    break;
+  }
+  case OBJ_CLOSURE: {
+    ObjClosure *closure = (ObjClosure *)object;
+    numberOf(heap, (Obj *)closure->function, NULL);
+    for (int i = 0; i < closure->upvalueCount; i++) {
+      numberOf(heap, (Obj *)closure->upvalues[i], NULL);
+    }
+    break;
+  }
+  case OBJ_FUNCTION: {
+    ObjFunction *function = (ObjFunction *)object;
+    numberOf(heap, (Obj *)function->name, NULL);
+    for (int i = 0; i < function->chunk.constants.count; i++) {
+      findValue(heap, function->chunk.constants.values[i]);
+    }
+    break;
+  }
+  case OBJ_INSTANCE: {
+    ObjInstance *instance = (ObjInstance *)object;
+    numberOf(heap, (Obj *)instance->klass, NULL);
+    findTable(heap, &instance->fields);
+    break;
+  }
+  case OBJ_UPVALUE: {
+    ObjUpvalue *upvalue = (ObjUpvalue *)object;
+    if (upvalue->location != &upvalue->closed) {
+      snapshotError(heap, "a variable still on the stack");
+    }
+    findValue(heap, upvalue->closed);
+    break;
+  }
+  case OBJ_LIST: {
+    ObjList *list = (ObjList *)object;
+    numberOf(heap, (Obj *)list->klass, NULL);
+    for (int i = 0; i < list->count; i++) {
+      findValue(heap, list->items[i]);
+    }
+    findTable(heap, &list->fields);
+    break;
+  }
+  case OBJ_MAP: {
+    ObjMap *map = (ObjMap *)object;
+    numberOf(heap, (Obj *)map->klass, NULL);
+    findTable(heap, &map->items);
+    findTable(heap, &map->fields);
+    break;
+  }
+  case OBJ_SET: {
+    ObjSet *set = (ObjSet *)object;
+    numberOf(heap, (Obj *)set->klass, NULL);
+    for (int i = valueTableNext(&set->items, 0); i >= 0;
+         i = valueTableNext(&set->items, i + 1)) {
+      findValue(heap, set->items.keys[i]);
+    }
+    findTable(heap, &set->fields);
+    break;
+  }
+  case OBJ_TYPED_ARRAY: {
+    ObjTypedArray *array = (ObjTypedArray *)object;
+    numberOf(heap, (Obj *)array->klass, NULL);
+    findTable(heap, &array->fields);
+    break;
+  }
+  case OBJ_DEQUE: {
+    ObjDeque *deque = (ObjDeque *)object;
+    numberOf(heap, (Obj *)deque->klass, NULL);
+    for (int i = 0; i < deque->count; i++) {
+      findValue(heap, *dequeSlot(deque, i));
+    }
+    findTable(heap, &deque->fields);
+    break;
+  }
+  case OBJ_BYTES: {
+    ObjBytes *bytes = (ObjBytes *)object;
+    numberOf(heap, (Obj *)bytes->klass, NULL);
+    findTable(heap, &bytes->fields);
+    break;
+  }
+  case OBJ_REGEX: {
+    ObjRegex *regex = (ObjRegex *)object;
+    numberOf(heap, (Obj *)regex->klass, NULL);
+    numberOf(heap, (Obj *)regex->pattern, NULL);
+    findTable(heap, &regex->fields);
+    break;
+  }
+  case OBJ_STRING:
+    findTable(heap, &((ObjString *)object)->fields);
+    break;
+  case OBJ_NATIVE:
+    snapshotError(heap, "a native function that was not registered");
+    break;
+  case OBJ_FILE:
+    snapshotError(heap, "an open file");
+    break;
+  }
+}
+
+// The order objects are created in when loading, so that each
+// constructor's arguments already exist.
+static int rankOf(Heap *heap, uint32_t number) {
+  if (heap->symbols[number] != NULL) {
+    return 0;
+  }
+  switch (heap->objects[number]->type) {
+  case OBJ_STRING:
+    return 1;
+  case OBJ_FUNCTION:
+    return 2;
+  case OBJ_UPVALUE:
+    return 3;
+  case OBJ_KLASS:
+    return 4;
+  case OBJ_CLOSURE:
+    return 5;
+  case OBJ_BOUND_METHOD:
+  case OBJ_BOUND_NATIVE:
+    return 7;
+  default:
+    return 6;
+  }
+}
+
+static ObjKlass *klassOf(Obj *object) {
+  switch (object->type) {
+  case OBJ_INSTANCE:
+    return ((ObjInstance *)object)->klass;
+  case OBJ_LIST:
+    return ((ObjList *)object)->klass;
+  case OBJ_MAP:
+    return ((ObjMap *)object)->klass;
+  case OBJ_SET:
+    return ((ObjSet *)object)->klass;
+  case OBJ_TYPED_ARRAY:
+    return ((ObjTypedArray *)object)->klass;
+  case OBJ_DEQUE:
+    return ((ObjDeque *)object)->klass;
+  case OBJ_BYTES:
+    return ((ObjBytes *)object)->klass;
+  case OBJ_REGEX:
+    return ((ObjRegex *)object)->klass;
+  default:
+    return NULL;
+  }
+}
+
+static void writeObjectNumber(Writer *writer, Heap *heap, Obj *object) {
+  writeU32(writer, numberOf(heap, object, NULL));
+}
+
+static void writeValue(Writer *writer, Heap *heap, Value value) {
+  if (IS_OBJ(value)) {
+    writeU8(writer, VALUE_OBJECT);
+    writeObjectNumber(writer, heap, AS_OBJ(value));
+  } else {
+    writeU8(writer, VALUE_PLAIN);
+    writeU64(writer, value);
+  }
+}
+
+// Table counts include tombstones, so the live entries are counted here.
+static uint32_t countEntries(Table *table) {
+  uint32_t count = 0;
+  for (int i = 0; i < table->capacity; i++) {
+    if (table->entries[i].key != NULL) {
+      count++;
+    }
+  }
+  return count;
+}
+
+static void writeTable(Writer *writer, Heap *heap, Table *table) {
+  writeU32(writer, countEntries(table));
+  for (int i = 0; i < table->capacity; i++) {
+    Entry *entry = &table->entries[i];
+    if (entry->key != NULL) {
+      writeObjectNumber(writer, heap, (Obj *)entry->key);
+      writeValue(writer, heap, entry->value);
+    }
+  }
+}
+
+// What the first pass needs to create an object.
+static void writeShell(Writer *writer, Heap *heap, uint32_t number) {
+  Obj *object = heap->objects[number];
+  writeU32(writer, number);
+  if (heap->symbols[number] != NULL) {
+    writeU8(writer, BUILTIN_TYPE);
+    writeChars(writer, heap->symbols[number]->chars,
+               heap->symbols[number]->length);
+    return;
+  }
+
+  writeU8(writer, object->type);
+  switch (object->type) {
+  case OBJ_STRING: {
+    ObjString *string = (ObjString *)object;
+    writeChars(writer, string->chars, string->length);
+    break;
+  }
+  case OBJ_FUNCTION: {
+    ObjFunction *function = (ObjFunction *)object;
+    Chunk *chunk = &function->chunk;
+    if (chunk->file == NULL) {
+      writeU32(writer, NO_OBJECT);
+    } else {
+      writeChars(writer, chunk->file, strlen(chunk->file));
+    }
+    writeU32(writer, function->arity);
+    writeU32(writer, function->upvalueCount);
+    writeU8(writer, function->variadic);
+    writeU32(writer, chunk->count);
+    writeBytes(writer, chunk->code, chunk->count);
+    writeU32(writer, chunk->lineCount);
+    for (int i = 0; i < chunk->lineCount; i++) {
+      writeU32(writer, chunk->lines[i].offset);
+      writeU32(writer, chunk->lines[i].line);
+    }
+    break;
+  }
+  case OBJ_KLASS: {
+    ObjKlass *klass = (ObjKlass *)object;
+    writeObjectNumber(writer, heap, (Obj *)klass->name);
+    writeU8(writer, klass->base);
+    break;
+  }
+  case OBJ_CLOSURE:
+    writeObjectNumber(writer, heap, (Obj *)((ObjClosure *)object)->function);
+    break;
+  case OBJ_TYPED_ARRAY: {
+    ObjTypedArray *array = (ObjTypedArray *)object;
+    writeObjectNumber(writer, heap, (Obj *)array->klass);
+    writeU8(writer, array->type);
+    writeU32(writer, array->count);
+    break;
+  }
+  case OBJ_BYTES: {
+    ObjBytes *bytes = (ObjBytes *)object;
+    writeObjectNumber(writer, heap, (Obj *)bytes->klass);
+    writeU32(writer, bytes->length);
+    break;
+  }
+  default:
+    if (rankOf(heap, number) == 6) {
+      writeObjectNumber(writer, heap, (Obj *)klassOf(object));
+    }
+    break;
+  }
+}
+
+// What the second pass fills in.
+static void writeContents(Writer *writer, Heap *heap, uint32_t number) {
+  Obj *object = heap->objects[number];
+  writeU32(writer, number);
+  switch (object->type) {
+  case OBJ_BOUND_METHOD: {
+    ObjBoundMethod *bound = (ObjBoundMethod *)object;
+    writeValue(writer, heap, bound->receiver);
+    writeObjectNumber(writer, heap, (Obj *)bound->method);
+    break;
+  }
+  case OBJ_BOUND_NATIVE: {
+    ObjBoundNative *bound = (ObjBoundNative *)object;
+    writeValue(writer, heap, bound->receiver);
+    writeObjectNumber(writer, heap, (Obj *)bound->native);
+    break;
+  }
+  case OBJ_KLASS:
+    writeTable(writer, heap, &((ObjKlass *)object)->properties);
+    break;
+  case OBJ_CLOSURE: {
+    ObjClosure *closure = (ObjClosure *)object;
+    for (int i = 0; i < closure->upvalueCount; i++) {
+      writeObjectNumber(writer, heap, (Obj *)closure->upvalues[i]);
+    }
+    break;
+  }
+  case OBJ_FUNCTION: {
+    ObjFunction *function = (ObjFunction *)object;
+    writeObjectNumber(writer, heap, (Obj *)function->name);
+    writeU32(writer, function->chunk.constants.count);
+    for (int i = 0; i < function->chunk.constants.count; i++) {
+      writeValue(writer, heap, function->chunk.constants.values[i]);
+    }
+    break;
+  }
+  case OBJ_INSTANCE:
+    writeTable(writer, heap, &((ObjInstance *)object)->fields);
+    break;
+  case OBJ_UPVALUE:
+    writeValue(writer, heap, ((ObjUpvalue *)object)->closed);
+    break;
+  case OBJ_LIST: {
+    ObjList *list = (ObjList *)object;
+    writeU32(writer, list->count);
+    for (int i = 0; i < list->count; i++) {
+      writeValue(writer, heap, list->items[i]);
+    }
+    writeTable(writer, heap, &list->fields);
+    break;
+  }
+  case OBJ_MAP: {
+    ObjMap *map = (ObjMap *)object;
+    writeTable(writer, heap, &map->items);
+    writeTable(writer, heap, &map->fields);
+    break;
+  }
+  case OBJ_SET: {
+    ObjSet *set = (ObjSet *)object;
+    writeU32(writer, set->items.count);
+    for (int i = valueTableNext(&set->items, 0); i >= 0;
+         i = valueTableNext(&set->items, i + 1)) {
+      writeValue(writer, heap, set->items.keys[i]);
+    }
+    writeTable(writer, heap, &set->fields);
+    break;
+  }
+  case OBJ_TYPED_ARRAY: {
+    ObjTypedArray *array = (ObjTypedArray *)object;
+    if (array->type == ARRAY_FLOAT64) {
+      writeBytes(writer, array->as.f64, sizeof(double) * array->count);
+    } else {
+      writeBytes(writer, array->as.i32, sizeof(int32_t) * array->count);
+    }
+    writeTable(writer, heap, &array->fields);
+    break;
+  }
+  case OBJ_DEQUE: {
+    ObjDeque *deque = (ObjDeque *)object;
+    writeU32(writer, deque->count);
+    for (int i = 0; i < deque->count; i++) {
+      writeValue(writer, heap, *dequeSlot(deque, i));
+    }
+    writeTable(writer, heap, &deque->fields);
+    break;
+  }
+  case OBJ_BYTES: {
+    ObjBytes *bytes = (ObjBytes *)object;
+    writeBytes(writer, bytes->data, bytes->length);
+    writeTable(writer, heap, &bytes->fields);
+    break;
+  }
+  case OBJ_REGEX: {
+    ObjRegex *regex = (ObjRegex *)object;
+    writeObjectNumber(writer, heap, (Obj *)regex->pattern);
+    writeTable(writer, heap, &regex->fields);
+    break;
+  }
+  case OBJ_STRING:
+    writeTable(writer, heap, &((ObjString *)object)->fields);
+    break;
+  case OBJ_NATIVE:
+  case OBJ_FILE:
+    break;
+  }
+}
+
+bool writeSnapshot(const char *path) {
+  Heap heap;
+  memset(&heap, 0, sizeof(Heap));
+
+  // Registered objects are numbered first, so that finding them again
+  // from the globals stops at their names.
+  for (int i = 0; i < vm.builtins.capacity; i++) {
+    Entry *entry = &vm.builtins.entries[i];
+    if (entry->key != NULL && IS_OBJ(entry->value)) {
+      numberOf(&heap, AS_OBJ(entry->value), entry->key);
+    }
+  }
+  findTable(&heap, &vm.globals);
+  for (uint32_t i = 0; i < heap.count && !heap.failed; i++) {
+    if (heap.symbols[i] == NULL) {
+      findReferences(&heap, heap.objects[i]);
+    }
+  }
+  if (heap.failed) {
+    freeHeap(&heap);
+    return false;
+  }
+
+  Writer writer;
+  initWriter(&writer);
+  writeBytes(&writer, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH);
+  writeU32(&writer, SNAPSHOT_VERSION);
+  writeU32(&writer, SNAPSHOT_BYTE_ORDER);
+
+  uint32_t moduleCount = 0;
+  for (int i = 0; i < vm.builtins.capacity; i++) {
+    ObjString *key = vm.builtins.entries[i].key;
+    if (key != NULL && key->length > 4 && memcmp(key->chars, "use:", 4) == 0) {
+      moduleCount++;
+    }
+  }
+  writeU32(&writer, moduleCount);
+  for (int i = 0; i < vm.builtins.capacity; i++) {
+    ObjString *key = vm.builtins.entries[i].key;
+    if (key != NULL && key->length > 4 && memcmp(key->chars, "use:", 4) == 0) {
+      writeChars(&writer, key->chars + 4, key->length - 4);
+    }
+  }
+
+  writeU32(&writer, heap.count);
+  for (int rank = 0; rank < RANK_COUNT; rank++) {
+    for (uint32_t i = 0; i < heap.count; i++) {
+      if (rankOf(&heap, i) == rank) {
+        writeShell(&writer, &heap, i);
+      }
+    }
+  }
+  for (uint32_t i = 0; i < heap.count; i++) {
+    if (heap.symbols[i] == NULL) {
+      writeContents(&writer, &heap, i);
+    }
+  }
+  writeTable(&writer, &heap, &vm.globals);
+
+  writeU32(&writer, countEntries(&vm.useStrings));
+  for (int i = 0; i < vm.useStrings.capacity; i++) {
+    ObjString *key = vm.useStrings.entries[i].key;
+    if (key != NULL) {
+      writeChars(&writer, key->chars, key->length);
+    }
+  }
+
+  Writer *parts[] = {&writer};
+  bool written = replaceFile(path, parts, 1);
+  if (!written) {
+    fprintf(stderr, "Could not write snapshot \"%s\".\n", path);
+  }
+  freeWriter(&writer);
+  freeHeap(&heap);
+  return written;
+}
+
+typedef struct {
+  Reader reader;
+  Obj **objects;
+  bool *named;
+  uint32_t count;
+  ObjList *keep; // roots everything loaded so far
+} Loader;
+
+static Obj *loadedObject(Loader *loader, uint32_t number, int type) {
+  if (number >= loader->count || loader->objects[number] == NULL ||
+      (type >= 0 && loader->objects[number]->type != (ObjType)type)) {
+    loader->reader.failed = true;
+    return NULL;
+  }
+  return loader->objects[number];
+}
+
+static Obj *readObject(Loader *loader, int type) {
+  return loadedObject(loader, readU32(&loader->reader), type);
+}
+
+// Like readObject, but allows a missing object.
+static Obj *readOptionalObject(Loader *loader, int type) {
+  uint32_t number = readU32(&loader->reader);
+  if (number == NO_OBJECT) {
+    return NULL;
+  }
+  return loadedObject(loader, number, type);
+}
+
+static Value readValue(Loader *loader) {
+  uint8_t tag = readU8(&loader->reader);
+  if (tag == VALUE_OBJECT) {
+    Obj *object = readObject(loader, -1);
+    return object == NULL ? NIL_VAL : OBJ_VAL(object);
+  }
+  Value value = readU64(&loader->reader);
+  if (tag != VALUE_PLAIN || IS_OBJ(value)) {
+    loader->reader.failed = true;
+    return NIL_VAL;
+  }
+  return value;
+}
+
+static void readTable(Loader *loader, Table *table) {
+  uint32_t count = readU32(&loader->reader);
+  for (uint32_t i = 0; i < count && !loader->reader.failed; i++) {
+    ObjString *key = (ObjString *)readObject(loader, OBJ_STRING);
+    Value value = readValue(loader);
+    if (key != NULL) {
+      tableSet(table, key, value);
+    }
+  }
+}
+
+// Counts below this many bytes per item cannot be real, and are refused
+// before anything is allocated for them.
+static bool fits(Loader *loader, uint32_t count, size_t itemSize) {
+  Reader *reader = &loader->reader;
+  if (reader->failed ||
+      count > (reader->count - reader->position) / itemSize) {
+    reader->failed = true;
+    return false;
+  }
+  return true;
+}
+
+static const char *usedPath(const char *chars, uint32_t length) {
+  uint32_t hash = hashString(chars, length);
+  ObjString *path = tableFindString(&vm.useStrings, chars, length, hash);
+  if (path == NULL) {
+    char *heapChars = ALLOCATE(char, length + 1);
+    memcpy(heapChars, chars, length);
+    heapChars[length] = '\0';
+    path = allocateString(heapChars, length, hash, &vm.useStrings,
+                          vm.klass.string);
+  }
+  return path->chars;
+}
+
+static Obj *loadBuiltin(Loader *loader) {
+  uint32_t length;
+  const char *symbol = readChars(&loader->reader, &length);
+  if (symbol == NULL) {
+    return NULL;
+  }
+  Value value;
+  ObjString *name = copyString(symbol, length, &vm.strings);
+  if (!tableGet(&vm.builtins, name, &value) || !IS_OBJ(value)) {
+    fprintf(stderr, "Snapshot needs '%.*s', which this ghoul does not have.\n",
+            (int)length, symbol);
+    loader->reader.failed = true;
+    return NULL;
+  }
+  return AS_OBJ(value);
+}
+
+static Obj *loadFunctionShell(Loader *loader) {
+  Reader *reader = &loader->reader;
+  uint32_t fileLength = readU32(reader);
+  const char *file = NULL;
+  if (fileLength != NO_OBJECT) {
+    const char *chars = (const char *)readBytes(reader, fileLength);
+    if (chars == NULL) {
+      return NULL;
+    }
+    file = usedPath(chars, fileLength);
+  }
+
+  ObjFunction *function = newFunction(file);
+  push(OBJ_VAL(function));
+  Chunk *chunk = &function->chunk;
+  function->arity = (int)readU32(reader);
+  function->upvalueCount = (int)readU32(reader);
+  function->variadic = readU8(reader) != 0;
+  if (function->upvalueCount < 0 || function->upvalueCount > UINT16_COUNT) {
+    reader->failed = true;
+  }
+
+  uint32_t count = readU32(reader);
+  const uint8_t *code = readBytes(reader, count);
+  if (code != NULL && count > 0) {
+    chunk->code = ALLOCATE(uint8_t, count);
+    memcpy(chunk->code, code, count);
+    chunk->count = count;
+    chunk->capacity = count;
+  }
+  uint32_t lineCount = readU32(reader);
+  if (lineCount > 0 && fits(loader, lineCount, 8)) {
+    chunk->lines = ALLOCATE(LineStart, lineCount);
+    chunk->lineCapacity = lineCount;
+    for (uint32_t i = 0; i < lineCount; i++) {
+      chunk->lines[i].offset = (int)readU32(reader);
+      chunk->lines[i].line = (int)readU32(reader);
+    }
+    chunk->lineCount = lineCount;
+  }
+  pop();
+  return (Obj *)function;
+}
+
+static Obj *loadShell(Loader *loader, uint8_t type) {
+  Reader *reader = &loader->reader;
+  if (type == BUILTIN_TYPE) {
+    return loadBuiltin(loader);
+  }
+
+  switch (type) {
+  case OBJ_STRING: {
+    uint32_t length;
+    const char *chars = readChars(reader, &length);
+    return chars == NULL ? NULL
+                         : (Obj *)copyString(chars, length, &vm.strings);
+  }
+  case OBJ_FUNCTION:
+    return loadFunctionShell(loader);
+  case OBJ_UPVALUE: {
+    ObjUpvalue *upvalue = newUpvalue(NULL);
+    upvalue->location = &upvalue->closed;
+    return (Obj *)upvalue;
+  }
+  case OBJ_KLASS: {
+    ObjString *name = (ObjString *)readOptionalObject(loader, OBJ_STRING);
+    ObjType base = (ObjType)readU8(reader);
+    return (Obj *)newKlass(name, base);
+  }
+  case OBJ_CLOSURE: {
+    ObjFunction *function = (ObjFunction *)readObject(loader, OBJ_FUNCTION);
+    return function == NULL ? NULL : (Obj *)newClosure(function);
+  }
+  case OBJ_BOUND_METHOD:
+    return (Obj *)newBoundMethod(NIL_VAL, NULL);
+  case OBJ_BOUND_NATIVE:
+    return (Obj *)newBoundNative(NIL_VAL, NULL);
+  default:
+    break;
+  }
+
+  ObjKlass *klass = (ObjKlass *)readOptionalObject(loader, OBJ_KLASS);
+  if (reader->failed) {
+    return NULL;
+  }
+  switch (type) {
+  case OBJ_INSTANCE:
+    return (Obj *)newInstance(klass);
+  case OBJ_LIST:
+    return (Obj *)newList(klass);
+  case OBJ_MAP:
+    return (Obj *)newMap(klass);
+  case OBJ_SET:
+    return (Obj *)newSet(klass);
+  case OBJ_DEQUE:
+    return (Obj *)newDeque(klass);
+  case OBJ_REGEX:
+    return (Obj *)newRegex(klass);
+  case OBJ_TYPED_ARRAY: {
+    ArrayType arrayType = (ArrayType)readU8(reader);
+    uint32_t count = readU32(reader);
+    if ((arrayType != ARRAY_FLOAT64 && arrayType != ARRAY_INT32) ||
+        !fits(loader, count, sizeof(int32_t))) {
+      reader->failed = true;
+      return NULL;
+    }
+    return (Obj *)newTypedArray(klass, arrayType, count);
+  }
+  case OBJ_BYTES: {
+    uint32_t length = readU32(reader);
+    return fits(loader, length, 1) ? (Obj *)newBytes(klass, length) : NULL;
+  }
+  default:
+    reader->failed = true;
+    return NULL;
+  }
+}
+
+static void loadContents(Loader *loader, Obj *object) {
+  Reader *reader = &loader->reader;
+  switch (object->type) {
+  case OBJ_BOUND_METHOD: {
+    ObjBoundMethod *bound = (ObjBoundMethod *)object;
+    bound->receiver = readValue(loader);
+    bound->method = (ObjClosure *)readObject(loader, OBJ_CLOSURE);
+    break;
+  }
+  case OBJ_BOUND_NATIVE: {
+    ObjBoundNative *bound = (ObjBoundNative *)object;
+    bound->receiver = readValue(loader);
+    bound->native = (ObjNative *)readObject(loader, OBJ_NATIVE);
+    break;
+  }
+  case OBJ_KLASS:
+    readTable(loader, &((ObjKlass *)object)->properties);
+    break;
+  case OBJ_CLOSURE: {
+    ObjClosure *closure = (ObjClosure *)object;
+    for (int i = 0; i < closure->upvalueCount; i++) {
+      closure->upvalues[i] = (ObjUpvalue *)readObject(loader, OBJ_UPVALUE);
+    }
+    break;
+  }
+  case OBJ_FUNCTION: {
+    ObjFunction *function = (ObjFunction *)object;
+    function->name = (ObjString *)readOptionalObject(loader, OBJ_STRING);
+    uint32_t count = readU32(reader);
+    for (uint32_t i = 0; i < count && !reader->failed; i++) {
+      addConstant(&function->chunk, readValue(loader));
+    }
+    break;
+  }
+  case OBJ_INSTANCE:
+    readTable(loader, &((ObjInstance *)object)->fields);
+    break;
+  case OBJ_UPVALUE:
+    ((ObjUpvalue *)object)->closed = readValue(loader);
+    break;
+  case OBJ_LIST: {
+    ObjList *list = (ObjList *)object;
+    uint32_t count = readU32(reader);
+    for (uint32_t i = 0; i < count && !reader->failed; i++) {
+      pushToList(list, readValue(loader));
+    }
+    readTable(loader, &list->fields);
+    break;
+  }
+  case OBJ_MAP: {
+    ObjMap *map = (ObjMap *)object;
+    readTable(loader, &map->items);
+    readTable(loader, &map->fields);
+    break;
+  }
+  case OBJ_SET: {
+    ObjSet *set = (ObjSet *)object;
+    uint32_t count = readU32(reader);
+    for (uint32_t i = 0; i < count && !reader->failed; i++) {
+      valueTableAdd(&set->items, readValue(loader));
+    }
+    readTable(loader, &set->fields);
+    break;
+  }
+  case OBJ_TYPED_ARRAY: {
+    ObjTypedArray *array = (ObjTypedArray *)object;
+    if (array->type == ARRAY_FLOAT64) {
+      size_t size = sizeof(double) * array->count;
+      const uint8_t *data = readBytes(reader, size);
+      if (data != NULL && size > 0) {
+        memcpy(array->as.f64, data, size);
+      }
+    } else {
+      size_t size = sizeof(int32_t) * array->count;
+      const uint8_t *data = readBytes(reader, size);
+      if (data != NULL && size > 0) {
+        memcpy(array->as.i32, data, size);
+      }
+    }
+    readTable(loader, &array->fields);
+    break;
+  }
+  case OBJ_DEQUE: {
+    ObjDeque *deque = (ObjDeque *)object;
+    uint32_t count = readU32(reader);
+    for (uint32_t i = 0; i < count && !reader->failed; i++) {
+      pushDequeBack(deque, readValue(loader));
+    }
+    readTable(loader, &deque->fields);
+    break;
+  }
+  case OBJ_BYTES: {
+    ObjBytes *bytes = (ObjBytes *)object;
+    const uint8_t *data = readBytes(reader, bytes->length);
+    if (data != NULL && bytes->length > 0) {
+      memcpy(bytes->data, data, bytes->length);
+    }
+    readTable(loader, &bytes->fields);
+    break;
+  }
+  case OBJ_REGEX: {
+    ObjRegex *regex = (ObjRegex *)object;
+    regex->pattern = (ObjString *)readObject(loader, OBJ_STRING);
+    if (regex->pattern != NULL && !recompileRegex(regex)) {
+      reader->failed = true;
+    }
+    readTable(loader, &regex->fields);
+    break;
+  }
+  case OBJ_STRING:
+    readTable(loader, &((ObjString *)object)->fields);
+    break;
+  case OBJ_NATIVE:
+  case OBJ_FILE:
+    reader->failed = true;
+    break;
+  }
+}
+
+static bool loadModules(Reader *reader) {
+  uint32_t count = readU32(reader);
+  for (uint32_t i = 0; i < count && !reader->failed; i++) {
+    uint32_t length;
+    const char *name = readChars(reader, &length);
+    if (name != NULL &&
+        !matchUseBuiltin(copyString(name, length, &vm.strings))) {
+      fprintf(stderr, "Snapshot uses '%.*s', which this ghoul does not have.\n",
+              (int)length, name);
+      reader->failed = true;
+    }
+  }
+  return !reader->failed;
+}
+
+static bool loadObjects(Loader *loader) {
+  Reader *reader = &loader->reader;
+  loader->count = readU32(reader);
+  if (!fits(loader, loader->count, 5)) {
+    return false;
+  }
+  loader->objects = calloc(loader->count + 1, sizeof(Obj *));
+  loader->named = calloc(loader->count + 1, sizeof(bool));
+  if (loader->objects == NULL || loader->named == NULL) {
+    reader->failed = true;
+    return false;
+  }
+
+  // Registered objects come back by name and have no contents record, so
+  // named also marks each object whose contents have been read.
+  uint32_t namedCount = 0;
+
+  for (uint32_t i = 0; i < loader->count && !reader->failed; i++) {
+    uint32_t number = readU32(reader);
+    uint8_t type = readU8(reader);
+    if (number >= loader->count || loader->objects[number] != NULL) {
+      reader->failed = true;
+      break;
+    }
+    Obj *object = loadShell(loader, type);
+    if (object == NULL) {
+      reader->failed = true;
+      break;
+    }
+    if (type == BUILTIN_TYPE) {
+      loader->named[number] = true;
+      namedCount++;
+    }
+    loader->objects[number] = object;
+    push(OBJ_VAL(object));
+    pushToList(loader->keep, OBJ_VAL(object));
+    pop();
+  }
+
+  uint32_t contentCount = loader->count - namedCount;
+  for (uint32_t i = 0; i < contentCount && !reader->failed; i++) {
+    uint32_t number = readU32(reader);
+    if (number >= loader->count || loader->named[number]) {
+      reader->failed = true;
+      break;
+    }
+    loader->named[number] = true;
+    loadContents(loader, loader->objects[number]);
+  }
+  return !reader->failed;
+}
+
+bool loadSnapshot(const char *path) {
+  size_t length = 0;
+  char *bytes = readWholeFile(path, &length);
+  if (bytes == NULL) {
+    fprintf(stderr, "Could not open snapshot \"%s\".\n", path);
+    return false;
+  }
+
+  Loader loader;
+  initReader(&loader.reader, bytes, length);
+  loader.objects = NULL;
+  loader.named = NULL;
+  loader.count = 0;
+  Reader *reader = &loader.reader;
+
+  const uint8_t *magic = readBytes(reader, SNAPSHOT_MAGIC_LENGTH);
+  bool loaded =
+      magic != NULL &&
+      memcmp(magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH) == 0 &&
+      readU32(reader) == SNAPSHOT_VERSION &&
+      readU32(reader) == SNAPSHOT_BYTE_ORDER && loadModules(reader);
+
+  if (loaded) {
+    loader.keep = newList(vm.klass.list);
+    push(OBJ_VAL(loader.keep));
+    loaded = loadObjects(&loader);
+    if (loaded) {
+      readTable(&loader, &vm.globals);
+    }
+
+    uint32_t useCount = readU32(reader);
+    for (uint32_t i = 0; i < useCount && !reader->failed; i++) {
+      uint32_t pathLength;
+      const char *chars = readChars(reader, &pathLength);
+      if (chars != NULL) {
+        usedPath(chars, pathLength);
+      }
+    }
+    loaded = loaded && !reader->failed && reader->position == reader->count;
+    pop();
+  }
+
+  if (!loaded) {
+    fprintf(stderr, "Snapshot \"%s\" is damaged or from another version.\n",
+            path);
+  }
+  free(loader.objects);
+  free(loader.named);
+  free(bytes);
+  return loaded;
+}
@@ -0,0 +1,18 @@
+#ifndef ghoul_snapshot_h
+#define ghoul_snapshot_h
+
+#include "object.h"
+
+// Names an object made while registering natives, such as "native:tick" or
+// "method:List.push". A snapshot refers to these by name and finds them
+// again in the process loading it, which registers the same natives.
+void nameBuiltin(const char *kind, ObjString *owner, const char *name,
+                 int length, Value value);
+
+// Saves the globals and everything reachable from them, returning false
+// after reporting a value that cannot be saved, such as an open file.
+bool writeSnapshot(const char *path);
+// Restores the globals saved by writeSnapshot on top of a fresh VM.
+bool loadSnapshot(const char *path);
+
+#endif
@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -152,3 +153,168 @@ void markTable(Table *table) {
     markValue(entry->value);
   }
 }
+
+// ValueTable keys are arbitrary values, so empty slots and tombstones use
+// tags that no user value can carry.
+#define EMPTY_KEY ((Value)(uint64_t)(QNAN | 4))
+#define TOMBSTONE_KEY ((Value)(uint64_t)(QNAN | 5))
+
+static uint32_t hashBits(uint64_t bits) {
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdULL;
+  bits ^= bits >> 33;
+  return (uint32_t)bits;
+}
+
+static uint32_t hashValue(Value value) {
+  if (IS_NUMBER(value)) {
+    double num = AS_NUMBER(value);
+    if (num == 0) {
+      // -0 and 0 are equal, so they must hash the same.
+      num = 0;
+    } else if (isnan(num)) {
+      // NaNs can carry any payload, but they are all the same key.
+      num = NAN;
+    }
+    return hashBits(NUMBER_VAL(num));
+  }
+  if (IS_STRING(value)) {
+    return AS_STRING(value)->hash;
+  }
+  return hashBits(value);
+}
+
+static bool valueKeysEqual(Value a, Value b) {
+  if (IS_STRING(a) && IS_STRING(b)) {
+    ObjString *x = AS_STRING(a);
+    ObjString *y = AS_STRING(b);
+    return x == y || (x->length == y->length && x->hash == y->hash &&
+                      memcmp(x->chars, y->chars, x->length) == 0);
+  }
+  // NaN never equals itself, but as a key it has to or it could be added
+  // over and over and never found again.
+  if (IS_NUMBER(a) && IS_NUMBER(b) && isnan(AS_NUMBER(a)) &&
+      isnan(AS_NUMBER(b))) {
+    return true;
+  }
+  return valuesEqual(a, b);
+}
+
+void initValueTable(ValueTable *table) {
+  table->count = 0;
+  table->used = 0;
+  table->capacity = 0;
+  table->keys = NULL;
+}
+
+void freeValueTable(ValueTable *table) {
+  FREE_ARRAY(Value, table->keys, table->capacity);
+  initValueTable(table);
+}
+
+static Value *findValueKey(Value *keys, int capacity, Value key) {
+  uint32_t index = hashValue(key) & (capacity - 1);
+  Value *tombstone = NULL;
+
+  for (;;) {
+    Value *slot = &keys[index];
+    if (*slot == EMPTY_KEY) {
+      return tombstone != NULL ? tombstone : slot;
+    } else if (*slot == TOMBSTONE_KEY) {
+      if (tombstone == NULL)
+        tombstone = slot;
+    } else if (valueKeysEqual(*slot, key)) {
+      return slot;
+    }
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void adjustValueCapacity(ValueTable *table, int capacity) {
+  Value *keys = ALLOCATE(Value, capacity);
+  for (int i = 0; i < capacity; i++) {
+    keys[i] = EMPTY_KEY;
+  }
+
+  for (int i = 0; i < table->capacity; i++) {
+    Value key = table->keys[i];
+    if (key == EMPTY_KEY || key == TOMBSTONE_KEY)
+      continue;
+    *findValueKey(keys, capacity, key) = key;
+  }
+
+  FREE_ARRAY(Value, table->keys, table->capacity);
+  table->keys = keys;
+  table->capacity = capacity;
+  table->used = table->count;
+}
+
+bool valueTableHas(ValueTable *table, Value key) {
+  if (table->count == 0)
+    return false;
+
+  Value *slot = findValueKey(table->keys, table->capacity, key);
+  return *slot != EMPTY_KEY && *slot != TOMBSTONE_KEY;
+}
+
+bool valueTableAdd(ValueTable *table, Value key) {
+  if (table->used + 1 > table->capacity * TABLE_MAX_LOAD) {
+    // Only grow when live keys need the room, otherwise just sweep the
+    // tombstones out at the current size.
+    int capacity = table->count + 1 > table->capacity * TABLE_MAX_LOAD / 2
+                       ? GROW_CAPACITY(table->capacity)
+                       : table->capacity;
+    adjustValueCapacity(table, capacity);
+  }
+
+  Value *slot = findValueKey(table->keys, table->capacity, key);
+  if (*slot != EMPTY_KEY && *slot != TOMBSTONE_KEY)
+    return false;
+
+  if (*slot == EMPTY_KEY)
+    table->used++;
+  table->count++;
+  *slot = key;
+  return true;
+}
+
+bool valueTableDelete(ValueTable *table, Value key) {
+  if (table->count == 0)
+    return false;
+
+  Value *slot = findValueKey(table->keys, table->capacity, key);
+  if (*slot == EMPTY_KEY || *slot == TOMBSTONE_KEY)
+    return false;
+
+  *slot = TOMBSTONE_KEY;
+  table->count--;
+  return true;
+}
+
+void valueTableAddAll(ValueTable *from, ValueTable *to) {
+  for (int i = 0; i < from->capacity; i++) {
+    Value key = from->keys[i];
+    if (key != EMPTY_KEY && key != TOMBSTONE_KEY) {
+      valueTableAdd(to, key);
+    }
+  }
+}
+
+int valueTableNext(ValueTable *table, int index) {
+  for (; index < table->capacity; index++) {
+    Value key = table->keys[index];
+    if (key != EMPTY_KEY && key != TOMBSTONE_KEY) {
+      return index;
+    }
+  }
+  return -1;
+}
+
+void markValueTable(ValueTable *table) {
+  for (int i = 0; i < table->capacity; i++) {
+    Value key = table->keys[i];
+    if (key != EMPTY_KEY && key != TOMBSTONE_KEY) {
+      markValue(key);
+    }
+  }
+}
@@ -14,6 +14,13 @@ typedef struct {
   Entry *entries;
 } Table;
 
+typedef struct {
+  int count;
+  int used;
+  int capacity;
+  Value *keys;
+} ValueTable;
+
 void initTable(Table *table);
 void freeTable(Table *table);
 bool tableGet(Table *table, ObjString *key, Value *value);
@@ -25,4 +32,13 @@ ObjString *tableFindString(Table *table, const char *chars, int length,
 void tableRemoveWhite(Table *table);
 void markTable(Table *table);
 
+void initValueTable(ValueTable *table);
+void freeValueTable(ValueTable *table);
+bool valueTableHas(ValueTable *table, Value key);
+bool valueTableAdd(ValueTable *table, Value key);
+bool valueTableDelete(ValueTable *table, Value key);
+void valueTableAddAll(ValueTable *from, ValueTable *to);
+int valueTableNext(ValueTable *table, int index);
+void markValueTable(ValueTable *table);
+
 #endif
@@ -1,60 +1,416 @@
 #include "utf8.h"
 #include "object.h"
+#include "memory.h"
 #include <stddef.h>
-int utf8_char_length(unsigned char byte) {
-    if (byte < 0x80) return 1;
-    if (byte < 0xC0) return -1;
-    if (byte < 0xE0) return 2;
-    if (byte < 0xF0) return 3;
-    if (byte < 0xF8) return 4;
-    return -1;
+#include <string.h>
+
+#if defined(__SSSE3__) || (defined(__SSE2__) && defined(__GNUC__))
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Bulk scans run 16 bytes at a time over a tiny vector layer. Every backend
+// can test for non-ASCII bytes and count continuation bytes; backends with a
+// byte shuffle (SSSE3, NEON) also get the lookup-table validator below.
+// Without a backend the scans fall back to 8 byte SWAR words.
+//
+// Builds for plain SSE2 still compile the validator for SSSE3 with a target
+// attribute, and only run it once the CPU is known to have SSSE3.
+#if defined(__SSE2__)
+#define UTF8_VEC 1
+typedef __m128i U8Vec;
+static inline U8Vec u8_load(const unsigned char* p) {
+    return _mm_loadu_si128((const __m128i*)p);
+}
+static inline U8Vec u8_splat(unsigned char x) { return _mm_set1_epi8((char)x); }
+static inline U8Vec u8_or(U8Vec a, U8Vec b) { return _mm_or_si128(a, b); }
+static inline U8Vec u8_and(U8Vec a, U8Vec b) { return _mm_and_si128(a, b); }
+static inline U8Vec u8_xor(U8Vec a, U8Vec b) { return _mm_xor_si128(a, b); }
+static inline U8Vec u8_sub(U8Vec a, U8Vec b) { return _mm_sub_epi8(a, b); }
+static inline U8Vec u8_sub_sat(U8Vec a, U8Vec b) { return _mm_subs_epu8(a, b); }
+static inline bool u8_any_high(U8Vec v) { return _mm_movemask_epi8(v) != 0; }
+static inline bool u8_any_set(U8Vec v) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xFFFF;
+}
+// 0xFF in every lane holding a 10xxxxxx byte.
+static inline U8Vec u8_continuations(U8Vec v) {
+    return _mm_cmplt_epi8(v, _mm_set1_epi8(-64));
+}
+static inline int u8_sum(U8Vec v) {
+    __m128i sums = _mm_sad_epu8(v, _mm_setzero_si128());
+    return _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+}
+#if defined(__SSSE3__) || defined(__GNUC__)
+#define UTF8_LOOKUP 1
+#if !defined(__SSSE3__)
+#define UTF8_LOOKUP_DISPATCH 1
+#define LOOKUP_TARGET __attribute__((target("ssse3")))
+#else
+#define LOOKUP_TARGET
+#endif
+static inline LOOKUP_TARGET U8Vec u8_lookup(U8Vec table, U8Vec index) {
+    return _mm_shuffle_epi8(table, index);
+}
+static inline LOOKUP_TARGET U8Vec u8_high_nibble(U8Vec v) {
+    return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
 }
+#define u8_prev(input, prev, n) _mm_alignr_epi8(input, prev, 16 - (n))
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define UTF8_VEC 1
+#define UTF8_LOOKUP 1
+typedef uint8x16_t U8Vec;
+static inline U8Vec u8_load(const unsigned char* p) { return vld1q_u8(p); }
+static inline U8Vec u8_splat(unsigned char x) { return vdupq_n_u8(x); }
+static inline U8Vec u8_or(U8Vec a, U8Vec b) { return vorrq_u8(a, b); }
+static inline U8Vec u8_and(U8Vec a, U8Vec b) { return vandq_u8(a, b); }
+static inline U8Vec u8_xor(U8Vec a, U8Vec b) { return veorq_u8(a, b); }
+static inline U8Vec u8_sub(U8Vec a, U8Vec b) { return vsubq_u8(a, b); }
+static inline U8Vec u8_sub_sat(U8Vec a, U8Vec b) { return vqsubq_u8(a, b); }
+static inline bool u8_any_high(U8Vec v) { return vmaxvq_u8(v) >= 0x80; }
+static inline bool u8_any_set(U8Vec v) { return vmaxvq_u8(v) != 0; }
+static inline U8Vec u8_continuations(U8Vec v) {
+    return vcltq_s8(vreinterpretq_s8_u8(v), vdupq_n_s8(-64));
+}
+static inline int u8_sum(U8Vec v) { return vaddlvq_u8(v); }
+static inline U8Vec u8_lookup(U8Vec table, U8Vec index) {
+    return vqtbl1q_u8(table, index);
+}
+static inline U8Vec u8_high_nibble(U8Vec v) { return vshrq_n_u8(v, 4); }
+#define u8_prev(input, prev, n) vextq_u8(prev, input, 16 - (n))
+#endif
 
-int utf8_string_length(const char* str, int byte_length) {
-    if (str == NULL || byte_length < 0) {
+#ifndef LOOKUP_TARGET
+#define LOOKUP_TARGET
+#endif
+
+#define SWAR_HIGH_BITS 0x8080808080808080ULL
+
+static inline uint64_t load_word(const unsigned char* p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+// Length of the leading run of ASCII bytes.
+static int ascii_prefix(const unsigned char* str, int byte_length) {
+    int pos = 0;
+#ifdef UTF8_VEC
+    while (pos + 64 <= byte_length) {
+        U8Vec any = u8_or(u8_or(u8_load(str + pos), u8_load(str + pos + 16)),
+                          u8_or(u8_load(str + pos + 32), u8_load(str + pos + 48)));
+        if (u8_any_high(any)) {
+            break;
+        }
+        pos += 64;
+    }
+    while (pos + 16 <= byte_length && !u8_any_high(u8_load(str + pos))) {
+        pos += 16;
+    }
+#endif
+    while (pos + 8 <= byte_length && (load_word(str + pos) & SWAR_HIGH_BITS) == 0) {
+        pos += 8;
+    }
+    while (pos < byte_length && str[pos] < 0x80) {
+        pos++;
+    }
+    return pos;
+}
+
+// Length of the ASCII run at str[pos], which is known to be ASCII. Short runs
+// between multi-byte characters are common, so only hand off to the bulk scan
+// once a whole word is ASCII.
+static inline int ascii_run(const unsigned char* str, int pos, int byte_length) {
+    if (pos + 8 > byte_length || (load_word(str + pos) & SWAR_HIGH_BITS) != 0) {
+        return 1;
+    }
+    return ascii_prefix(str + pos, byte_length - pos);
+}
+
+#ifdef UTF8_LOOKUP
+// Keiser and Lemire's lookup validator. Each byte is classified by the high
+// and low nibble of the byte before it and the high nibble of itself; the
+// three table lookups AND together to the error bits that pair can produce.
+// A second check then demands continuations after 3 and 4 byte leads.
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+static const unsigned char byte_1_high_table[16] = {
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+};
+
+static const unsigned char byte_1_low_table[16] = {
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+};
+
+static const unsigned char byte_2_high_table[16] = {
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+};
+
+// A block whose last bytes open a sequence the block does not finish.
+static const unsigned char incomplete_table[16] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1,
+};
+
+static inline LOOKUP_TARGET U8Vec check_block(U8Vec input, U8Vec prev) {
+    U8Vec prev1 = u8_prev(input, prev, 1);
+    U8Vec special = u8_and(
+        u8_and(u8_lookup(u8_load(byte_1_high_table), u8_high_nibble(prev1)),
+               u8_lookup(u8_load(byte_1_low_table), u8_and(prev1, u8_splat(0x0F)))),
+        u8_lookup(u8_load(byte_2_high_table), u8_high_nibble(input)));
+
+    U8Vec third = u8_sub_sat(u8_prev(input, prev, 2), u8_splat(0xE0 - 0x80));
+    U8Vec fourth = u8_sub_sat(u8_prev(input, prev, 3), u8_splat(0xF0 - 0x80));
+    U8Vec must_continue = u8_and(u8_or(third, fourth), u8_splat(0x80));
+    return u8_xor(must_continue, special);
+}
+
+// Validates and counts continuation bytes in one pass.
+static LOOKUP_TARGET bool lookup_validate_and_count(const unsigned char* str, int byte_length,
+                                                    int* continuations) {
+    U8Vec zero = u8_splat(0);
+    U8Vec prev = zero;
+    U8Vec prev_incomplete = zero;
+    U8Vec error = zero;
+    U8Vec counts = zero;
+    U8Vec incomplete = u8_load(incomplete_table);
+    int pending = 0;
+    int total = 0;
+    unsigned char tail[16];
+
+    for (int pos = 0; pos < byte_length; pos += 16) {
+        U8Vec input;
+        if (byte_length - pos >= 16) {
+            input = u8_load(str + pos);
+        } else {
+            // Zero padding reads as ASCII, so a truncated tail still errors.
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, str + pos, byte_length - pos);
+            input = u8_load(tail);
+        }
+
+        if (!u8_any_high(input)) {
+            error = u8_or(error, prev_incomplete);
+            prev_incomplete = zero;
+        } else {
+            error = u8_or(error, check_block(input, prev));
+            prev_incomplete = u8_sub_sat(input, incomplete);
+            // Lanes count down from zero, so flush before they can wrap.
+            counts = u8_sub(counts, u8_continuations(input));
+            if (++pending == 255) {
+                total += u8_sum(counts);
+                counts = zero;
+                pending = 0;
+            }
+        }
+        prev = input;
+    }
+
+    error = u8_or(error, prev_incomplete);
+    *continuations = total + u8_sum(counts);
+    return !u8_any_set(error);
+}
+
+#ifdef UTF8_LOOKUP_DISPATCH
+#define lookup_available() __builtin_cpu_supports("ssse3")
+#else
+#define lookup_available() true
+#endif
+#endif
+
+#if !defined(UTF8_LOOKUP) || defined(UTF8_LOOKUP_DISPATCH)
+// Checks one multi-byte sequence starting at str[pos] and returns its length,
+// or 0 when it is truncated, overlong, a surrogate or beyond U+10FFFF.
+static int scalar_sequence_length(const unsigned char* str, int pos, int byte_length) {
+    unsigned char byte = str[pos];
+    int char_len = utf8_char_length(byte);
+
+    if (char_len <= 0) {
         return 0;
     }
-    if (byte_length == 0) {
+
+    if (pos + char_len > byte_length) {
         return 0;
     }
-    
-    int char_count = 0;
+
+    for (int i = 1; i < char_len; i++) {
+        unsigned char cont_byte = str[pos + i];
+        if ((cont_byte & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+
+    if (char_len == 2) {
+        unsigned int codepoint = ((byte & 0x1F) << 6) | (str[pos + 1] & 0x3F);
+        if (codepoint < 0x80) {
+            return 0;
+        }
+    } else if (char_len == 3) {
+        unsigned int codepoint = ((byte & 0x0F) << 12) |
+                               ((str[pos + 1] & 0x3F) << 6) |
+                               (str[pos + 2] & 0x3F);
+        if (codepoint < 0x800 || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+            return 0;
+        }
+    } else if (char_len == 4) {
+        unsigned int codepoint = ((byte & 0x07) << 18) |
+                               ((str[pos + 1] & 0x3F) << 12) |
+                               ((str[pos + 2] & 0x3F) << 6) |
+                               (str[pos + 3] & 0x3F);
+        if (codepoint < 0x10000 || codepoint > 0x10FFFF) {
+            return 0;
+        }
+    }
+
+    return char_len;
+}
+
+static bool scalar_validate_and_count(const unsigned char* str, int byte_length,
+                                      int* continuations) {
     int pos = 0;
-    
+    int total = 0;
+
     while (pos < byte_length) {
-        int char_len = utf8_char_length((unsigned char)str[pos]);
-        if (char_len <= 0) {
-            char_count++;
-            pos++;
+        if (str[pos] < 0x80) {
+            pos += ascii_run(str, pos, byte_length);
             continue;
         }
-        if (pos + char_len > byte_length) {
-            char_count++;
-            break;
+        int char_len = scalar_sequence_length(str, pos, byte_length);
+        if (char_len == 0) {
+            return false;
         }
-        
-        bool valid_sequence = true;
-        for (int i = 1; i < char_len; i++) {
-            unsigned char cont_byte = (unsigned char)str[pos + i];
-            if ((cont_byte & 0xC0) != 0x80) {
-                valid_sequence = false;
-                break;
-            }
+        total += char_len - 1;
+        pos += char_len;
+    }
+
+    *continuations = total;
+    return true;
+}
+#endif
+
+static bool validate_and_count(const unsigned char* str, int byte_length, int* continuations) {
+#if defined(UTF8_LOOKUP_DISPATCH)
+    if (lookup_available()) {
+        return lookup_validate_and_count(str, byte_length, continuations);
+    }
+    return scalar_validate_and_count(str, byte_length, continuations);
+#elif defined(UTF8_LOOKUP)
+    return lookup_validate_and_count(str, byte_length, continuations);
+#else
+    return scalar_validate_and_count(str, byte_length, continuations);
+#endif
+}
+
+// Steps over one character the forgiving way: a malformed byte is a
+// character of its own and a truncated sequence runs to the end.
+static inline int lenient_step(const unsigned char* str, int pos, int byte_length) {
+    int char_len = utf8_char_length(str[pos]);
+    if (char_len == 1 || char_len <= 0) {
+        return pos + 1;
+    }
+    if (pos + char_len > byte_length) {
+        return byte_length;
+    }
+    for (int i = 1; i < char_len; i++) {
+        if ((str[pos + i] & 0xC0) != 0x80) {
+            return pos + 1;
         }
-        
-        if (!valid_sequence) {
-            char_count++;
-            pos++;
+    }
+    return pos + char_len;
+}
+
+static int lenient_length(const unsigned char* str, int byte_length) {
+    int char_count = 0;
+    int pos = 0;
+
+    while (pos < byte_length) {
+        if (str[pos] < 0x80) {
+            int run = ascii_run(str, pos, byte_length);
+            char_count += run;
+            pos += run;
             continue;
         }
-        
         char_count++;
-        pos += char_len;
+        pos = lenient_step(str, pos, byte_length);
     }
-    
+
     return char_count;
 }
 
+int utf8_char_length(unsigned char byte) {
+    if (byte < 0x80) return 1;
+    if (byte < 0xC0) return -1;
+    if (byte < 0xE0) return 2;
+    if (byte < 0xF0) return 3;
+    if (byte < 0xF8) return 4;
+    return -1;
+}
+
+int utf8_string_length(const char* str, int byte_length) {
+    if (str == NULL || byte_length < 0) {
+        return 0;
+    }
+    if (byte_length == 0) {
+        return 0;
+    }
+
+    const unsigned char* bytes = (const unsigned char*)str;
+    int prefix = ascii_prefix(bytes, byte_length);
+    if (prefix == byte_length) {
+        return byte_length;
+    }
+
+    int rest = byte_length - prefix;
+#ifdef UTF8_LOOKUP
+    // Well-formed text has exactly one non-continuation byte per character.
+    int continuations;
+    if (lookup_available() &&
+        lookup_validate_and_count(bytes + prefix, rest, &continuations)) {
+        return byte_length - continuations;
+    }
+#endif
+    return prefix + lenient_length(bytes + prefix, rest);
+}
+
 bool utf8_is_valid(const char* str, int byte_length) {
     if (str == NULL) {
         return false;
@@ -65,54 +421,15 @@ bool utf8_is_valid(const char* str, int byte_length) {
     if (byte_length == 0) {
         return true;
     }
-    
-    int pos = 0;
-    
-    while (pos < byte_length) {
-        unsigned char byte = (unsigned char)str[pos];
-        int char_len = utf8_char_length(byte);
-        
-        if (char_len <= 0) {
-            return false;
-        }
-        
-        if (pos + char_len > byte_length) {
-            return false;
-        }
-        
-        for (int i = 1; i < char_len; i++) {
-            unsigned char cont_byte = (unsigned char)str[pos + i];
-            if ((cont_byte & 0xC0) != 0x80) {
-                return false;
-            }
-        }
-        
-        if (char_len == 2) {
-            unsigned int codepoint = ((byte & 0x1F) << 6) | (str[pos + 1] & 0x3F);
-            if (codepoint < 0x80) {
-                return false;
-            }
-        } else if (char_len == 3) {
-            unsigned int codepoint = ((byte & 0x0F) << 12) | 
-                                   ((str[pos + 1] & 0x3F) << 6) | 
-                                   (str[pos + 2] & 0x3F);
-            if (codepoint < 0x800 || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
-                return false;
-            }
-        } else if (char_len == 4) {
-            unsigned int codepoint = ((byte & 0x07) << 18) | 
-                                   ((str[pos + 1] & 0x3F) << 12) | 
-                                   ((str[pos + 2] & 0x3F) << 6) | 
-                                   (str[pos + 3] & 0x3F);
-            if (codepoint < 0x10000 || codepoint > 0x10FFFF) {
-                return false;
-            }
-        }
-        
-        pos += char_len;
+
+    const unsigned char* bytes = (const unsigned char*)str;
+    int prefix = ascii_prefix(bytes, byte_length);
+    if (prefix == byte_length) {
+        return true;
     }
-    
-    return pos == byte_length;
+
+    int continuations;
+    return validate_and_count(bytes + prefix, byte_length - prefix, &continuations);
 }
 
 int utf8_char_at_index(const char* str, int char_index, int byte_length) {
@@ -176,36 +493,11 @@ bool utf8_is_ascii_only(const char* str, int byte_length) {
     if (byte_length == 0) {
         return true;
     }
-    
-    for (int i = 0; i < byte_length; i++) {
-        if ((unsigned char)str[i] > 0x7F) {
-            return false;
-        }
-    }
-    
-    return true;
+
+    return ascii_prefix((const unsigned char*)str, byte_length) == byte_length;
 }
 
 int utf8_string_length_fast(const char* str, int byte_length) {
-    if (str == NULL || byte_length < 0) {
-        return 0;
-    }
-    if (byte_length == 0) {
-        return 0;
-    }
-    
-    bool is_ascii = true;
-    for (int i = 0; i < byte_length; i++) {
-        if ((unsigned char)str[i] > 0x7F) {
-            is_ascii = false;
-            break;
-        }
-    }
-    
-    if (is_ascii) {
-        return byte_length;
-    }
-    
     return utf8_string_length(str, byte_length);
 }
 
@@ -241,4 +533,103 @@ bool utf8_get_cached_is_ascii(struct ObjString* string) {
     
     utf8_get_cached_length(string);
     return string->is_ascii;
-}
\ No newline at end of file
+}
+
+int utf8_next_offset(const char* str, int byte_pos, int byte_length) {
+    return lenient_step((const unsigned char*)str, byte_pos, byte_length);
+}
+
+// Non-ASCII strings longer than one stride get a breadcrumb per
+// UTF8_OFFSET_STRIDE characters, so any character is at most a stride's walk
+// from a known byte offset. Strings are immutable, so the index is built once.
+static int char_offset_count(struct ObjString* string) {
+    return (string->char_length + UTF8_OFFSET_STRIDE - 1) / UTF8_OFFSET_STRIDE;
+}
+
+static void build_char_offsets(struct ObjString* string) {
+    int count = char_offset_count(string);
+    int* offsets = ALLOCATE(int, count);
+    const unsigned char* str = (const unsigned char*)string->chars;
+    int pos = 0;
+
+    for (int i = 0; i < string->char_length; i++) {
+        if (i % UTF8_OFFSET_STRIDE == 0) {
+            offsets[i / UTF8_OFFSET_STRIDE] = pos;
+        }
+        pos = lenient_step(str, pos, string->length);
+    }
+    string->char_offsets = offsets;
+}
+
+int utf8_char_offset(struct ObjString* string, int char_index) {
+    int char_length = utf8_get_cached_length(string);
+    if (char_index < 0 || char_index > char_length) {
+        return -1;
+    }
+    if (string->is_ascii) {
+        return char_index;
+    }
+    if (char_index == char_length) {
+        return string->length;
+    }
+
+    int pos = 0;
+    int walk = char_index;
+    if (char_length > UTF8_OFFSET_STRIDE) {
+        if (string->char_offsets == NULL) {
+            build_char_offsets(string);
+        }
+        pos = string->char_offsets[char_index / UTF8_OFFSET_STRIDE];
+        walk = char_index % UTF8_OFFSET_STRIDE;
+    }
+
+    const unsigned char* str = (const unsigned char*)string->chars;
+    while (walk-- > 0) {
+        pos = lenient_step(str, pos, string->length);
+    }
+    return pos;
+}
+
+int utf8_char_index(struct ObjString* string, int byte_offset) {
+    int char_length = utf8_get_cached_length(string);
+    if (string->is_ascii || byte_offset <= 0) {
+        return byte_offset;
+    }
+    if (byte_offset >= string->length) {
+        return char_length;
+    }
+
+    int pos = 0;
+    int index = 0;
+    if (char_length > UTF8_OFFSET_STRIDE) {
+        if (string->char_offsets == NULL) {
+            build_char_offsets(string);
+        }
+        int low = 0;
+        int high = char_offset_count(string) - 1;
+        while (low < high) {
+            int mid = low + (high - low + 1) / 2;
+            if (string->char_offsets[mid] <= byte_offset) {
+                low = mid;
+            } else {
+                high = mid - 1;
+            }
+        }
+        pos = string->char_offsets[low];
+        index = low * UTF8_OFFSET_STRIDE;
+    }
+
+    const unsigned char* str = (const unsigned char*)string->chars;
+    while (pos < byte_offset) {
+        pos = lenient_step(str, pos, string->length);
+        index++;
+    }
+    return index;
+}
+
+void utf8_free_char_offsets(struct ObjString* string) {
+    if (string->char_offsets != NULL) {
+        FREE_ARRAY(int, string->char_offsets, char_offset_count(string));
+        string->char_offsets = NULL;
+    }
+}
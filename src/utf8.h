@@ -18,4 +18,13 @@ int utf8_string_length_fast(const char* str, int byte_length);
 int utf8_get_cached_length(struct ObjString* string);
 bool utf8_get_cached_is_ascii(struct ObjString* string);
 
+// Character <-> byte offset mapping for string indexing. Both are O(1)
+// amortized: ASCII strings map directly, others through a lazily built
+// breadcrumb index. The string must be reachable, as building may collect.
+#define UTF8_OFFSET_STRIDE 32
+int utf8_next_offset(const char* str, int byte_pos, int byte_length);
+int utf8_char_offset(struct ObjString* string, int char_index);
+int utf8_char_index(struct ObjString* string, int byte_offset);
+void utf8_free_char_offsets(struct ObjString* string);
+
 #endif
\ No newline at end of file
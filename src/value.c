@@ -2,6 +2,7 @@
 #include <string.h>
 
 #include "memory.h"
+#include "number.h"
 #include "object.h"
 #include "value.h"
 
@@ -34,7 +35,9 @@ void printValue(Value value) {
   } else if (IS_NIL(value)) {
     printf("nil");
   } else if (IS_NUMBER(value)) {
-    printf("%.15g", AS_NUMBER(value));
+    char buffer[NUMBER_BUFFER_SIZE];
+    int length = formatNumber(AS_NUMBER(value), buffer);
+    fwrite(buffer, 1, length, stdout);
   } else if (IS_OBJ(value)) {
     printObject(value);
   }
@@ -1,15 +1,21 @@
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include "chunk.h"
+#include "cache.h"
 #include "compiler.h"
+#include "loader.h"
 #include "memory.h"
 #include "native/native.h"
+#include "number.h"
 #include "object.h"
 #include "table.h"
+#include "utf8.h"
 #include "value.h"
 #include "vm.h"
 
@@ -37,9 +43,13 @@ void runtimeError(const char *format, ...) {
     CallFrame *frame = &vm.frames[i];
     ObjFunction *function = frame->closure->function;
     size_t instruction = frame->ip - function->chunk.code - 1;
-    fprintf(stderr, "[line %d of %s] in ",
-            getLine(&function->chunk, instruction),
-            getFileName(&function->chunk));
+    int line = getLine(&function->chunk, instruction);
+    if (line < 0) {
+      fprintf(stderr, "[%s] in ", getFileName(&function->chunk));
+    } else {
+      fprintf(stderr, "[line %d of %s] in ", line,
+              getFileName(&function->chunk));
+    }
     if (function->name == NULL) {
       fprintf(stderr, "script\n");
     } else {
@@ -50,7 +60,36 @@ void runtimeError(const char *format, ...) {
   resetStack();
 }
 
+// GHOUL_HASH_SEED fixes the string hash seed, and with it the iteration
+// order of maps and sets, so runs can be reproduced. Otherwise each process
+// draws a fresh seed.
+static uint64_t chooseHashSeed() {
+  const char *fixed = getenv("GHOUL_HASH_SEED");
+  if (fixed != NULL && *fixed != '\0') {
+    char *end;
+    unsigned long long seed = strtoull(fixed, &end, 10);
+    if (*end == '\0') {
+      return (uint64_t)seed;
+    }
+  }
+
+  uint64_t seed = 0;
+  FILE *random = fopen("/dev/urandom", "rb");
+  if (random != NULL) {
+    size_t read = fread(&seed, sizeof(seed), 1, random);
+    fclose(random);
+    if (read == 1) {
+      return seed;
+    }
+  }
+  // No system entropy: fall back on the clock and address randomization.
+  seed = (uint64_t)time(NULL) ^ ((uint64_t)clock() << 32);
+  seed ^= (uint64_t)(uintptr_t)&seed ^ (uint64_t)(uintptr_t)&vm;
+  return seed;
+}
+
 void initVM() {
+  seedStringHash(chooseHashSeed());
   resetStack();
   vm.objects = NULL;
   vm.bytesAllocated = 0;
@@ -63,6 +102,7 @@ void initVM() {
   initTable(&vm.globals);
   initTable(&vm.strings);
   initTable(&vm.useStrings);
+  initTable(&vm.builtins);
 
   vm.klass.list = NULL;
   vm.klass.file = NULL;
@@ -70,9 +110,18 @@ void initVM() {
   vm.klass.error = NULL;
   vm.klass.pair = NULL;
   vm.klass.map = NULL;
+  vm.klass.set = NULL;
+  vm.klass.float64Array = NULL;
+  vm.klass.int32Array = NULL;
+  vm.klass.deque = NULL;
+  vm.klass.bytes = NULL;
+  vm.klass.regex = NULL;
+  vm.klass.match = NULL;
 
   vm.keep = NULL;
   vm.shouldPanic = false;
+  vm.optimize = false;
+  vm.stripLines = false;
 
   registerBuiltInKlasses();
   
@@ -106,6 +155,7 @@ void freeVM() {
   freeTable(&vm.strings);
   freeTable(&vm.globals);
   freeTable(&vm.useStrings);
+  freeTable(&vm.builtins);
   vm.string.init = NULL;
   vm.string.isError = NULL;
   vm.string.message = NULL;
@@ -122,6 +172,13 @@ void freeVM() {
   vm.klass.error = NULL;
   vm.klass.pair = NULL;
   vm.klass.map = NULL;
+  vm.klass.set = NULL;
+  vm.klass.float64Array = NULL;
+  vm.klass.int32Array = NULL;
+  vm.klass.deque = NULL;
+  vm.klass.bytes = NULL;
+  vm.klass.regex = NULL;
+  vm.klass.match = NULL;
   vm.keep = NULL;
   freeObjects();
 }
@@ -201,6 +258,23 @@ static bool initClass(ObjKlass *klass, Value initializer, int argCount) {
   case OBJ_FILE:
     vm.stackTop[-argCount - 1] = OBJ_VAL(newFile(klass));
     break;
+  case OBJ_SET:
+    vm.stackTop[-argCount - 1] = OBJ_VAL(newSet(klass));
+    break;
+  case OBJ_DEQUE:
+    vm.stackTop[-argCount - 1] = OBJ_VAL(newDeque(klass));
+    break;
+  case OBJ_BYTES:
+    vm.stackTop[-argCount - 1] = OBJ_VAL(newBytes(klass, 0));
+    break;
+  case OBJ_REGEX:
+    vm.stackTop[-argCount - 1] = OBJ_VAL(newRegex(klass));
+    break;
+  case OBJ_TYPED_ARRAY:
+    // The element type is settled by the builtin init the subclass chains to.
+    vm.stackTop[-argCount - 1] =
+        OBJ_VAL(newTypedArray(klass, ARRAY_FLOAT64, 0));
+    break;
   case OBJ_STRING:
     vm.stackTop[-argCount - 1] =
         OBJ_VAL(copyEscString("", 0, &vm.strings, klass));
@@ -290,6 +364,26 @@ static bool invoke(ObjString *name, int argCount) {
     ObjString *string = AS_STRING(receiver);
     klass = string->klass;
     fields = &string->fields;
+  } else if (IS_SET(receiver)) {
+    ObjSet *set = AS_SET(receiver);
+    klass = set->klass;
+    fields = &set->fields;
+  } else if (IS_TYPED_ARRAY(receiver)) {
+    ObjTypedArray *array = AS_TYPED_ARRAY(receiver);
+    klass = array->klass;
+    fields = &array->fields;
+  } else if (IS_DEQUE(receiver)) {
+    ObjDeque *deque = AS_DEQUE(receiver);
+    klass = deque->klass;
+    fields = &deque->fields;
+  } else if (IS_BYTES(receiver)) {
+    ObjBytes *bytes = AS_BYTES(receiver);
+    klass = bytes->klass;
+    fields = &bytes->fields;
+  } else if (IS_REGEX(receiver)) {
+    ObjRegex *regex = AS_REGEX(receiver);
+    klass = regex->klass;
+    fields = &regex->fields;
   } else {
     runtimeError("Only instances have methods.");
     return false;
@@ -369,7 +463,7 @@ static void defineMethod(ObjString *name) {
   return;
 }
 
-static bool isFalsey(Value value) {
+bool isFalsey(Value value) {
   return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
@@ -389,6 +483,53 @@ static void concatenateStrings() {
   push(OBJ_VAL(result));
 }
 
+// Joins the top count values into one string, sizing it up front so only
+// the result is allocated.
+static bool buildString(int count) {
+  Value *parts = vm.stackTop - count;
+  const char *texts[UINT8_MAX];
+  int lengths[UINT8_MAX];
+  char numbers[UINT8_MAX][NUMBER_BUFFER_SIZE];
+  size_t total = 0;
+  for (int i = 0; i < count; i++) {
+    Value part = parts[i];
+    if (IS_STRING(part)) {
+      texts[i] = AS_STRING(part)->chars;
+      lengths[i] = AS_STRING(part)->length;
+    } else if (IS_NUMBER(part)) {
+      texts[i] = numbers[i];
+      lengths[i] = formatNumber(AS_NUMBER(part), numbers[i]);
+    } else if (IS_BOOL(part)) {
+      texts[i] = AS_BOOL(part) ? "true" : "false";
+      lengths[i] = AS_BOOL(part) ? 4 : 5;
+    } else if (IS_NIL(part)) {
+      texts[i] = "nil";
+      lengths[i] = 3;
+    } else {
+      runtimeError("Can only interpolate strings, numbers, bools and nil.");
+      return false;
+    }
+    total += lengths[i];
+  }
+  if (total > INT_MAX) {
+    runtimeError("Interpolated string is too large.");
+    return false;
+  }
+
+  char *chars = ALLOCATE(char, total + 1);
+  char *cursor = chars;
+  for (int i = 0; i < count; i++) {
+    memcpy(cursor, texts[i], lengths[i]);
+    cursor += lengths[i];
+  }
+  chars[total] = '\0';
+
+  ObjString *result = takeString(chars, (int)total);
+  vm.stackTop -= count;
+  push(OBJ_VAL(result));
+  return true;
+}
+
 static void concatenateLists() {
   ObjList *b = AS_LIST(peek(0));
   ObjList *a = AS_LIST(peek(1));
@@ -404,12 +545,15 @@ static void concatenateLists() {
   push(OBJ_VAL(result));
 }
 
-static InterpretResult run() {
+static InterpretResult run(int baseFrame) {
   CallFrame *frame = &vm.frames[vm.frameCount - 1];
 
 #define READ_BYTE() (*(frame->ip++))
 #define READ_SHORT()                                                           \
   (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+#define READ_LONG()                                                            \
+  (frame->ip += 3, (uint32_t)((frame->ip[-3] << 16) | (frame->ip[-2] << 8) |   \
+                              frame->ip[-1]))
 #define READ_CONSTANT()                                                        \
   (frame->closure->function->chunk.constants.values[READ_BYTE()])
 #define READ_CONSTANT_SHORT()                                                  \
@@ -473,6 +617,12 @@ static InterpretResult run() {
       push(constant);
       break;
     }
+    case OP_CONSTANT_LONG: {
+      Value constant =
+          frame->closure->function->chunk.constants.values[READ_LONG()];
+      push(constant);
+      break;
+    }
     case OP_NIL:
       push(NIL_VAL);
       break;
@@ -543,6 +693,11 @@ static InterpretResult run() {
       frame->slots[slot] = peek(0);
       break;
     }
+    case OP_SET_LOCAL_POP: {
+      uint8_t slot = READ_BYTE();
+      frame->slots[slot] = pop();
+      break;
+    }
     case OP_DEFINE_GLOBAL: {
       ObjString *name = READ_STRING();
       if (!tableSet(&vm.globals, name, peek(0))) {
@@ -583,7 +738,7 @@ static InterpretResult run() {
       break;
     }
     case OP_GET_UPVALUE_SHORT: {
-      uint8_t slot = READ_SHORT();
+      uint16_t slot = READ_SHORT();
       push(*frame->closure->upvalues[slot]->location);
       break;
     }
@@ -593,7 +748,7 @@ static InterpretResult run() {
       break;
     }
     case OP_SET_UPVALUE_SHORT: {
-      uint8_t slot = READ_SHORT();
+      uint16_t slot = READ_SHORT();
       *frame->closure->upvalues[slot]->location = peek(0);
       break;
     }
@@ -620,6 +775,26 @@ static InterpretResult run() {
         ObjString *string = AS_STRING(peek(0));
         klass = string->klass;
         fields = &string->fields;
+      } else if (IS_SET(peek(0))) {
+        ObjSet *set = AS_SET(peek(0));
+        klass = set->klass;
+        fields = &set->fields;
+      } else if (IS_TYPED_ARRAY(peek(0))) {
+        ObjTypedArray *array = AS_TYPED_ARRAY(peek(0));
+        klass = array->klass;
+        fields = &array->fields;
+      } else if (IS_DEQUE(peek(0))) {
+        ObjDeque *deque = AS_DEQUE(peek(0));
+        klass = deque->klass;
+        fields = &deque->fields;
+      } else if (IS_BYTES(peek(0))) {
+        ObjBytes *bytes = AS_BYTES(peek(0));
+        klass = bytes->klass;
+        fields = &bytes->fields;
+      } else if (IS_REGEX(peek(0))) {
+        ObjRegex *regex = AS_REGEX(peek(0));
+        klass = regex->klass;
+        fields = &regex->fields;
       } else {
         runtimeError("Only instances have properties.");
         return INTERPRET_RUNTIME_ERROR;
@@ -659,6 +834,26 @@ static InterpretResult run() {
         ObjString *string = AS_STRING(peek(0));
         klass = string->klass;
         fields = &string->fields;
+      } else if (IS_SET(peek(0))) {
+        ObjSet *set = AS_SET(peek(0));
+        klass = set->klass;
+        fields = &set->fields;
+      } else if (IS_TYPED_ARRAY(peek(0))) {
+        ObjTypedArray *array = AS_TYPED_ARRAY(peek(0));
+        klass = array->klass;
+        fields = &array->fields;
+      } else if (IS_DEQUE(peek(0))) {
+        ObjDeque *deque = AS_DEQUE(peek(0));
+        klass = deque->klass;
+        fields = &deque->fields;
+      } else if (IS_BYTES(peek(0))) {
+        ObjBytes *bytes = AS_BYTES(peek(0));
+        klass = bytes->klass;
+        fields = &bytes->fields;
+      } else if (IS_REGEX(peek(0))) {
+        ObjRegex *regex = AS_REGEX(peek(0));
+        klass = regex->klass;
+        fields = &regex->fields;
       } else {
         runtimeError("Only instances have properties.");
         return INTERPRET_RUNTIME_ERROR;
@@ -692,6 +887,21 @@ static InterpretResult run() {
       } else if (IS_FILE(peek(0))) {
         ObjFile *file = AS_FILE(peek(0));
         fields = &file->fields;
+      } else if (IS_SET(peek(1))) {
+        ObjSet *set = AS_SET(peek(1));
+        fields = &set->fields;
+      } else if (IS_TYPED_ARRAY(peek(1))) {
+        ObjTypedArray *array = AS_TYPED_ARRAY(peek(1));
+        fields = &array->fields;
+      } else if (IS_DEQUE(peek(1))) {
+        ObjDeque *deque = AS_DEQUE(peek(1));
+        fields = &deque->fields;
+      } else if (IS_BYTES(peek(1))) {
+        ObjBytes *bytes = AS_BYTES(peek(1));
+        fields = &bytes->fields;
+      } else if (IS_REGEX(peek(1))) {
+        ObjRegex *regex = AS_REGEX(peek(1));
+        fields = &regex->fields;
       } else {
         runtimeError("Only instances have fields.");
         return INTERPRET_RUNTIME_ERROR;
@@ -720,6 +930,21 @@ static InterpretResult run() {
       } else if (IS_FILE(peek(0))) {
         ObjFile *file = AS_FILE(peek(0));
         fields = &file->fields;
+      } else if (IS_SET(peek(1))) {
+        ObjSet *set = AS_SET(peek(1));
+        fields = &set->fields;
+      } else if (IS_TYPED_ARRAY(peek(1))) {
+        ObjTypedArray *array = AS_TYPED_ARRAY(peek(1));
+        fields = &array->fields;
+      } else if (IS_DEQUE(peek(1))) {
+        ObjDeque *deque = AS_DEQUE(peek(1));
+        fields = &deque->fields;
+      } else if (IS_BYTES(peek(1))) {
+        ObjBytes *bytes = AS_BYTES(peek(1));
+        fields = &bytes->fields;
+      } else if (IS_REGEX(peek(1))) {
+        ObjRegex *regex = AS_REGEX(peek(1));
+        fields = &regex->fields;
       } else {
         runtimeError("Only instances have fields.");
         return INTERPRET_RUNTIME_ERROR;
@@ -788,6 +1013,11 @@ static InterpretResult run() {
         return INTERPRET_RUNTIME_ERROR;
       }
       break;
+    case OP_BUILD_STRING:
+      if (!buildString(READ_BYTE())) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      break;
     case OP_SUBTRACT:
       BINARY_OP(NUMBER_VAL, -);
       break;
@@ -827,18 +1057,24 @@ static InterpretResult run() {
       break;
     }
     case OP_JUMP: {
-      uint16_t offset = READ_SHORT();
+      uint32_t offset = READ_LONG();
       frame->ip += offset;
       break;
     }
     case OP_JUMP_IF_FALSE: {
-      uint16_t offset = READ_SHORT();
+      uint32_t offset = READ_LONG();
       if (isFalsey(peek(0)))
         frame->ip += offset;
       break;
     }
+    case OP_JUMP_IF_TRUE: {
+      uint32_t offset = READ_LONG();
+      if (!isFalsey(peek(0)))
+        frame->ip += offset;
+      break;
+    }
     case OP_LOOP: {
-      uint16_t offset = READ_SHORT();
+      uint32_t offset = READ_LONG();
       frame->ip -= offset;
       break;
     }
@@ -930,17 +1166,18 @@ static InterpretResult run() {
       closeUpvalues(vm.stackTop - 1);
       pop();
       break;
+    case OP_RETURN_NIL:
+      push(NIL_VAL);
+      // Fall through.
     case OP_RETURN: {
       Value result = pop();
       closeUpvalues(frame->slots);
       vm.frameCount--;
-      if (vm.frameCount == 0) {
-        pop();
-        return INTERPRET_OK;
-      }
-
       vm.stackTop = frame->slots;
       push(result);
+      if (vm.frameCount == baseFrame) {
+        return INTERPRET_OK;
+      }
       frame = &vm.frames[vm.frameCount - 1];
       break;
     }
@@ -1032,6 +1269,36 @@ static InterpretResult run() {
       break;
     }
     case OP_INDEX_SUBSCR: {
+      if (IS_NUMBER(peek(0)) && IS_TYPED_ARRAY(peek(1))) {
+        int index = (int)AS_NUMBER(pop());
+        ObjTypedArray *array = AS_TYPED_ARRAY(pop());
+        if (!isValidTypedArrayIndex(array, index)) {
+          runtimeError("Array index out of range.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL(indexFromTypedArray(array, index)));
+        break;
+      }
+      if (IS_NUMBER(peek(0)) && IS_DEQUE(peek(1))) {
+        int index = (int)AS_NUMBER(pop());
+        ObjDeque *deque = AS_DEQUE(pop());
+        if (!isValidDequeIndex(deque, index)) {
+          runtimeError("Deque index out of range.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        push(*dequeSlot(deque, index));
+        break;
+      }
+      if (IS_NUMBER(peek(0)) && IS_BYTES(peek(1))) {
+        int index = (int)AS_NUMBER(pop());
+        ObjBytes *bytes = AS_BYTES(pop());
+        if (!isValidBytesIndex(bytes, index)) {
+          runtimeError("Bytes index out of range.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        push(NUMBER_VAL((double)bytes->data[index]));
+        break;
+      }
       if (IS_STRING(peek(0))) {
         ObjString *key = AS_STRING(pop());
         if (!IS_MAP(peek(0))) {
@@ -1063,15 +1330,20 @@ static InterpretResult run() {
 
         push(indexFromList(list, index));
       } else if (IS_STRING(peek(0))) {
-        ObjString *string = AS_STRING(pop());
+        // Indexes count characters. The string stays on the stack while its
+        // offset index may be built.
+        ObjString *string = AS_STRING(peek(0));
 
-        if (index > string->length - 1 || index < 0) {
+        if (index > utf8_get_cached_length(string) - 1 || index < 0) {
           runtimeError("String index out of range.");
           return INTERPRET_RUNTIME_ERROR;
         }
 
-        push(OBJ_VAL(
-            copyString(string->chars + (int)index, index, &vm.strings)));
+        int start = utf8_char_offset(string, (int)index);
+        int end = utf8_next_offset(string->chars, start, string->length);
+        ObjString *ch = sliceString(string, start, end - start);
+        pop();
+        push(OBJ_VAL(ch));
       } else {
         runtimeError("Invalid type to index into.");
         return INTERPRET_RUNTIME_ERROR;
@@ -1079,6 +1351,51 @@ static InterpretResult run() {
       break;
     }
     case OP_STORE_SUBSCR: {
+      if (IS_NUMBER(peek(1)) && IS_TYPED_ARRAY(peek(2))) {
+        if (!IS_NUMBER(peek(0))) {
+          runtimeError("Can only store numbers in a typed array.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        Value item = pop();
+        int index = (int)AS_NUMBER(pop());
+        ObjTypedArray *array = AS_TYPED_ARRAY(pop());
+        if (!isValidTypedArrayIndex(array, index)) {
+          runtimeError("Array index out of range.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        storeToTypedArray(array, index, AS_NUMBER(item));
+        push(item);
+        break;
+      }
+      if (IS_NUMBER(peek(1)) && IS_DEQUE(peek(2))) {
+        Value item = pop();
+        int index = (int)AS_NUMBER(pop());
+        ObjDeque *deque = AS_DEQUE(pop());
+        if (!isValidDequeIndex(deque, index)) {
+          runtimeError("Deque index out of range.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        *dequeSlot(deque, index) = item;
+        push(item);
+        break;
+      }
+      if (IS_NUMBER(peek(1)) && IS_BYTES(peek(2))) {
+        if (!IS_NUMBER(peek(0)) || AS_NUMBER(peek(0)) < 0 ||
+            AS_NUMBER(peek(0)) > 255) {
+          runtimeError("Can only store numbers from 0 to 255 in bytes.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        Value item = pop();
+        int index = (int)AS_NUMBER(pop());
+        ObjBytes *bytes = AS_BYTES(pop());
+        if (!isValidBytesIndex(bytes, index)) {
+          runtimeError("Bytes index out of range.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        bytes->data[index] = (uint8_t)AS_NUMBER(item);
+        push(item);
+        break;
+      }
       Value item = pop();
       if (IS_STRING(peek(0))) {
         ObjString *str = AS_STRING(pop());
@@ -1165,13 +1482,16 @@ static InterpretResult run() {
           push(NIL_VAL);
           break;
         }
-        ObjString *ch = copyString(string->chars, 1, &vm.strings);
+        int end = utf8_next_offset(string->chars, 0, string->length);
+        ObjString *ch = sliceString(string, 0, end);
         ch->klass = string->klass;
         push(OBJ_VAL(ch));
       } else if (IS_STRING(peek(1)) && IS_NUMBER(peek(0))) {
+        // The iterator state is the byte offset of the current character,
+        // so stepping is O(1) whatever the encoding.
         ObjString *string = AS_STRING(peek(1));
         int i = (int)AS_NUMBER(peek(0));
-        i += 1;
+        i = utf8_next_offset(string->chars, i, string->length);
         if (i > string->length - 1) {
           pop();
           push(NIL_VAL);
@@ -1179,13 +1499,85 @@ static InterpretResult run() {
         }
         pop();
         push(NUMBER_VAL((double)i));
-        ObjString *ch = copyString(string->chars + i, 1, &vm.strings);
+        int end = utf8_next_offset(string->chars, i, string->length);
+        ObjString *ch = sliceString(string, i, end - i);
         ch->klass = string->klass;
         push(OBJ_VAL(ch));
+      } else if (IS_SET(peek(0))) {
+        ObjSet *set = AS_SET(peek(0));
+        int i = valueTableNext(&set->items, 0);
+        if (i == -1) {
+          push(NIL_VAL);
+          break;
+        }
+        push(NUMBER_VAL((double)i));
+        push(set->items.keys[i]);
+      } else if (IS_SET(peek(1)) && IS_NUMBER(peek(0))) {
+        ObjSet *set = AS_SET(peek(1));
+        int i = valueTableNext(&set->items, (int)AS_NUMBER(peek(0)) + 1);
+        pop();
+        if (i == -1) {
+          push(NIL_VAL);
+          break;
+        }
+        push(NUMBER_VAL((double)i));
+        push(set->items.keys[i]);
+      } else if (IS_TYPED_ARRAY(peek(0))) {
+        ObjTypedArray *array = AS_TYPED_ARRAY(peek(0));
+        push(NUMBER_VAL(0));
+        if (!isValidTypedArrayIndex(array, 0)) {
+          pop();
+          push(NIL_VAL);
+          break;
+        }
+        push(NUMBER_VAL(indexFromTypedArray(array, 0)));
+      } else if (IS_TYPED_ARRAY(peek(1)) && IS_NUMBER(peek(0))) {
+        ObjTypedArray *array = AS_TYPED_ARRAY(peek(1));
+        int i = (int)AS_NUMBER(pop()) + 1;
+        if (!isValidTypedArrayIndex(array, i)) {
+          push(NIL_VAL);
+          break;
+        }
+        push(NUMBER_VAL((double)i));
+        push(NUMBER_VAL(indexFromTypedArray(array, i)));
+      } else if (IS_DEQUE(peek(0))) {
+        ObjDeque *deque = AS_DEQUE(peek(0));
+        if (deque->count == 0) {
+          push(NIL_VAL);
+          break;
+        }
+        push(NUMBER_VAL(0));
+        push(*dequeSlot(deque, 0));
+      } else if (IS_DEQUE(peek(1)) && IS_NUMBER(peek(0))) {
+        ObjDeque *deque = AS_DEQUE(peek(1));
+        int i = (int)AS_NUMBER(pop()) + 1;
+        if (!isValidDequeIndex(deque, i)) {
+          push(NIL_VAL);
+          break;
+        }
+        push(NUMBER_VAL((double)i));
+        push(*dequeSlot(deque, i));
+      } else if (IS_BYTES(peek(0))) {
+        ObjBytes *bytes = AS_BYTES(peek(0));
+        if (bytes->length == 0) {
+          push(NIL_VAL);
+          break;
+        }
+        push(NUMBER_VAL(0));
+        push(NUMBER_VAL((double)bytes->data[0]));
+      } else if (IS_BYTES(peek(1)) && IS_NUMBER(peek(0))) {
+        ObjBytes *bytes = AS_BYTES(peek(1));
+        int i = (int)AS_NUMBER(pop()) + 1;
+        if (!isValidBytesIndex(bytes, i)) {
+          push(NIL_VAL);
+          break;
+        }
+        push(NUMBER_VAL((double)i));
+        push(NUMBER_VAL((double)bytes->data[i]));
       } else if (IS_NIL(peek(0))) {
         break;
       } else {
-        runtimeError("Only functions, strings and lists can be used after in.");
+        runtimeError("Only functions, strings, lists, sets, arrays, deques and bytes can be used after in.");
         return INTERPRET_RUNTIME_ERROR;
       }
       break;
@@ -1195,6 +1587,7 @@ static InterpretResult run() {
 
 #undef READ_BYTE
 #undef READ_SHORT
+#undef READ_LONG
 #undef READ_CONSTANT
 #undef READ_CONSTANT_SHORT
 #undef READ_STRING
@@ -1204,16 +1597,87 @@ static InterpretResult run() {
 #undef MATH_OP
 }
 
-InterpretResult interpret(const char *source, const char *file) {
-  ObjFunction *function = compile(source, file);
-  if (function == NULL)
-    return INTERPRET_COMPILE_ERROR;
-
+static InterpretResult runScript(ObjFunction *function) {
   push(OBJ_VAL(function));
   ObjClosure *closure = newClosure(function);
   pop();
   push(OBJ_VAL(closure));
   call(closure, 0);
 
-  return run();
+  InterpretResult result = run(0);
+  if (result == INTERPRET_OK) {
+    pop();
+  }
+  return result;
+}
+
+InterpretResult interpret(const char *source, const char *file) {
+  ObjFunction *function = compile(source, file);
+  if (function == NULL)
+    return INTERPRET_COMPILE_ERROR;
+
+  return runScript(function);
+}
+
+// Like interpret, but goes through the script's bytecode cache, loading it
+// when it is up to date and writing it after compiling otherwise.
+InterpretResult interpretFile(const char *source, const char *file) {
+  ObjFunction *function = loadCache(file, source);
+  if (function == NULL) {
+    beginUseRecording();
+    int tokenCount = 0;
+    Token *tokens = preloadUses(source, &tokenCount);
+    function = compileTokens(source, file, tokens, tokenCount);
+    finishPreloading();
+    free(tokens);
+    if (function != NULL) {
+      push(OBJ_VAL(function));
+      writeCache(file, source, function);
+      pop();
+    }
+    endUseRecording();
+  }
+  if (function == NULL)
+    return INTERPRET_COMPILE_ERROR;
+
+  return runScript(function);
+}
+
+// Like interpret, but runs the bundle built into the binary for source when
+// it matches, and compiles source otherwise.
+InterpretResult interpretBundle(const char *source, const char *file,
+                                const uint8_t *bytes, size_t length) {
+  ObjFunction *function = NULL;
+  if (bytes != NULL) {
+    function = loadBundle(file, source, bytes, length);
+  }
+  if (function == NULL)
+    function = compile(source, file);
+  if (function == NULL)
+    return INTERPRET_COMPILE_ERROR;
+
+  return runScript(function);
+}
+
+// Calls a Ghoul value from native code and runs it to completion in a nested
+// dispatch loop. The callee and arguments are pushed onto the VM stack, so
+// they stay rooted for the duration of the call. On failure the error has
+// already been reported and vm.shouldPanic is set, so the calling native only
+// needs to return.
+bool vmCallValue(Value callee, int argCount, Value *args, Value *result) {
+  int baseFrame = vm.frameCount;
+  push(callee);
+  for (int i = 0; i < argCount; i++) {
+    push(args[i]);
+  }
+  if (!callValue(callee, argCount)) {
+    vm.shouldPanic = true;
+    return false;
+  }
+  if (vm.frameCount > baseFrame && run(baseFrame) != INTERPRET_OK) {
+    vm.shouldPanic = true;
+    return false;
+  }
+  *result = pop();
+  return true;
 }
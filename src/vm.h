@@ -21,6 +21,13 @@ typedef struct {
   ObjKlass *string;
   ObjKlass *error;
   ObjKlass *pair;
+  ObjKlass *set;
+  ObjKlass *float64Array;
+  ObjKlass *int32Array;
+  ObjKlass *deque;
+  ObjKlass *bytes;
+  ObjKlass *regex;
+  ObjKlass *match;
 } BuiltInKlass;
 
 typedef struct {
@@ -44,11 +51,15 @@ typedef struct {
   Value *stackTop;
   Table globals;
   Table useStrings;
+  Table builtins;
   Table strings;
+  uint64_t hashSeed;
   BuiltInKlass klass;
   BuiltInStrings string;
   ObjUpvalue *openUpvalues;
   bool shouldPanic;
+  bool optimize;
+  bool stripLines;
 
   size_t bytesAllocated;
   size_t nextGC;
@@ -72,8 +83,13 @@ void runtimeError(const char *format, ...);
 void initVM();
 void freeVM();
 InterpretResult interpret(const char *source, const char *file);
+InterpretResult interpretFile(const char *source, const char *file);
+InterpretResult interpretBundle(const char *source, const char *file,
+                                const uint8_t *bytes, size_t length);
 void push(Value value);
 Value pop();
 Value peek(int distance);
+bool isFalsey(Value value);
+bool vmCallValue(Value callee, int argCount, Value *args, Value *result);
 
 #endif
@@ -1,10 +1,13 @@
 package main
 
 import (
+	"bytes"
 	"fmt"
 	"log"
 	"os"
 	"os/exec"
+	"path/filepath"
+	"regexp"
 	"runtime"
 	"strings"
 	"sync"
@@ -12,6 +15,31 @@ import (
 
 var failed = false
 
+type mode struct {
+	flags []string
+	// A cached run follows a run with the same flags and must load the
+	// .ghoulc that run left instead of compiling the script again.
+	cached bool
+	// A stripped run goes without line numbers, so it only runs tests that
+	// expect a runtime error and checks their traces without lines.
+	stripped bool
+}
+
+// Every test runs once as is and once through the optimizer, which must not
+// change what it prints, then once more from the optimized run's cache.
+// Tests that end in a runtime error also run with -s. The runs of one file
+// go one after the other, since some tests write files at fixed paths and
+// all of them share one cache.
+var modes = []mode{
+	{},
+	{flags: []string{"-O"}},
+	{flags: []string{"-O"}, cached: true},
+	{flags: []string{"-s"}, stripped: true},
+}
+
+// A trace line's place, as in "[line 3 of errors/trace.ghoul] in script".
+var tracePlace = regexp.MustCompile(`\[line \d+ of ([^\]]*)\] in `)
+
 func main() {
 	files := getFiles()
 	println("running tests...")
@@ -22,15 +50,56 @@ func main() {
 		wg.Add(1)
 		go func(f string) {
 			defer wg.Done()
-			resBuffer := ""
-			res := run(f, &resBuffer)
-			if getRes(res, f, &resBuffer) {
-				resBuffer = fmt.Sprintf("%s\033[32msuccess:\033[0m test passed in %s\n", resBuffer, f)
+			for _, m := range modes {
+				resBuffer := ""
+				name := strings.TrimSpace(fmt.Sprintf("%s %s", strings.Join(m.flags, " "), f))
+				expected, compileError := getCompileErrors(f)
+				if m.cached {
+					name = "cached " + name
+					if compileError {
+						continue
+					}
+				}
+				if m.stripped && (compileError || !expectsError(f)) {
+					continue
+				}
+				var before os.FileInfo
+				if m.cached {
+					before = statCache(f, name, &resBuffer)
+				}
+				out, errOut, exitedWithError := run(f, m.flags, &resBuffer)
+				if m.stripped {
+					out = tracePlace.ReplaceAllString(out, "[$1] in ")
+				}
+				var passed bool
+				if compileError {
+					passed = getCompileRes(expected, out, errOut, exitedWithError, name, &resBuffer)
+				} else {
+					passed = getRes(out, errOut, exitedWithError, name, &resBuffer)
+				}
+				if before != nil {
+					passed = checkCacheHit(f, before, name, &resBuffer) && passed
+				} else if m.cached {
+					passed = false
+				}
+				if passed {
+					resBuffer = fmt.Sprintf("%s\033[32msuccess:\033[0m test passed in %s\n", resBuffer, name)
+				}
+				resBuffer = fmt.Sprintf("%s%s\n", resBuffer, "-------------")
+				resChan <- resBuffer
 			}
-			resBuffer = fmt.Sprintf("%s%s\n", resBuffer, "-------------")
-			resChan <- resBuffer
 		}(f)
 	}
+	wg.Add(1)
+	go func() {
+		defer wg.Done()
+		resChan <- runSnapshot()
+	}()
+	wg.Add(1)
+	go func() {
+		defer wg.Done()
+		resChan <- runCacheEdit()
+	}()
 	go func() {
 		wg.Wait()
 		close(resChan)
@@ -84,7 +153,153 @@ func getFiles() []string {
 	return files
 }
 
-func run(filepath string, resBuffer *string) string {
+func run(filepath string, flags []string, resBuffer *string) (string, string, bool) {
+	args := append(append([]string{}, flags...), filepath)
+	// A fixed hash seed keeps map and set iteration order stable.
+	return runGhoul(args, append(environ(), "GHOUL_HASH_SEED=0"))
+}
+
+// The harness decides when scripts are cached and how strings hash, so the
+// caller's settings for either are left out of the environment.
+func environ() []string {
+	env := make([]string, 0)
+	for _, v := range os.Environ() {
+		if !strings.HasPrefix(v, "GHOUL_HASH_SEED=") && !strings.HasPrefix(v, "GHOUL_NO_CACHE=") {
+			env = append(env, v)
+		}
+	}
+	return env
+}
+
+// Returns the .ghoulc a run of filepath left, or nil with a failure noted
+// when it left none.
+func statCache(filepath string, name string, resBuffer *string) os.FileInfo {
+	info, err := os.Stat(filepath + "c")
+	if err != nil {
+		failed = true
+		*resBuffer = fmt.Sprintf("%s\033[31mtest failed:\033[0m no cache to load in %s\n", *resBuffer, name)
+		return nil
+	}
+	return info
+}
+
+// A run that loads the cache leaves it alone, while one that compiles
+// replaces the file with a fresh one.
+func checkCacheHit(filepath string, before os.FileInfo, name string, resBuffer *string) bool {
+	after := statCache(filepath, name, resBuffer)
+	if after == nil {
+		return false
+	}
+	if !os.SameFile(before, after) {
+		failed = true
+		*resBuffer = fmt.Sprintf("%s\033[31mtest failed:\033[0m the cache was compiled again in %s\n", *resBuffer, name)
+		return false
+	}
+	return true
+}
+
+// The snapshot test saves the heap setup.ghoul leaves behind and runs
+// check.ghoul on top of it. Neither run fixes the hash seed, so the load has
+// to rehash every table it restores.
+func runSnapshot() string {
+	resBuffer := ""
+	name := "--snapshot snapshot/lib/setup.ghoul, --from-snapshot snapshot/lib/check.ghoul"
+	snap, err := os.CreateTemp("", "ghoul-*.snapshot")
+	if err != nil {
+		log.Fatal(err)
+	}
+	snap.Close()
+	defer os.Remove(snap.Name())
+	env := environ()
+	passed := false
+	out, errOut, exitedWithError := runGhoul([]string{"--snapshot", snap.Name(), "snapshot/lib/setup.ghoul"}, env)
+	if exitedWithError || out != "" {
+		failed = true
+		resBuffer = fmt.Sprintf("%s\033[31merror:\033[0m could not take the snapshot in %s;\n %s%s\n", resBuffer, name, out, errOut)
+	} else {
+		out, errOut, exitedWithError = runGhoul([]string{"--from-snapshot", snap.Name(), "snapshot/lib/check.ghoul"}, env)
+		passed = getRes(out, errOut, exitedWithError, name, &resBuffer)
+	}
+	if passed {
+		resBuffer = fmt.Sprintf("%s\033[32msuccess:\033[0m test passed in %s\n", resBuffer, name)
+	}
+	return fmt.Sprintf("%s%s\n", resBuffer, "-------------")
+}
+
+// The cache edit test runs a script, runs it again from its cache, then
+// edits the file it uses. The next run must notice the edit, compile the
+// script again and print the new value.
+func runCacheEdit() string {
+	resBuffer := ""
+	name := "cache edit"
+	dir, err := os.MkdirTemp("", "ghoul-cache-")
+	if err != nil {
+		log.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+	script := filepath.Join(dir, "main.ghoul")
+	used := filepath.Join(dir, "greeting.ghoul")
+	writeFile(used, ":greeting = \"hello\";\n")
+	writeFile(script, fmt.Sprintf("use \"%s\";\nprint greeting;\n", filepath.ToSlash(used)))
+
+	steps := []struct {
+		edit     string
+		expected string
+		hit      bool
+	}{
+		{"", "hello", false},
+		{"", "hello", true},
+		{":greeting = \"goodbye\";\n", "goodbye", false},
+	}
+	var before os.FileInfo
+	passed := true
+	for i, step := range steps {
+		stepName := fmt.Sprintf("%s, run %d", name, i+1)
+		if step.edit != "" {
+			writeFile(used, step.edit)
+		}
+		out, errOut, exitedWithError := runGhoul([]string{script}, environ())
+		if exitedWithError {
+			failed = true
+			resBuffer = fmt.Sprintf("%s\033[31merror:\033[0m non zero exit in %s;\n %s%s\n", resBuffer, stepName, out, errOut)
+			passed = false
+			break
+		}
+		if !compareLines([]string{step.expected}, splitLines(out), stepName, &resBuffer) {
+			failed = true
+			passed = false
+			break
+		}
+		after := statCache(script, stepName, &resBuffer)
+		if after == nil {
+			passed = false
+			break
+		}
+		if before != nil && os.SameFile(before, after) != step.hit {
+			failed = true
+			if step.hit {
+				resBuffer = fmt.Sprintf("%s\033[31mtest failed:\033[0m the cache was compiled again in %s\n", resBuffer, stepName)
+			} else {
+				resBuffer = fmt.Sprintf("%s\033[31mtest failed:\033[0m a stale cache was loaded in %s\n", resBuffer, stepName)
+			}
+			passed = false
+			break
+		}
+		before = after
+	}
+	if passed {
+		resBuffer = fmt.Sprintf("%s\033[32msuccess:\033[0m test passed in %s\n", resBuffer, name)
+	}
+	return fmt.Sprintf("%s%s\n", resBuffer, "-------------")
+}
+
+func writeFile(path string, text string) {
+	if err := os.WriteFile(path, []byte(text), 0644); err != nil {
+		log.Fatal(err)
+	}
+}
+
+func runGhoul(args []string, env []string) (string, string, bool) {
 	var exePath string
 	if runtime.GOOS == "windows" {
 		exePath = "./ghoul.exe"
@@ -95,28 +310,46 @@ func run(filepath string, resBuffer *string) string {
 	if err != nil {
 		log.Fatal(err)
 	}
-	cmd := exec.Command(path, filepath)
-	out, err := cmd.CombinedOutput()
+	cmd := exec.Command(path, args...)
+	cmd.Env = env
+	var stdout, stderr bytes.Buffer
+	cmd.Stdout = &stdout
+	cmd.Stderr = &stderr
+	if err := cmd.Run(); err != nil {
+		if _, exited := err.(*exec.ExitError); !exited {
+			log.Fatal(err)
+		}
+	}
+	// Error traces name scripts by their full path, which differs between
+	// machines, so they are compared relative to the tests directory.
+	dir, err := os.Getwd()
 	if err != nil {
-		failed = true
-		*resBuffer = fmt.Sprintf("%s\033[31merror:\033[0m non zero exit, code %s;\n %s\n", *resBuffer, err, out)
-		return ""
+		log.Fatal(err)
 	}
-	outstring := string(out)
-	return outstring
+	errOut := strings.ReplaceAll(stderr.String(), dir+string(os.PathSeparator), "")
+	return stdout.String(), errOut, cmd.ProcessState.ExitCode() != 0
 }
 
-func getRes(fileData string, fileName string, resBuffer *string) bool {
+func splitLines(text string) []string {
 	var data []string
 	if runtime.GOOS == "windows" {
-		data = strings.Split(fileData, "\r\n")
-	} else {		
-		data = strings.Split(fileData, "\n")
+		data = strings.Split(text, "\r\n")
+	} else {
+		data = strings.Split(text, "\n")
 	}
-	data = data[:len(data)-1]
+	return data[:len(data)-1]
+}
+
+// A test may end its expected output with a $error$ line followed by the
+// runtime error it should stop with. Such a test must exit non zero and its
+// stderr must match those lines; any other test must exit cleanly.
+func getRes(out string, errOut string, exitedWithError bool, fileName string, resBuffer *string) bool {
+	data := splitLines(out)
 	expected := make([]string, 0)
+	expectedError := make([]string, 0)
 	actual := make([]string, 0)
 	expectedFound := false
+	errorFound := false
 	actualFound := false
 	for _, line := range data {
 		if line == "$expect$" {
@@ -134,11 +367,24 @@ func getRes(fileData string, fileName string, resBuffer *string) bool {
 			actual = append(actual, line)
 			continue
 		}
+		if line == "$error$" {
+			errorFound = true
+			continue
+		}
+		if errorFound {
+			expectedError = append(expectedError, line)
+			continue
+		}
 		if expectedFound && !actualFound {
 			expected = append(expected, line)
 			continue
 		}
 	}
+	if exitedWithError && !errorFound {
+		failed = true
+		*resBuffer = fmt.Sprintf("%s\033[31merror:\033[0m non zero exit in %s;\n %s%s\n", *resBuffer, fileName, out, errOut)
+		return false
+	}
 	if !expectedFound {
 		*resBuffer = fmt.Sprintf("%s\033[31mtest failed:\033[0m no $expect$ in %s\n", *resBuffer, fileName)
 		return false
@@ -147,7 +393,63 @@ func getRes(fileData string, fileName string, resBuffer *string) bool {
 		*resBuffer = fmt.Sprintf("%s\033[31mtest failed:\033[0m no $actual$ in %s\n", *resBuffer, fileName)
 		return false
 	}
+	if errorFound {
+		if !exitedWithError {
+			failed = true
+			*resBuffer = fmt.Sprintf("%s\033[31mtest failed:\033[0m expected a runtime error in %s\n", *resBuffer, fileName)
+			return false
+		}
+		expected = append(expected, expectedError...)
+		actual = append(actual, splitLines(errOut)...)
+	}
+	return compareLines(expected, actual, fileName, resBuffer)
+}
+
+func expectsError(filepath string) bool {
+	source, err := os.ReadFile(filepath)
+	if err != nil {
+		log.Fatal(err)
+	}
+	return strings.Contains(string(source), "print \"$error$\";")
+}
+
+// A test that must not compile prints nothing, so it lists the compile
+// errors it expects in comments instead: a "# $compile-error$" line, then
+// one "# " line per error.
+func getCompileErrors(filepath string) ([]string, bool) {
+	source, err := os.ReadFile(filepath)
+	if err != nil {
+		log.Fatal(err)
+	}
+	expected := make([]string, 0)
+	found := false
+	for _, line := range strings.Split(string(source), "\n") {
+		line = strings.TrimRight(line, "\r")
+		if line == "# $compile-error$" {
+			found = true
+			continue
+		}
+		if !found {
+			continue
+		}
+		if !strings.HasPrefix(line, "# ") {
+			break
+		}
+		expected = append(expected, strings.TrimPrefix(line, "# "))
+	}
+	return expected, found
+}
+
+func getCompileRes(expected []string, out string, errOut string, exitedWithError bool, fileName string, resBuffer *string) bool {
+	if !exitedWithError || out != "" {
+		failed = true
+		*resBuffer = fmt.Sprintf("%s\033[31mtest failed:\033[0m expected a compile error in %s;\n %s%s\n", *resBuffer, fileName, out, errOut)
+		return false
+	}
+	return compareLines(expected, splitLines(errOut), fileName, resBuffer)
+}
 
+func compareLines(expected []string, actual []string, fileName string, resBuffer *string) bool {
 	if len(expected) != len(actual) {
 		*resBuffer = fmt.Sprintf("%s\033[31mtest failed:\033[0m expected length is not equal to actual length in %s; expected is %d, actual is %d\n", *resBuffer, fileName, len(expected), len(actual))
 		return false